@@ -0,0 +1,161 @@
+// Micro benchmark of the skeleton and skinning hot paths: the Eigen
+// Matrix4f implementation against every AffineKernel isa supported here.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "common/affine_kernels.h"
+#include "common/utility.h"
+
+namespace {
+
+struct SkeletonData {
+  std::vector<int> parents;
+  STLVectorOfEigenTypes<Eigen::Quaternionf> rotations;
+  STLVectorOfEigenTypes<Eigen::Vector3f> translations;
+  STLVectorOfEigenTypes<Eigen::Vector3f> scales;
+  // Every joint is skinned.
+  std::vector<int> joints;
+  STLVectorOfEigenTypes<Eigen::Matrix4f> invbindmats;
+};
+
+SkeletonData MakeSkeleton(int joint_num) {
+  std::mt19937 rng(joint_num);
+  std::uniform_real_distribution<float> dist(-1.f, 1.f);
+  SkeletonData data;
+  for (int j_idx = 0; j_idx < joint_num; ++j_idx) {
+    // Parents before children, a bit bushy like a real rig.
+    data.parents.push_back(j_idx == 0 ? -1 : (j_idx - 1) / 2);
+    data.rotations.push_back(
+        Eigen::Quaternionf(dist(rng), dist(rng), dist(rng), dist(rng))
+            .normalized());
+    data.translations.push_back(
+        Eigen::Vector3f(dist(rng), dist(rng), dist(rng)));
+    data.scales.push_back(
+        Eigen::Vector3f(1.f + 0.1f * dist(rng), 1.f + 0.1f * dist(rng),
+                        1.f + 0.1f * dist(rng)));
+    data.joints.push_back(joint_num - 1 - j_idx);
+    Eigen::Matrix4f invbindmat = Eigen::Matrix4f::Identity();
+    invbindmat.block<3, 3>(0, 0) =
+        Eigen::Quaternionf(dist(rng), dist(rng), dist(rng), dist(rng))
+            .normalized()
+            .toRotationMatrix();
+    invbindmat.block<3, 1>(0, 3) << dist(rng), dist(rng), dist(rng);
+    data.invbindmats.push_back(invbindmat);
+  }
+  return data;
+}
+
+// The code before AffineKernel.
+void RunEigen(const SkeletonData &data,
+              STLVectorOfEigenTypes<Eigen::Matrix4f> &global_mats,
+              std::vector<float> &pose_data) {
+  const int joint_num = data.parents.size();
+  for (int j_idx = 0; j_idx < joint_num; ++j_idx) {
+    Eigen::Matrix4f local_mat = Eigen::Matrix4f::Identity();
+    local_mat.block<3, 3>(0, 0) = data.rotations[j_idx].toRotationMatrix() *
+                                  data.scales[j_idx].asDiagonal();
+    local_mat.block<3, 1>(0, 3) = data.translations[j_idx];
+    if (data.parents[j_idx] == -1) {
+      global_mats[j_idx] = local_mat;
+    } else {
+      global_mats[j_idx].noalias() =
+          global_mats[data.parents[j_idx]] * local_mat;
+    }
+  }
+  for (int j_idx = 0; j_idx < joint_num; ++j_idx) {
+    Eigen::Matrix4f pose_mat =
+        global_mats[data.joints[j_idx]] * data.invbindmats[j_idx];
+    std::copy(pose_mat.data(), pose_mat.data() + 16, &pose_data[16 * j_idx]);
+  }
+}
+
+void RunKernel(const SkeletonData &data, const std::vector<int> &slots,
+               const STLVectorOfEigenTypes<AffineMatrix> &invbindmats,
+               STLVectorOfEigenTypes<AffineMatrix> &local_mats,
+               STLVectorOfEigenTypes<AffineMatrix> &global_mats,
+               STLVectorOfEigenTypes<AffineMatrix> &palette) {
+  const int joint_num = data.parents.size();
+  AffineKernel::ComposeTRS(data.rotations[0].coeffs().data(),
+                           data.translations[0].data(), data.scales[0].data(),
+                           joint_num, local_mats.data());
+  AffineKernel::ConcatenateHierarchy(local_mats.data(), data.parents.data(),
+                                     slots.data(), joint_num,
+                                     global_mats.data());
+  AffineKernel::BuildPalette(global_mats.data(), data.joints.data(),
+                             invbindmats.data(), joint_num, palette.data());
+}
+
+template <typename Func> double MeasureNanoSecond(int iter_num, Func func) {
+  // Warm up.
+  for (int i = 0; i < iter_num / 10 + 1; ++i) {
+    func();
+  }
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < iter_num; ++i) {
+    func();
+  }
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(end - begin).count() /
+         iter_num;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const int iter_num = argc > 1 ? std::atoi(argv[1]) : 20000;
+  const AffineKernel::Isa supported_isa = AffineKernel::GetSupportedIsa();
+  std::printf("Supported isa: %s\n", AffineKernel::GetIsaName(supported_isa));
+
+  bool all_match = true;
+  for (int joint_num : {24, 92, 256, 1024}) {
+    SkeletonData data = MakeSkeleton(joint_num);
+    STLVectorOfEigenTypes<Eigen::Matrix4f> eigen_globals(joint_num);
+    std::vector<float> eigen_pose_data(16 * joint_num);
+    double eigen_ns = MeasureNanoSecond(iter_num, [&]() {
+      RunEigen(data, eigen_globals, eigen_pose_data);
+    });
+    std::printf("joints %5d | Eigen  %10.1f ns/frame\n", joint_num, eigen_ns);
+
+    STLVectorOfEigenTypes<AffineMatrix> invbindmats;
+    for (const auto &invbindmat : data.invbindmats) {
+      invbindmats.push_back(AffineKernel::FromMatrix4(invbindmat));
+    }
+    std::vector<int> slots(joint_num);
+    for (int j_idx = 0; j_idx < joint_num; ++j_idx) {
+      slots[j_idx] = j_idx;
+    }
+    STLVectorOfEigenTypes<AffineMatrix> local_mats(joint_num),
+        global_mats(joint_num), palette(joint_num);
+    for (int isa = AffineKernel::ISA_SCALAR; isa <= supported_isa; ++isa) {
+      AffineKernel::SetIsa(static_cast<AffineKernel::Isa>(isa));
+      double kernel_ns = MeasureNanoSecond(iter_num, [&]() {
+        RunKernel(data, slots, invbindmats, local_mats, global_mats, palette);
+      });
+
+      // Compare with the Eigen result.
+      float max_error = 0;
+      float pose_data[16];
+      for (int j_idx = 0; j_idx < joint_num; ++j_idx) {
+        AffineKernel::StoreMatrix4(palette[j_idx], pose_data);
+        for (int e_idx = 0; e_idx < 16; ++e_idx) {
+          max_error = std::max(
+              max_error,
+              std::abs(pose_data[e_idx] - eigen_pose_data[16 * j_idx + e_idx]));
+        }
+      }
+      const bool match = max_error < 1e-3f;
+      all_match = all_match && match;
+      std::printf(
+          "joints %5d | %-6s %10.1f ns/frame | x%.2f | max error %g%s\n",
+          joint_num,
+          AffineKernel::GetIsaName(static_cast<AffineKernel::Isa>(isa)),
+          kernel_ns, eigen_ns / kernel_ns, max_error, match ? "" : " MISMATCH");
+    }
+    AffineKernel::SetIsa(supported_isa);
+  }
+  return all_match ? 0 : 1;
+}
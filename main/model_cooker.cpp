@@ -0,0 +1,111 @@
+// Offline cooker of the runtime model format, see graphic/cooked_model.h.
+//   sa_cook [--no-optimize|--no-overdraw] <model.gltf|glb> [out.sac]
+//     Cook one model, the output defaults to the model path with .sac. The
+//     triangle lists are optimized unless told otherwise(see
+//     CookedModel::CookOptions), the ACMR/ATVR of every mesh are logged.
+//   sa_cook --bench <model.gltf|glb>...
+//     Cook every model, then time Model::Init of the source and of the
+//     cooked file in a hidden GL context, e.g. sa_cook --bench
+//     ../resource/*/*.gltf. Run it from the build directory like sa, the
+//     shaders are loaded from ../shader.
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <GL/gl3w.h>
+#include <GLFW/glfw3.h>
+
+#include "graphic/cooked_model.h"
+#include "graphic/model.h"
+
+namespace {
+
+// Milliseconds of Model::Init, including the GL uploads.
+double TimeModelInit(const std::string &model_path) {
+  std::unique_ptr<Model> model(new Model());
+  glFinish();
+  auto begin = std::chrono::steady_clock::now();
+  model->Init(model_path);
+  glFinish();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+int RunBench(int model_num, char **model_paths) {
+  if (!glfwInit()) {
+    std::fprintf(stderr, "GLFW init failed.\n");
+    return 1;
+  }
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+  glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+  GLFWwindow *window = glfwCreateWindow(64, 64, "sa_cook", nullptr, nullptr);
+  if (!window) {
+    std::fprintf(stderr, "Create GL context failed.\n");
+    glfwTerminate();
+    return 1;
+  }
+  glfwMakeContextCurrent(window);
+  if (gl3wInit() != 0) {
+    std::fprintf(stderr, "GL3W: Failed to initialize OpenGL loader!\n");
+    glfwTerminate();
+    return 1;
+  }
+
+  int rc = 0;
+  std::printf("%-48s %12s %12s\n", "model", "source ms", "cooked ms");
+  for (int m_idx = 0; m_idx < model_num; ++m_idx) {
+    const std::string model_path = model_paths[m_idx];
+    const std::string cooked_path = CookedModel::GetCookedPath(model_path);
+    if (!CookedModel::Cook(model_path, cooked_path)) {
+      rc = 1;
+      continue;
+    }
+    // The first load warms up the file cache and the shader compiler.
+    TimeModelInit(model_path);
+    const double source_ms = TimeModelInit(model_path);
+    const double cooked_ms = TimeModelInit(cooked_path);
+    std::printf("%-48s %12.2f %12.2f\n", model_path.c_str(), source_ms,
+                cooked_ms);
+  }
+  glfwDestroyWindow(window);
+  glfwTerminate();
+  return rc;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc >= 3 && std::strcmp(argv[1], "--bench") == 0) {
+    return RunBench(argc - 2, argv + 2);
+  }
+  CookedModel::CookOptions options;
+  int arg_idx = 1;
+  for (; arg_idx < argc && std::strncmp(argv[arg_idx], "--", 2) == 0;
+       ++arg_idx) {
+    if (std::strcmp(argv[arg_idx], "--no-optimize") == 0) {
+      options.optimize_meshes = false;
+    } else if (std::strcmp(argv[arg_idx], "--no-overdraw") == 0) {
+      options.optimize_overdraw = false;
+    } else {
+      break;
+    }
+  }
+  const int path_num = argc - arg_idx;
+  if (path_num != 1 && path_num != 2) {
+    std::printf("Usage: %s [--no-optimize|--no-overdraw] <model.gltf|glb> "
+                "[out.sac]\n"
+                "       %s --bench <model.gltf|glb>...\n",
+                argv[0], argv[0]);
+    return 1;
+  }
+  const std::string model_path = argv[arg_idx];
+  const std::string cooked_path = path_num == 2
+                                      ? argv[arg_idx + 1]
+                                      : CookedModel::GetCookedPath(model_path);
+  return CookedModel::Cook(model_path, cooked_path, options) ? 0 : 1;
+}
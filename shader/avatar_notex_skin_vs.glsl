@@ -2,27 +2,88 @@
 
 layout(location = 0) in vec3 in_position;
 layout(location = 2) in vec3 in_normal;
-layout(location = 3) in vec4 in_skinning_joints;
+layout(location = 3) in uvec4 in_skinning_joints;
 layout(location = 4) in vec4 in_skinning_weights;
 
 out vec3 frag_normal;
 out vec3 frag_position;
 out vec4 frag_color;
 
-uniform mat4 model_matrix;
 uniform mat4 view_matrix;
 uniform mat4 proj_matrix;
+#ifdef MULTI_DRAW_INDIRECT
+// Per draw data of glMultiDrawElementsIndirect(GLSL 430), the draw index
+// comes from the base instance of the command through an instanced
+// attribute.
+layout(location = 5) in uint in_draw_index;
+struct DrawData {
+  mat4 model_matrix;
+  vec4 color;
+};
+layout(std430, binding = 0) readonly buffer DrawDataBuffer {
+  DrawData draws[];
+};
+#define model_matrix draws[in_draw_index].model_matrix
+#define vertex_color draws[in_draw_index].color
+#else
+uniform mat4 model_matrix;
 uniform vec4 vertex_color;
+#endif
+
+// Skinning palette, three vec4 rows(3x4 row major affine matrix) per joint.
+// Instanced draws store the palettes instance after instance.
+#ifndef SKINNING_JOINT_NUM
+#define SKINNING_JOINT_NUM 256
+#endif
+#ifdef SKINNING_PALETTE_TBO
+uniform samplerBuffer skinning_palette;
+vec4 GetPaletteRow(int joint, int row) {
+  return texelFetch(skinning_palette,
+                    3 * (gl_InstanceID * SKINNING_JOINT_NUM + joint) + row);
+}
+#else
+layout(std140) uniform SkinningPalette {
+  vec4 skinning_palette_rows[3 * SKINNING_JOINT_NUM];
+};
+vec4 GetPaletteRow(int joint, int row) {
+  return skinning_palette_rows[3 * joint + row];
+}
+#endif
+
+// Influences blended per vertex, 1 or 2 need the influences sorted by
+// decreasing weight, the first ones are renormalized.
+#ifndef SKINNING_INFLUENCE_NUM
+#define SKINNING_INFLUENCE_NUM 4
+#endif
 
-uniform mat4 skinning_transforms[100];
+// The joints are an integer attribute(glVertexAttribIPointer).
+mat4 GetSkinningMatrix(uvec4 joints, vec4 weights) {
+  ivec4 joint_indices = ivec4(joints);
+  vec4 rows[3];
+#if SKINNING_INFLUENCE_NUM == 2
+  float weight_scale = 1.0 / (weights.x + weights.y);
+#endif
+  for (int r_idx = 0; r_idx < 3; ++r_idx) {
+#if SKINNING_INFLUENCE_NUM == 1
+    rows[r_idx] = GetPaletteRow(joint_indices.x, r_idx);
+#elif SKINNING_INFLUENCE_NUM == 2
+    rows[r_idx] = (weights.x * GetPaletteRow(joint_indices.x, r_idx) +
+                   weights.y * GetPaletteRow(joint_indices.y, r_idx)) *
+                  weight_scale;
+#else
+    rows[r_idx] = weights.x * GetPaletteRow(joint_indices.x, r_idx) +
+                  weights.y * GetPaletteRow(joint_indices.y, r_idx) +
+                  weights.z * GetPaletteRow(joint_indices.z, r_idx) +
+                  weights.w * GetPaletteRow(joint_indices.w, r_idx);
+#endif
+  }
+  return transpose(mat4(rows[0], rows[1], rows[2], vec4(0.0, 0.0, 0.0, 1.0)));
+}
 
 void main() {
     // lbs
   mat4 skinning_matrix =
-      in_skinning_weights.x * skinning_transforms[int(in_skinning_joints.x)] +
-      in_skinning_weights.y * skinning_transforms[int(in_skinning_joints.y)] +
-      in_skinning_weights.z * skinning_transforms[int(in_skinning_joints.z)] +
-      in_skinning_weights.w * skinning_transforms[int(in_skinning_joints.w)];
+      GetSkinningMatrix(in_skinning_joints, in_skinning_weights);
 
   vec4 skin_position = skinning_matrix * vec4(in_position, 1.0f);
   vec3 skin_normal = mat3(skinning_matrix) * in_normal;
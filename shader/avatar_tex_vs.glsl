@@ -9,10 +9,26 @@ out vec3 frag_position;
 out vec4 frag_color;
 out vec2 frag_texcoord;
 
-uniform mat4 model_matrix;
 uniform mat4 view_matrix;
 uniform mat4 proj_matrix;
+#ifdef MULTI_DRAW_INDIRECT
+// Per draw data of glMultiDrawElementsIndirect(GLSL 430), the draw index
+// comes from the base instance of the command through an instanced
+// attribute.
+layout(location = 5) in uint in_draw_index;
+struct DrawData {
+  mat4 model_matrix;
+  vec4 color;
+};
+layout(std430, binding = 0) readonly buffer DrawDataBuffer {
+  DrawData draws[];
+};
+#define model_matrix draws[in_draw_index].model_matrix
+#define vertex_color draws[in_draw_index].color
+#else
+uniform mat4 model_matrix;
 uniform vec4 vertex_color;
+#endif
 
 void main() {
   gl_Position = proj_matrix * view_matrix * model_matrix * vec4(in_position, 1.0f);
@@ -0,0 +1,475 @@
+#include "common/affine_kernels.h"
+#include "common/logging.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||            \
+    defined(_M_IX86)
+#define SA_AFFINE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define SA_AFFINE_X86 0
+#endif
+
+// MSVC allows the intrinsics without any flag, gcc and clang need the target
+// attribute to compile them without -mavx2 for the whole project.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SA_TARGET_SSE4
+#define SA_TARGET_AVX2
+#else
+#define SA_TARGET_SSE4 __attribute__((target("sse4.1")))
+#define SA_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace AffineKernel {
+
+namespace {
+
+// ------------------------------- Scalar ------------------------------------
+
+inline void MultiplyScalarInline(const float *a, const float *b, float *out) {
+  float result[12];
+  for (int r_idx = 0; r_idx < 3; ++r_idx) {
+    const float *a_row = a + 4 * r_idx;
+    for (int c_idx = 0; c_idx < 4; ++c_idx) {
+      result[4 * r_idx + c_idx] = a_row[0] * b[c_idx] +
+                                  a_row[1] * b[4 + c_idx] +
+                                  a_row[2] * b[8 + c_idx];
+    }
+    result[4 * r_idx + 3] += a_row[3];
+  }
+  std::copy(result, result + 12, out);
+}
+
+void MultiplyScalar(const AffineMatrix &a, const AffineMatrix &b,
+                    AffineMatrix &out) {
+  MultiplyScalarInline(a.m, b.m, out.m);
+}
+
+void ConcatenateHierarchyScalar(const AffineMatrix *locals,
+                                const int *parent_slots, const int *slots,
+                                int count, AffineMatrix *globals) {
+  for (int i = 0; i < count; ++i) {
+    const int slot = slots[i];
+    const int parent_slot = parent_slots[slot];
+    if (parent_slot == -1) {
+      globals[slot] = locals[slot];
+    } else {
+      MultiplyScalarInline(globals[parent_slot].m, locals[slot].m,
+                           globals[slot].m);
+    }
+  }
+}
+
+void BuildPaletteScalar(const AffineMatrix *globals, const int *slots,
+                        const AffineMatrix *inv_binds, int count,
+                        AffineMatrix *out) {
+  for (int i = 0; i < count; ++i) {
+    MultiplyScalarInline(globals[slots[i]].m, inv_binds[i].m, out[i].m);
+  }
+}
+
+inline void ComposeTRSScalarInline(const float *q, const float *t,
+                                   const float *s, float *out) {
+  const float x2 = q[0] + q[0], y2 = q[1] + q[1], z2 = q[2] + q[2];
+  const float xx = q[0] * x2, yy = q[1] * y2, zz = q[2] * z2;
+  const float xy = q[0] * y2, xz = q[0] * z2, yz = q[1] * z2;
+  const float wx = q[3] * x2, wy = q[3] * y2, wz = q[3] * z2;
+
+  out[0] = (1 - (yy + zz)) * s[0];
+  out[1] = (xy - wz) * s[1];
+  out[2] = (xz + wy) * s[2];
+  out[3] = t[0];
+  out[4] = (xy + wz) * s[0];
+  out[5] = (1 - (xx + zz)) * s[1];
+  out[6] = (yz - wx) * s[2];
+  out[7] = t[1];
+  out[8] = (xz - wy) * s[0];
+  out[9] = (yz + wx) * s[1];
+  out[10] = (1 - (xx + yy)) * s[2];
+  out[11] = t[2];
+}
+
+void ComposeTRSScalar(const float *rotations, const float *translations,
+                      const float *scales, int count, AffineMatrix *out) {
+  for (int i = 0; i < count; ++i) {
+    ComposeTRSScalarInline(rotations + 4 * i, translations + 3 * i,
+                           scales + 3 * i, out[i].m);
+  }
+}
+
+#if SA_AFFINE_X86
+// -------------------------------- SSE4 -------------------------------------
+
+SA_TARGET_SSE4 inline void MultiplySSE4Inline(const float *a, const float *b,
+                                              float *out) {
+  const __m128 b0 = _mm_loadu_ps(b);
+  const __m128 b1 = _mm_loadu_ps(b + 4);
+  const __m128 b2 = _mm_loadu_ps(b + 8);
+  const __m128 zero = _mm_setzero_ps();
+  __m128 rows[3];
+  for (int r_idx = 0; r_idx < 3; ++r_idx) {
+    const __m128 a_row = _mm_loadu_ps(a + 4 * r_idx);
+    __m128 row = _mm_mul_ps(_mm_shuffle_ps(a_row, a_row, 0x00), b0);
+    row = _mm_add_ps(row,
+                     _mm_mul_ps(_mm_shuffle_ps(a_row, a_row, 0x55), b1));
+    row = _mm_add_ps(row,
+                     _mm_mul_ps(_mm_shuffle_ps(a_row, a_row, 0xAA), b2));
+    // The implicit (0, 0, 0, 1) row of b adds a.w to the translation.
+    rows[r_idx] = _mm_add_ps(row, _mm_blend_ps(zero, a_row, 0x8));
+  }
+  _mm_storeu_ps(out, rows[0]);
+  _mm_storeu_ps(out + 4, rows[1]);
+  _mm_storeu_ps(out + 8, rows[2]);
+}
+
+SA_TARGET_SSE4 void MultiplySSE4(const AffineMatrix &a, const AffineMatrix &b,
+                                 AffineMatrix &out) {
+  MultiplySSE4Inline(a.m, b.m, out.m);
+}
+
+SA_TARGET_SSE4 void ConcatenateHierarchySSE4(
+    const AffineMatrix *locals, const int *parent_slots, const int *slots,
+    int count, AffineMatrix *globals) {
+  for (int i = 0; i < count; ++i) {
+    const int slot = slots[i];
+    const int parent_slot = parent_slots[slot];
+    if (parent_slot == -1) {
+      globals[slot] = locals[slot];
+    } else {
+      MultiplySSE4Inline(globals[parent_slot].m, locals[slot].m,
+                         globals[slot].m);
+    }
+  }
+}
+
+SA_TARGET_SSE4 void BuildPaletteSSE4(const AffineMatrix *globals,
+                                     const int *slots,
+                                     const AffineMatrix *inv_binds, int count,
+                                     AffineMatrix *out) {
+  for (int i = 0; i < count; ++i) {
+    MultiplySSE4Inline(globals[slots[i]].m, inv_binds[i].m, out[i].m);
+  }
+}
+
+// Compute 4 matrices at once, the quaternions are transposed into SoA.
+SA_TARGET_SSE4 void ComposeTRSSSE4(const float *rotations,
+                                   const float *translations,
+                                   const float *scales, int count,
+                                   AffineMatrix *out) {
+  const __m128 one = _mm_set1_ps(1.f);
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 qx = _mm_loadu_ps(rotations + 4 * i);
+    __m128 qy = _mm_loadu_ps(rotations + 4 * i + 4);
+    __m128 qz = _mm_loadu_ps(rotations + 4 * i + 8);
+    __m128 qw = _mm_loadu_ps(rotations + 4 * i + 12);
+    _MM_TRANSPOSE4_PS(qx, qy, qz, qw);
+
+    const float *t = translations + 3 * i;
+    const float *s = scales + 3 * i;
+    __m128 tx = _mm_setr_ps(t[0], t[3], t[6], t[9]);
+    __m128 ty = _mm_setr_ps(t[1], t[4], t[7], t[10]);
+    __m128 tz = _mm_setr_ps(t[2], t[5], t[8], t[11]);
+    const __m128 sx = _mm_setr_ps(s[0], s[3], s[6], s[9]);
+    const __m128 sy = _mm_setr_ps(s[1], s[4], s[7], s[10]);
+    const __m128 sz = _mm_setr_ps(s[2], s[5], s[8], s[11]);
+
+    const __m128 x2 = _mm_add_ps(qx, qx);
+    const __m128 y2 = _mm_add_ps(qy, qy);
+    const __m128 z2 = _mm_add_ps(qz, qz);
+    const __m128 xx = _mm_mul_ps(qx, x2);
+    const __m128 yy = _mm_mul_ps(qy, y2);
+    const __m128 zz = _mm_mul_ps(qz, z2);
+    const __m128 xy = _mm_mul_ps(qx, y2);
+    const __m128 xz = _mm_mul_ps(qx, z2);
+    const __m128 yz = _mm_mul_ps(qy, z2);
+    const __m128 wx = _mm_mul_ps(qw, x2);
+    const __m128 wy = _mm_mul_ps(qw, y2);
+    const __m128 wz = _mm_mul_ps(qw, z2);
+
+    __m128 r00 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+    __m128 r01 = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+    __m128 r02 = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+    __m128 r10 = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+    __m128 r11 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+    __m128 r12 = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+    __m128 r20 = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+    __m128 r21 = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+    __m128 r22 = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+
+    // Back to one matrix per register row.
+    _MM_TRANSPOSE4_PS(r00, r01, r02, tx);
+    _MM_TRANSPOSE4_PS(r10, r11, r12, ty);
+    _MM_TRANSPOSE4_PS(r20, r21, r22, tz);
+    _mm_storeu_ps(out[i + 0].m, r00);
+    _mm_storeu_ps(out[i + 1].m, r01);
+    _mm_storeu_ps(out[i + 2].m, r02);
+    _mm_storeu_ps(out[i + 3].m, tx);
+    _mm_storeu_ps(out[i + 0].m + 4, r10);
+    _mm_storeu_ps(out[i + 1].m + 4, r11);
+    _mm_storeu_ps(out[i + 2].m + 4, r12);
+    _mm_storeu_ps(out[i + 3].m + 4, ty);
+    _mm_storeu_ps(out[i + 0].m + 8, r20);
+    _mm_storeu_ps(out[i + 1].m + 8, r21);
+    _mm_storeu_ps(out[i + 2].m + 8, r22);
+    _mm_storeu_ps(out[i + 3].m + 8, tz);
+  }
+  ComposeTRSScalar(rotations + 4 * i, translations + 3 * i, scales + 3 * i,
+                   count - i, out + i);
+}
+
+// -------------------------------- AVX2 -------------------------------------
+
+// Rows 0 and 1 in one 256 bit register, row 2 in a 128 bit one.
+SA_TARGET_AVX2 inline void MultiplyAVX2Inline(const float *a, const float *b,
+                                              float *out) {
+  const __m128 b0_128 = _mm_loadu_ps(b);
+  const __m128 b1_128 = _mm_loadu_ps(b + 4);
+  const __m128 b2_128 = _mm_loadu_ps(b + 8);
+  const __m256 b0 = _mm256_set_m128(b0_128, b0_128);
+  const __m256 b1 = _mm256_set_m128(b1_128, b1_128);
+  const __m256 b2 = _mm256_set_m128(b2_128, b2_128);
+
+  const __m256 a01 = _mm256_loadu_ps(a);
+  __m256 r01 = _mm256_mul_ps(_mm256_permute_ps(a01, 0x00), b0);
+  r01 = _mm256_fmadd_ps(_mm256_permute_ps(a01, 0x55), b1, r01);
+  r01 = _mm256_fmadd_ps(_mm256_permute_ps(a01, 0xAA), b2, r01);
+  r01 = _mm256_add_ps(r01, _mm256_blend_ps(_mm256_setzero_ps(), a01, 0x88));
+
+  const __m128 a2 = _mm_loadu_ps(a + 8);
+  __m128 r2 = _mm_mul_ps(_mm_permute_ps(a2, 0x00), b0_128);
+  r2 = _mm_fmadd_ps(_mm_permute_ps(a2, 0x55), b1_128, r2);
+  r2 = _mm_fmadd_ps(_mm_permute_ps(a2, 0xAA), b2_128, r2);
+  r2 = _mm_add_ps(r2, _mm_blend_ps(_mm_setzero_ps(), a2, 0x8));
+
+  _mm256_storeu_ps(out, r01);
+  _mm_storeu_ps(out + 8, r2);
+}
+
+SA_TARGET_AVX2 void MultiplyAVX2(const AffineMatrix &a, const AffineMatrix &b,
+                                 AffineMatrix &out) {
+  MultiplyAVX2Inline(a.m, b.m, out.m);
+}
+
+SA_TARGET_AVX2 void ConcatenateHierarchyAVX2(
+    const AffineMatrix *locals, const int *parent_slots, const int *slots,
+    int count, AffineMatrix *globals) {
+  for (int i = 0; i < count; ++i) {
+    const int slot = slots[i];
+    const int parent_slot = parent_slots[slot];
+    if (parent_slot == -1) {
+      globals[slot] = locals[slot];
+    } else {
+      MultiplyAVX2Inline(globals[parent_slot].m, locals[slot].m,
+                         globals[slot].m);
+    }
+  }
+}
+
+SA_TARGET_AVX2 void BuildPaletteAVX2(const AffineMatrix *globals,
+                                     const int *slots,
+                                     const AffineMatrix *inv_binds, int count,
+                                     AffineMatrix *out) {
+  for (int i = 0; i < count; ++i) {
+    MultiplyAVX2Inline(globals[slots[i]].m, inv_binds[i].m, out[i].m);
+  }
+}
+
+// Compute 8 matrices at once, the inputs are gathered into SoA.
+SA_TARGET_AVX2 void ComposeTRSAVX2(const float *rotations,
+                                   const float *translations,
+                                   const float *scales, int count,
+                                   AffineMatrix *out) {
+  const __m256i index4 = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+  const __m256i index3 = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  const __m256 one = _mm256_set1_ps(1.f);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const float *q = rotations + 4 * i;
+    const float *t = translations + 3 * i;
+    const float *s = scales + 3 * i;
+    const __m256 qx = _mm256_i32gather_ps(q + 0, index4, 4);
+    const __m256 qy = _mm256_i32gather_ps(q + 1, index4, 4);
+    const __m256 qz = _mm256_i32gather_ps(q + 2, index4, 4);
+    const __m256 qw = _mm256_i32gather_ps(q + 3, index4, 4);
+    const __m256 tx = _mm256_i32gather_ps(t + 0, index3, 4);
+    const __m256 ty = _mm256_i32gather_ps(t + 1, index3, 4);
+    const __m256 tz = _mm256_i32gather_ps(t + 2, index3, 4);
+    const __m256 sx = _mm256_i32gather_ps(s + 0, index3, 4);
+    const __m256 sy = _mm256_i32gather_ps(s + 1, index3, 4);
+    const __m256 sz = _mm256_i32gather_ps(s + 2, index3, 4);
+
+    const __m256 x2 = _mm256_add_ps(qx, qx);
+    const __m256 y2 = _mm256_add_ps(qy, qy);
+    const __m256 z2 = _mm256_add_ps(qz, qz);
+    const __m256 xx = _mm256_mul_ps(qx, x2);
+    const __m256 yy = _mm256_mul_ps(qy, y2);
+    const __m256 zz = _mm256_mul_ps(qz, z2);
+    const __m256 xy = _mm256_mul_ps(qx, y2);
+    const __m256 xz = _mm256_mul_ps(qx, z2);
+    const __m256 yz = _mm256_mul_ps(qy, z2);
+    const __m256 wx = _mm256_mul_ps(qw, x2);
+    const __m256 wy = _mm256_mul_ps(qw, y2);
+    const __m256 wz = _mm256_mul_ps(qw, z2);
+
+    const __m256 elms[3][4] = {
+        {_mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(yy, zz)), sx),
+         _mm256_mul_ps(_mm256_sub_ps(xy, wz), sy),
+         _mm256_mul_ps(_mm256_add_ps(xz, wy), sz), tx},
+        {_mm256_mul_ps(_mm256_add_ps(xy, wz), sx),
+         _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, zz)), sy),
+         _mm256_mul_ps(_mm256_sub_ps(yz, wx), sz), ty},
+        {_mm256_mul_ps(_mm256_sub_ps(xz, wy), sx),
+         _mm256_mul_ps(_mm256_add_ps(yz, wx), sy),
+         _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, yy)), sz), tz}};
+
+    // Transpose each 128 bit half back to one matrix row per register.
+    for (int r_idx = 0; r_idx < 3; ++r_idx) {
+      for (int half = 0; half < 2; ++half) {
+        __m128 c0 = half ? _mm256_extractf128_ps(elms[r_idx][0], 1)
+                         : _mm256_castps256_ps128(elms[r_idx][0]);
+        __m128 c1 = half ? _mm256_extractf128_ps(elms[r_idx][1], 1)
+                         : _mm256_castps256_ps128(elms[r_idx][1]);
+        __m128 c2 = half ? _mm256_extractf128_ps(elms[r_idx][2], 1)
+                         : _mm256_castps256_ps128(elms[r_idx][2]);
+        __m128 c3 = half ? _mm256_extractf128_ps(elms[r_idx][3], 1)
+                         : _mm256_castps256_ps128(elms[r_idx][3]);
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+        AffineMatrix *dst = out + i + 4 * half;
+        _mm_storeu_ps(dst[0].m + 4 * r_idx, c0);
+        _mm_storeu_ps(dst[1].m + 4 * r_idx, c1);
+        _mm_storeu_ps(dst[2].m + 4 * r_idx, c2);
+        _mm_storeu_ps(dst[3].m + 4 * r_idx, c3);
+      }
+    }
+  }
+  ComposeTRSSSE4(rotations + 4 * i, translations + 3 * i, scales + 3 * i,
+                 count - i, out + i);
+}
+
+bool CpuSupports(Isa isa) {
+  if (isa == ISA_SCALAR) {
+    return true;
+  }
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  const int max_leaf = info[0];
+  __cpuid(info, 1);
+  const bool sse41 = (info[2] & (1 << 19)) != 0;
+  if (isa == ISA_SSE4) {
+    return sse41;
+  }
+  const bool fma = (info[2] & (1 << 12)) != 0;
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  const bool avx = (info[2] & (1 << 28)) != 0;
+  if (max_leaf < 7 || !sse41 || !fma || !osxsave || !avx) {
+    return false;
+  }
+  // The os must save the ymm registers.
+  if ((_xgetbv(0) & 0x6) != 0x6) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  if (isa == ISA_SSE4) {
+    return __builtin_cpu_supports("sse4.1");
+  }
+  return __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("avx2") &&
+         __builtin_cpu_supports("fma");
+#endif
+}
+#else
+bool CpuSupports(Isa isa) { return isa == ISA_SCALAR; }
+#endif // SA_AFFINE_X86
+
+struct KernelTable {
+  Isa isa;
+  void (*multiply)(const AffineMatrix &, const AffineMatrix &,
+                   AffineMatrix &);
+  void (*concatenate_hierarchy)(const AffineMatrix *, const int *, const int *,
+                                int, AffineMatrix *);
+  void (*build_palette)(const AffineMatrix *, const int *,
+                        const AffineMatrix *, int, AffineMatrix *);
+  void (*compose_trs)(const float *, const float *, const float *, int,
+                      AffineMatrix *);
+};
+
+KernelTable MakeKernelTable(Isa isa) {
+#if SA_AFFINE_X86
+  if (isa == ISA_AVX2) {
+    return {ISA_AVX2, MultiplyAVX2, ConcatenateHierarchyAVX2,
+            BuildPaletteAVX2, ComposeTRSAVX2};
+  } else if (isa == ISA_SSE4) {
+    return {ISA_SSE4, MultiplySSE4, ConcatenateHierarchySSE4,
+            BuildPaletteSSE4, ComposeTRSSSE4};
+  }
+#endif
+  return {ISA_SCALAR, MultiplyScalar, ConcatenateHierarchyScalar,
+          BuildPaletteScalar, ComposeTRSScalar};
+}
+
+KernelTable &GetKernelTable() {
+  static KernelTable kernel_table = MakeKernelTable(GetSupportedIsa());
+  return kernel_table;
+}
+
+} // namespace
+
+Isa GetSupportedIsa() {
+  static const Isa supported_isa =
+      CpuSupports(ISA_AVX2) ? ISA_AVX2
+                            : (CpuSupports(ISA_SSE4) ? ISA_SSE4 : ISA_SCALAR);
+  return supported_isa;
+}
+
+Isa GetIsa() { return GetKernelTable().isa; }
+
+const char *GetIsaName(Isa isa) {
+  switch (isa) {
+  case ISA_AVX2:
+    return "AVX2";
+  case ISA_SSE4:
+    return "SSE4.1";
+  default:
+    return "Scalar";
+  }
+}
+
+bool SetIsa(Isa isa) {
+  if (!CpuSupports(isa)) {
+    LOG(WARNING) << "AffineKernel: " << GetIsaName(isa)
+                 << " isn't supported by the cpu.";
+    return false;
+  }
+  GetKernelTable() = MakeKernelTable(isa);
+  return true;
+}
+
+void Multiply(const AffineMatrix &a, const AffineMatrix &b,
+              AffineMatrix &out) {
+  GetKernelTable().multiply(a, b, out);
+}
+
+void ConcatenateHierarchy(const AffineMatrix *locals, const int *parent_slots,
+                          const int *slots, int count, AffineMatrix *globals) {
+  GetKernelTable().concatenate_hierarchy(locals, parent_slots, slots, count,
+                                         globals);
+}
+
+void BuildPalette(const AffineMatrix *globals, const int *slots,
+                  const AffineMatrix *inv_binds, int count,
+                  AffineMatrix *out) {
+  GetKernelTable().build_palette(globals, slots, inv_binds, count, out);
+}
+
+void ComposeTRS(const float *rotations, const float *translations,
+                const float *scales, int count, AffineMatrix *out) {
+  GetKernelTable().compose_trs(rotations, translations, scales, count, out);
+}
+
+} // namespace AffineKernel
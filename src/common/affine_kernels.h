@@ -0,0 +1,79 @@
+#pragma once
+
+#include <Eigen/Eigen>
+
+// 3x4 row major affine matrix, the last row (0, 0, 0, 1) is implicit.
+// The rows can be uploaded as three vec4 directly.
+struct alignas(16) AffineMatrix {
+  float m[12];
+
+  static AffineMatrix Identity() {
+    AffineMatrix result = {{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0}};
+    return result;
+  }
+};
+
+// Small kernel library for the affine transforms in skeleton and skinning.
+// Every kernel has a scalar, a SSE4.1 and an AVX2(+FMA) implementation, the
+// fastest one supported by the cpu is picked at runtime.
+namespace AffineKernel {
+
+enum Isa { ISA_SCALAR = 0, ISA_SSE4 = 1, ISA_AVX2 = 2 };
+
+// The best isa supported by the cpu.
+Isa GetSupportedIsa();
+Isa GetIsa();
+const char *GetIsaName(Isa isa);
+// Force an isa(e.g. for benchmark), return false if it isn't supported.
+bool SetIsa(Isa isa);
+
+// out = a * b, out may alias a or b.
+void Multiply(const AffineMatrix &a, const AffineMatrix &b, AffineMatrix &out);
+
+// For every slot in slots(parents before children):
+// globals[slot] = globals[parent_slots[slot]] * locals[slot], or locals[slot]
+// for the roots(parent slot -1).
+void ConcatenateHierarchy(const AffineMatrix *locals, const int *parent_slots,
+                          const int *slots, int count, AffineMatrix *globals);
+
+// out[i] = globals[slots[i]] * inv_binds[i].
+void BuildPalette(const AffineMatrix *globals, const int *slots,
+                  const AffineMatrix *inv_binds, int count, AffineMatrix *out);
+
+// out[i] = T * R * S, rotations are normalized quaternions (x, y, z, w),
+// translations and scales are packed xyz.
+void ComposeTRS(const float *rotations, const float *translations,
+                const float *scales, int count, AffineMatrix *out);
+
+// Conversion with Eigen(column major 4x4).
+inline AffineMatrix FromMatrix4(const Eigen::Matrix4f &matrix) {
+  AffineMatrix result;
+  for (int r_idx = 0; r_idx < 3; ++r_idx) {
+    for (int c_idx = 0; c_idx < 4; ++c_idx) {
+      result.m[4 * r_idx + c_idx] = matrix(r_idx, c_idx);
+    }
+  }
+  return result;
+}
+
+inline Eigen::Matrix4f ToMatrix4(const AffineMatrix &affine) {
+  Eigen::Matrix4f result = Eigen::Matrix4f::Identity();
+  for (int r_idx = 0; r_idx < 3; ++r_idx) {
+    for (int c_idx = 0; c_idx < 4; ++c_idx) {
+      result(r_idx, c_idx) = affine.m[4 * r_idx + c_idx];
+    }
+  }
+  return result;
+}
+
+// Write as column major 4x4, the layout of glUniformMatrix4fv.
+inline void StoreMatrix4(const AffineMatrix &affine, float *result) {
+  for (int c_idx = 0; c_idx < 4; ++c_idx) {
+    result[4 * c_idx + 0] = affine.m[c_idx];
+    result[4 * c_idx + 1] = affine.m[4 + c_idx];
+    result[4 * c_idx + 2] = affine.m[8 + c_idx];
+    result[4 * c_idx + 3] = c_idx == 3 ? 1.f : 0.f;
+  }
+}
+
+} // namespace AffineKernel
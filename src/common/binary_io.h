@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Little endian binary blobs of trivially copyable values. Arrays are written
+// as a uint32 count followed by the elements, and padded to 4 bytes so the
+// reader can hand them to GL without copying.
+class BinaryWriter {
+public:
+  template <typename T> void Write(const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "BinaryWriter only writes trivially copyable types.");
+    WriteBytes(&value, sizeof(T));
+  }
+  template <typename T, typename A>
+  void WriteVector(const std::vector<T, A> &values) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "BinaryWriter only writes trivially copyable types.");
+    Write(static_cast<uint32_t>(values.size()));
+    WriteBytes(values.data(), values.size() * sizeof(T));
+    Align();
+  }
+  void WriteString(const std::string &value) {
+    Write(static_cast<uint32_t>(value.size()));
+    WriteBytes(value.data(), value.size());
+    Align();
+  }
+  // A uint32 byte size followed by the bytes.
+  void WriteBlob(const void *data, size_t size) {
+    Write(static_cast<uint32_t>(size));
+    WriteBytes(data, size);
+    Align();
+  }
+  void WriteBytes(const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    data_.insert(data_.end(), bytes, bytes + size);
+  }
+  void Align() { data_.resize((data_.size() + 3) & ~size_t(3), 0); }
+
+  const std::vector<uint8_t> &GetData() const { return data_; }
+  bool SaveToFile(const std::string &path) const {
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(data_.data()), data_.size());
+    return file.good();
+  }
+
+private:
+  std::vector<uint8_t> data_;
+};
+
+// Reads what BinaryWriter wrote. Reading past the end sets the failed flag
+// and returns zeros, check IsFailed once after reading a section.
+class BinaryReader {
+public:
+  BinaryReader(const uint8_t *data, size_t size) : data_(data), size_(size) {}
+
+  template <typename T> T Read() {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "BinaryReader only reads trivially copyable types.");
+    T value;
+    const uint8_t *bytes = ReadBytes(sizeof(T));
+    if (bytes) {
+      std::memcpy(&value, bytes, sizeof(T));
+    } else {
+      std::memset(&value, 0, sizeof(T));
+    }
+    return value;
+  }
+  template <typename T, typename A> void ReadVector(std::vector<T, A> &values) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "BinaryReader only reads trivially copyable types.");
+    const uint32_t count = Read<uint32_t>();
+    const uint8_t *bytes = ReadBytes(size_t(count) * sizeof(T));
+    values.resize(bytes ? count : 0);
+    if (bytes && count) {
+      std::memcpy(&values[0], bytes, size_t(count) * sizeof(T));
+    }
+    Align();
+  }
+  // Count of the elements that follow, each at least element_byte_size
+  // bytes. Fails when the rest of the data can't hold them, so a corrupt
+  // count never sizes a container.
+  uint32_t ReadCount(size_t element_byte_size) {
+    const uint32_t count = Read<uint32_t>();
+    if (failed_ || size_t(count) * element_byte_size > size_ - offset_) {
+      failed_ = true;
+      return 0;
+    }
+    return count;
+  }
+  std::string ReadString() {
+    const uint32_t size = Read<uint32_t>();
+    const uint8_t *bytes = ReadBytes(size);
+    Align();
+    return bytes ? std::string(reinterpret_cast<const char *>(bytes), size)
+                 : std::string();
+  }
+  // Points into the source data, no copy.
+  const uint8_t *ReadBlob(size_t &size) {
+    size = Read<uint32_t>();
+    const uint8_t *bytes = ReadBytes(size);
+    Align();
+    if (!bytes) {
+      size = 0;
+    }
+    return bytes;
+  }
+  const uint8_t *ReadBytes(size_t size) {
+    if (failed_ || size > size_ - offset_) {
+      failed_ = true;
+      return nullptr;
+    }
+    const uint8_t *bytes = data_ + offset_;
+    offset_ += size;
+    return bytes;
+  }
+  void Align() { offset_ = std::min((offset_ + 3) & ~size_t(3), size_); }
+
+  bool IsFailed() const { return failed_; }
+
+private:
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+  bool failed_ = false;
+};
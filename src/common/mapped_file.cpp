@@ -0,0 +1,108 @@
+#include "common/mapped_file.h"
+#include "common/logging.h"
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(MappedFile &&rhs) noexcept
+    : data_(rhs.data_), size_(rhs.size_) {
+  rhs.data_ = nullptr;
+  rhs.size_ = 0;
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&rhs) noexcept {
+  if (this != &rhs) {
+    Close();
+    data_ = rhs.data_;
+    size_ = rhs.size_;
+    rhs.data_ = nullptr;
+    rhs.size_ = 0;
+  }
+  return *this;
+}
+
+// The view keeps the file alive, so the handles are closed right after
+// mapping.
+#if defined(_WIN32)
+bool MappedFile::Open(const std::string &path) {
+  Close();
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    LOG(WARNING) << "Open " << path << " failed.";
+    return false;
+  }
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    LOG(WARNING) << "Can't map empty file " << path;
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping =
+      CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (!mapping) {
+    LOG(WARNING) << "Map " << path << " failed.";
+    return false;
+  }
+  void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!data) {
+    LOG(WARNING) << "Map " << path << " failed.";
+    return false;
+  }
+  data_ = static_cast<const uint8_t *>(data);
+  size_ = static_cast<size_t>(file_size.QuadPart);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_) {
+    UnmapViewOfFile(data_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+#else
+bool MappedFile::Open(const std::string &path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    LOG(WARNING) << "Open " << path << " failed.";
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    LOG(WARNING) << "Can't map empty file " << path;
+    close(fd);
+    return false;
+  }
+  void *data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG(WARNING) << "Map " << path << " failed.";
+    return false;
+  }
+  data_ = static_cast<const uint8_t *>(data);
+  size_ = file_stat.st_size;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_) {
+    munmap(const_cast<uint8_t *>(data_), size_);
+  }
+  data_ = nullptr;
+  size_ = 0;
+}
+#endif
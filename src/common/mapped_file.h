@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read only mapping of a whole file. The pages are loaded on demand by the
+// OS, so reading a part of a big file doesn't read the rest. Unmapped by
+// Close or the destructor.
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile() { Close(); }
+  MappedFile(const MappedFile &rhs) = delete;
+  MappedFile &operator=(const MappedFile &rhs) = delete;
+  MappedFile(MappedFile &&rhs) noexcept;
+  MappedFile &operator=(MappedFile &&rhs) noexcept;
+
+  // Empty files can't be mapped, Open fails for them.
+  bool Open(const std::string &path);
+  void Close();
+
+  bool IsOpen() const { return data_ != nullptr; }
+  const uint8_t *GetData() const { return data_; }
+  size_t GetSize() const { return size_; }
+
+private:
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+};
@@ -0,0 +1,76 @@
+#include <algorithm>
+
+#include "common/logging.h"
+#include "common/thread_pool.h"
+
+ThreadPool::ThreadPool(int thread_num) {
+  CHECK(thread_num > 0) << "ThreadPool needs at least one thread.";
+  for (int t_idx = 0; t_idx < thread_num; ++t_idx) {
+    threads_.emplace_back(&ThreadPool::WorkerLoop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cond_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+ThreadPool &ThreadPool::GetShared() {
+  static ThreadPool thread_pool(
+      std::max(static_cast<int>(std::thread::hardware_concurrency()) - 1, 1));
+  return thread_pool;
+}
+
+void ThreadPool::WorkerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+void TaskQueue::Push(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.push_back(std::move(task));
+  }
+  cond_.notify_one();
+}
+
+bool TaskQueue::RunOne() {
+  std::function<void()> task;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tasks_.empty()) {
+      return false;
+    }
+    task = std::move(tasks_.front());
+    tasks_.pop_front();
+  }
+  task();
+  return true;
+}
+
+void TaskQueue::WaitForTask(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait_for(lock, timeout, [this]() { return !tasks_.empty(); });
+}
+
+bool TaskQueue::IsEmpty() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return tasks_.empty();
+}
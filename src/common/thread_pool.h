@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed number of worker threads running the submitted tasks in FIFO order.
+// The destructor finishes the queued tasks before joining.
+class ThreadPool {
+public:
+  explicit ThreadPool(int thread_num);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &rhs) = delete;
+  ThreadPool &operator=(const ThreadPool &rhs) = delete;
+
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> Submit(F &&task) {
+    typedef typename std::result_of<F()>::type Result;
+    // std::function needs a copyable callable.
+    auto packaged_task =
+        std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+    std::future<Result> result = packaged_task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.emplace_back([packaged_task]() { (*packaged_task)(); });
+    }
+    cond_.notify_one();
+    return result;
+  }
+
+  int GetThreadNum() const { return threads_.size(); }
+
+  // Shared by the loaders, one thread less than the hardware threads(at least
+  // one) so the calling thread keeps a core.
+  static ThreadPool &GetShared();
+
+private:
+  void WorkerLoop();
+
+  std::vector<std::thread> threads_;
+  std::deque<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stopping_ = false;
+};
+
+// Tasks pushed from any thread and run by one owner thread, e.g. the GL calls
+// of a loader that must stay on the context thread.
+class TaskQueue {
+public:
+  TaskQueue() = default;
+  TaskQueue(const TaskQueue &rhs) = delete;
+  TaskQueue &operator=(const TaskQueue &rhs) = delete;
+
+  void Push(std::function<void()> task);
+  // Run the oldest task, return false if there is none.
+  bool RunOne();
+  // Block until a task is pushed or timeout passes, don't run it.
+  void WaitForTask(std::chrono::milliseconds timeout);
+  bool IsEmpty();
+
+private:
+  std::deque<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+};
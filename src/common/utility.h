@@ -26,6 +26,12 @@ std::shared_ptr<T> STLMakeSharedOfEigenTypes(const Args&... args) {
 }
 
 
+// Heap bytes reserved by a vector.
+template <typename T, typename Alloc>
+size_t GetVectorBytes(const std::vector<T, Alloc> &vec) {
+  return vec.capacity() * sizeof(T);
+}
+
 double GetTimeStampSecond();
 
 double GetMod(double s, double a);
\ No newline at end of file
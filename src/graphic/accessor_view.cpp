@@ -0,0 +1,312 @@
+#include <algorithm>
+#include <cstring>
+
+#include "common/affine_kernels.h"
+#include "common/logging.h"
+#include "graphic/accessor_view.h"
+#include "graphic/model.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||            \
+    defined(_M_IX86)
+#define SA_ACCESSOR_X86 1
+#include <immintrin.h>
+#else
+#define SA_ACCESSOR_X86 0
+#endif
+
+// See affine_kernels.cpp.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SA_TARGET_SSE4
+#else
+#define SA_TARGET_SSE4 __attribute__((target("sse4.1")))
+#endif
+
+namespace {
+
+template <typename T>
+void ConvertScalar(const uint8_t *src, size_t count, float scale, bool clamp,
+                   float *dst) {
+  for (size_t c_idx = 0; c_idx < count; ++c_idx) {
+    T value;
+    std::memcpy(&value, src + c_idx * sizeof(T), sizeof(T));
+    const float result = value * scale;
+    dst[c_idx] = clamp ? std::max(result, -1.f) : result;
+  }
+}
+
+#if SA_ACCESSOR_X86
+// 16 bytes per loop, widened to 4 x 4 int32. Return the converted count.
+SA_TARGET_SSE4 size_t ConvertBytesSSE4(const uint8_t *src, size_t count,
+                                       bool is_signed, float scale,
+                                       bool clamp, float *dst) {
+  const __m128 scale4 = _mm_set1_ps(scale);
+  const __m128 minus_one = _mm_set1_ps(-1.f);
+  size_t c_idx = 0;
+  for (; c_idx + 16 <= count; c_idx += 16) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + c_idx));
+    const __m128i parts[4] = {bytes, _mm_srli_si128(bytes, 4),
+                              _mm_srli_si128(bytes, 8),
+                              _mm_srli_si128(bytes, 12)};
+    for (int p_idx = 0; p_idx < 4; ++p_idx) {
+      const __m128i ints = is_signed ? _mm_cvtepi8_epi32(parts[p_idx])
+                                     : _mm_cvtepu8_epi32(parts[p_idx]);
+      __m128 result = _mm_mul_ps(_mm_cvtepi32_ps(ints), scale4);
+      if (clamp) {
+        result = _mm_max_ps(result, minus_one);
+      }
+      _mm_storeu_ps(dst + c_idx + 4 * p_idx, result);
+    }
+  }
+  return c_idx;
+}
+
+// 8 shorts per loop, widened to 2 x 4 int32. Return the converted count.
+SA_TARGET_SSE4 size_t ConvertShortsSSE4(const uint8_t *src, size_t count,
+                                        bool is_signed, float scale,
+                                        bool clamp, float *dst) {
+  const __m128 scale4 = _mm_set1_ps(scale);
+  const __m128 minus_one = _mm_set1_ps(-1.f);
+  size_t c_idx = 0;
+  for (; c_idx + 8 <= count; c_idx += 8) {
+    const __m128i shorts = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(src + c_idx * sizeof(uint16_t)));
+    const __m128i parts[2] = {shorts, _mm_srli_si128(shorts, 8)};
+    for (int p_idx = 0; p_idx < 2; ++p_idx) {
+      const __m128i ints = is_signed ? _mm_cvtepi16_epi32(parts[p_idx])
+                                     : _mm_cvtepu16_epi32(parts[p_idx]);
+      __m128 result = _mm_mul_ps(_mm_cvtepi32_ps(ints), scale4);
+      if (clamp) {
+        result = _mm_max_ps(result, minus_one);
+      }
+      _mm_storeu_ps(dst + c_idx + 4 * p_idx, result);
+    }
+  }
+  return c_idx;
+}
+#endif // SA_ACCESSOR_X86
+
+bool UseSSE4() {
+  return AffineKernel::GetIsa() >= AffineKernel::ISA_SSE4;
+}
+
+// Scratch bytes of a strided ReadFloats, the elements of a block are packed
+// into it and converted in one run.
+const size_t kGatherByteSize = 4096;
+
+} // namespace
+
+void ConvertComponentsToFloat(const uint8_t *src, int component_type,
+                              bool normalized, size_t count, float *dst) {
+  switch (component_type) {
+  case TINYGLTF_COMPONENT_TYPE_FLOAT:
+    std::memcpy(dst, src, count * sizeof(float));
+    return;
+  case TINYGLTF_COMPONENT_TYPE_BYTE:
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: {
+    const bool is_signed = component_type == TINYGLTF_COMPONENT_TYPE_BYTE;
+    const float scale =
+        normalized ? (is_signed ? 1.f / 127.f : 1.f / 255.f) : 1.f;
+    const bool clamp = normalized && is_signed;
+    size_t done = 0;
+#if SA_ACCESSOR_X86
+    if (UseSSE4()) {
+      done = ConvertBytesSSE4(src, count, is_signed, scale, clamp, dst);
+    }
+#endif
+    if (is_signed) {
+      ConvertScalar<int8_t>(src + done, count - done, scale, clamp,
+                            dst + done);
+    } else {
+      ConvertScalar<uint8_t>(src + done, count - done, scale, clamp,
+                             dst + done);
+    }
+    return;
+  }
+  case TINYGLTF_COMPONENT_TYPE_SHORT:
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+    const bool is_signed = component_type == TINYGLTF_COMPONENT_TYPE_SHORT;
+    const float scale =
+        normalized ? (is_signed ? 1.f / 32767.f : 1.f / 65535.f) : 1.f;
+    const bool clamp = normalized && is_signed;
+    size_t done = 0;
+#if SA_ACCESSOR_X86
+    if (UseSSE4()) {
+      done = ConvertShortsSSE4(src, count, is_signed, scale, clamp, dst);
+    }
+#endif
+    const uint8_t *rest = src + done * sizeof(uint16_t);
+    if (is_signed) {
+      ConvertScalar<int16_t>(rest, count - done, scale, clamp, dst + done);
+    } else {
+      ConvertScalar<uint16_t>(rest, count - done, scale, clamp, dst + done);
+    }
+    return;
+  }
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+    ConvertScalar<uint32_t>(src, count, 1.f, false, dst);
+    return;
+  case TINYGLTF_COMPONENT_TYPE_INT:
+    ConvertScalar<int32_t>(src, count, 1.f, false, dst);
+    return;
+  default:
+    CHECK(0) << "Don't support componentType: " << component_type;
+  }
+}
+
+AccessorView::AccessorView(const tinygltf::Model &model,
+                           const std::vector<BufferSpan> &buffers,
+                           const tinygltf::Accessor &accessor)
+    : count_(accessor.count), component_num_(GLTFTypeElmSize(accessor.type)),
+      component_type_(accessor.componentType),
+      normalized_(accessor.normalized) {
+  element_byte_size_ =
+      component_num_ * GLTFComponentByteSize(accessor.componentType);
+  if (accessor.bufferView >= 0) {
+    const auto &buffer_view = model.bufferViews[accessor.bufferView];
+    const int byte_stride = accessor.ByteStride(buffer_view);
+    CHECK(byte_stride != -1) << "byte_strid equal -1";
+    byte_stride_ = byte_stride;
+    data_ = buffers[buffer_view.buffer].data + buffer_view.byteOffset +
+            accessor.byteOffset;
+  }
+  if (!accessor.sparse.isSparse) {
+    return;
+  }
+
+  const auto &indices_view =
+      model.bufferViews[accessor.sparse.indices.bufferView];
+  const auto &values_view =
+      model.bufferViews[accessor.sparse.values.bufferView];
+  const uint8_t *indices = buffers[indices_view.buffer].data +
+                           indices_view.byteOffset +
+                           accessor.sparse.indices.byteOffset;
+  const uint8_t *values = buffers[values_view.buffer].data +
+                          values_view.byteOffset +
+                          accessor.sparse.values.byteOffset;
+  const int index_type = accessor.sparse.indices.componentType;
+  const size_t index_size = GLTFComponentByteSize(index_type);
+  sparse_values_.resize(accessor.sparse.count);
+  for (int s_idx = 0; s_idx < accessor.sparse.count; ++s_idx) {
+    const uint8_t *index_ptr = indices + s_idx * index_size;
+    size_t index = 0;
+    if (index_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
+      index = *index_ptr;
+    } else if (index_type == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+      uint16_t value;
+      std::memcpy(&value, index_ptr, sizeof(value));
+      index = value;
+    } else {
+      uint32_t value;
+      std::memcpy(&value, index_ptr, sizeof(value));
+      index = value;
+    }
+    CHECK(index < count_) << "sparse index is out of range.";
+    sparse_values_[s_idx] =
+        std::make_pair(index, values + s_idx * element_byte_size_);
+  }
+  // The spec requires increasing indices, don't rely on it.
+  std::stable_sort(sparse_values_.begin(), sparse_values_.end(),
+                   [](const std::pair<size_t, const uint8_t *> &lhs,
+                      const std::pair<size_t, const uint8_t *> &rhs) {
+                     return lhs.first < rhs.first;
+                   });
+}
+
+const uint8_t *AccessorView::GetElement(size_t e_idx) const {
+  if (!sparse_values_.empty()) {
+    auto iter = std::lower_bound(
+        sparse_values_.begin(), sparse_values_.end(), e_idx,
+        [](const std::pair<size_t, const uint8_t *> &value, size_t index) {
+          return value.first < index;
+        });
+    if (iter != sparse_values_.end() && iter->first == e_idx) {
+      return iter->second;
+    }
+  }
+  return data_ ? data_ + e_idx * byte_stride_ : nullptr;
+}
+
+void AccessorView::ReadPacked(std::vector<uint8_t> &result) const {
+  result.assign(count_ * element_byte_size_, 0);
+  if (data_ && byte_stride_ == element_byte_size_) {
+    std::memcpy(result.data(), data_, result.size());
+  } else if (data_) {
+    for (size_t e_idx = 0; e_idx < count_; ++e_idx) {
+      std::memcpy(&result[e_idx * element_byte_size_],
+                  data_ + e_idx * byte_stride_, element_byte_size_);
+    }
+  }
+  ApplySparse(result.data(), element_byte_size_);
+}
+
+void AccessorView::ReadFloats(float *result) const {
+  if (!data_) {
+    std::fill(result, result + count_ * component_num_, 0.f);
+  } else if (byte_stride_ == element_byte_size_) {
+    // Packed, one run over all the components.
+    ConvertComponentsToFloat(data_, component_type_, normalized_,
+                             count_ * component_num_, result);
+  } else if (component_type_ == TINYGLTF_COMPONENT_TYPE_FLOAT) {
+    // Nothing to convert, copy every element into place.
+    for (size_t e_idx = 0; e_idx < count_; ++e_idx) {
+      std::memcpy(result + e_idx * component_num_,
+                  data_ + e_idx * byte_stride_, element_byte_size_);
+    }
+  } else {
+    // Strided or interleaved, gather a block of elements then convert it in
+    // one run, so the SSE kernels see more than one element.
+    uint8_t packed[kGatherByteSize];
+    const size_t block_count = kGatherByteSize / element_byte_size_;
+    for (size_t begin_idx = 0; begin_idx < count_; begin_idx += block_count) {
+      const size_t end_idx = std::min(count_, begin_idx + block_count);
+      for (size_t e_idx = begin_idx; e_idx < end_idx; ++e_idx) {
+        std::memcpy(packed + (e_idx - begin_idx) * element_byte_size_,
+                    data_ + e_idx * byte_stride_, element_byte_size_);
+      }
+      ConvertComponentsToFloat(packed, component_type_, normalized_,
+                               (end_idx - begin_idx) * component_num_,
+                               result + begin_idx * component_num_);
+    }
+  }
+  for (const auto &sparse_value : sparse_values_) {
+    ConvertComponentsToFloat(sparse_value.second, component_type_,
+                             normalized_, component_num_,
+                             result + sparse_value.first * component_num_);
+  }
+}
+
+void AccessorView::ReadFloats(std::vector<float> &result) const {
+  result.resize(count_ * component_num_);
+  if (!result.empty()) {
+    ReadFloats(result.data());
+  }
+}
+
+void AccessorView::ReadIndices(std::vector<uint32_t> &result) const {
+  CHECK(component_num_ == 1) << "indices must be scalars.";
+  std::vector<uint8_t> packed;
+  ReadPacked(packed);
+  result.resize(count_);
+  for (size_t e_idx = 0; e_idx < count_; ++e_idx) {
+    if (component_type_ == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
+      result[e_idx] = packed[e_idx];
+    } else if (component_type_ == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+      uint16_t index;
+      std::memcpy(&index, &packed[e_idx * sizeof(index)], sizeof(index));
+      result[e_idx] = index;
+    } else {
+      CHECK(component_type_ == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)
+          << "Don't support index componentType: " << component_type_;
+      std::memcpy(&result[e_idx], &packed[e_idx * sizeof(uint32_t)],
+                  sizeof(uint32_t));
+    }
+  }
+}
+
+void AccessorView::ApplySparse(uint8_t *elements, size_t byte_stride) const {
+  for (const auto &sparse_value : sparse_values_) {
+    std::memcpy(elements + sparse_value.first * byte_stride,
+                sparse_value.second, element_byte_size_);
+  }
+}
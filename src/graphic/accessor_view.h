@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <tiny_gltf.h>
+#include <utility>
+#include <vector>
+
+#include "graphic/gltf_loader.h"
+
+// dst[i] = src[i] as float for count components of component_type.
+// Normalized integers are mapped to [0, 1], or [-1, 1] for the signed ones.
+// 8 and 16 bits integers are converted with SSE4.1 when
+// AffineKernel::GetIsa() has it.
+void ConvertComponentsToFloat(const uint8_t *src, int component_type,
+                              bool normalized, size_t count, float *dst);
+
+// Read only view of a gltf accessor over the buffer spans of the loader.
+// Handles the byteStride of the view, the accessors without bufferView(all
+// zeros) and the sparse values, which are resolved once by the constructor.
+class AccessorView {
+public:
+  AccessorView(const tinygltf::Model &model,
+               const std::vector<BufferSpan> &buffers,
+               const tinygltf::Accessor &accessor);
+
+  size_t GetCount() const { return count_; }
+  int GetComponentNum() const { return component_num_; }
+  int GetComponentType() const { return component_type_; }
+  bool IsNormalized() const { return normalized_; }
+  size_t GetElementByteSize() const { return element_byte_size_; }
+  // 0 for the accessors without bufferView.
+  size_t GetByteStride() const { return byte_stride_; }
+
+  // Raw bytes of element e_idx with the sparse values applied, nullptr for
+  // a zero element.
+  const uint8_t *GetElement(size_t e_idx) const;
+  // Every element tightly packed, in the accessor component type.
+  void ReadPacked(std::vector<uint8_t> &result) const;
+  // Every component as float, GetCount() * GetComponentNum() of them.
+  void ReadFloats(float *result) const;
+  void ReadFloats(std::vector<float> &result) const;
+  // Every element of an unsigned integer scalar accessor, e.g. the indices.
+  void ReadIndices(std::vector<uint32_t> &result) const;
+  // Write the sparse values into elements laid out with byte_stride, e.g. a
+  // copy of the buffer view.
+  void ApplySparse(uint8_t *elements, size_t byte_stride) const;
+
+private:
+  const uint8_t *data_ = nullptr;
+  size_t byte_stride_ = 0;
+  size_t count_ = 0;
+  int component_num_ = 0;
+  int component_type_ = 0;
+  bool normalized_ = false;
+  size_t element_byte_size_ = 0;
+  // (element index, value bytes), sorted by element index.
+  std::vector<std::pair<size_t, const uint8_t *>> sparse_values_;
+};
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <map>
+
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/quaternion.hpp>
+
+#include "common/logging.h"
+#include "common/utility.h"
+#include "graphic/accessor_view.h"
+#include "graphic/animation.h"
+#include "graphic/model.h"
+
+namespace {
+
+// Append the accessor data as floats.
+void AppendAccessorData(const tinygltf::Model &model,
+                        const std::vector<BufferSpan> &buffers,
+                        int accessor_idx, std::vector<float> &result) {
+  const AccessorView view(model, buffers, model.accessors[accessor_idx]);
+  const size_t offset = result.size();
+  result.resize(offset + view.GetCount() * view.GetComponentNum());
+  if (result.size() > offset) {
+    view.ReadFloats(result.data() + offset);
+  }
+}
+
+} // namespace
+
+void AnimationClip::Init(const tinygltf::Model &model,
+                         const std::vector<BufferSpan> &buffers,
+                         int anim_idx) {
+  CHECK(anim_idx >= 0 && anim_idx < model.animations.size())
+      << "anim_idx is beyond model.animations array.";
+  const auto &animation = model.animations[anim_idx];
+  name_ = animation.name;
+  duration_ = 0;
+  timelines_.clear();
+  channels_.clear();
+  key_times_.clear();
+  key_values_.clear();
+
+  // input accessor index -> timeline index.
+  std::map<int, int> input2timeline_map;
+  for (const auto &anim_channel : animation.channels) {
+    Channel channel;
+    if (anim_channel.target_path == "translation") {
+      channel.path = PATH_TRANSLATION;
+      channel.value_size = 3;
+    } else if (anim_channel.target_path == "rotation") {
+      channel.path = PATH_ROTATION;
+      channel.value_size = 4;
+    } else if (anim_channel.target_path == "scale") {
+      channel.path = PATH_SCALE;
+      channel.value_size = 3;
+    } else {
+      // Morph target weights are not supported.
+      LOG(WARNING) << "Skip animation channel with target_path: "
+                   << anim_channel.target_path;
+      continue;
+    }
+    if (anim_channel.target_node < 0) {
+      continue;
+    }
+    channel.node_idx = anim_channel.target_node;
+
+    const auto &anim_sampler = animation.samplers[anim_channel.sampler];
+    if (anim_sampler.interpolation == "STEP") {
+      channel.interpolation = INTERP_STEP;
+    } else if (anim_sampler.interpolation == "CUBICSPLINE") {
+      channel.interpolation = INTERP_CUBIC;
+    } else {
+      channel.interpolation = INTERP_LINEAR;
+    }
+
+    auto timeline_iter = input2timeline_map.find(anim_sampler.input);
+    if (timeline_iter == input2timeline_map.end()) {
+      Timeline timeline;
+      timeline.key_offset = key_times_.size();
+      AppendAccessorData(model, buffers, anim_sampler.input, key_times_);
+      timeline.key_num = key_times_.size() - timeline.key_offset;
+      CHECK(timeline.key_num > 0) << "animation sampler has no keys.";
+      timeline.duration = key_times_.back();
+      duration_ = std::max(duration_, timeline.duration);
+      timeline_iter =
+          input2timeline_map.insert({anim_sampler.input, timelines_.size()})
+              .first;
+      timelines_.push_back(timeline);
+    }
+    channel.timeline_idx = timeline_iter->second;
+
+    channel.value_offset = key_values_.size();
+    AppendAccessorData(model, buffers, anim_sampler.output, key_values_);
+    int key_num = timelines_[channel.timeline_idx].key_num;
+    int value_num = (key_values_.size() - channel.value_offset) /
+                    channel.value_size;
+    CHECK(value_num ==
+          (channel.interpolation == INTERP_CUBIC ? 3 * key_num : key_num))
+        << "animation output count doesn't match input count.";
+    channels_.push_back(channel);
+  }
+}
+
+void AnimationClip::Serialize(BinaryWriter &writer) const {
+  writer.WriteString(name_);
+  writer.Write(duration_);
+  writer.WriteVector(timelines_);
+  writer.WriteVector(channels_);
+  writer.WriteVector(key_times_);
+  writer.WriteVector(key_values_);
+}
+
+bool AnimationClip::Deserialize(BinaryReader &reader, int node_num) {
+  name_ = reader.ReadString();
+  duration_ = reader.Read<float>();
+  reader.ReadVector(timelines_);
+  reader.ReadVector(channels_);
+  reader.ReadVector(key_times_);
+  reader.ReadVector(key_values_);
+  if (reader.IsFailed()) {
+    return false;
+  }
+  for (const auto &timeline : timelines_) {
+    if (timeline.key_offset < 0 || timeline.key_num < 0 ||
+        size_t(timeline.key_offset) + timeline.key_num > key_times_.size()) {
+      return false;
+    }
+  }
+  for (const auto &channel : channels_) {
+    if (channel.node_idx < 0 || channel.node_idx >= node_num ||
+        channel.timeline_idx < 0 ||
+        channel.timeline_idx >= static_cast<int>(timelines_.size()) ||
+        channel.path < PATH_TRANSLATION || channel.path > PATH_SCALE ||
+        channel.interpolation < INTERP_LINEAR ||
+        channel.interpolation > INTERP_CUBIC ||
+        (channel.value_size != 3 && channel.value_size != 4) ||
+        channel.value_offset < 0) {
+      return false;
+    }
+    // SampleChannel reads the first key even without keys.
+    const size_t key_num =
+        std::max(timelines_[channel.timeline_idx].key_num, 1);
+    const size_t key_size = (channel.interpolation == INTERP_CUBIC ? 3 : 1) *
+                            size_t(channel.value_size);
+    if (size_t(channel.value_offset) + key_num * key_size >
+        key_values_.size()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void AnimationClip::EvaluateTimelines(
+    double time, std::vector<KeyCursor> &timeline_cursors) const {
+  timeline_cursors.resize(timelines_.size());
+  for (size_t t_idx = 0; t_idx < timelines_.size(); ++t_idx) {
+    const auto &timeline = timelines_[t_idx];
+    auto &cursor = timeline_cursors[t_idx];
+    if (timeline.key_num < 2 || timeline.duration <= 0) {
+      cursor.index = 0;
+      cursor.weight = 0;
+      cursor.delta_time = 0;
+      continue;
+    }
+    const float *time_begin = key_times_.data() + timeline.key_offset;
+    const float *time_end = time_begin + timeline.key_num;
+    float cur_mod_time = GetMod(time, timeline.duration);
+    int index = std::upper_bound(time_begin, time_end, cur_mod_time) -
+                time_begin - 1;
+    index = std::min(std::max(index, 0), timeline.key_num - 2);
+
+    cursor.index = index;
+    cursor.delta_time = time_begin[index + 1] - time_begin[index];
+    cursor.weight =
+        cursor.delta_time > 0
+            ? (cur_mod_time - time_begin[index]) / cursor.delta_time
+            : 0;
+    cursor.weight = std::min(std::max(cursor.weight, 0.f), 1.f);
+  }
+}
+
+void AnimationClip::SampleChannel(int chan_idx, const KeyCursor &cursor,
+                                  float *result) const {
+  const auto &channel = channels_[chan_idx];
+  const int size = channel.value_size;
+  const float *values = key_values_.data() + channel.value_offset;
+
+  if (timelines_[channel.timeline_idx].key_num < 2) {
+    const float *value =
+        channel.interpolation == INTERP_CUBIC ? values + size : values;
+    std::copy(value, value + size, result);
+    return;
+  }
+
+  if (channel.interpolation == INTERP_CUBIC) {
+    // Keys are (in_tangent, value, out_tangent).
+    const float *v0 = values + (3 * cursor.index + 1) * size;
+    const float *b0 = values + (3 * cursor.index + 2) * size;
+    const float *a1 = values + (3 * (cursor.index + 1) + 0) * size;
+    const float *v1 = values + (3 * (cursor.index + 1) + 1) * size;
+    const float t = cursor.weight;
+    const float t2 = t * t;
+    const float t3 = t2 * t;
+    const float dt = cursor.delta_time;
+    for (int c_idx = 0; c_idx < size; ++c_idx) {
+      result[c_idx] = (2 * t3 - 3 * t2 + 1) * v0[c_idx] +
+                      (t3 - 2 * t2 + t) * dt * b0[c_idx] +
+                      (-2 * t3 + 3 * t2) * v1[c_idx] +
+                      (t3 - t2) * dt * a1[c_idx];
+    }
+    if (channel.path == PATH_ROTATION) {
+      glm::quat quat = glm::normalize(
+          glm::quat(result[3], result[0], result[1], result[2]));
+      result[0] = quat.x;
+      result[1] = quat.y;
+      result[2] = quat.z;
+      result[3] = quat.w;
+    }
+    return;
+  }
+
+  const float *left = values + cursor.index * size;
+  if (channel.interpolation == INTERP_STEP || cursor.weight <= 0) {
+    std::copy(left, left + size, result);
+    return;
+  }
+  const float *right = left + size;
+  const float weight = cursor.weight;
+  if (channel.path == PATH_ROTATION) {
+    glm::quat quat_left(left[3], left[0], left[1], left[2]);
+    glm::quat quat_right(right[3], right[0], right[1], right[2]);
+    glm::quat quat_slerp = glm::shortMix(quat_left, quat_right, weight);
+    result[0] = quat_slerp.x;
+    result[1] = quat_slerp.y;
+    result[2] = quat_slerp.z;
+    result[3] = quat_slerp.w;
+  } else {
+    for (int c_idx = 0; c_idx < size; ++c_idx) {
+      result[c_idx] = (1 - weight) * left[c_idx] + weight * right[c_idx];
+    }
+  }
+}
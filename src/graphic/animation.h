@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <tiny_gltf.h>
+#include <vector>
+
+#include "common/binary_io.h"
+#include "common/utility.h"
+#include "graphic/gltf_loader.h"
+
+// Compiled animation clip.
+// The accessor data of one gltf animation is decoded once into flat arrays,
+// channels are resolved to node index and path enum, and samplers that share
+// an input accessor share one timeline. Sampling a frame does no allocation
+// and no string work.
+class AnimationClip {
+public:
+  enum TargetPath { PATH_TRANSLATION = 0, PATH_ROTATION = 1, PATH_SCALE = 2 };
+  enum Interpolation { INTERP_LINEAR = 0, INTERP_STEP = 1, INTERP_CUBIC = 2 };
+
+  // Key times of one input accessor.
+  struct Timeline {
+    int key_offset = 0;
+    int key_num = 0;
+    float duration = 0;
+  };
+
+  struct Channel {
+    int node_idx = -1;
+    TargetPath path = PATH_TRANSLATION;
+    Interpolation interpolation = INTERP_LINEAR;
+    int timeline_idx = -1;
+    // Offset into key_values_, cubic spline keys are stored as
+    // (in_tangent, value, out_tangent) triplets.
+    int value_offset = 0;
+    // 3 for translation and scale, 4 for rotation(x, y, z, w).
+    int value_size = 0;
+  };
+
+  // Result of the key search of one timeline.
+  struct KeyCursor {
+    int index = 0;
+    float weight = 0;
+    float delta_time = 0;
+  };
+
+  AnimationClip() = default;
+  ~AnimationClip() = default;
+
+  // buffers: the bytes of model.buffers, see GLTFLoader.
+  void Init(const tinygltf::Model &model,
+            const std::vector<BufferSpan> &buffers, int anim_idx);
+  // The compiled arrays, for cooked models.
+  void Serialize(BinaryWriter &writer) const;
+  // Return false when the arrays are truncated or index out of each other,
+  // or a channel targets a node out of node_num.
+  bool Deserialize(BinaryReader &reader, int node_num);
+
+  // Search the keys of every timeline once, cursors must be sized to
+  // GetTimelineNum() to avoid reallocation.
+  void EvaluateTimelines(double time,
+                         std::vector<KeyCursor> &timeline_cursors) const;
+  // Write the interpolated value of chan_idx to result(3 or 4 floats).
+  void SampleChannel(int chan_idx, const KeyCursor &cursor,
+                     float *result) const;
+
+  int GetChannelNum() const { return channels_.size(); }
+  int GetTimelineNum() const { return timelines_.size(); }
+  const Channel &GetChannel(int chan_idx) const { return channels_[chan_idx]; }
+  float GetDuration() const { return duration_; }
+  const std::string &GetName() const { return name_; }
+  // Resident CPU bytes.
+  size_t GetByteSize() const {
+    return GetVectorBytes(timelines_) + GetVectorBytes(channels_) +
+           GetVectorBytes(key_times_) + GetVectorBytes(key_values_);
+  }
+
+private:
+  std::string name_;
+  float duration_ = 0;
+
+  std::vector<Timeline> timelines_;
+  std::vector<Channel> channels_;
+  std::vector<float> key_times_;
+  std::vector<float> key_values_;
+};
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cmath>
+
+#include "common/logging.h"
+#include "graphic/accessor_view.h"
+#include "graphic/bounds.h"
+
+void AABB::Extend(const glm::vec3 &point) {
+  if (IsEmpty()) {
+    min = point;
+    max = point;
+    return;
+  }
+  for (int c_idx = 0; c_idx < 3; ++c_idx) {
+    min[c_idx] = std::min(min[c_idx], point[c_idx]);
+    max[c_idx] = std::max(max[c_idx], point[c_idx]);
+  }
+}
+
+void AABB::Extend(const AABB &box) {
+  if (!box.IsEmpty()) {
+    Extend(box.min);
+    Extend(box.max);
+  }
+}
+
+AABB AABB::Grow(float ratio) const {
+  if (IsEmpty()) {
+    return *this;
+  }
+  const glm::vec3 margin = (max - min) * ratio;
+  AABB result;
+  result.min = min - margin;
+  result.max = max + margin;
+  return result;
+}
+
+AABB AABB::Transform(const glm::mat4 &matrix) const {
+  // Row major 3x4, glm is column major.
+  AffineMatrix affine;
+  for (int r_idx = 0; r_idx < 3; ++r_idx) {
+    for (int c_idx = 0; c_idx < 4; ++c_idx) {
+      affine.m[4 * r_idx + c_idx] = matrix[c_idx][r_idx];
+    }
+  }
+  return Transform(affine);
+}
+
+AABB AABB::Transform(const AffineMatrix &matrix) const {
+  if (IsEmpty()) {
+    return *this;
+  }
+  // The center is transformed, the extent by the absolute matrix.
+  const glm::vec3 center = (min + max) * 0.5f;
+  const glm::vec3 extent = (max - min) * 0.5f;
+  AABB result;
+  for (int r_idx = 0; r_idx < 3; ++r_idx) {
+    const float *row = &matrix.m[4 * r_idx];
+    const float new_center =
+        row[0] * center.x + row[1] * center.y + row[2] * center.z + row[3];
+    const float new_extent = std::abs(row[0]) * extent.x +
+                             std::abs(row[1]) * extent.y +
+                             std::abs(row[2]) * extent.z;
+    result.min[r_idx] = new_center - new_extent;
+    result.max[r_idx] = new_center + new_extent;
+  }
+  return result;
+}
+
+void Frustum::Init(const glm::mat4 &view_proj) {
+  // Gribb and Hartmann, -w <= x, y, z <= w.
+  glm::vec4 rows[4];
+  for (int r_idx = 0; r_idx < 4; ++r_idx) {
+    rows[r_idx] = glm::vec4(view_proj[0][r_idx], view_proj[1][r_idx],
+                            view_proj[2][r_idx], view_proj[3][r_idx]);
+  }
+  for (int a_idx = 0; a_idx < 3; ++a_idx) {
+    planes_[2 * a_idx] = rows[3] + rows[a_idx];
+    planes_[2 * a_idx + 1] = rows[3] - rows[a_idx];
+  }
+}
+
+bool Frustum::Intersects(const AABB &box) const {
+  if (box.IsEmpty()) {
+    return true;
+  }
+  for (const auto &plane : planes_) {
+    // The corner furthest along the normal.
+    const glm::vec3 corner(plane.x >= 0 ? box.max.x : box.min.x,
+                           plane.y >= 0 ? box.max.y : box.min.y,
+                           plane.z >= 0 ? box.max.z : box.min.z);
+    if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z +
+            plane.w <
+        0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+namespace Bounds {
+
+AABB GetMeshBounds(const tinygltf::Model &model,
+                   const std::vector<BufferSpan> &buffers,
+                   const tinygltf::Mesh &mesh) {
+  AABB result;
+  std::vector<float> positions;
+  for (const auto &primitive : mesh.primitives) {
+    auto a_iter = primitive.attributes.find("POSITION");
+    if (a_iter == primitive.attributes.end()) {
+      continue;
+    }
+    const auto &accessor = model.accessors[a_iter->second];
+    // Required by the spec, but not by tinygltf.
+    if (accessor.minValues.size() == 3 && accessor.maxValues.size() == 3) {
+      result.Extend(glm::vec3(accessor.minValues[0], accessor.minValues[1],
+                              accessor.minValues[2]));
+      result.Extend(glm::vec3(accessor.maxValues[0], accessor.maxValues[1],
+                              accessor.maxValues[2]));
+      continue;
+    }
+    const AccessorView view(model, buffers, accessor);
+    CHECK(view.GetComponentNum() == 3) << "POSITION must be a vec3.";
+    view.ReadFloats(positions);
+    for (size_t v_idx = 0; v_idx < view.GetCount(); ++v_idx) {
+      result.Extend(glm::vec3(positions[3 * v_idx], positions[3 * v_idx + 1],
+                              positions[3 * v_idx + 2]));
+    }
+  }
+  return result;
+}
+
+void ExtendJointBounds(const tinygltf::Model &model,
+                       const std::vector<BufferSpan> &buffers,
+                       const tinygltf::Mesh &mesh,
+                       std::vector<AABB> &joint_bounds) {
+  std::vector<float> positions;
+  std::vector<float> joints;
+  std::vector<float> weights;
+  for (const auto &primitive : mesh.primitives) {
+    auto position_iter = primitive.attributes.find("POSITION");
+    auto joints_iter = primitive.attributes.find("JOINTS_0");
+    auto weights_iter = primitive.attributes.find("WEIGHTS_0");
+    if (position_iter == primitive.attributes.end() ||
+        joints_iter == primitive.attributes.end() ||
+        weights_iter == primitive.attributes.end()) {
+      continue;
+    }
+    AccessorView(model, buffers, model.accessors[position_iter->second])
+        .ReadFloats(positions);
+    AccessorView(model, buffers, model.accessors[joints_iter->second])
+        .ReadFloats(joints);
+    AccessorView(model, buffers, model.accessors[weights_iter->second])
+        .ReadFloats(weights);
+    const size_t vertex_num = positions.size() / 3;
+    CHECK(joints.size() == 4 * vertex_num && weights.size() == 4 * vertex_num)
+        << "JOINTS_0 and WEIGHTS_0 must be vec4 of the POSITION count.";
+    for (size_t v_idx = 0; v_idx < vertex_num; ++v_idx) {
+      const glm::vec3 position(positions[3 * v_idx], positions[3 * v_idx + 1],
+                               positions[3 * v_idx + 2]);
+      for (int i_idx = 0; i_idx < 4; ++i_idx) {
+        const size_t joint = static_cast<size_t>(joints[4 * v_idx + i_idx]);
+        if (weights[4 * v_idx + i_idx] > 0 && joint < joint_bounds.size()) {
+          joint_bounds[joint].Extend(position);
+        }
+      }
+    }
+  }
+}
+
+AABB GetSkinnedBounds(const std::vector<AABB> &joint_bounds,
+                      const AffineMatrix *palette) {
+  AABB result;
+  for (size_t j_idx = 0; j_idx < joint_bounds.size(); ++j_idx) {
+    if (!joint_bounds[j_idx].IsEmpty()) {
+      result.Extend(joint_bounds[j_idx].Transform(palette[j_idx]));
+    }
+  }
+  return result;
+}
+
+} // namespace Bounds
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <tiny_gltf.h>
+#include <vector>
+
+#include "common/affine_kernels.h"
+#include "graphic/gltf_loader.h"
+
+// Axis aligned bounding box, empty until extended.
+struct AABB {
+  glm::vec3 min = glm::vec3(1.f, 1.f, 1.f);
+  glm::vec3 max = glm::vec3(-1.f, -1.f, -1.f);
+
+  bool IsEmpty() const { return min.x > max.x; }
+  void Extend(const glm::vec3 &point);
+  void Extend(const AABB &box);
+  // Every side moved out by ratio times the box size, e.g. to keep using
+  // the bounds of an older pose.
+  AABB Grow(float ratio) const;
+  // Box of the transformed box, empty stays empty.
+  AABB Transform(const glm::mat4 &matrix) const;
+  AABB Transform(const AffineMatrix &matrix) const;
+};
+
+// The six planes of a view projection, the normals point inside.
+class Frustum {
+public:
+  Frustum() = default;
+  // clip = view_proj * world.
+  void Init(const glm::mat4 &view_proj);
+  // False only if box is entirely outside one plane, so a few boxes near the
+  // corners pass. Empty boxes(no bounds) always pass.
+  bool Intersects(const AABB &box) const;
+
+private:
+  glm::vec4 planes_[6];
+};
+
+// Load time bounds of the gltf meshes, in mesh space.
+namespace Bounds {
+
+// Union of the POSITION min/max of the primitives, read from the accessors
+// when min/max are missing.
+AABB GetMeshBounds(const tinygltf::Model &model,
+                   const std::vector<BufferSpan> &buffers,
+                   const tinygltf::Mesh &mesh);
+// Extend joint_bounds[j] with the vertices of mesh influenced by skin joint
+// j. The skinned vertex is a weighted mean of palette[j] * vertex, so the
+// union of joint_bounds[j].Transform(palette[j]) bounds the posed mesh.
+void ExtendJointBounds(const tinygltf::Model &model,
+                       const std::vector<BufferSpan> &buffers,
+                       const tinygltf::Mesh &mesh,
+                       std::vector<AABB> &joint_bounds);
+// Union of the joint bounds posed by the palette.
+AABB GetSkinnedBounds(const std::vector<AABB> &joint_bounds,
+                      const AffineMatrix *palette);
+
+} // namespace Bounds
@@ -0,0 +1,447 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <numeric>
+#include <sys/stat.h>
+
+#include "common/binary_io.h"
+#include "common/logging.h"
+#include "common/mapped_file.h"
+#include "graphic/accessor_view.h"
+#include "graphic/animation.h"
+#include "graphic/bounds.h"
+#include "graphic/cooked_model.h"
+#include "graphic/gltf_loader.h"
+#include "graphic/mesh_optimizer.h"
+#include "graphic/model.h"
+#include "graphic/scene_tree.h"
+#include "graphic/skeleton_lod.h"
+
+namespace CookedModel {
+
+namespace {
+
+// Tightly packed elements of the accessor, the sparse values applied.
+std::vector<uint8_t> ReadAccessor(const tinygltf::Model &model,
+                                  const std::vector<BufferSpan> &buffers,
+                                  const tinygltf::Accessor &accessor) {
+  std::vector<uint8_t> result;
+  AccessorView(model, buffers, accessor).ReadPacked(result);
+  return result;
+}
+
+// RGBA8 copy of a decoded image, 16 bits channels keep the high byte.
+std::vector<uint8_t> ToRGBA8(const tinygltf::Image &image) {
+  const size_t pixel_num = size_t(image.width) * image.height;
+  const int channel_size = image.bits / 8;
+  CHECK(channel_size == 1 || channel_size == 2)
+      << "Don't support image.bits: " << image.bits;
+  std::vector<uint8_t> result(pixel_num * 4, 255);
+  for (size_t p_idx = 0; p_idx < pixel_num; ++p_idx) {
+    uint8_t channels[4] = {0, 0, 0, 255};
+    for (int c_idx = 0; c_idx < image.component; ++c_idx) {
+      // Little endian, the high byte is the last one.
+      channels[c_idx] =
+          image.image[(p_idx * image.component + c_idx + 1) * channel_size -
+                      1];
+    }
+    if (image.component == 1) {
+      channels[1] = channels[2] = channels[0];
+    } else if (image.component == 2) {
+      channels[3] = channels[1];
+      channels[1] = channels[2] = channels[0];
+    }
+    std::memcpy(&result[p_idx * 4], channels, 4);
+  }
+  return result;
+}
+
+// Box filtered half size level, odd edges repeat the last texel.
+std::vector<uint8_t> Downsample(const std::vector<uint8_t> &level, int width,
+                                int height, int &next_width,
+                                int &next_height) {
+  next_width = std::max(width / 2, 1);
+  next_height = std::max(height / 2, 1);
+  std::vector<uint8_t> result(size_t(next_width) * next_height * 4);
+  for (int y_idx = 0; y_idx < next_height; ++y_idx) {
+    const int y0 = std::min(2 * y_idx, height - 1);
+    const int y1 = std::min(2 * y_idx + 1, height - 1);
+    for (int x_idx = 0; x_idx < next_width; ++x_idx) {
+      const int x0 = std::min(2 * x_idx, width - 1);
+      const int x1 = std::min(2 * x_idx + 1, width - 1);
+      for (int c_idx = 0; c_idx < 4; ++c_idx) {
+        const int sum = level[(size_t(y0) * width + x0) * 4 + c_idx] +
+                        level[(size_t(y0) * width + x1) * 4 + c_idx] +
+                        level[(size_t(y1) * width + x0) * 4 + c_idx] +
+                        level[(size_t(y1) * width + x1) * 4 + c_idx];
+        result[(size_t(y_idx) * next_width + x_idx) * 4 + c_idx] =
+            (sum + 2) / 4;
+      }
+    }
+  }
+  return result;
+}
+
+void WriteTextures(const tinygltf::Model &model, BinaryWriter &writer) {
+  writer.Write(static_cast<uint32_t>(model.textures.size()));
+  for (const auto &texture : model.textures) {
+    tinygltf::Sampler sampler;
+    if (texture.sampler >= 0) {
+      sampler = model.samplers[texture.sampler];
+    }
+    const auto &image = model.images[texture.source];
+    std::vector<uint8_t> level = ToRGBA8(image);
+    int width = image.width;
+    int height = image.height;
+
+    TextureHeader header;
+    header.min_filter =
+        sampler.minFilter > 0 ? sampler.minFilter : GL_LINEAR_MIPMAP_LINEAR;
+    header.mag_filter = sampler.magFilter > 0 ? sampler.magFilter : GL_LINEAR;
+    header.wrap_s = sampler.wrapS;
+    header.wrap_t = sampler.wrapT;
+    header.level_num = 1;
+    while (std::max(width, height) >> header.level_num) {
+      ++header.level_num;
+    }
+    writer.Write(header);
+    for (uint32_t l_idx = 0; l_idx < header.level_num; ++l_idx) {
+      LevelHeader level_header = {uint32_t(width), uint32_t(height)};
+      writer.Write(level_header);
+      writer.WriteBlob(level.data(), level.size());
+      if (l_idx + 1 < header.level_num) {
+        level = Downsample(level, width, height, width, height);
+      }
+    }
+  }
+}
+
+// Weld and reorder a triangle list, non indexed lists become indexed.
+// Indices are u16 when the vertices fit.
+void OptimizePrimitive(const CookOptions &options,
+                       const std::vector<VertexAttrib> &attribs,
+                       PrimitiveHeader &header, std::vector<uint8_t> &vertices,
+                       std::vector<uint32_t> &indices) {
+  header.vertex_num =
+      MeshOptimizer::WeldVertices(vertices, header.stride, indices);
+  MeshOptimizer::OptimizeVertexCache(indices, header.vertex_num);
+  if (options.optimize_overdraw) {
+    for (const auto &attrib : attribs) {
+      if (attrib.location == 0 && attrib.type == GL_FLOAT &&
+          attrib.size == 3) {
+        MeshOptimizer::OptimizeOverdraw(indices, &vertices[attrib.offset],
+                                        header.vertex_num, header.stride,
+                                        1.05f);
+      }
+    }
+  }
+  header.vertex_num =
+      MeshOptimizer::OptimizeVertexFetch(vertices, header.stride, indices);
+  header.index_num = indices.size();
+  header.index_type = header.vertex_num <= 65536 ? GL_UNSIGNED_SHORT
+                                                 : GL_UNSIGNED_INT;
+}
+
+std::vector<uint8_t> PackIndices(const std::vector<uint32_t> &indices,
+                                 uint32_t index_type) {
+  const size_t index_size = GLTFComponentByteSize(index_type);
+  std::vector<uint8_t> result(indices.size() * index_size);
+  for (size_t i_idx = 0; i_idx < indices.size(); ++i_idx) {
+    // Little endian, the low bytes.
+    std::memcpy(&result[i_idx * index_size], &indices[i_idx], index_size);
+  }
+  return result;
+}
+
+void WriteMeshes(const tinygltf::Model &model,
+                 const std::vector<BufferSpan> &buffers,
+                 const CookOptions &options, BinaryWriter &writer) {
+  // The attribute locations of the avatar shaders.
+  const std::pair<const char *, uint32_t> attrib_locations[] = {
+      {"POSITION", 0}, {"TEXCOORD_0", 1}, {"NORMAL", 2},
+      {"JOINTS_0", 3}, {"WEIGHTS_0", 4}};
+
+  writer.Write(static_cast<uint32_t>(model.meshes.size()));
+  for (size_t m_idx = 0; m_idx < model.meshes.size(); ++m_idx) {
+    const auto &mesh = model.meshes[m_idx];
+    MeshOptimizer::CacheStats source_stats;
+    MeshOptimizer::CacheStats cooked_stats;
+    writer.Write(static_cast<uint32_t>(mesh.primitives.size()));
+    for (const auto &primitive : mesh.primitives) {
+      PrimitiveHeader header;
+      std::memset(&header, 0, sizeof(header));
+      header.mode = GLTFRenderMode(primitive.mode);
+      header.texture_idx = -1;
+      glm::vec4 color(0.5, 0.5, 0.5, 1.0);
+      if (primitive.material >= 0) {
+        const auto &pbr = model.materials[primitive.material]
+                              .pbrMetallicRoughness;
+        if (pbr.baseColorTexture.index >= 0) {
+          header.texture_idx = pbr.baseColorTexture.index;
+        } else if (!pbr.baseColorFactor.empty()) {
+          color = glm::vec4(pbr.baseColorFactor[0], pbr.baseColorFactor[1],
+                            pbr.baseColorFactor[2], pbr.baseColorFactor[3]);
+        }
+      }
+      std::memcpy(header.color, &color[0], sizeof(header.color));
+
+      // Interleave the attributes, every attribute 4 bytes aligned.
+      std::vector<VertexAttrib> attribs;
+      std::vector<std::vector<uint8_t>> attrib_data;
+      for (const auto &attrib_location : attrib_locations) {
+        auto iter = primitive.attributes.find(attrib_location.first);
+        if (iter == primitive.attributes.end()) {
+          continue;
+        }
+        const auto &accessor = model.accessors[iter->second];
+        VertexAttrib attrib;
+        attrib.location = attrib_location.second;
+        attrib.size = GLTFTypeElmSize(accessor.type);
+        attrib.type = accessor.componentType;
+        attrib.normalized = accessor.normalized ? 1 : 0;
+        attrib.offset = header.stride;
+        header.stride += (attrib.size * GLTFComponentByteSize(attrib.type) +
+                          3) & ~3u;
+        if (attrib.location == 0) {
+          header.vertex_num = accessor.count;
+        }
+        attribs.push_back(attrib);
+        attrib_data.push_back(ReadAccessor(model, buffers, accessor));
+      }
+      std::vector<uint8_t> vertices(size_t(header.vertex_num) * header.stride,
+                                    0);
+      for (size_t a_idx = 0; a_idx < attribs.size(); ++a_idx) {
+        const auto &attrib = attribs[a_idx];
+        const size_t elm_byte_size =
+            attrib.size * GLTFComponentByteSize(attrib.type);
+        const size_t elm_num =
+            std::min<size_t>(header.vertex_num,
+                             attrib_data[a_idx].size() / elm_byte_size);
+        for (size_t v_idx = 0; v_idx < elm_num; ++v_idx) {
+          std::memcpy(&vertices[v_idx * header.stride + attrib.offset],
+                      &attrib_data[a_idx][v_idx * elm_byte_size],
+                      elm_byte_size);
+        }
+      }
+
+      std::vector<uint32_t> indices;
+      if (primitive.indices >= 0) {
+        const auto &accessor = model.accessors[primitive.indices];
+        header.index_type = accessor.componentType;
+        header.index_num = accessor.count;
+        AccessorView(model, buffers, accessor).ReadIndices(indices);
+      }
+      if (options.optimize_meshes && header.mode == GL_TRIANGLES &&
+          header.vertex_num > 0 && header.stride > 0) {
+        if (indices.empty()) {
+          indices.resize(header.vertex_num);
+          std::iota(indices.begin(), indices.end(), 0);
+        }
+        if (indices.size() % 3 == 0) {
+          source_stats.Add(
+              MeshOptimizer::AnalyzeVertexCache(indices, header.vertex_num));
+          OptimizePrimitive(options, attribs, header, vertices, indices);
+          cooked_stats.Add(
+              MeshOptimizer::AnalyzeVertexCache(indices, header.vertex_num));
+        } else if (primitive.indices < 0) {
+          indices.clear();
+        }
+      }
+
+      writer.Write(header);
+      writer.WriteVector(attribs);
+      writer.WriteBlob(vertices.data(), vertices.size());
+      const std::vector<uint8_t> index_data =
+          PackIndices(indices, header.index_type);
+      writer.WriteBlob(index_data.data(), index_data.size());
+    }
+    if (source_stats.triangle_num > 0) {
+      LOG(INFO) << "Cook mesh " << m_idx << " " << mesh.name << ": "
+                << source_stats.ToString() << " -> "
+                << cooked_stats.ToString();
+    }
+  }
+}
+
+void WriteNodes(const tinygltf::Model &model, BinaryWriter &writer) {
+  // SceneTree resolves the local TRS the same way at runtime.
+  SceneTree scene_tree;
+  scene_tree.Init(model);
+  const int node_num = model.nodes.size();
+  std::vector<int> parent_indices(node_num);
+  std::vector<int> meshes(node_num);
+  std::vector<float> rotations(4 * node_num);
+  std::vector<float> translations(3 * node_num);
+  std::vector<float> scales(3 * node_num);
+  writer.Write(static_cast<uint32_t>(node_num));
+  for (int n_idx = 0; n_idx < node_num; ++n_idx) {
+    writer.WriteString(model.nodes[n_idx].name);
+    parent_indices[n_idx] = scene_tree.GetParentIndex(n_idx);
+    meshes[n_idx] = model.nodes[n_idx].mesh;
+    scene_tree.GetLocalPose(n_idx, &rotations[4 * n_idx],
+                            &translations[3 * n_idx], &scales[3 * n_idx]);
+  }
+  writer.WriteVector(parent_indices);
+  writer.WriteVector(meshes);
+  writer.WriteVector(rotations);
+  writer.WriteVector(translations);
+  writer.WriteVector(scales);
+  for (const auto &node : model.nodes) {
+    writer.WriteVector(node.children);
+  }
+  std::vector<int> scene_roots;
+  if (!model.scenes.empty()) {
+    scene_roots =
+        model.scenes[model.defaultScene > -1 ? model.defaultScene : 0].nodes;
+  }
+  writer.WriteVector(scene_roots);
+}
+
+void WriteSkin(const tinygltf::Model &model,
+               const std::vector<BufferSpan> &buffers, BinaryWriter &writer) {
+  std::vector<int> joints;
+  STLVectorOfEigenTypes<AffineMatrix> invbindmats;
+  if (!model.skins.empty()) {
+    const auto &skin = model.skins[0];
+    joints = skin.joints;
+    invbindmats.resize(joints.size(), AffineMatrix::Identity());
+    if (skin.inverseBindMatrices >= 0) {
+      const AccessorView view(model, buffers,
+                              model.accessors[skin.inverseBindMatrices]);
+      CHECK(view.GetCount() == joints.size())
+          << "skin joints doesn't match matrix count.";
+      std::vector<float> matrices;
+      view.ReadFloats(matrices);
+      for (size_t j_idx = 0; j_idx < joints.size(); ++j_idx) {
+        invbindmats[j_idx] = AffineKernel::FromMatrix4(
+            Eigen::Matrix4f(matrices.data() + 16 * j_idx));
+      }
+    }
+  }
+  std::vector<double> joint_weights(joints.size(), 0);
+  for (const auto &mesh : model.meshes) {
+    SkeletonLod::AccumulateJointWeights(model, buffers, mesh, joint_weights);
+  }
+  writer.WriteVector(joints);
+  writer.WriteVector(invbindmats);
+  writer.WriteVector(joint_weights);
+}
+
+void WriteBounds(const tinygltf::Model &model,
+                 const std::vector<BufferSpan> &buffers, BinaryWriter &writer) {
+  std::vector<AABB> mesh_bounds;
+  for (const auto &mesh : model.meshes) {
+    mesh_bounds.push_back(Bounds::GetMeshBounds(model, buffers, mesh));
+  }
+  std::vector<AABB> joint_bounds;
+  if (!model.skins.empty()) {
+    joint_bounds.assign(model.skins[0].joints.size(), AABB());
+    for (const auto &mesh : model.meshes) {
+      Bounds::ExtendJointBounds(model, buffers, mesh, joint_bounds);
+    }
+  }
+  writer.WriteVector(mesh_bounds);
+  writer.WriteVector(joint_bounds);
+}
+
+void WriteAnimations(const tinygltf::Model &model,
+                     const std::vector<BufferSpan> &buffers,
+                     BinaryWriter &writer) {
+  writer.Write(static_cast<uint32_t>(model.animations.size()));
+  for (size_t a_idx = 0; a_idx < model.animations.size(); ++a_idx) {
+    AnimationClip clip;
+    clip.Init(model, buffers, a_idx);
+    clip.Serialize(writer);
+  }
+}
+
+// FileHeader::source_size and source_mtime of path.
+bool GetSourceStamp(const std::string &path, uint64_t &size, int64_t &mtime) {
+  struct stat file_stat;
+  if (stat(path.c_str(), &file_stat) != 0) {
+    return false;
+  }
+  size = file_stat.st_size;
+  mtime = file_stat.st_mtime;
+  return true;
+}
+
+} // namespace
+
+bool IsCookedPath(const std::string &path) {
+  if (path.size() < 4) {
+    return false;
+  }
+  std::string ext = path.substr(path.size() - 4);
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  return ext == ".sac";
+}
+
+std::string GetCookedPath(const std::string &model_path) {
+  const size_t dot_pos = model_path.find_last_of('.');
+  const size_t dir_pos = model_path.find_last_of("/\\");
+  if (dot_pos == std::string::npos ||
+      (dir_pos != std::string::npos && dot_pos < dir_pos)) {
+    return model_path + ".sac";
+  }
+  return model_path.substr(0, dot_pos) + ".sac";
+}
+
+bool IsUpToDate(const std::string &cooked_path,
+                const std::string &model_path) {
+  MappedFile file;
+  uint64_t source_size = 0;
+  int64_t source_mtime = 0;
+  if (!file.Open(cooked_path) ||
+      !GetSourceStamp(model_path, source_size, source_mtime)) {
+    return false;
+  }
+  BinaryReader reader(file.GetData(), file.GetSize());
+  const FileHeader header = reader.Read<FileHeader>();
+  return !reader.IsFailed() && header.magic == kMagic &&
+         header.version == kVersion && header.source_size == source_size &&
+         header.source_mtime == source_mtime;
+}
+
+bool Cook(const std::string &model_path, const std::string &cooked_path) {
+  return Cook(model_path, cooked_path, CookOptions());
+}
+
+bool Cook(const std::string &model_path, const std::string &cooked_path,
+          const CookOptions &options) {
+  tinygltf::Model model;
+  GLTFLoader loader;
+  if (!loader.Load(model_path, true, model)) {
+    LOG(WARNING) << "Cook: load " << model_path << " failed.";
+    return false;
+  }
+  const auto &buffers = loader.GetBufferSpans();
+
+  BinaryWriter writer;
+  FileHeader header;
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.flags = (model.textures.empty() ? 0 : FLAG_HAS_TEXTURE) |
+                 (model.skins.empty() ? 0 : FLAG_SKINNED);
+  header.reserved = 0;
+  header.source_size = 0;
+  header.source_mtime = 0;
+  GetSourceStamp(model_path, header.source_size, header.source_mtime);
+  writer.Write(header);
+  WriteTextures(model, writer);
+  WriteMeshes(model, buffers, options, writer);
+  WriteNodes(model, writer);
+  WriteSkin(model, buffers, writer);
+  WriteBounds(model, buffers, writer);
+  WriteAnimations(model, buffers, writer);
+
+  if (!writer.SaveToFile(cooked_path)) {
+    LOG(WARNING) << "Cook: write " << cooked_path << " failed.";
+    return false;
+  }
+  LOG(INFO) << "Cook " << model_path << " -> " << cooked_path << ", "
+            << writer.GetData().size() << " bytes.";
+  return true;
+}
+
+} // namespace CookedModel
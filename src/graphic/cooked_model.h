@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Cooked model, a binary file holding what Model::Init builds from a gltf:
+// interleaved vertex streams, index buffers, decoded texture mips, compiled
+// animation clips and the node tables. sa_cook writes it, Model::Init maps it
+// and hands the streams to GL without parsing.
+//
+// Layout, every section is 4 bytes aligned(see BinaryWriter):
+//   FileHeader
+//   textures: uint32 num, per texture TextureHeader then level_num x
+//     (LevelHeader, pixel blob)
+//   meshes: uint32 num, per mesh uint32 primitive num, per primitive
+//     PrimitiveHeader, VertexAttrib vector, vertex blob, index blob
+//   nodes: uint32 num, names, parent/mesh vectors, TRS vectors, children
+//     vector per node, scene root vector
+//   skin: joint vector, inverse bind matrix vector, joint weight vector(see
+//     SkeletonLod)
+//   bounds: mesh AABB vector, joint AABB vector(see Bounds)
+//   animations: uint32 num, AnimationClip::Serialize each
+namespace CookedModel {
+
+constexpr uint32_t kMagic = 0x4B434153; // "SACK"
+// Bump it whenever the layout changes, older files are rejected.
+constexpr uint32_t kVersion = 4;
+
+enum Flags { FLAG_HAS_TEXTURE = 1, FLAG_SKINNED = 2 };
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t reserved;
+  // Size and modification time(seconds) of the .gltf or .glb file when it
+  // was cooked, see IsUpToDate. The external buffers and images aren't
+  // tracked.
+  uint64_t source_size;
+  int64_t source_mtime;
+};
+
+// Levels are GL_RGBA/GL_UNSIGNED_BYTE, level 0 first.
+struct TextureHeader {
+  uint32_t min_filter;
+  uint32_t mag_filter;
+  uint32_t wrap_s;
+  uint32_t wrap_t;
+  uint32_t level_num;
+};
+
+struct LevelHeader {
+  uint32_t width;
+  uint32_t height;
+};
+
+// Same meaning as the glVertexAttribPointer arguments.
+struct VertexAttrib {
+  uint32_t location;
+  uint32_t size;
+  uint32_t type;
+  uint32_t normalized;
+  uint32_t offset;
+};
+
+struct PrimitiveHeader {
+  uint32_t mode;
+  uint32_t vertex_num;
+  uint32_t stride;
+  // 0 for glDrawArrays.
+  uint32_t index_type;
+  uint32_t index_num;
+  // -1 for none.
+  int32_t texture_idx;
+  float color[4];
+};
+
+struct CookOptions {
+  // Weld the vertices of the triangle lists, then reorder them for the
+  // vertex cache and the vertex fetch, see MeshOptimizer.
+  bool optimize_meshes = true;
+  // Also sort the triangle clusters front to back, for less overdraw.
+  bool optimize_overdraw = true;
+};
+
+// ".sac" files are cooked models.
+bool IsCookedPath(const std::string &path);
+// model_path with the extension replaced by ".sac".
+std::string GetCookedPath(const std::string &model_path);
+// Whether cooked_path is a cooked model of the current version, cooked from
+// model_path as it is now. A stale cooked model shows an older gltf.
+bool IsUpToDate(const std::string &cooked_path, const std::string &model_path);
+// Cook a .gltf or .glb file, no GL context needed.
+bool Cook(const std::string &model_path, const std::string &cooked_path);
+bool Cook(const std::string &model_path, const std::string &cooked_path,
+          const CookOptions &options);
+
+} // namespace CookedModel
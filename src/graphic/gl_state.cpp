@@ -0,0 +1,161 @@
+#include "graphic/gl_state.h"
+#include "common/logging.h"
+
+constexpr int GLStateCache::kMaxTextureUnits;
+constexpr int GLStateCache::kMaxUniformBindings;
+
+bool IsGLVersionAtLeast(int major, int minor) {
+  GLint cur_major = 0;
+  GLint cur_minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &cur_major);
+  glGetIntegerv(GL_MINOR_VERSION, &cur_minor);
+  return cur_major > major || (cur_major == major && cur_minor >= minor);
+}
+
+void GLStateCache::Invalidate() {
+  program_ = -1;
+  vao_ = -1;
+  draw_indirect_buffer_ = -1;
+  active_unit_ = -1;
+  for (int u_idx = 0; u_idx < kMaxTextureUnits; ++u_idx) {
+    textures_2d_[u_idx] = -1;
+    texture_buffers_[u_idx] = -1;
+    samplers_[u_idx] = -1;
+  }
+  for (int b_idx = 0; b_idx < kMaxUniformBindings; ++b_idx) {
+    uniform_buffers_[b_idx] = -1;
+    storage_buffers_[b_idx] = -1;
+  }
+  for (int c_idx = 0; c_idx < CAP_NUM; ++c_idx) {
+    capabilities_[c_idx] = -1;
+  }
+}
+
+void GLStateCache::UseProgram(GLuint program) {
+  if (program_ == static_cast<GLint>(program)) {
+    ++stats_.elided;
+    return;
+  }
+  glUseProgram(program);
+  program_ = program;
+  ++stats_.issued;
+}
+
+void GLStateCache::BindVertexArray(GLuint vao) {
+  if (vao_ == static_cast<GLint>(vao)) {
+    ++stats_.elided;
+    return;
+  }
+  glBindVertexArray(vao);
+  vao_ = vao;
+  ++stats_.issued;
+}
+
+void GLStateCache::ActiveTexture(GLuint unit) {
+  if (active_unit_ == static_cast<GLint>(unit)) {
+    ++stats_.elided;
+    return;
+  }
+  glActiveTexture(GL_TEXTURE0 + unit);
+  active_unit_ = unit;
+  ++stats_.issued;
+}
+
+void GLStateCache::BindTexture(GLuint unit, GLenum target, GLuint texture) {
+  CHECK(unit < kMaxTextureUnits) << "texture unit " << unit
+                                 << " is beyond the state cache.";
+  GLint *bound = nullptr;
+  if (target == GL_TEXTURE_2D) {
+    bound = &textures_2d_[unit];
+  } else if (target == GL_TEXTURE_BUFFER) {
+    bound = &texture_buffers_[unit];
+  }
+  if (bound && *bound == static_cast<GLint>(texture)) {
+    ++stats_.elided;
+    return;
+  }
+  ActiveTexture(unit);
+  glBindTexture(target, texture);
+  if (bound) {
+    *bound = texture;
+  }
+  ++stats_.issued;
+}
+
+void GLStateCache::BindSampler(GLuint unit, GLuint sampler) {
+  CHECK(unit < kMaxTextureUnits) << "texture unit " << unit
+                                 << " is beyond the state cache.";
+  if (samplers_[unit] == static_cast<GLint>(sampler)) {
+    ++stats_.elided;
+    return;
+  }
+  glBindSampler(unit, sampler);
+  samplers_[unit] = sampler;
+  ++stats_.issued;
+}
+
+void GLStateCache::BindUniformBuffer(GLuint binding, GLuint buffer) {
+  CHECK(binding < kMaxUniformBindings) << "uniform binding " << binding
+                                       << " is beyond the state cache.";
+  if (uniform_buffers_[binding] == static_cast<GLint>(buffer)) {
+    ++stats_.elided;
+    return;
+  }
+  glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+  uniform_buffers_[binding] = buffer;
+  ++stats_.issued;
+}
+
+void GLStateCache::BindStorageBuffer(GLuint binding, GLuint buffer) {
+  CHECK(binding < kMaxUniformBindings) << "storage binding " << binding
+                                       << " is beyond the state cache.";
+  if (storage_buffers_[binding] == static_cast<GLint>(buffer)) {
+    ++stats_.elided;
+    return;
+  }
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+  storage_buffers_[binding] = buffer;
+  ++stats_.issued;
+}
+
+void GLStateCache::BindDrawIndirectBuffer(GLuint buffer) {
+  if (draw_indirect_buffer_ == static_cast<GLint>(buffer)) {
+    ++stats_.elided;
+    return;
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+  draw_indirect_buffer_ = buffer;
+  ++stats_.issued;
+}
+
+int GLStateCache::GetCapabilityIndex(GLenum cap) const {
+  switch (cap) {
+  case GL_DEPTH_TEST:
+    return CAP_DEPTH_TEST;
+  case GL_MULTISAMPLE:
+    return CAP_MULTISAMPLE;
+  case GL_CULL_FACE:
+    return CAP_CULL_FACE;
+  case GL_BLEND:
+    return CAP_BLEND;
+  default:
+    return -1;
+  }
+}
+
+void GLStateCache::SetEnabled(GLenum cap, bool enabled) {
+  const int cap_idx = GetCapabilityIndex(cap);
+  if (cap_idx != -1 && capabilities_[cap_idx] == (enabled ? 1 : 0)) {
+    ++stats_.elided;
+    return;
+  }
+  if (enabled) {
+    glEnable(cap);
+  } else {
+    glDisable(cap);
+  }
+  if (cap_idx != -1) {
+    capabilities_[cap_idx] = enabled ? 1 : 0;
+  }
+  ++stats_.issued;
+}
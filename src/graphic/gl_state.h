@@ -0,0 +1,71 @@
+#pragma once
+
+#include <GL/gl3w.h>
+
+// Version of the current context, e.g. (4, 3) for the multi draw indirect
+// path. Only valid once the context is current.
+bool IsGLVersionAtLeast(int major, int minor);
+
+// Shadow of the GL binding state, a call is only issued when the value
+// changes. Anything touching GL outside the cache(e.g. the imgui renderer)
+// makes the shadow stale, call Invalidate before using the cache again.
+class GLStateCache {
+public:
+  static constexpr int kMaxTextureUnits = 16;
+  static constexpr int kMaxUniformBindings = 8;
+
+  struct Stats {
+    int issued = 0;
+    int elided = 0;
+  };
+
+  GLStateCache() { Invalidate(); }
+
+  // Forget the shadowed state, the next calls are always issued.
+  void Invalidate();
+  // Reset the per frame stats.
+  void ResetStats() { stats_ = Stats(); }
+  const Stats &GetStats() const { return stats_; }
+
+  void UseProgram(GLuint program);
+  void BindVertexArray(GLuint vao);
+  // Only GL_TEXTURE_2D and GL_TEXTURE_BUFFER are shadowed.
+  void BindTexture(GLuint unit, GLenum target, GLuint texture);
+  void BindSampler(GLuint unit, GLuint sampler);
+  void BindUniformBuffer(GLuint binding, GLuint buffer);
+  // GL 4.3+ only.
+  void BindStorageBuffer(GLuint binding, GLuint buffer);
+  void BindDrawIndirectBuffer(GLuint buffer);
+  // Only GL_DEPTH_TEST, GL_MULTISAMPLE, GL_CULL_FACE and GL_BLEND are
+  // shadowed, the others are always issued.
+  void SetEnabled(GLenum cap, bool enabled);
+
+  // Count a call issued by the caller itself, e.g. draw calls and uniforms.
+  void CountIssued(int num = 1) { stats_.issued += num; }
+  void CountElided(int num = 1) { stats_.elided += num; }
+
+private:
+  enum Capability {
+    CAP_DEPTH_TEST = 0,
+    CAP_MULTISAMPLE,
+    CAP_CULL_FACE,
+    CAP_BLEND,
+    CAP_NUM
+  };
+  // -1 means unknown.
+  int GetCapabilityIndex(GLenum cap) const;
+  void ActiveTexture(GLuint unit);
+
+  GLint program_;
+  GLint vao_;
+  GLint active_unit_;
+  GLint textures_2d_[kMaxTextureUnits];
+  GLint texture_buffers_[kMaxTextureUnits];
+  GLint samplers_[kMaxTextureUnits];
+  GLint uniform_buffers_[kMaxUniformBindings];
+  GLint storage_buffers_[kMaxUniformBindings];
+  GLint draw_indirect_buffer_;
+  // 0 disabled, 1 enabled, -1 unknown.
+  int capabilities_[CAP_NUM];
+  Stats stats_;
+};
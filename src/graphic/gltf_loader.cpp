@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <json.hpp>
+
+#include "common/logging.h"
+#include "graphic/gltf_loader.h"
+
+namespace {
+
+constexpr uint32_t kGlbMagic = 0x46546C67;     // "glTF"
+constexpr uint32_t kGlbChunkJson = 0x4E4F534A; // "JSON"
+constexpr uint32_t kGlbChunkBin = 0x004E4942;  // "BIN\0"
+// One zero byte, replaces the mapped buffers in the json given to tinygltf.
+const char kStandInUri[] = "data:application/octet-stream;base64,AA==";
+
+uint32_t ReadUint32(const uint8_t *ptr) {
+  uint32_t value = 0;
+  std::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+bool HasGlbExtension(const std::string &path) {
+  if (path.size() < 4) {
+    return false;
+  }
+  std::string ext = path.substr(path.size() - 4);
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+  return ext == ".glb";
+}
+
+std::string GetBaseDir(const std::string &path) {
+  size_t pos = path.find_last_of("/\\");
+  return pos == std::string::npos ? std::string() : path.substr(0, pos + 1);
+}
+
+// Percent decoding of the relative uris, e.g. "my%20mesh.bin".
+std::string DecodeUri(const std::string &uri) {
+  std::string result;
+  for (size_t c_idx = 0; c_idx < uri.size(); ++c_idx) {
+    if (uri[c_idx] == '%' && c_idx + 2 < uri.size() &&
+        std::isxdigit(uri[c_idx + 1]) && std::isxdigit(uri[c_idx + 2])) {
+      result += static_cast<char>(std::stoi(uri.substr(c_idx + 1, 2), 0, 16));
+      c_idx += 2;
+    } else {
+      result += uri[c_idx];
+    }
+  }
+  return result;
+}
+
+} // namespace
+
+bool GLTFLoader::Load(const std::string &path, bool map_buffers,
+                      tinygltf::Model &model, bool defer_images) {
+  Release();
+  defer_images_ = defer_images;
+  const bool is_binary = HasGlbExtension(path);
+  tinygltf::TinyGLTF gltf_ctx;
+  gltf_ctx.SetImageLoader(&GLTFLoader::LoadImage, this);
+  std::string err;
+  std::string warn;
+  bool ret = false;
+  if (map_buffers) {
+    ret = LoadMapped(gltf_ctx, path, GetBaseDir(path), is_binary, model, err,
+                     warn);
+  } else if (is_binary) {
+    ret = gltf_ctx.LoadBinaryFromFile(&model, &err, &warn, path);
+  } else {
+    ret = gltf_ctx.LoadASCIIFromFile(&model, &err, &warn, path);
+  }
+
+  if (!err.empty()) {
+    LOG(WARNING) << err;
+  }
+  if (!warn.empty()) {
+    LOG(WARNING) << warn;
+  }
+  if (!ret) {
+    Release();
+    return false;
+  }
+
+  // The buffers tinygltf loaded itself.
+  buffer_spans_.resize(model.buffers.size());
+  for (size_t b_idx = 0; b_idx < model.buffers.size(); ++b_idx) {
+    if (!buffer_spans_[b_idx].data) {
+      buffer_spans_[b_idx].data = model.buffers[b_idx].data.data();
+      buffer_spans_[b_idx].size = model.buffers[b_idx].data.size();
+    }
+  }
+  LOG(INFO) << "Load " << path << ": " << model.buffers.size()
+            << " buffers, " << mapped_byte_size_ << " bytes mapped.";
+  return true;
+}
+
+bool GLTFLoader::LoadMapped(tinygltf::TinyGLTF &gltf_ctx,
+                            const std::string &path,
+                            const std::string &base_dir, bool is_binary,
+                            tinygltf::Model &model, std::string &err,
+                            std::string &warn) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    err = "Can't map " + path;
+    return false;
+  }
+
+  const char *json_data = reinterpret_cast<const char *>(file.GetData());
+  size_t json_size = file.GetSize();
+  const uint8_t *bin_data = nullptr;
+  size_t bin_size = 0;
+  if (is_binary) {
+    // 12 bytes header, then the json chunk and the optional binary chunk.
+    const uint8_t *data = file.GetData();
+    const size_t size = file.GetSize();
+    if (size < 20 || ReadUint32(data) != kGlbMagic ||
+        ReadUint32(data + 16) != kGlbChunkJson) {
+      err = "Invalid glb header: " + path;
+      return false;
+    }
+    json_size = ReadUint32(data + 12);
+    json_data = reinterpret_cast<const char *>(data + 20);
+    if (20 + json_size > size) {
+      err = "Invalid glb json chunk: " + path;
+      return false;
+    }
+    const size_t bin_chunk = 20 + json_size;
+    if (bin_chunk + 8 <= size &&
+        ReadUint32(data + bin_chunk + 4) == kGlbChunkBin) {
+      bin_size = std::min<size_t>(ReadUint32(data + bin_chunk),
+                                  size - bin_chunk - 8);
+      bin_data = data + bin_chunk + 8;
+    }
+  }
+
+  nlohmann::json doc =
+      nlohmann::json::parse(json_data, json_data + json_size, nullptr, false);
+  if (doc.is_discarded()) {
+    err = "Invalid json: " + path;
+    return false;
+  }
+
+  // Map the buffers and hide them from tinygltf. Anything unusual(data
+  // uris, missing files, bad sizes) is left to tinygltf and its errors.
+  bool use_glb_mapping = false;
+  std::vector<std::string> mapped_uris;
+  if (doc.count("buffers") && doc["buffers"].is_array()) {
+    auto &buffers = doc["buffers"];
+    buffer_spans_.assign(buffers.size(), BufferSpan());
+    mapped_uris.resize(buffers.size());
+    for (size_t b_idx = 0; b_idx < buffers.size(); ++b_idx) {
+      auto &buffer = buffers[b_idx];
+      const size_t byte_length = buffer.value("byteLength", size_t(0));
+      if (byte_length == 0) {
+        continue;
+      }
+      BufferSpan &span = buffer_spans_[b_idx];
+      if (!buffer.count("uri")) {
+        // The binary chunk of the glb.
+        if (b_idx != 0 || !bin_data || byte_length > bin_size) {
+          continue;
+        }
+        span.data = bin_data;
+        use_glb_mapping = true;
+      } else {
+        const std::string uri = buffer["uri"].get<std::string>();
+        if (uri.compare(0, 5, "data:") == 0) {
+          continue;
+        }
+        MappedFile bin_file;
+        if (!bin_file.Open(base_dir + DecodeUri(uri)) ||
+            bin_file.GetSize() < byte_length) {
+          continue;
+        }
+        span.data = bin_file.GetData();
+        mapped_uris[b_idx] = uri;
+        mapped_files_.push_back(std::move(bin_file));
+      }
+      span.size = byte_length;
+      mapped_byte_size_ += byte_length;
+      buffer["uri"] = kStandInUri;
+      buffer["byteLength"] = 1;
+    }
+  }
+
+  // The images stored in the mapped buffers are decoded by LoadImage from
+  // the mapping.
+  struct ImageSource {
+    int image_idx;
+    int view_idx;
+    std::string mime_type;
+  };
+  std::vector<ImageSource> image_sources;
+  if (doc.count("images") && doc["images"].is_array() &&
+      doc.count("bufferViews")) {
+    auto &images = doc["images"];
+    const auto &buffer_views = doc["bufferViews"];
+    for (size_t i_idx = 0; i_idx < images.size(); ++i_idx) {
+      auto &image = images[i_idx];
+      if (!image.count("bufferView")) {
+        continue;
+      }
+      const size_t view_idx = image["bufferView"].get<size_t>();
+      if (view_idx >= buffer_views.size()) {
+        continue;
+      }
+      const auto &buffer_view = buffer_views[view_idx];
+      const size_t buffer_idx = buffer_view.value("buffer", size_t(0));
+      const size_t byte_offset = buffer_view.value("byteOffset", size_t(0));
+      const size_t byte_length = buffer_view.value("byteLength", size_t(0));
+      if (buffer_idx >= buffer_spans_.size() ||
+          !buffer_spans_[buffer_idx].data ||
+          byte_offset + byte_length > buffer_spans_[buffer_idx].size) {
+        continue;
+      }
+      BufferSpan &span = mapped_images_[i_idx];
+      span.data = buffer_spans_[buffer_idx].data + byte_offset;
+      span.size = byte_length;
+      image_sources.push_back(
+          {int(i_idx), int(view_idx), image.value("mimeType", "")});
+      image.erase("bufferView");
+      image["uri"] = kStandInUri;
+    }
+  }
+
+  const std::string json_text = doc.dump();
+  bool ret = gltf_ctx.LoadASCIIFromString(&model, &err, &warn,
+                                          json_text.c_str(), json_text.size(),
+                                          base_dir);
+  if (use_glb_mapping) {
+    mapped_files_.push_back(std::move(file));
+  }
+  if (!ret) {
+    return false;
+  }
+
+  // Restore what the stand-ins replaced.
+  for (size_t b_idx = 0; b_idx < buffer_spans_.size(); ++b_idx) {
+    if (buffer_spans_[b_idx].data) {
+      auto &buffer = model.buffers[b_idx];
+      buffer.uri = mapped_uris[b_idx];
+      std::vector<unsigned char>().swap(buffer.data);
+    }
+  }
+  for (const auto &image_source : image_sources) {
+    auto &image = model.images[image_source.image_idx];
+    image.bufferView = image_source.view_idx;
+    image.uri.clear();
+    image.mimeType = image_source.mime_type;
+  }
+  return true;
+}
+
+bool GLTFLoader::LoadImage(tinygltf::Image *image, const int image_idx,
+                           std::string *err, std::string *warn, int req_width,
+                           int req_height, const unsigned char *bytes,
+                           int size, void *user_data) {
+  GLTFLoader *loader = static_cast<GLTFLoader *>(user_data);
+  auto iter = loader->mapped_images_.find(image_idx);
+  if (iter != loader->mapped_images_.end()) {
+    bytes = iter->second.data;
+    size = iter->second.size;
+  }
+  if (loader->defer_images_) {
+    // The bytes given by tinygltf only live during the call.
+    if (iter == loader->mapped_images_.end()) {
+      std::vector<uint8_t> &owned = loader->owned_images_[image_idx];
+      owned.assign(bytes, bytes + size);
+      BufferSpan &span = loader->mapped_images_[image_idx];
+      span.data = owned.data();
+      span.size = owned.size();
+    }
+    loader->deferred_images_.push_back(image_idx);
+    return true;
+  }
+  return tinygltf::LoadImageData(image, image_idx, err, warn, req_width,
+                                 req_height, bytes, size, nullptr);
+}
+
+bool GLTFLoader::DecodeImage(int image_idx, tinygltf::Image &image) const {
+  auto iter = mapped_images_.find(image_idx);
+  CHECK(iter != mapped_images_.end())
+      << "image " << image_idx << " isn't deferred.";
+  std::string err;
+  std::string warn;
+  bool ret = tinygltf::LoadImageData(&image, image_idx, &err, &warn, 0, 0,
+                                     iter->second.data, iter->second.size,
+                                     nullptr);
+  if (!err.empty()) {
+    LOG(WARNING) << err;
+  }
+  if (!warn.empty()) {
+    LOG(WARNING) << warn;
+  }
+  return ret;
+}
+
+void GLTFLoader::Release() {
+  mapped_files_.clear();
+  buffer_spans_.clear();
+  mapped_images_.clear();
+  owned_images_.clear();
+  deferred_images_.clear();
+  mapped_byte_size_ = 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tiny_gltf.h>
+#include <vector>
+
+#include "common/mapped_file.h"
+
+// Bytes of one gltf buffer.
+struct BufferSpan {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+};
+
+// Load .gltf and .glb files. tinygltf copies every buffer into
+// tinygltf::Buffer::data, with map_buffers the .glb binary chunk and the
+// external .bin files are mapped instead, and tinygltf only sees a one byte
+// stand-in for them. Read the buffers through GetBufferSpans, the mapped
+// ones are empty in the model. Embedded data uris are still decoded by
+// tinygltf. With defer_images the images are kept encoded, DecodeImage
+// decodes them later, e.g. on worker threads.
+class GLTFLoader {
+public:
+  GLTFLoader() = default;
+  GLTFLoader(const GLTFLoader &rhs) = delete;
+  GLTFLoader &operator=(const GLTFLoader &rhs) = delete;
+
+  bool Load(const std::string &path, bool map_buffers, tinygltf::Model &model,
+            bool defer_images = false);
+  // One span per model.buffers, valid until Release.
+  const std::vector<BufferSpan> &GetBufferSpans() const {
+    return buffer_spans_;
+  }
+  // Bytes read through the mappings instead of copied.
+  size_t GetMappedByteSize() const { return mapped_byte_size_; }
+  // Images left encoded by a deferred Load.
+  const std::vector<int> &GetDeferredImages() const {
+    return deferred_images_;
+  }
+  // Decode a deferred image, thread safe for different images.
+  bool DecodeImage(int image_idx, tinygltf::Image &image) const;
+  // Unmap the files, call it once the buffers are uploaded and decoded.
+  void Release();
+
+private:
+  bool LoadMapped(tinygltf::TinyGLTF &gltf_ctx, const std::string &path,
+                  const std::string &base_dir, bool is_binary,
+                  tinygltf::Model &model, std::string &err, std::string &warn);
+  // tinygltf image loader, decodes the images of the mapped buffers from the
+  // mapping instead of the stand-in.
+  static bool LoadImage(tinygltf::Image *image, const int image_idx,
+                        std::string *err, std::string *warn, int req_width,
+                        int req_height, const unsigned char *bytes, int size,
+                        void *user_data);
+
+  std::vector<MappedFile> mapped_files_;
+  std::vector<BufferSpan> buffer_spans_;
+  // image index -> encoded bytes in a mapped buffer, or in owned_images_
+  // for the deferred images tinygltf read itself.
+  std::map<int, BufferSpan> mapped_images_;
+  std::map<int, std::vector<uint8_t>> owned_images_;
+  bool defer_images_ = false;
+  std::vector<int> deferred_images_;
+  size_t mapped_byte_size_ = 0;
+};
@@ -0,0 +1,85 @@
+#include "common/logging.h"
+#include "graphic/gpu_resource_cache.h"
+
+GPUResourceCache &GPUResourceCache::GetShared() {
+  static GPUResourceCache cache;
+  return cache;
+}
+
+GLuint GPUResourceCache::Acquire(
+    const Key &key, const std::function<GLuint(size_t &byte_size)> &create) {
+  auto iter = resources_.find(key);
+  if (iter != resources_.end()) {
+    ++iter->second.ref_num;
+    ++stats_.hits;
+    return iter->second.id;
+  }
+
+  Entry entry;
+  entry.id = create(entry.byte_size);
+  CHECK(entry.id != 0) << "Create GPU resource " << key.index << " of "
+                       << key.asset << " failed.";
+  entry.ref_num = 1;
+  resources_[key] = entry;
+  ++stats_.misses;
+  if (key.type == RESOURCE_TEXTURE) {
+    ++stats_.texture_num;
+  } else {
+    ++stats_.buffer_num;
+  }
+  stats_.resident_bytes += entry.byte_size;
+  return entry.id;
+}
+
+void GPUResourceCache::Release(const Key &key) {
+  auto iter = resources_.find(key);
+  if (iter == resources_.end()) {
+    return;
+  }
+  if (--iter->second.ref_num > 0) {
+    return;
+  }
+  Delete(key.type, iter->second);
+  resources_.erase(iter);
+}
+
+GLuint GPUResourceCache::GetSampler(GLint min_filter, GLint mag_filter,
+                                    GLint wrap_s, GLint wrap_t) {
+  const auto key = std::make_tuple(min_filter, mag_filter, wrap_s, wrap_t);
+  auto iter = samplers_.find(key);
+  if (iter != samplers_.end()) {
+    return iter->second;
+  }
+  GLuint sampler = 0;
+  glGenSamplers(1, &sampler);
+  glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, min_filter);
+  glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, mag_filter);
+  glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, wrap_s);
+  glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, wrap_t);
+  samplers_[key] = sampler;
+  ++stats_.sampler_num;
+  return sampler;
+}
+
+void GPUResourceCache::Clear() {
+  for (const auto &resource : resources_) {
+    Delete(resource.first.type, resource.second);
+  }
+  resources_.clear();
+  for (const auto &sampler : samplers_) {
+    glDeleteSamplers(1, &sampler.second);
+  }
+  samplers_.clear();
+  stats_ = Stats();
+}
+
+void GPUResourceCache::Delete(ResourceType type, const Entry &entry) {
+  if (type == RESOURCE_TEXTURE) {
+    glDeleteTextures(1, &entry.id);
+    --stats_.texture_num;
+  } else {
+    glDeleteBuffers(1, &entry.id);
+    --stats_.buffer_num;
+  }
+  stats_.resident_bytes -= entry.byte_size;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <GL/gl3w.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <tuple>
+
+// GL textures and buffers shared by the models loading the same asset, and
+// sampler objects shared by everything. The textures and buffers are
+// reference counted and deleted with their last reference, the samplers live
+// until Clear. GL thread only.
+class GPUResourceCache {
+public:
+  // RESOURCE_COMPACT_BUFFER is a buffer of VertexCompaction, indexed by the
+  // source accessor. RESOURCE_BATCH_BUFFER is a buffer of StaticBatcher.
+  // RESOURCE_ARENA_BUFFER is a static buffer of the multi draw arena.
+  // RESOURCE_PACKED_BUFFER is the packed elements of a sparse accessor or of
+  // one without bufferView, indexed by the accessor.
+  enum ResourceType {
+    RESOURCE_TEXTURE = 0,
+    RESOURCE_BUFFER = 1,
+    RESOURCE_COMPACT_BUFFER = 2,
+    RESOURCE_BATCH_BUFFER = 3,
+    RESOURCE_ARENA_BUFFER = 4,
+    RESOURCE_PACKED_BUFFER = 5
+  };
+  struct Key {
+    ResourceType type = RESOURCE_TEXTURE;
+    // e.g. the model path.
+    std::string asset;
+    // e.g. the image or bufferView index.
+    int index = -1;
+
+    bool operator<(const Key &rhs) const {
+      return std::tie(type, asset, index) <
+             std::tie(rhs.type, rhs.asset, rhs.index);
+    }
+  };
+
+  struct Stats {
+    int texture_num = 0;
+    int buffer_num = 0;
+    int sampler_num = 0;
+    // Textures are counted with their mip chain.
+    size_t resident_bytes = 0;
+    // Acquire calls served by the cache and creating the resource.
+    int hits = 0;
+    int misses = 0;
+  };
+
+  GPUResourceCache() = default;
+  GPUResourceCache(const GPUResourceCache &rhs) = delete;
+  GPUResourceCache &operator=(const GPUResourceCache &rhs) = delete;
+
+  static GPUResourceCache &GetShared();
+
+  // Return the resource of key with one more reference. On a miss create
+  // makes it and sets its byte size.
+  GLuint Acquire(const Key &key,
+                 const std::function<GLuint(size_t &byte_size)> &create);
+  // Drop one reference, the resource is deleted with the last one.
+  void Release(const Key &key);
+  GLuint GetSampler(GLint min_filter, GLint mag_filter, GLint wrap_s,
+                    GLint wrap_t);
+  const Stats &GetStats() const { return stats_; }
+  // Delete everything, e.g. before destroying the context. The references
+  // still held are ignored by Release.
+  void Clear();
+
+private:
+  struct Entry {
+    GLuint id = 0;
+    int ref_num = 0;
+    size_t byte_size = 0;
+  };
+  void Delete(ResourceType type, const Entry &entry);
+
+  std::map<Key, Entry> resources_;
+  std::map<std::tuple<GLint, GLint, GLint, GLint>, GLuint> samplers_;
+  Stats stats_;
+};
@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+
+#include <glm/glm.hpp>
+
+#include "common/logging.h"
+#include "graphic/mesh_optimizer.h"
+
+namespace MeshOptimizer {
+
+namespace {
+
+const uint32_t kInvalidIndex = ~0u;
+// Entries of the LRU cache OptimizeVertexCache scores against.
+const int kLRUCacheSize = 32;
+
+// FNV-1a of the vertex bytes.
+uint32_t HashVertex(const uint8_t *vertex, size_t stride) {
+  uint32_t hash = 2166136261u;
+  for (size_t b_idx = 0; b_idx < stride; ++b_idx) {
+    hash = (hash ^ vertex[b_idx]) * 16777619u;
+  }
+  return hash;
+}
+
+// Forsyth's vertex score, cache_pos is -1 outside the cache.
+float VertexScore(int cache_pos, int remaining_num) {
+  if (remaining_num == 0) {
+    return -1.f;
+  }
+  float score = 0.f;
+  if (cache_pos >= 0) {
+    // The vertices of the last triangle get a fixed score, so it doesn't
+    // matter which of them the next triangle uses.
+    score = cache_pos < 3
+                ? 0.75f
+                : std::pow(1.f - float(cache_pos - 3) / (kLRUCacheSize - 3),
+                           1.5f);
+  }
+  // Favor the vertices with few triangles left, to finish them off.
+  return score + 2.f / std::sqrt(float(remaining_num));
+}
+
+glm::vec3 GetPosition(const uint8_t *positions, size_t stride,
+                      uint32_t index) {
+  glm::vec3 position;
+  std::memcpy(&position[0], positions + index * stride, sizeof(position));
+  return position;
+}
+
+} // namespace
+
+float CacheStats::GetACMR() const {
+  return triangle_num ? float(transform_num) / triangle_num : 0.f;
+}
+
+float CacheStats::GetATVR() const {
+  return vertex_num ? float(transform_num) / vertex_num : 0.f;
+}
+
+void CacheStats::Add(const CacheStats &rhs) {
+  triangle_num += rhs.triangle_num;
+  vertex_num += rhs.vertex_num;
+  transform_num += rhs.transform_num;
+}
+
+std::string CacheStats::ToString() const {
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(3) << "ACMR " << GetACMR()
+      << ", ATVR " << GetATVR() << ", " << triangle_num << " triangles, "
+      << vertex_num << " vertices";
+  return oss.str();
+}
+
+CacheStats AnalyzeVertexCache(const std::vector<uint32_t> &indices,
+                              size_t vertex_num, int cache_size) {
+  CacheStats stats;
+  stats.triangle_num = indices.size() / 3;
+  stats.vertex_num = vertex_num;
+  // Time stamp of the last miss per vertex, a FIFO hit is a miss newer
+  // than cache_size misses.
+  std::vector<size_t> miss_stamps(vertex_num, 0);
+  size_t stamp = cache_size + 1;
+  for (uint32_t index : indices) {
+    if (stamp - miss_stamps[index] > size_t(cache_size)) {
+      miss_stamps[index] = stamp++;
+      ++stats.transform_num;
+    }
+  }
+  return stats;
+}
+
+size_t WeldVertices(std::vector<uint8_t> &vertices, size_t stride,
+                    std::vector<uint32_t> &indices) {
+  const size_t vertex_num = vertices.size() / stride;
+  if (indices.empty()) {
+    indices.resize(vertex_num);
+    std::iota(indices.begin(), indices.end(), 0);
+  }
+  // Open addressing on the vertex bytes, at most half full.
+  size_t table_size = 1;
+  while (table_size < 2 * vertex_num) {
+    table_size *= 2;
+  }
+  std::vector<uint32_t> table(table_size, kInvalidIndex);
+  std::vector<uint32_t> remap(vertex_num);
+  size_t welded_num = 0;
+  for (size_t v_idx = 0; v_idx < vertex_num; ++v_idx) {
+    const uint8_t *vertex = &vertices[v_idx * stride];
+    size_t slot = HashVertex(vertex, stride) & (table_size - 1);
+    while (table[slot] != kInvalidIndex &&
+           std::memcmp(&vertices[table[slot] * stride], vertex, stride) != 0) {
+      slot = (slot + 1) & (table_size - 1);
+    }
+    if (table[slot] == kInvalidIndex) {
+      // Move the first vertex of the group down, the slot stores the new
+      // index so the later duplicates compare against the moved bytes.
+      if (welded_num != v_idx) {
+        std::memcpy(&vertices[welded_num * stride], vertex, stride);
+      }
+      table[slot] = welded_num++;
+    }
+    remap[v_idx] = table[slot];
+  }
+  for (auto &index : indices) {
+    index = remap[index];
+  }
+  vertices.resize(welded_num * stride);
+  return welded_num;
+}
+
+void OptimizeVertexCache(std::vector<uint32_t> &indices, size_t vertex_num) {
+  const size_t triangle_num = indices.size() / 3;
+  if (triangle_num == 0) {
+    return;
+  }
+  // Triangles of every vertex, the live ones first.
+  std::vector<int> remaining_nums(vertex_num, 0);
+  for (uint32_t index : indices) {
+    ++remaining_nums[index];
+  }
+  std::vector<size_t> offsets(vertex_num + 1, 0);
+  for (size_t v_idx = 0; v_idx < vertex_num; ++v_idx) {
+    offsets[v_idx + 1] = offsets[v_idx] + remaining_nums[v_idx];
+  }
+  std::vector<uint32_t> vertex_triangles(indices.size());
+  std::vector<size_t> fill_offsets(offsets.begin(), offsets.end() - 1);
+  for (size_t t_idx = 0; t_idx < triangle_num; ++t_idx) {
+    for (int c_idx = 0; c_idx < 3; ++c_idx) {
+      vertex_triangles[fill_offsets[indices[3 * t_idx + c_idx]]++] = t_idx;
+    }
+  }
+
+  std::vector<int> cache_positions(vertex_num, -1);
+  std::vector<float> vertex_scores(vertex_num);
+  for (size_t v_idx = 0; v_idx < vertex_num; ++v_idx) {
+    vertex_scores[v_idx] = VertexScore(-1, remaining_nums[v_idx]);
+  }
+  std::vector<bool> emitted(triangle_num, false);
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  // Most recent first, the last 3 entries are just evicted.
+  std::vector<uint32_t> cache;
+  std::vector<uint32_t> next_cache;
+  size_t scan_cursor = 0;
+  int best_triangle = -1;
+  for (size_t e_idx = 0; e_idx < triangle_num; ++e_idx) {
+    if (best_triangle < 0) {
+      // Nothing in the cache has a live triangle, restart from the first
+      // triangle left in the input order.
+      while (emitted[scan_cursor]) {
+        ++scan_cursor;
+      }
+      best_triangle = scan_cursor;
+    }
+    const uint32_t *triangle = &indices[3 * best_triangle];
+    emitted[best_triangle] = true;
+    next_cache.assign(triangle, triangle + 3);
+    for (int c_idx = 0; c_idx < 3; ++c_idx) {
+      const uint32_t vertex = triangle[c_idx];
+      result.push_back(vertex);
+      // Remove the triangle from the live ones of the vertex.
+      uint32_t *live_begin = &vertex_triangles[offsets[vertex]];
+      uint32_t *live_end = live_begin + remaining_nums[vertex];
+      *std::find(live_begin, live_end, uint32_t(best_triangle)) =
+          *(live_end - 1);
+      --remaining_nums[vertex];
+    }
+    for (uint32_t vertex : cache) {
+      if (vertex != triangle[0] && vertex != triangle[1] &&
+          vertex != triangle[2]) {
+        next_cache.push_back(vertex);
+      }
+    }
+    cache.swap(next_cache);
+
+    // Rescore the cached vertices and their triangles, the evicted ones
+    // drop their cache score.
+    for (size_t c_idx = 0; c_idx < cache.size(); ++c_idx) {
+      const uint32_t vertex = cache[c_idx];
+      cache_positions[vertex] = c_idx < size_t(kLRUCacheSize) ? c_idx : -1;
+      vertex_scores[vertex] =
+          VertexScore(cache_positions[vertex], remaining_nums[vertex]);
+    }
+    best_triangle = -1;
+    float best_score = -1.f;
+    for (uint32_t vertex : cache) {
+      for (int l_idx = 0; l_idx < remaining_nums[vertex]; ++l_idx) {
+        const uint32_t t_idx = vertex_triangles[offsets[vertex] + l_idx];
+        const float score = vertex_scores[indices[3 * t_idx]] +
+                            vertex_scores[indices[3 * t_idx + 1]] +
+                            vertex_scores[indices[3 * t_idx + 2]];
+        if (score > best_score) {
+          best_score = score;
+          best_triangle = t_idx;
+        }
+      }
+    }
+    if (cache.size() > size_t(kLRUCacheSize)) {
+      cache.resize(kLRUCacheSize);
+    }
+  }
+  indices.swap(result);
+}
+
+void OptimizeOverdraw(std::vector<uint32_t> &indices, const uint8_t *positions,
+                      size_t vertex_num, size_t stride, float threshold) {
+  const size_t triangle_num = indices.size() / 3;
+  if (triangle_num < 2) {
+    return;
+  }
+  // Hard cluster boundaries where the FIFO cache restarts, a triangle
+  // missing all 3 vertices. Sorting whole clusters keeps their cache hits.
+  const int cache_size = 16;
+  std::vector<size_t> cluster_begins;
+  std::vector<size_t> miss_stamps(vertex_num, 0);
+  size_t stamp = cache_size + 1;
+  for (size_t t_idx = 0; t_idx < triangle_num; ++t_idx) {
+    int miss_num = 0;
+    for (int c_idx = 0; c_idx < 3; ++c_idx) {
+      const uint32_t index = indices[3 * t_idx + c_idx];
+      if (stamp - miss_stamps[index] > size_t(cache_size)) {
+        miss_stamps[index] = stamp++;
+        ++miss_num;
+      }
+    }
+    if (t_idx == 0 || miss_num == 3) {
+      cluster_begins.push_back(t_idx);
+    }
+  }
+  if (cluster_begins.size() < 2) {
+    return;
+  }
+  cluster_begins.push_back(triangle_num);
+
+  glm::vec3 mesh_center(0.f);
+  for (uint32_t index : indices) {
+    mesh_center += GetPosition(positions, stride, index);
+  }
+  mesh_center /= float(indices.size());
+  // Sort key: the area weighted cluster normal against the direction from
+  // the mesh center, the clusters facing outward occlude the others.
+  const size_t cluster_num = cluster_begins.size() - 1;
+  std::vector<float> keys(cluster_num);
+  for (size_t c_idx = 0; c_idx < cluster_num; ++c_idx) {
+    glm::vec3 center(0.f);
+    glm::vec3 normal(0.f);
+    float area = 0.f;
+    for (size_t t_idx = cluster_begins[c_idx];
+         t_idx < cluster_begins[c_idx + 1]; ++t_idx) {
+      const glm::vec3 p0 = GetPosition(positions, stride, indices[3 * t_idx]);
+      const glm::vec3 p1 =
+          GetPosition(positions, stride, indices[3 * t_idx + 1]);
+      const glm::vec3 p2 =
+          GetPosition(positions, stride, indices[3 * t_idx + 2]);
+      const glm::vec3 face_normal = glm::cross(p1 - p0, p2 - p0);
+      const float face_area = glm::length(face_normal);
+      center += (p0 + p1 + p2) * (face_area / 3.f);
+      normal += face_normal;
+      area += face_area;
+    }
+    if (area > 0.f) {
+      center /= area;
+    }
+    const float normal_length = glm::length(normal);
+    keys[c_idx] = normal_length > 0.f
+                      ? glm::dot(center - mesh_center, normal / normal_length)
+                      : 0.f;
+  }
+  std::vector<size_t> order(cluster_num);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&keys](size_t lhs, size_t rhs) {
+                     return keys[lhs] > keys[rhs];
+                   });
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  for (size_t c_idx : order) {
+    result.insert(result.end(), indices.begin() + 3 * cluster_begins[c_idx],
+                  indices.begin() + 3 * cluster_begins[c_idx + 1]);
+  }
+  if (AnalyzeVertexCache(result, vertex_num).GetACMR() <=
+      AnalyzeVertexCache(indices, vertex_num).GetACMR() * threshold) {
+    indices.swap(result);
+  }
+}
+
+size_t OptimizeVertexFetch(std::vector<uint8_t> &vertices, size_t stride,
+                           std::vector<uint32_t> &indices) {
+  const size_t vertex_num = vertices.size() / stride;
+  std::vector<uint32_t> remap(vertex_num, kInvalidIndex);
+  std::vector<uint8_t> result;
+  result.reserve(vertices.size());
+  uint32_t next_index = 0;
+  for (auto &index : indices) {
+    CHECK(index < vertex_num) << "index is out of range.";
+    if (remap[index] == kInvalidIndex) {
+      remap[index] = next_index++;
+      result.insert(result.end(), vertices.begin() + index * stride,
+                    vertices.begin() + (index + 1) * stride);
+    }
+    index = remap[index];
+  }
+  vertices.swap(result);
+  return next_index;
+}
+
+} // namespace MeshOptimizer
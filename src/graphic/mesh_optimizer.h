@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Triangle list optimizations of an interleaved vertex buffer, used by the
+// cooker(see CookedModel::Cook). Run them in order:
+//   WeldVertices          merge the byte equal vertices into an index buffer
+//   OptimizeVertexCache   reorder the triangles for the post transform cache
+//   OptimizeOverdraw      reorder the cache friendly clusters front to back
+//   OptimizeVertexFetch   reorder the vertices by first use
+namespace MeshOptimizer {
+
+// Post transform cache efficiency of a triangle list, simulated with a FIFO.
+struct CacheStats {
+  size_t triangle_num = 0;
+  size_t vertex_num = 0;
+  // Vertices transformed, the cache misses.
+  size_t transform_num = 0;
+
+  // Average cache miss ratio, transforms per triangle, 0.5 to 3.
+  float GetACMR() const;
+  // Average transform to vertex ratio, 1 is the best.
+  float GetATVR() const;
+  void Add(const CacheStats &rhs);
+  std::string ToString() const;
+};
+
+CacheStats AnalyzeVertexCache(const std::vector<uint32_t> &indices,
+                              size_t vertex_num, int cache_size = 16);
+
+// Collapse the vertices with the same bytes. indices are remapped in place,
+// empty indices stand for a non indexed list. Return the welded vertex num,
+// vertices keep the first vertex of every group.
+size_t WeldVertices(std::vector<uint8_t> &vertices, size_t stride,
+                    std::vector<uint32_t> &indices);
+// Forsyth's linear speed vertex cache optimization, for a 32 entries LRU.
+void OptimizeVertexCache(std::vector<uint32_t> &indices, size_t vertex_num);
+// Split the list where the cache restarts and sort the clusters by how much
+// they face away from the mesh center, so the outer faces are drawn first.
+// positions is the float x3 of vertex 0, stride bytes apart. The new order
+// is kept only if its ACMR stays within threshold times the input's.
+void OptimizeOverdraw(std::vector<uint32_t> &indices, const uint8_t *positions,
+                      size_t vertex_num, size_t stride, float threshold);
+// Reorder the vertices by first use and drop the unused ones. Return the new
+// vertex num.
+size_t OptimizeVertexFetch(std::vector<uint8_t> &vertices, size_t stride,
+                           std::vector<uint32_t> &indices);
+
+} // namespace MeshOptimizer
@@ -1,4 +1,8 @@
 #include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
 
 #include <glm/common.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -8,1019 +12,1995 @@
 #define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "common/binary_io.h"
 #include "common/logging.h"
+#include "common/mapped_file.h"
+#include "common/thread_pool.h"
+#include "graphic/accessor_view.h"
+#include "graphic/cooked_model.h"
+#include "graphic/gpu_resource_cache.h"
 #include "graphic/model.h"
+#include "graphic/skin_influence.h"
 
-// R is Eigen types
-//template <typename T, typename R>
-//void ParseData(const uint8_t *buffer, int count, int stride,
-//               STLVectorOfEigenTypes<R> &result_array) {
-//  result_array.clear();
-//  for (int e_idx = 0; e_idx < count; ++e_idx) {
-//    uint8_t *ptr = buffer + e_idx * stride;
-//    R cur_elm(ptr);
-//    result_array.push_back(R);
-//  }
-//}
-
-//void Model::SetPrimitiveNormals(const tinygltf::Primitive &primitive,
-//                                RenderParams &render_params) {
-//  auto iter = primitive.attributes.begin();
-//  const auto iter_end = primitive.attributes.end();
-//
-//  int position_idx = -1;
-//  for (; iter != iter_end; iter++) {
-//    if (iter->first == "POSITION") {
-//      position_idx = iter->second;
-//      break;
-//    }
-//  }
-//  CHECK(position_idx != -1) << "primitive's POSITION attrib is not exist!";
-//  const auto &position_accessor = model_.accessors[position_idx];
-//  const auto &position_buffer_view =
-//      model_.bufferViews[position_accessor.bufferView];
-//
-//  const std::vector<uint8_t> &position_data =
-//      cpu_buffer_views_[position_accessor.bufferView];
-//  CHECK(!position_data.empty())
-//      << "primitive's position cpu data hasn't been inited!";
-//
-//  if (render_params.draw_type == DRAW_ELEMENT) {
-//    int indices_idx = primitive.indices;
-//    const auto &indices_accessor = model_.accessors[indices_idx];
-//    const auto &indices_buffer_view =
-//        model_.bufferViews[indices_accessor.bufferView];
-//
-//    const std::vector<uint8_t> &indices_data =
-//        cpu_buffer_views_[indices_accessor.bufferView];
-//    CHECK(!indices_data.empty())
-//        << "primitive's indices cpu data hasn't been inited!";
-//    std::map<int, std::vector<glm::vec3>> indices_normal_map;
-//
-//    int indices_count = indices_accessor.count;
-//    int indices_elm_size = GLTFTypeElmSize(indices_accessor.type);
-//    int indices_byte_size =
-//        GLTFComponentByteSize(indices_accessor.componentType);
-//    int indices_byte_stride = indices_buffer_view.byteStride;
-//
-//    switch (indices_accessor.componentType) {
-//    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-//    case TINYGLTF_COMPONENT_TYPE_BYTE:
-//    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-//    case TINYGLTF_COMPONENT_TYPE_SHORT:
-//    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-//    case TINYGLTF_COMPONENT_TYPE_INT:
-//    case TINYGLTF_COMPONENT_TYPE_FLOAT:
-//    case TINYGLTF_COMPONENT_TYPE_DOUBLE:
-//    }
-//
-//  } else {
-//  }
-//}
+namespace {
+
+// The joints(location 3) and the multi draw index(location 5) are integers
+// in the shaders.
+void SetVertexAttrib(GLuint location, GLint size, GLenum type,
+                     bool normalized, GLsizei stride, size_t offset) {
+  const GLvoid *pointer = reinterpret_cast<const GLvoid *>(offset);
+  if (location == 3 || location == 5) {
+    glVertexAttribIPointer(location, size, type, stride, pointer);
+  } else {
+    glVertexAttribPointer(location, size, type, normalized ? GL_TRUE : GL_FALSE,
+                          stride, pointer);
+  }
+  glEnableVertexAttribArray(location);
+}
+
+// Per draw data of the multi draw shaders, std430 mat4 and vec4.
+const size_t kDrawDataFloatNum = 16 + 4;
+
+// Clip sample rates(Hz) of the animation LOD tiers, and the screen sizes
+// (bounds radius over the half view height) below which the next tier is
+// used.
+const double kAnimationLodRates[Model::kAnimationLodNum] = {60, 30, 15};
+const float kAnimationLodScreenSizes[Model::kAnimationLodNum - 1] = {0.25f,
+                                                                    0.1f};
+// Golden ratio step, spreads the sample phases of the instances evenly.
+const float kPhaseStep = 0.618034f;
+
+// Influences per vertex of the skin influence variants.
+const int kInfluenceNums[Model::kInfluenceVariantNum] = {4, 2, 1};
+
+// Index of the variant shader, variant 0 is the base shader.
+int GetInfluenceShaderIndex(bool is_instanced, int variant) {
+  return (is_instanced ? Model::kInfluenceVariantNum - 1 : 0) + variant - 1;
+}
+
+template <typename T> std::vector<uint8_t> ToBytes(const std::vector<T> &src) {
+  std::vector<uint8_t> bytes(src.size() * sizeof(T));
+  std::memcpy(bytes.data(), src.data(), bytes.size());
+  return bytes;
+}
+
+// Mip levels of a cooked texture, more is a corrupt file.
+const uint32_t kMaxCookedLevelNum = 32;
+
+// The draw of a cooked primitive stays inside its buffers.
+bool IsCookedPrimitiveValid(
+    const CookedModel::PrimitiveHeader &primitive,
+    const std::vector<CookedModel::VertexAttrib> &attribs,
+    size_t vertex_byte_size, size_t index_byte_size, size_t texture_num) {
+  if (size_t(primitive.vertex_num) * primitive.stride > vertex_byte_size ||
+      primitive.texture_idx < -1 ||
+      primitive.texture_idx >= static_cast<int>(texture_num)) {
+    return false;
+  }
+  for (const auto &attrib : attribs) {
+    const size_t component_size = GLTFComponentByteSize(attrib.type);
+    if (attrib.size < 1 || attrib.size > 4 || component_size == 0 ||
+        size_t(attrib.offset) + attrib.size * component_size >
+            primitive.stride) {
+      return false;
+    }
+  }
+  size_t index_size = 0;
+  switch (primitive.index_type) {
+  case 0:
+    return true;
+  case GL_UNSIGNED_BYTE:
+    index_size = 1;
+    break;
+  case GL_UNSIGNED_SHORT:
+    index_size = 2;
+    break;
+  case GL_UNSIGNED_INT:
+    index_size = 4;
+    break;
+  default:
+    return false;
+  }
+  return size_t(primitive.index_num) * index_size <= index_byte_size;
+}
+
+// Every index of a cooked table in [min_index, end).
+bool IsInRange(const std::vector<int> &indices, int min_index, int end) {
+  for (int index : indices) {
+    if (index < min_index || index >= end) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The cooked node tables form a forest: parents in range and acyclic, and
+// the children lists match the parents.
+bool IsNodeForest(const std::vector<int> &parent_indices,
+                  const std::vector<std::vector<int>> &node_children) {
+  const int node_num = parent_indices.size();
+  if (!IsInRange(parent_indices, -1, node_num)) {
+    return false;
+  }
+  for (int n_idx = 0; n_idx < node_num; ++n_idx) {
+    for (int child_idx : node_children[n_idx]) {
+      if (child_idx < 0 || child_idx >= node_num ||
+          parent_indices[child_idx] != n_idx) {
+        return false;
+      }
+    }
+  }
+  // Every node is reached once from the roots.
+  std::vector<int> node_stack;
+  for (int n_idx = 0; n_idx < node_num; ++n_idx) {
+    if (parent_indices[n_idx] == -1) {
+      node_stack.push_back(n_idx);
+    }
+  }
+  int reached_num = 0;
+  while (!node_stack.empty()) {
+    const int node_idx = node_stack.back();
+    node_stack.pop_back();
+    if (++reached_num > node_num) {
+      return false;
+    }
+    node_stack.insert(node_stack.end(), node_children[node_idx].begin(),
+                      node_children[node_idx].end());
+  }
+  return reached_num == node_num;
+}
+
+} // namespace
 
 void Model::Init(const std::string &model_path) {
+  Init(model_path, LoadOptions());
+}
+
+void Model::Init(const std::string &model_path, const LoadOptions &options) {
+  std::shared_ptr<LoadState> state = StartLoad(model_path, options);
+  // Run the GL calls of the stages until the model is finished.
+  while (!state->finished) {
+    if (!state->gl_tasks.RunOne()) {
+      state->gl_tasks.WaitForTask(std::chrono::milliseconds(1));
+    }
+  }
+  CHECK(!state->failed) << state->error;
+}
+
+std::unique_ptr<Model::AsyncLoad>
+Model::LoadAsync(const std::string &model_path) {
+  return LoadAsync(model_path, LoadOptions());
+}
+
+std::unique_ptr<Model::AsyncLoad>
+Model::LoadAsync(const std::string &model_path, const LoadOptions &options) {
+  std::unique_ptr<AsyncLoad> async_load(new AsyncLoad());
+  async_load->model_.reset(new Model());
+  async_load->state_ = async_load->model_->StartLoad(model_path, options);
+  return async_load;
+}
+
+Model::AsyncLoad::~AsyncLoad() {
+  if (!state_) {
+    return;
+  }
+  // The CPU stages still running reference the model, the state outlives
+  // them by itself.
+  while (state_->cpu_task_num > 0) {
+    state_->gl_tasks.WaitForTask(std::chrono::milliseconds(1));
+  }
+}
+
+bool Model::AsyncLoad::Update(double budget_ms) {
+  const double begin_time = GetTimeStampSecond();
+  // At least one GL task per call, so a small budget still makes progress.
+  while (!state_->finished && state_->gl_tasks.RunOne()) {
+    if ((GetTimeStampSecond() - begin_time) * 1000.0 >= budget_ms) {
+      break;
+    }
+  }
+  return state_->finished;
+}
+
+bool Model::AsyncLoad::IsReady() const {
+  return state_->finished && !state_->failed;
+}
+
+bool Model::AsyncLoad::IsFailed() const {
+  return state_->finished && state_->failed;
+}
+
+const std::string &Model::AsyncLoad::GetError() const {
+  return state_->error;
+}
+
+std::shared_ptr<Model> Model::AsyncLoad::GetModel() const {
+  return IsReady() ? model_ : nullptr;
+}
+
+std::shared_ptr<Model::LoadState>
+Model::StartLoad(const std::string &model_path, const LoadOptions &options) {
+  std::shared_ptr<LoadState> state = std::make_shared<LoadState>();
+  state->thread_pool = options.parallel ? &ThreadPool::GetShared() : nullptr;
+  state->keep_gltf = options.keep_gltf;
+  state->multi_draw = options.multi_draw && IsGLVersionAtLeast(4, 3);
+  if (options.multi_draw && !state->multi_draw) {
+    LOG(WARNING) << "Multi draw needs GL 4.3, use the per primitive draws.";
+  }
+  ReleaseResources();
+  asset_path_ = model_path;
+  animation_clips_.clear();
+  mesh_bounds_.clear();
+  joint_bounds_.clear();
+  pose_bounds_ = AABB();
   // Load models.
-  tinygltf::TinyGLTF gltf_ctx;
-  std::string err;
-  std::string warn;
-  bool ret = false;
-  ret = gltf_ctx.LoadASCIIFromFile(&model_, &err, &warn, model_path);
+  LoadState *state_ptr = state.get();
+  if (CookedModel::IsCookedPath(model_path)) {
+    // Mostly GL uploads straight from the mapped file, one GL task.
+    RunCPUTask(state, [this, model_path, options, state_ptr]() {
+      state_ptr->gl_tasks.Push([this, model_path, options, state_ptr]() {
+        InitFromCooked(model_path, options, *state_ptr);
+      });
+    });
+  } else {
+    RunCPUTask(state, [this, model_path, options, state]() {
+      InitFromGLTF(model_path, options, state);
+    });
+  }
+  return state;
+}
 
-  if (!err.empty()) {
-    LOG(ERROR) << err;
+void Model::RunCPUTask(const std::shared_ptr<LoadState> &state,
+                       std::function<void()> task) {
+  ++state->cpu_task_num;
+  // The last CPU stage queues FinishLoad behind all the GL calls.
+  auto run_task = [this, state, task]() {
+    task();
+    if (state->cpu_task_num.fetch_sub(1) == 1) {
+      LoadState *state_ptr = state.get();
+      state->gl_tasks.Push([this, state_ptr]() { FinishLoad(*state_ptr); });
+    }
+  };
+  if (state->thread_pool) {
+    state->thread_pool->Submit(run_task);
+  } else {
+    run_task();
+  }
+}
+
+void Model::FinishLoad(LoadState &state) {
+  if (state.failed) {
+    loader_.Release();
+    ReleaseCPUData();
+    ReleaseResources();
+    state.finished = true;
+    return;
   }
-  if (!warn.empty()) {
-    LOG(WARNING) << warn;
+  for (auto &mesh_render_params : mesh_render_params_) {
+    for (auto &render_params : mesh_render_params.second) {
+      if (render_params.texture_idx >= 0) {
+        render_params.texture_id = state.textures[render_params.texture_idx];
+      }
+    }
+  }
+  for (auto &static_batch : static_batches_) {
+    auto &render_params = static_batch.render_params;
+    if (render_params.texture_idx >= 0) {
+      render_params.texture_id = state.textures[render_params.texture_idx];
+    }
+  }
+  for (auto &group : multi_draw_groups_) {
+    if (group.texture_idx >= 0) {
+      group.texture_id = state.textures[group.texture_idx];
+    }
+  }
+  // Draws of one Render, every batch range was a draw of its own.
+  draw_num_ = static_batches_.size();
+  source_draw_num_ = 0;
+  for (const auto &static_batch : static_batches_) {
+    source_draw_num_ += static_batch.ranges.size();
   }
-  if (!ret) {
-    LOG(FATAL) << "Load gltf failed!";
+  std::vector<int> node_stack = scene_roots_;
+  while (!node_stack.empty()) {
+    const int node_idx = node_stack.back();
+    node_stack.pop_back();
+    auto iter = mesh_render_params_.find(node_meshes_[node_idx]);
+    if (iter != mesh_render_params_.end() &&
+        (node_batched_.empty() || !node_batched_[node_idx])) {
+      source_draw_num_ += iter->second.size();
+      draw_num_ += iter->second.size();
+    }
+    node_stack.insert(node_stack.end(), node_children_[node_idx].begin(),
+                      node_children_[node_idx].end());
+  }
+  if (!static_batches_.empty()) {
+    LOG(INFO) << asset_path_ << " static batches: " << source_draw_num_
+              << " draws -> " << draw_num_;
+  }
+  // Everything is uploaded or decoded, drop the mappings and the CPU copies.
+  loader_.Release();
+  if (!state.keep_gltf) {
+    const MemoryReport loaded_report = GetMemoryReport();
+    ReleaseCPUData();
+    LOG(INFO) << asset_path_ << " CPU memory, loaded: "
+              << loaded_report.ToString()
+              << ", runtime: " << GetMemoryReport().ToString();
+  }
+  if (source_geometry_byte_size_ > 0) {
+    LOG(INFO) << asset_path_ << " geometry: "
+              << source_geometry_byte_size_ / 1024.0 << " KB source, "
+              << geometry_byte_size_ / 1024.0 << " KB uploaded";
   }
 
-  if (model_.textures.size() > 0) {
-    if (model_.skins.size() > 0) {
-      is_skinning_ = true;
-      shader_.InitFromFile("../shader/avatar_tex_skin_vs.glsl",
-                           "../shader/avatar_tex_skin_fs.glsl");
+  if (is_skinning_) {
+    // The shader storage of the palette depends on the joint number.
+    skinning_palette_buffer_.Init(skinning_joints_.size());
+    shader_.SetDefines(skinning_palette_buffer_.GetShaderDefines());
+  }
+  if (has_texture_) {
+    if (is_skinning_) {
+      vs_path_ = "../shader/avatar_tex_skin_vs.glsl";
+      fs_path_ = "../shader/avatar_tex_skin_fs.glsl";
     } else {
-      is_skinning_ = false;
-      shader_.InitFromFile("../shader/avatar_tex_vs.glsl",
-                           "../shader/avatar_tex_fs.glsl");
+      vs_path_ = "../shader/avatar_tex_vs.glsl";
+      fs_path_ = "../shader/avatar_tex_fs.glsl";
     }
   } else {
-    if (model_.skins.size() > 0) {
-      is_skinning_ = true;
-      shader_.InitFromFile("../shader/avatar_notex_skin_vs.glsl",
-                           "../shader/avatar_notex_skin_fs.glsl");
+    if (is_skinning_) {
+      vs_path_ = "../shader/avatar_notex_skin_vs.glsl";
+      fs_path_ = "../shader/avatar_notex_skin_fs.glsl";
+    } else {
+      vs_path_ = "../shader/avatar_notex_vs.glsl";
+      fs_path_ = "../shader/avatar_notex_fs.glsl";
+    }
+  }
+  shader_.InitFromFile(vs_path_, fs_path_);
+  // Resolve the uniforms of the render loop once.
+  ResolveUniformHandles(shader_, uniform_handles_);
+  if (is_skinning_) {
+    InitInfluenceShaders(false, skinning_palette_buffer_.GetShaderDefines());
+  }
+  if (!multi_draw_groups_.empty()) {
+    std::vector<std::string> defines;
+    if (is_skinning_) {
+      defines = skinning_palette_buffer_.GetShaderDefines();
+    }
+    defines.push_back("MULTI_DRAW_INDIRECT");
+    multi_draw_shader_.SetDefines(defines);
+    multi_draw_shader_.SetVersion("430 core");
+    if (multi_draw_shader_.InitFromFile(vs_path_, fs_path_)) {
+      // The model matrix and the color are per draw data.
+      auto &handles = multi_draw_uniform_handles_;
+      handles.view_matrix = multi_draw_shader_.GetUniformHandle("view_matrix");
+      handles.proj_matrix = multi_draw_shader_.GetUniformHandle("proj_matrix");
+      handles.diffuse_texture =
+          multi_draw_shader_.GetUniformHandle("diffuse_texture", !has_texture_);
+      draw_num_ = multi_draw_groups_.size();
+      LOG(INFO) << asset_path_ << " multi draw: " << multi_draw_nodes_.size()
+                << " commands in " << draw_num_ << " calls";
     } else {
-      is_skinning_ = false;
-      shader_.InitFromFile("../shader/avatar_notex_vs.glsl",
-                           "../shader/avatar_notex_fs.glsl");
+      LOG(WARNING) << asset_path_
+                   << " multi draw shader failed, use the per primitive draws.";
+      multi_draw_groups_.clear();
     }
   }
+  // The instanced shader is built by the first RenderInstances.
+  instance_palette_buffer_.Release();
+  influence_shaders_inited_[1] = false;
+  instance_trees_.clear();
+  instance_bounds_.clear();
+  instance_start_time_ = -1;
+
+  animation_size_ = animation_clips_.size();
+  animation_index_ = animation_size_ > 0 ? 0 : -1;
+  animation_names_.clear();
+  for (int a_idx = 0; a_idx < animation_size_; ++a_idx) {
+    animation_names_ += "Animation " + std::to_string(a_idx) + '\0';
+  }
+  state.finished = true;
+}
 
-  mesh_render_params_.clear();
-  for (size_t m_idx = 0; m_idx < model_.meshes.size(); ++m_idx) {
-    const auto &mesh = model_.meshes[m_idx];
-    mesh_render_params_[m_idx] = std::vector<RenderParams>();
-    for (size_t p_idx = 0; p_idx < mesh.primitives.size(); ++p_idx) {
-      const auto &primitive = mesh.primitives[p_idx];
-      RenderParams cur_render_params;
-      glGenVertexArrays(1, &cur_render_params.vao);
-      glBindVertexArray(cur_render_params.vao);
-
-      auto a_iter = primitive.attributes.begin();
-      auto a_iter_end = primitive.attributes.end();
-
-      bool has_normal = false;
-      for (; a_iter != a_iter_end; ++a_iter) {
-        if (a_iter->first == "NORMAL") {
-          has_normal = true;
-        }
-      }
+void Model::FailLoad(LoadState &state, const std::string &error) {
+  LOG(WARNING) << error;
+  if (!state.failed.exchange(true)) {
+    state.error = error;
+  }
+}
 
-      a_iter = primitive.attributes.begin();
-      for (; a_iter != a_iter_end; ++a_iter) {
-        const auto &accessor = model_.accessors[a_iter->second];
-        GLuint cur_vbo = 0;
-        if (a_iter->first == "POSITION" || a_iter->first == "NORMAL" ||
-            a_iter->first == "TEXCOORD_0" || a_iter->first == "JOINTS_0" ||
-            a_iter->first == "WEIGHTS_0") {
-          cur_vbo = ProcessBufferView(accessor, GL_ARRAY_BUFFER);
-        }
-        int size = GLTFTypeElmSize(accessor.type);
-        int byte_stride =
-            accessor.ByteStride(model_.bufferViews[accessor.bufferView]);
-        CHECK(byte_stride != -1) << "byte_strid equal -1";
-        if (a_iter->first == "POSITION") {
-          cur_render_params.count = accessor.count;
-          glBindBuffer(GL_ARRAY_BUFFER, cur_vbo);
-          glVertexAttribPointer(0, size, accessor.componentType,
-                                accessor.normalized ? GL_TRUE : GL_FALSE,
-                                byte_stride, (GLvoid *)(accessor.byteOffset));
-          glEnableVertexAttribArray(0);
-          glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-          if (!has_normal) {
-            // if don't have normal
-            ProcessBufferView(accessor); // process cpu buffer.
-          }
-        } else if (a_iter->first == "TEXCOORD_0") {
-          glBindBuffer(GL_ARRAY_BUFFER, cur_vbo);
-          glVertexAttribPointer(1, size, accessor.componentType,
-                                accessor.normalized ? GL_TRUE : GL_FALSE,
-                                byte_stride, (GLvoid *)(accessor.byteOffset));
-          glEnableVertexAttribArray(1);
-          glBindBuffer(GL_ARRAY_BUFFER, 0);
-        } else if (a_iter->first == "NORMAL") {
-          glBindBuffer(GL_ARRAY_BUFFER, cur_vbo);
-          glVertexAttribPointer(2, size, accessor.componentType,
-                                accessor.normalized ? GL_TRUE : GL_FALSE,
-                                byte_stride, (GLvoid *)(accessor.byteOffset));
-          glEnableVertexAttribArray(2);
-          glBindBuffer(GL_ARRAY_BUFFER, 0);
-        } else if (a_iter->first == "JOINTS_0") {
-          glBindBuffer(GL_ARRAY_BUFFER, cur_vbo);
-          glVertexAttribPointer(3, size, accessor.componentType,
-                                accessor.normalized ? GL_TRUE : GL_FALSE,
-                                byte_stride, (GLvoid *)(accessor.byteOffset));
-          glEnableVertexAttribArray(3);
-          glBindBuffer(GL_ARRAY_BUFFER, 0);
-        } else if (a_iter->first == "WEIGHTS_0") {
-          glBindBuffer(GL_ARRAY_BUFFER, cur_vbo);
-          glVertexAttribPointer(4, size, accessor.componentType,
-                                accessor.normalized ? GL_TRUE : GL_FALSE,
-                                byte_stride, (GLvoid *)(accessor.byteOffset));
-          glEnableVertexAttribArray(4);
-          glBindBuffer(GL_ARRAY_BUFFER, 0);
+void Model::InitFromGLTF(const std::string &model_path,
+                         const LoadOptions &options,
+                         const std::shared_ptr<LoadState> &state) {
+  // Decode the images on the pool, tinygltf keeps them encoded.
+  const bool defer_images = state->thread_pool != nullptr;
+  if (!loader_.Load(model_path, options.map_buffers, model_, defer_images)) {
+    FailLoad(*state, "Load " + model_path + " failed.");
+    return;
+  }
+  has_texture_ = model_.textures.size() > 0;
+  is_skinning_ = model_.skins.size() > 0;
+
+  // Upload every texture as soon as its image is decoded.
+  LoadState *state_ptr = state.get();
+  state->textures.assign(model_.textures.size(), 0);
+  state->image_textures.assign(model_.images.size(), std::vector<int>());
+  for (size_t t_idx = 0; t_idx < model_.textures.size(); ++t_idx) {
+    if (model_.textures[t_idx].source >= 0) {
+      state->image_textures[model_.textures[t_idx].source].push_back(t_idx);
+    }
+  }
+  for (size_t i_idx = 0; i_idx < model_.images.size(); ++i_idx) {
+    if (state->image_textures[i_idx].empty()) {
+      continue;
+    }
+    RunCPUTask(state, [this, i_idx, defer_images, state_ptr]() {
+      // tinygltf fails the whole load for a bad image, so does the pool.
+      if (defer_images &&
+          !loader_.DecodeImage(i_idx, model_.images[i_idx])) {
+        FailLoad(*state_ptr, "Decode image " + std::to_string(i_idx) +
+                                 " of " + asset_path_ + " failed.");
+        return;
+      }
+      state_ptr->gl_tasks.Push([this, i_idx, state_ptr]() {
+        const GLuint texture_id = UploadTexture(i_idx);
+        for (int t_idx : state_ptr->image_textures[i_idx]) {
+          state_ptr->textures[t_idx] = texture_id;
         }
+      });
+    });
+  }
+  animation_clips_.resize(model_.animations.size());
+  for (size_t a_idx = 0; a_idx < model_.animations.size(); ++a_idx) {
+    RunCPUTask(state, [this, a_idx]() {
+      animation_clips_[a_idx].Init(model_, loader_.GetBufferSpans(), a_idx);
+    });
+  }
+  // build up scene_tree
+  RunCPUTask(state, [this]() { scene_tree_.Init(model_); });
+  if (is_skinning_) {
+    const auto &skin = model_.skins[0];
+    skinning_joints_ = skin.joints;
+    skinning_invbindmat_.resize(skinning_joints_.size(),
+                                AffineMatrix::Identity());
+
+    // Identity when the skin has no inverse bind matrices.
+    if (skin.inverseBindMatrices >= 0) {
+      const AccessorView view(model_, loader_.GetBufferSpans(),
+                              model_.accessors[skin.inverseBindMatrices]);
+      CHECK(skin.joints.size() == view.GetCount())
+          << "skin joints doesn't match matrix count.";
+      std::vector<float> matrices;
+      view.ReadFloats(matrices);
+      for (int j_idx = 0; j_idx < skinning_joints_.size(); ++j_idx) {
+        skinning_invbindmat_[j_idx] = AffineKernel::FromMatrix4(
+            Eigen::Matrix4f(matrices.data() + 16 * j_idx));
       }
+    }
+  }
+  RunCPUTask(state, [this]() { InitBounds(); });
+  if (is_skinning_) {
+    const SkeletonLod::Mode skeleton_lod_mode = options.skeleton_lod_mode;
+    RunCPUTask(state, [this, skeleton_lod_mode]() {
+      InitSkeletonLod(skeleton_lod_mode);
+    });
+  }
+  node_meshes_.resize(model_.nodes.size());
+  node_children_.resize(model_.nodes.size());
+  for (size_t n_idx = 0; n_idx < model_.nodes.size(); ++n_idx) {
+    node_meshes_[n_idx] = model_.nodes[n_idx].mesh;
+    node_children_[n_idx] = model_.nodes[n_idx].children;
+  }
+  scene_roots_.clear();
+  if (!model_.scenes.empty()) {
+    int scene_to_display = model_.defaultScene > -1 ? model_.defaultScene : 0;
+    scene_roots_ = model_.scenes[scene_to_display].nodes;
+  }
 
-      if (primitive.indices >= 0) {
-        cur_render_params.draw_type = DRAW_ELEMENT;
-        cur_render_params.indices_vbo = ProcessBufferView(
-            model_.accessors[primitive.indices], GL_ELEMENT_ARRAY_BUFFER);
-        cur_render_params.count = model_.accessors[primitive.indices].count;
-        if (!has_normal) {
-          ProcessBufferView(model_.accessors[primitive.indices]);
-        }
-      } else {
-        cur_render_params.draw_type = DRAW_ARRAY;
+  // The meshes only drawn by the static batches aren't uploaded alone.
+  std::vector<bool> mesh_used(model_.meshes.size(), true);
+  if (options.batch_static) {
+    node_batched_ =
+        StaticBatcher::SelectNodes(model_, scene_roots_, is_skinning_);
+    mesh_used.assign(model_.meshes.size(), false);
+    for (size_t n_idx = 0; n_idx < node_meshes_.size(); ++n_idx) {
+      if (node_meshes_[n_idx] >= 0 && !node_batched_[n_idx]) {
+        mesh_used[node_meshes_[n_idx]] = true;
       }
+    }
+    RunCPUTask(state, [this, state_ptr]() {
+      std::shared_ptr<std::vector<StaticBatcher::Batch>> batches =
+          std::make_shared<std::vector<StaticBatcher::Batch>>();
+      StaticBatcher::Build(model_, loader_.GetBufferSpans(), scene_roots_,
+                           node_batched_, is_skinning_, *batches);
+      state_ptr->gl_tasks.Push(
+          [this, batches]() { InitStaticBatches(*batches); });
+    });
+  }
 
-      // Calculated and setted normal if needed
-
-      // Load textures.
-      if (primitive.material >= 0) {
-        const auto &material = model_.materials[primitive.material];
-        if (material.pbrMetallicRoughness.baseColorTexture.index >= 0) {
-          // Load image as texture.
-          const auto &texture = model_.textures[material.pbrMetallicRoughness
-                                                    .baseColorTexture.index];
-          const auto &sampler = model_.samplers[texture.sampler];
-          const auto &image = model_.images[texture.source];
-
-          glGenTextures(1, &cur_render_params.texture_id);
-          glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-          glBindTexture(GL_TEXTURE_2D, cur_render_params.texture_id);
-          glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                          sampler.minFilter);
-          glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
-                          sampler.magFilter);
-          GLenum format = GL_RGBA;
-          if (image.component == 3) {
-            format = GL_RGB;
-          }
-
-          GLenum type = GL_UNSIGNED_BYTE;
-          if (image.bits == 8) {
-            type = GL_UNSIGNED_BYTE;
-          } else if (image.bits == 16) {
-            type = GL_UNSIGNED_SHORT;
-          } else if (image.bits == 32) {
-            type = GL_UNSIGNED_INT;
-          } else {
-            CHECK(0) << "Don't support image.bits: " << image.bits;
-          }
-          glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-          glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0,
-                       format, type, image.image.data());
-          glGenerateMipmap(GL_TEXTURE_2D);
-          glBindTexture(GL_TEXTURE_2D, 0);
-          // model_.samplers
-        } else {
-          if (!material.pbrMetallicRoughness.baseColorFactor.empty()) {
-            cur_render_params.color =
-                glm::vec4(material.pbrMetallicRoughness.baseColorFactor[0],
-                          material.pbrMetallicRoughness.baseColorFactor[1],
-                          material.pbrMetallicRoughness.baseColorFactor[2],
-                          material.pbrMetallicRoughness.baseColorFactor[3]);
-          } else {
-            cur_render_params.color = glm::vec4(0.5, 0.5, 0.5, 1.0);
-          }
-        }
+  if (state->multi_draw) {
+    RunCPUTask(state, [this, state_ptr]() {
+      std::shared_ptr<StaticBatcher::Batch> arena =
+          std::make_shared<StaticBatcher::Batch>();
+      if (!StaticBatcher::BuildArena(model_, loader_.GetBufferSpans(),
+                                     *arena)) {
+        LOG(WARNING) << asset_path_
+                     << " isn't all triangle lists, no multi draw.";
+        return;
       }
+      state_ptr->gl_tasks.Push([this, arena]() { InitMultiDraw(*arena); });
+    });
+  }
 
-      mesh_render_params_[m_idx].push_back(cur_render_params);
-      glBindVertexArray(0);
+  // One GL task per mesh, so an async load spreads them across frames.
+  for (size_t m_idx = 0; m_idx < model_.meshes.size(); ++m_idx) {
+    if (!mesh_used[m_idx]) {
+      continue;
     }
+    if (!options.compact_vertices) {
+      state->gl_tasks.Push([this, m_idx]() { InitMesh(m_idx); });
+      continue;
+    }
+    // The conversion runs on the pool, the upload on the GL thread.
+    RunCPUTask(state, [this, m_idx, state_ptr]() {
+      const auto &mesh = model_.meshes[m_idx];
+      std::shared_ptr<std::vector<VertexCompaction::Primitive>> primitives =
+          std::make_shared<std::vector<VertexCompaction::Primitive>>(
+              mesh.primitives.size());
+      for (size_t p_idx = 0; p_idx < mesh.primitives.size(); ++p_idx) {
+        VertexCompaction::Compact(model_, loader_.GetBufferSpans(),
+                                  mesh.primitives[p_idx],
+                                  (*primitives)[p_idx]);
+      }
+      state_ptr->gl_tasks.Push([this, m_idx, primitives]() {
+        InitCompactMesh(m_idx, *primitives);
+      });
+    });
   }
+}
 
-  if (is_skinning_) {
-    const auto &skin = model_.skins[0];
-    skinning_joints_ = skin.joints;
-    skinning_invbindmat_.resize(skinning_joints_.size(),
-                                Eigen::Matrix4f::Identity());
+void Model::InitMesh(int m_idx) {
+  const auto &mesh = model_.meshes[m_idx];
+  mesh_render_params_[m_idx] = std::vector<RenderParams>();
+  for (size_t p_idx = 0; p_idx < mesh.primitives.size(); ++p_idx) {
+    const auto &primitive = mesh.primitives[p_idx];
+    RenderParams cur_render_params;
+    glGenVertexArrays(1, &cur_render_params.vao);
+    glBindVertexArray(cur_render_params.vao);
+
+    auto a_iter = primitive.attributes.begin();
+    auto a_iter_end = primitive.attributes.end();
+    for (; a_iter != a_iter_end; ++a_iter) {
+      const auto &accessor = model_.accessors[a_iter->second];
+      if (a_iter->first != "POSITION" && a_iter->first != "NORMAL" &&
+          a_iter->first != "TEXCOORD_0" && a_iter->first != "JOINTS_0" &&
+          a_iter->first != "WEIGHTS_0") {
+        continue;
+      }
+      int byte_stride = 0;
+      size_t byte_offset = 0;
+      const GLuint cur_vbo = ProcessBufferView(
+          a_iter->second, GL_ARRAY_BUFFER, byte_stride, byte_offset);
+      int size = GLTFTypeElmSize(accessor.type);
+      if (a_iter->first == "POSITION") {
+        cur_render_params.count = accessor.count;
+        glBindBuffer(GL_ARRAY_BUFFER, cur_vbo);
+        SetVertexAttrib(0, size, accessor.componentType, accessor.normalized,
+                        byte_stride, byte_offset);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+      } else if (a_iter->first == "TEXCOORD_0") {
+        glBindBuffer(GL_ARRAY_BUFFER, cur_vbo);
+        SetVertexAttrib(1, size, accessor.componentType, accessor.normalized,
+                        byte_stride, byte_offset);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+      } else if (a_iter->first == "NORMAL") {
+        glBindBuffer(GL_ARRAY_BUFFER, cur_vbo);
+        SetVertexAttrib(2, size, accessor.componentType, accessor.normalized,
+                        byte_stride, byte_offset);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+      } else if (a_iter->first == "JOINTS_0") {
+        glBindBuffer(GL_ARRAY_BUFFER, cur_vbo);
+        SetVertexAttrib(3, size, accessor.componentType, accessor.normalized,
+                        byte_stride, byte_offset);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+      } else if (a_iter->first == "WEIGHTS_0") {
+        glBindBuffer(GL_ARRAY_BUFFER, cur_vbo);
+        SetVertexAttrib(4, size, accessor.componentType, accessor.normalized,
+                        byte_stride, byte_offset);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        // Uploaded as is, only the trailing zero weights can be dropped.
+        std::vector<float> weights;
+        AccessorView(model_, loader_.GetBufferSpans(), accessor)
+            .ReadFloats(weights);
+        cur_render_params.influence_num = SkinInfluence::Analyze(
+            weights, cur_render_params.influence_sorted);
+      }
+    }
 
-    const auto &accessor = model_.accessors[skin.inverseBindMatrices];
-    const auto &buffer_view = model_.bufferViews[accessor.bufferView];
-    const auto &buffer = model_.buffers[buffer_view.buffer];
+    cur_render_params.mode = GLTFRenderMode(primitive.mode);
+    if (primitive.indices >= 0) {
+      const auto &index_accessor = model_.accessors[primitive.indices];
+      cur_render_params.draw_type = DRAW_ELEMENT;
+      int byte_stride = 0;
+      size_t byte_offset = 0;
+      cur_render_params.indices_vbo =
+          ProcessBufferView(primitive.indices, GL_ELEMENT_ARRAY_BUFFER,
+                            byte_stride, byte_offset);
+      cur_render_params.count = index_accessor.count;
+      cur_render_params.index_type = index_accessor.componentType;
+      cur_render_params.index_offset = byte_offset;
+      // Record the index buffer in the vao, ProcessBufferView unbinds it.
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cur_render_params.indices_vbo);
+    } else {
+      cur_render_params.draw_type = DRAW_ARRAY;
+    }
 
-    const float *buffer_ptr = reinterpret_cast<const float *>(
-        buffer.data.data() + buffer_view.byteOffset + accessor.byteOffset);
-    CHECK(skin.joints.size() == accessor.count)
-        << "skin joints doesn't match matrix count.";
+    SetMaterial(primitive.material, cur_render_params);
+    mesh_render_params_[m_idx].push_back(cur_render_params);
+    glBindVertexArray(0);
+  }
+}
 
-    int data_stride = 16;
-    if (buffer_view.byteStride != 0) {
-      data_stride = buffer_view.byteStride / 4;
+void Model::InitCompactMesh(
+    int m_idx, const std::vector<VertexCompaction::Primitive> &primitives) {
+  const auto &mesh = model_.meshes[m_idx];
+  mesh_render_params_[m_idx] = std::vector<RenderParams>();
+  for (size_t p_idx = 0; p_idx < mesh.primitives.size(); ++p_idx) {
+    const auto &primitive = primitives[p_idx];
+    source_geometry_byte_size_ += primitive.source_byte_size;
+    geometry_byte_size_ += primitive.compact_byte_size;
+    RenderParams cur_render_params;
+    cur_render_params.mode = GLTFRenderMode(mesh.primitives[p_idx].mode);
+    glGenVertexArrays(1, &cur_render_params.vao);
+    glBindVertexArray(cur_render_params.vao);
+    // One buffer per stream, the streams of an accessor are shared by the
+    // primitives using it.
+    for (const auto &stream : primitive.streams) {
+      glBindBuffer(GL_ARRAY_BUFFER,
+                   AcquireBuffer(GPUResourceCache::RESOURCE_COMPACT_BUFFER,
+                                 stream.accessor_idx, GL_ARRAY_BUFFER,
+                                 stream.data));
+      SetVertexAttrib(stream.location, stream.size, stream.type,
+                      stream.normalized, stream.stride, 0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (primitive.indices.type) {
+      // Recorded in the vao.
+      cur_render_params.indices_vbo = AcquireBuffer(
+          GPUResourceCache::RESOURCE_COMPACT_BUFFER,
+          primitive.indices.accessor_idx, GL_ELEMENT_ARRAY_BUFFER,
+          primitive.indices.data);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cur_render_params.indices_vbo);
+      cur_render_params.draw_type = DRAW_ELEMENT;
+      cur_render_params.index_type = primitive.indices.type;
+      cur_render_params.count = primitive.index_num;
+    } else {
+      cur_render_params.draw_type = DRAW_ARRAY;
+      cur_render_params.count = primitive.vertex_num;
+    }
+    if (primitive.influence_num > 0) {
+      cur_render_params.influence_num = primitive.influence_num;
+      cur_render_params.influence_sorted = true;
     }
+    SetMaterial(mesh.primitives[p_idx].material, cur_render_params);
+    mesh_render_params_[m_idx].push_back(cur_render_params);
+    glBindVertexArray(0);
+  }
+}
 
-    for (int j_idx = 0; j_idx < skinning_joints_.size(); ++j_idx) {
-      skinning_invbindmat_[j_idx] =
-          Eigen::Matrix4f(buffer_ptr + data_stride * j_idx);
-      // LOG(INFO) << "index: " << j_idx;
-      // std::cout << skinning_invbindmat_[j_idx] << std::endl;
+void Model::InitStaticBatches(
+    const std::vector<StaticBatcher::Batch> &batches) {
+  for (size_t b_idx = 0; b_idx < batches.size(); ++b_idx) {
+    const auto &batch = batches[b_idx];
+    StaticBatch static_batch;
+    RenderParams &render_params = static_batch.render_params;
+    glGenVertexArrays(1, &render_params.vao);
+    glBindVertexArray(render_params.vao);
+    glBindBuffer(GL_ARRAY_BUFFER,
+                 AcquireBuffer(GPUResourceCache::RESOURCE_BATCH_BUFFER,
+                               2 * b_idx, GL_ARRAY_BUFFER, batch.vertices));
+    for (const auto &attrib : batch.attribs) {
+      SetVertexAttrib(attrib.location, attrib.size, attrib.type, false,
+                      batch.stride, attrib.offset);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Recorded in the vao.
+    render_params.indices_vbo =
+        AcquireBuffer(GPUResourceCache::RESOURCE_BATCH_BUFFER, 2 * b_idx + 1,
+                      GL_ELEMENT_ARRAY_BUFFER, batch.indices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, render_params.indices_vbo);
+    glBindVertexArray(0);
+    render_params.draw_type = DRAW_ELEMENT;
+    render_params.index_type = batch.index_type;
+    render_params.count = batch.index_num;
+    if (batch.influence_num > 0) {
+      render_params.influence_num = batch.influence_num;
+      render_params.influence_sorted = true;
     }
+    SetMaterial(batch.material, render_params);
+    static_batch.ranges = batch.ranges;
+    // The positions are the first float x3 of the vertices.
+    for (size_t v_idx = 0; v_idx < batch.vertex_num; ++v_idx) {
+      glm::vec3 position;
+      std::memcpy(&position[0], &batch.vertices[v_idx * batch.stride],
+                  sizeof(float) * 3);
+      static_batch.bounds.Extend(position);
+    }
+    static_batches_.push_back(static_batch);
+    geometry_byte_size_ += batch.vertices.size() + batch.indices.size();
   }
-  // build up scene_tree
-  scene_tree_.Init(model_);
+}
 
-  if (!model_.animations.empty()) {
-    animation_index_ = 0;
-    animation_size_ = model_.animations.size();
-    animation_names_.clear();
-    for (int a_idx = 0; a_idx < animation_size_; ++a_idx) {
-      animation_names_ += "Animation " + std::to_string(a_idx) + '\0';
+void Model::InitMultiDraw(const StaticBatcher::Batch &arena) {
+  // The material of every arena range, the ranges are in mesh order.
+  std::vector<RenderParams> range_params(arena.ranges.size());
+  std::vector<int> mesh_first_range(model_.meshes.size(), 0);
+  for (size_t r_idx = 0; r_idx < arena.ranges.size(); ++r_idx) {
+    const auto &range = arena.ranges[r_idx];
+    if (range.primitive_idx == 0) {
+      mesh_first_range[range.mesh_idx] = r_idx;
+    }
+    SetMaterial(model_.meshes[range.mesh_idx]
+                    .primitives[range.primitive_idx]
+                    .material,
+                range_params[r_idx]);
+  }
+  // (node, range) of every draw of the scene, grouped by texture.
+  std::vector<std::pair<int, int>> draws;
+  std::vector<int> node_stack = scene_roots_;
+  while (!node_stack.empty()) {
+    const int node_idx = node_stack.back();
+    node_stack.pop_back();
+    const int mesh_idx = node_meshes_[node_idx];
+    if (mesh_idx >= 0) {
+      for (size_t p_idx = 0; p_idx < model_.meshes[mesh_idx].primitives.size();
+           ++p_idx) {
+        draws.push_back(
+            std::make_pair(node_idx, mesh_first_range[mesh_idx] + p_idx));
+      }
+    }
+    node_stack.insert(node_stack.end(), node_children_[node_idx].begin(),
+                      node_children_[node_idx].end());
+  }
+  if (draws.empty()) {
+    return;
+  }
+  std::stable_sort(draws.begin(), draws.end(),
+                   [&range_params](const std::pair<int, int> &lhs,
+                                   const std::pair<int, int> &rhs) {
+                     return range_params[lhs.second].texture_idx <
+                            range_params[rhs.second].texture_idx;
+                   });
+
+  multi_draw_commands_data_.resize(draws.size());
+  std::vector<uint32_t> draw_indices(draws.size());
+  for (size_t d_idx = 0; d_idx < draws.size(); ++d_idx) {
+    const auto &range = arena.ranges[draws[d_idx].second];
+    const RenderParams &params = range_params[draws[d_idx].second];
+    auto &command = multi_draw_commands_data_[d_idx];
+    command.count = range.index_num;
+    command.first_index = range.first_index;
+    command.base_instance = d_idx;
+    draw_indices[d_idx] = d_idx;
+    multi_draw_nodes_.push_back(draws[d_idx].first);
+    multi_draw_colors_.push_back(params.color);
+    if (multi_draw_groups_.empty() ||
+        multi_draw_groups_.back().texture_idx != params.texture_idx) {
+      MultiDrawGroup group;
+      group.texture_idx = params.texture_idx;
+      group.sampler_id = params.sampler_id;
+      group.first_command = d_idx;
+      multi_draw_groups_.push_back(group);
     }
+    ++multi_draw_groups_.back().command_num;
   }
+
+  glGenVertexArrays(1, &multi_draw_vao_);
+  glBindVertexArray(multi_draw_vao_);
+  glBindBuffer(GL_ARRAY_BUFFER,
+               AcquireBuffer(GPUResourceCache::RESOURCE_ARENA_BUFFER, 0,
+                             GL_ARRAY_BUFFER, arena.vertices));
+  for (const auto &attrib : arena.attribs) {
+    SetVertexAttrib(attrib.location, attrib.size, attrib.type, false,
+                    arena.stride, attrib.offset);
+  }
+  // One draw index per instance, offset by the base instance.
+  glBindBuffer(GL_ARRAY_BUFFER,
+               AcquireBuffer(GPUResourceCache::RESOURCE_ARENA_BUFFER, 1,
+                             GL_ARRAY_BUFFER, ToBytes(draw_indices)));
+  SetVertexAttrib(5, 1, GL_UNSIGNED_INT, false, sizeof(uint32_t), 0);
+  glVertexAttribDivisor(5, 1);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  // Recorded in the vao.
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
+               AcquireBuffer(GPUResourceCache::RESOURCE_ARENA_BUFFER, 2,
+                             GL_ELEMENT_ARRAY_BUFFER, arena.indices));
+  glBindVertexArray(0);
+  multi_draw_index_type_ = arena.index_type;
+  // The commands of the visible draws are uploaded every frame.
+  glGenBuffers(1, &multi_draw_commands_);
+  glGenBuffers(1, &multi_draw_storage_);
+  geometry_byte_size_ += arena.vertices.size() + arena.indices.size();
 }
 
-void Model::Render(const glm::mat4 &view_matrix, const glm::mat4 &proj_matrix,
-                   const glm::mat4 &model_matrix) {
-  shader_.Use();
-  // Set model matrix when render mesh
-  shader_.Set("view_matrix", view_matrix);
-  shader_.Set("proj_matrix", proj_matrix);
+void Model::InitBounds() {
+  mesh_bounds_.resize(model_.meshes.size());
+  for (size_t m_idx = 0; m_idx < model_.meshes.size(); ++m_idx) {
+    mesh_bounds_[m_idx] = Bounds::GetMeshBounds(
+        model_, loader_.GetBufferSpans(), model_.meshes[m_idx]);
+  }
+  if (!is_skinning_) {
+    return;
+  }
+  // Every mesh of a skinned model is posed by the palette.
+  joint_bounds_.assign(skinning_joints_.size(), AABB());
+  for (const auto &mesh : model_.meshes) {
+    Bounds::ExtendJointBounds(model_, loader_.GetBufferSpans(), mesh,
+                              joint_bounds_);
+  }
+}
 
-  // Set the animation index manually.
-  if (animation_size_ > 0 && animation_index_ >= 0 &&
-      animation_index_ < animation_size_) {
-    scene_tree_.SetAnimationFrame(model_, animation_index_,
-                                  GetTimeStampSecond());
+void Model::InitSkeletonLod(SkeletonLod::Mode mode) {
+  std::vector<double> joint_weights(skinning_joints_.size(), 0);
+  if (mode == SkeletonLod::MODE_WEIGHT) {
+    for (const auto &mesh : model_.meshes) {
+      SkeletonLod::AccumulateJointWeights(model_, loader_.GetBufferSpans(),
+                                          mesh, joint_weights);
+    }
   }
+  SkeletonLod::Build(model_, model_.skins[0], skinning_invbindmat_,
+                     joint_weights, mode, kAnimationLodNum, skeleton_lods_);
+}
 
-  scene_tree_.UpdateGlobalPose();
-  if (is_skinning_) {
-    std::vector<float> skinning_pose_data;
-    scene_tree_.GetSkinningPoseData(skinning_joints_, skinning_invbindmat_,
-                                    skinning_pose_data);
-    shader_.SetMat4Array("skinning_transforms", skinning_pose_data,
-                         model_.skins[0].joints.size());
+GLuint Model::AcquireBuffer(GPUResourceCache::ResourceType type, int index,
+                            GLenum buffer_type,
+                            const std::vector<uint8_t> &data) {
+  GPUResourceCache::Key key;
+  key.type = type;
+  key.asset = asset_path_;
+  key.index = index;
+  cached_resources_.push_back(key);
+  return GPUResourceCache::GetShared().Acquire(key, [&](size_t &byte_size) {
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(buffer_type, buffer);
+    glBufferData(buffer_type, data.size(), data.data(), GL_STATIC_DRAW);
+    byte_size = data.size();
+    return buffer;
+  });
+}
+
+void Model::SetMaterial(int material_idx, RenderParams &render_params) {
+  if (material_idx < 0) {
+    return;
+  }
+  // The texture is resolved once uploaded.
+  const auto &material = model_.materials[material_idx];
+  if (material.pbrMetallicRoughness.baseColorTexture.index >= 0) {
+    render_params.texture_idx =
+        material.pbrMetallicRoughness.baseColorTexture.index;
+    render_params.sampler_id = GetTextureSampler(render_params.texture_idx);
+  } else if (!material.pbrMetallicRoughness.baseColorFactor.empty()) {
+    render_params.color =
+        glm::vec4(material.pbrMetallicRoughness.baseColorFactor[0],
+                  material.pbrMetallicRoughness.baseColorFactor[1],
+                  material.pbrMetallicRoughness.baseColorFactor[2],
+                  material.pbrMetallicRoughness.baseColorFactor[3]);
+  } else {
+    render_params.color = glm::vec4(0.5, 0.5, 0.5, 1.0);
   }
+}
 
-  GLboolean last_enable_depth_test = glIsEnabled(GL_DEPTH_TEST);
-  GLboolean last_enable_multisample = glIsEnabled(GL_MULTISAMPLE);
+GLuint Model::UploadTexture(int image_idx) {
+  GPUResourceCache::Key key;
+  key.type = GPUResourceCache::RESOURCE_TEXTURE;
+  key.asset = asset_path_;
+  key.index = image_idx;
+  cached_resources_.push_back(key);
+  return GPUResourceCache::GetShared().Acquire(key, [&](size_t &byte_size) {
+    const auto &image = model_.images[image_idx];
+    GLuint texture_id = 0;
+    glGenTextures(1, &texture_id);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    // The filters and wraps are in the sampler objects.
+    GLenum format = GL_RGBA;
+    if (image.component == 3) {
+      format = GL_RGB;
+    }
 
-  glEnable(GL_DEPTH_TEST);
-  glEnable(GL_MULTISAMPLE);
+    GLenum type = GL_UNSIGNED_BYTE;
+    if (image.bits == 8) {
+      type = GL_UNSIGNED_BYTE;
+    } else if (image.bits == 16) {
+      type = GL_UNSIGNED_SHORT;
+    } else if (image.bits == 32) {
+      type = GL_UNSIGNED_INT;
+    } else {
+      CHECK(0) << "Don't support image.bits: " << image.bits;
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0,
+                 format, type, image.image.data());
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    // RGBA8 with the mip chain.
+    byte_size = size_t(image.width) * image.height * 4 * 4 / 3;
+    return texture_id;
+  });
+}
 
-  int scene_to_display = model_.defaultScene > -1 ? model_.defaultScene : 0;
-  const tinygltf::Scene &scene = model_.scenes[scene_to_display];
-  for (size_t n_idx = 0; n_idx < scene.nodes.size(); ++n_idx) {
-    RenderNode(scene.nodes[n_idx], glm::mat4(1.f), model_matrix);
+GLuint Model::GetTextureSampler(int texture_idx) {
+  tinygltf::Sampler sampler;
+  if (model_.textures[texture_idx].sampler >= 0) {
+    sampler = model_.samplers[model_.textures[texture_idx].sampler];
   }
+  return GPUResourceCache::GetShared().GetSampler(
+      sampler.minFilter > 0 ? sampler.minFilter : GL_LINEAR_MIPMAP_LINEAR,
+      sampler.magFilter > 0 ? sampler.magFilter : GL_LINEAR, sampler.wrapS,
+      sampler.wrapT);
+}
 
-  if (!last_enable_depth_test)
-    glDisable(GL_DEPTH_TEST);
-  if (!last_enable_multisample)
-    glDisable(GL_MULTISAMPLE);
+void Model::ReleaseCPUData() {
+  // Destroying the elements frees the images and the buffers.
+  model_ = tinygltf::Model();
+  gpu_buffer_views_.clear();
+  gpu_packed_accessors_.clear();
 }
 
-glm::mat4 GetNodeTransform(const tinygltf::Node &node) {
-  glm::mat4 node_transform(1.f);
-  if (node.matrix.size() == 16) {
-    std::copy(node.matrix.begin(), node.matrix.end(), &node_transform[0][0]);
-  } else {
-    glm::vec3 scale_vec(1.0, 1.0, 1.0);
-    glm::quat rot_vec(1.0, 0.0, 0.0, 0.0);
-    glm::vec3 trans_vec(0.0, 0.0, 0.0);
-    if (!node.scale.empty()) {
-      scale_vec = glm::vec3(node.scale[0], node.scale[1], node.scale[2]);
+size_t Model::MemoryReport::GetTotal() const {
+  return gltf_images + gltf_buffers + gltf_metadata + animation + scene_tree +
+         skinning + render_tables;
+}
+
+std::string Model::MemoryReport::ToString() const {
+  std::ostringstream oss;
+  oss << std::fixed << std::setprecision(1) << "images "
+      << gltf_images / 1024.0 << " KB, buffers " << gltf_buffers / 1024.0
+      << " KB, gltf metadata " << gltf_metadata / 1024.0
+      << " KB, animation " << animation / 1024.0 << " KB, scene tree "
+      << scene_tree / 1024.0 << " KB, skinning " << skinning / 1024.0
+      << " KB, render tables " << render_tables / 1024.0 << " KB, total "
+      << GetTotal() / 1024.0 << " KB";
+  return oss.str();
+}
+
+Model::MemoryReport Model::GetMemoryReport() const {
+  MemoryReport report;
+  for (const auto &image : model_.images) {
+    report.gltf_images += image.image.capacity();
+  }
+  for (const auto &buffer : model_.buffers) {
+    report.gltf_buffers += buffer.data.capacity();
+  }
+  report.gltf_metadata =
+      GetVectorBytes(model_.accessors) + GetVectorBytes(model_.bufferViews) +
+      GetVectorBytes(model_.materials) + GetVectorBytes(model_.meshes) +
+      GetVectorBytes(model_.nodes) + GetVectorBytes(model_.textures) +
+      GetVectorBytes(model_.images) + GetVectorBytes(model_.buffers) +
+      GetVectorBytes(model_.skins) + GetVectorBytes(model_.samplers) +
+      GetVectorBytes(model_.animations) + GetVectorBytes(model_.scenes);
+  for (const auto &mesh : model_.meshes) {
+    report.gltf_metadata += GetVectorBytes(mesh.primitives);
+  }
+  for (const auto &animation : model_.animations) {
+    report.gltf_metadata += GetVectorBytes(animation.channels) +
+                            GetVectorBytes(animation.samplers);
+  }
+  for (const auto &clip : animation_clips_) {
+    report.animation += clip.GetByteSize();
+  }
+  report.animation += GetVectorBytes(animation_clips_);
+  report.animation += GetVectorBytes(instance_lods_);
+  auto add_lod_bytes = [&report](const AnimationLod &lod) {
+    for (const auto *pose : {&lod.from_pose, &lod.to_pose}) {
+      report.animation += GetVectorBytes(pose->rotations) +
+                          GetVectorBytes(pose->translations) +
+                          GetVectorBytes(pose->scales);
     }
-    if (!node.rotation.empty()) {
-      rot_vec = glm::quat(node.rotation[3], node.rotation[0], node.rotation[1],
-                          node.rotation[2]);
+  };
+  add_lod_bytes(animation_lod_state_);
+  for (const auto &lod : instance_lods_) {
+    add_lod_bytes(lod);
+  }
+  report.scene_tree = scene_tree_.GetByteSize();
+  for (const auto &instance_tree : instance_trees_) {
+    report.scene_tree += instance_tree.GetByteSize();
+  }
+  report.skinning = GetVectorBytes(skinning_joints_) +
+                    GetVectorBytes(skinning_invbindmat_) +
+                    GetVectorBytes(skinning_palette_) +
+                    GetVectorBytes(instance_palettes_) +
+                    GetVectorBytes(level_palette_);
+  for (const auto &level : skeleton_lods_) {
+    report.skinning += GetVectorBytes(level.node_mask) +
+                       GetVectorBytes(level.joints) +
+                       GetVectorBytes(level.invbindmat) +
+                       GetVectorBytes(level.palette_indices);
+  }
+  for (const auto &mesh_render_params : mesh_render_params_) {
+    report.render_tables += GetVectorBytes(mesh_render_params.second);
+  }
+  for (const auto &children : node_children_) {
+    report.render_tables += GetVectorBytes(children);
+  }
+  for (const auto &static_batch : static_batches_) {
+    report.render_tables += GetVectorBytes(static_batch.ranges);
+  }
+  report.render_tables += GetVectorBytes(mesh_bounds_) +
+                          GetVectorBytes(joint_bounds_) +
+                          GetVectorBytes(instance_bounds_);
+  report.render_tables += GetVectorBytes(node_meshes_) +
+                          GetVectorBytes(node_children_) +
+                          GetVectorBytes(scene_roots_) +
+                          GetVectorBytes(cached_resources_) +
+                          GetVectorBytes(static_batches_) +
+                          GetVectorBytes(multi_draw_groups_) +
+                          GetVectorBytes(multi_draw_nodes_) +
+                          GetVectorBytes(multi_draw_colors_) +
+                          GetVectorBytes(multi_draw_commands_data_) +
+                          GetVectorBytes(multi_draw_frame_commands_) +
+                          GetVectorBytes(multi_draw_data_);
+  return report;
+}
+
+void Model::ReleaseResources() {
+  for (const auto &mesh_render_params : mesh_render_params_) {
+    for (const auto &render_params : mesh_render_params.second) {
+      glDeleteVertexArrays(1, &render_params.vao);
     }
-    if (!node.translation.empty()) {
-      trans_vec = glm::vec3(node.translation[0], node.translation[1],
-                            node.translation[2]);
+  }
+  mesh_render_params_.clear();
+  for (const auto &static_batch : static_batches_) {
+    glDeleteVertexArrays(1, &static_batch.render_params.vao);
+  }
+  static_batches_.clear();
+  node_batched_.clear();
+  glDeleteVertexArrays(1, &multi_draw_vao_);
+  glDeleteBuffers(1, &multi_draw_commands_);
+  glDeleteBuffers(1, &multi_draw_storage_);
+  multi_draw_vao_ = 0;
+  multi_draw_storage_ = 0;
+  multi_draw_commands_ = 0;
+  multi_draw_commands_data_.clear();
+  multi_draw_groups_.clear();
+  multi_draw_nodes_.clear();
+  multi_draw_colors_.clear();
+  source_draw_num_ = 0;
+  draw_num_ = 0;
+  for (const auto &key : cached_resources_) {
+    GPUResourceCache::GetShared().Release(key);
+  }
+  cached_resources_.clear();
+  gpu_buffer_views_.clear();
+  gpu_packed_accessors_.clear();
+  source_geometry_byte_size_ = 0;
+  geometry_byte_size_ = 0;
+}
+
+void Model::InitFromCooked(const std::string &cooked_path,
+                           const LoadOptions &options, LoadState &state) {
+  using namespace CookedModel;
+  MappedFile file;
+  if (!file.Open(cooked_path)) {
+    FailLoad(state, "Load " + cooked_path + " failed.");
+    return;
+  }
+  BinaryReader reader(file.GetData(), file.GetSize());
+  const FileHeader header = reader.Read<FileHeader>();
+  if (reader.IsFailed() || header.magic != kMagic ||
+      header.version != kVersion) {
+    FailLoad(state, cooked_path + " isn't a cooked model of version " +
+                        std::to_string(kVersion) +
+                        ", cook it again with sa_cook.");
+    return;
+  }
+  has_texture_ = header.flags & FLAG_HAS_TEXTURE;
+  is_skinning_ = header.flags & FLAG_SKINNED;
+
+  // Textures, the mips are decoded already. Read every level even when the
+  // cache has the texture.
+  GPUResourceCache &cache = GPUResourceCache::GetShared();
+  std::vector<GLuint> textures(reader.ReadCount(sizeof(TextureHeader)));
+  std::vector<GLuint> samplers(textures.size());
+  std::vector<LevelHeader> levels;
+  std::vector<const uint8_t *> level_pixels;
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  for (size_t t_idx = 0; t_idx < textures.size(); ++t_idx) {
+    const TextureHeader texture_header = reader.Read<TextureHeader>();
+    if (reader.IsFailed()) {
+      FailLoad(state, cooked_path + " is truncated.");
+      return;
     }
+    if (texture_header.level_num == 0 ||
+        texture_header.level_num > kMaxCookedLevelNum) {
+      FailLoad(state, cooked_path + " is corrupt.");
+      return;
+    }
+    levels.resize(texture_header.level_num);
+    level_pixels.resize(texture_header.level_num);
+    for (uint32_t l_idx = 0; l_idx < texture_header.level_num; ++l_idx) {
+      levels[l_idx] = reader.Read<LevelHeader>();
+      size_t byte_size = 0;
+      level_pixels[l_idx] = reader.ReadBlob(byte_size);
+      if (reader.IsFailed() ||
+          byte_size != size_t(levels[l_idx].width) * levels[l_idx].height * 4) {
+        FailLoad(state, cooked_path + " is truncated.");
+        return;
+      }
+    }
+    samplers[t_idx] =
+        cache.GetSampler(texture_header.min_filter, texture_header.mag_filter,
+                         texture_header.wrap_s, texture_header.wrap_t);
+
+    GPUResourceCache::Key key;
+    key.type = GPUResourceCache::RESOURCE_TEXTURE;
+    key.asset = asset_path_;
+    key.index = t_idx;
+    cached_resources_.push_back(key);
+    textures[t_idx] = cache.Acquire(key, [&](size_t &byte_size) {
+      GLuint texture = 0;
+      glGenTextures(1, &texture);
+      glBindTexture(GL_TEXTURE_2D, texture);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                      texture_header.level_num - 1);
+      for (uint32_t l_idx = 0; l_idx < texture_header.level_num; ++l_idx) {
+        glTexImage2D(GL_TEXTURE_2D, l_idx, GL_RGBA, levels[l_idx].width,
+                     levels[l_idx].height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     level_pixels[l_idx]);
+        byte_size += size_t(levels[l_idx].width) * levels[l_idx].height * 4;
+      }
+      glBindTexture(GL_TEXTURE_2D, 0);
+      return texture;
+    });
+  }
 
-    glm::mat4 cur_scale = glm::scale(glm::mat4(1.f), scale_vec);
-    glm::mat4 cur_rot = glm::toMat4(rot_vec);
-    glm::mat4 cur_trans = glm::translate(glm::mat4(1.f), trans_vec);
-    node_transform = cur_trans * cur_rot * cur_scale;
+  // Meshes, one interleaved vertex buffer per primitive. The buffers are
+  // cached by primitive order, vertices then indices.
+  const uint32_t mesh_num = reader.ReadCount(sizeof(uint32_t));
+  std::vector<VertexAttrib> attribs;
+  int buffer_idx = 0;
+  for (uint32_t m_idx = 0; m_idx < mesh_num; ++m_idx) {
+    auto &mesh_render_params = mesh_render_params_[m_idx];
+    const uint32_t primitive_num = reader.ReadCount(sizeof(PrimitiveHeader));
+    for (uint32_t p_idx = 0; p_idx < primitive_num; ++p_idx) {
+      const PrimitiveHeader primitive = reader.Read<PrimitiveHeader>();
+      reader.ReadVector(attribs);
+      size_t vertex_byte_size = 0;
+      const uint8_t *vertices = reader.ReadBlob(vertex_byte_size);
+      size_t index_byte_size = 0;
+      const uint8_t *indices = reader.ReadBlob(index_byte_size);
+      if (reader.IsFailed()) {
+        FailLoad(state, cooked_path + " is truncated.");
+        return;
+      }
+      if (!IsCookedPrimitiveValid(primitive, attribs, vertex_byte_size,
+                                  index_byte_size, textures.size())) {
+        FailLoad(state, cooked_path + " is corrupt.");
+        return;
+      }
+      source_geometry_byte_size_ += vertex_byte_size + index_byte_size;
+      geometry_byte_size_ += vertex_byte_size + index_byte_size;
+
+      RenderParams render_params;
+      render_params.mode = primitive.mode;
+      glGenVertexArrays(1, &render_params.vao);
+      glBindVertexArray(render_params.vao);
+      GPUResourceCache::Key key;
+      key.type = GPUResourceCache::RESOURCE_BUFFER;
+      key.asset = asset_path_;
+      key.index = buffer_idx++;
+      cached_resources_.push_back(key);
+      const GLuint vbo = cache.Acquire(key, [&](size_t &byte_size) {
+        GLuint buffer = 0;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, vertex_byte_size, vertices,
+                     GL_STATIC_DRAW);
+        byte_size = vertex_byte_size;
+        return buffer;
+      });
+      glBindBuffer(GL_ARRAY_BUFFER, vbo);
+      for (const auto &attrib : attribs) {
+        SetVertexAttrib(attrib.location, attrib.size, attrib.type,
+                        attrib.normalized != 0, primitive.stride,
+                        attrib.offset);
+      }
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+      if (primitive.index_type) {
+        // Recorded in the vao.
+        key.index = buffer_idx++;
+        cached_resources_.push_back(key);
+        render_params.indices_vbo = cache.Acquire(key, [&](size_t &byte_size) {
+          GLuint buffer = 0;
+          glGenBuffers(1, &buffer);
+          glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+          glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_byte_size, indices,
+                       GL_STATIC_DRAW);
+          byte_size = index_byte_size;
+          return buffer;
+        });
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, render_params.indices_vbo);
+        render_params.draw_type = DRAW_ELEMENT;
+        render_params.index_type = primitive.index_type;
+        render_params.count = primitive.index_num;
+      } else {
+        render_params.draw_type = DRAW_ARRAY;
+        render_params.count = primitive.vertex_num;
+      }
+      glBindVertexArray(0);
+      if (primitive.texture_idx >= 0) {
+        render_params.texture_id = textures[primitive.texture_idx];
+        render_params.sampler_id = samplers[primitive.texture_idx];
+      }
+      render_params.color =
+          glm::vec4(primitive.color[0], primitive.color[1],
+                    primitive.color[2], primitive.color[3]);
+      mesh_render_params.push_back(render_params);
+    }
   }
 
-  return node_transform;
-}
+  // Nodes.
+  const uint32_t node_num = reader.ReadCount(sizeof(uint32_t));
+  std::vector<std::string> node_names(node_num);
+  for (auto &node_name : node_names) {
+    node_name = reader.ReadString();
+  }
+  std::vector<int> parent_indices;
+  std::vector<float> rotations, translations, scales;
+  reader.ReadVector(parent_indices);
+  reader.ReadVector(node_meshes_);
+  reader.ReadVector(rotations);
+  reader.ReadVector(translations);
+  reader.ReadVector(scales);
+  node_children_.resize(node_num);
+  for (auto &children : node_children_) {
+    reader.ReadVector(children);
+  }
+  reader.ReadVector(scene_roots_);
+  if (reader.IsFailed()) {
+    FailLoad(state, cooked_path + " is truncated.");
+    return;
+  }
+  if (parent_indices.size() != node_num || node_meshes_.size() != node_num ||
+      rotations.size() != 4 * node_num ||
+      translations.size() != 3 * node_num || scales.size() != 3 * node_num ||
+      !IsNodeForest(parent_indices, node_children_) ||
+      !IsInRange(node_meshes_, -1, mesh_num) ||
+      !IsInRange(scene_roots_, 0, node_num)) {
+    FailLoad(state, cooked_path + " is corrupt.");
+    return;
+  }
+  scene_tree_.Init(node_names, parent_indices, rotations, translations,
+                   scales);
+
+  // Skin and animations.
+  reader.ReadVector(skinning_joints_);
+  reader.ReadVector(skinning_invbindmat_);
+  std::vector<double> joint_weights;
+  reader.ReadVector(joint_weights);
+  if (reader.IsFailed()) {
+    FailLoad(state, cooked_path + " is truncated.");
+    return;
+  }
+  if (skinning_invbindmat_.size() != skinning_joints_.size() ||
+      joint_weights.size() != skinning_joints_.size() ||
+      !IsInRange(skinning_joints_, 0, node_num)) {
+    FailLoad(state, cooked_path + " is corrupt.");
+    return;
+  }
+  if (is_skinning_) {
+    // See InitSkeletonLod, the joint weights are cooked.
+    SkeletonLod::Build(node_children_, node_meshes_, skinning_joints_,
+                       skinning_invbindmat_, joint_weights,
+                       options.skeleton_lod_mode, kAnimationLodNum,
+                       skeleton_lods_);
+  }
 
-void QTSToMatrix(const std::vector<float> &qts, Eigen::Matrix4f &matrix) {
-  Eigen::Matrix3f rotation = Eigen::Quaternion<float>(&qts[0]).matrix();
-  Eigen::Matrix4f scale = Eigen::Matrix4f::Identity();
-  scale(0, 0) = qts[7];
-  scale(1, 1) = qts[8];
-  scale(2, 2) = qts[9];
-
-  matrix = Eigen::Matrix4f::Identity();
-  matrix.block(0, 0, 3, 3) = rotation;
-
-  matrix = scale * matrix;
-  matrix.block(0, 3, 3, 1) << qts[4], qts[5], qts[6];
-}
-
-void MatrixToQTS(const Eigen::Matrix4f &matrix, std::vector<float> &qts) {
-  Eigen::Matrix4f mat = matrix;
-
-  qts = std::vector<float>(10, 0);
-  Eigen::Matrix<float, 1, 3> x_vec, y_vec, z_vec;
-  x_vec << mat(0, 0), mat(0, 1), mat(0, 2);
-  y_vec << mat(1, 0), mat(1, 1), mat(1, 2);
-  z_vec << mat(2, 0), mat(2, 1), mat(2, 2);
-
-  float scale_x = x_vec.norm();
-  float scale_y = y_vec.norm();
-  float scale_z = z_vec.norm();
-  x_vec.normalize();
-  y_vec.normalize();
-  z_vec.normalize();
-  mat.block(0, 0, 1, 3) = x_vec;
-  mat.block(1, 0, 1, 3) = y_vec;
-  mat.block(2, 0, 1, 3) = z_vec;
-
-  Eigen::Matrix3f rot_mat = mat.block(0, 0, 3, 3);
-
-  Eigen::Quaternion<float> qua(rot_mat);
-  qts[0] = qua.x();
-  qts[1] = qua.y();
-  qts[2] = qua.z();
-  qts[3] = qua.w();
-  qts[4] = mat(0, 3);
-  qts[5] = mat(1, 3);
-  qts[6] = mat(2, 3);
-  qts[7] = scale_x;
-  qts[8] = scale_y;
-  qts[9] = scale_z;
-}
-
-void Model::RenderNode(int node_idx, const glm::mat4 &parent_transform,
-                       const glm::mat4 &model_matrix) {
-  const auto &node = model_.nodes[node_idx];
-  const Eigen::Matrix4f &node_local = scene_tree_.GetNode(node_idx)->local_mat_;
-  glm::mat4 cur_transform(1.f);
-  std::copy(node_local.data(), node_local.data() + node_local.size(),
-            &cur_transform[0][0]);
-  cur_transform = parent_transform * cur_transform;
-  if (node.mesh > -1) {
-    // Set model matrix.
-    if (is_skinning_) {
-      // If use skinning, the scene_tree has setted the node transforms in the
-      // GetSkinningPoseData. So I only need to set model_matrix.
-      shader_.Set("model_matrix", model_matrix);
-    } else {
-      shader_.Set("model_matrix", model_matrix * cur_transform);
+  // Bounds, see InitBounds.
+  reader.ReadVector(mesh_bounds_);
+  reader.ReadVector(joint_bounds_);
+  if (reader.IsFailed()) {
+    FailLoad(state, cooked_path + " is truncated.");
+    return;
+  }
+  if (mesh_bounds_.size() != mesh_num ||
+      joint_bounds_.size() != skinning_joints_.size()) {
+    FailLoad(state, cooked_path + " is corrupt.");
+    return;
+  }
+  animation_clips_.resize(reader.ReadCount(sizeof(uint32_t)));
+  for (auto &clip : animation_clips_) {
+    if (!clip.Deserialize(reader, node_num)) {
+      FailLoad(state, cooked_path + (reader.IsFailed() ? " is truncated."
+                                                       : " is corrupt."));
+      return;
     }
-
-    RenderMesh(node.mesh);
   }
-  for (size_t c_idx = 0; c_idx < node.children.size(); ++c_idx) {
-    RenderNode(node.children[c_idx], cur_transform, model_matrix);
+  if (reader.IsFailed()) {
+    FailLoad(state, cooked_path + " is truncated.");
   }
 }
 
-void Model::RenderMesh(int mesh_idx) {
-  const auto &mesh = model_.meshes[mesh_idx];
-  for (size_t p_idx = 0; p_idx < mesh.primitives.size(); ++p_idx) {
-    const auto &primitive = mesh.primitives[p_idx];
-    const auto &render_params = mesh_render_params_[mesh_idx][p_idx];
-    glBindVertexArray(render_params.vao);
+void Model::ResolveUniformHandles(Shader &shader, UniformHandles &handles) {
+  handles.view_matrix = shader.GetUniformHandle("view_matrix");
+  handles.proj_matrix = shader.GetUniformHandle("proj_matrix");
+  handles.model_matrix = shader.GetUniformHandle("model_matrix");
+  handles.diffuse_texture =
+      shader.GetUniformHandle("diffuse_texture", !has_texture_);
+  handles.vertex_color = shader.GetUniformHandle("vertex_color", has_texture_);
+}
+
+void Model::SetFrameUniforms(RenderQueue &render_queue, Shader &shader,
+                             const UniformHandles &handles,
+                             const glm::mat4 &view_matrix,
+                             const glm::mat4 &proj_matrix) {
+  // Per frame uniforms are program state, set them now. The draws are
+  // submitted to render_queue.
+  GLStateCache &state_cache = render_queue.GetStateCache();
+  state_cache.UseProgram(shader.GetProgramId());
+  shader.Set(handles.view_matrix, view_matrix);
+  shader.Set(handles.proj_matrix, proj_matrix);
+  shader.Set(handles.diffuse_texture, 0);
+  state_cache.CountIssued(handles.diffuse_texture.IsValid() ? 3 : 2);
+}
 
-    int mode = GLTFRenderMode(primitive.mode);
+RenderQueue::DrawItem Model::MakeDrawItem(Shader &shader,
+                                          const UniformHandles &handles,
+                                          const SkinningPalette *palette,
+                                          const glm::mat4 &model_matrix,
+                                          int instance_num) {
+  RenderQueue::DrawItem item;
+  item.shader = &shader;
+  item.skinning_palette = palette;
+  item.model_matrix_handle = handles.model_matrix;
+  item.model_matrix = model_matrix;
+  item.color_handle = handles.vertex_color;
+  item.instance_num = instance_num;
+  return item;
+}
 
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    glEnableVertexAttribArray(2);
-    if (is_skinning_) {
-      glEnableVertexAttribArray(3);
-      glEnableVertexAttribArray(4);
+void Model::Render(RenderQueue &render_queue, const glm::mat4 &view_matrix,
+                   const glm::mat4 &proj_matrix,
+                   const glm::mat4 &model_matrix) {
+  BeginCulling(view_matrix, proj_matrix);
+  const int lod_tier = SelectAnimationLod(pose_bounds_, model_matrix);
+  UpdatePose(IsPoseCulled(pose_bounds_, model_matrix), lod_tier);
+  influence_lod_variant_ = skin_influence_lod_ ? lod_tier : 0;
+
+  if (!multi_draw_groups_.empty()) {
+    SetFrameUniforms(render_queue, multi_draw_shader_,
+                     multi_draw_uniform_handles_, view_matrix, proj_matrix);
+    RenderMultiDraw(render_queue, model_matrix);
+    return;
+  }
+  SetFrameUniforms(render_queue, shader_, uniform_handles_, view_matrix,
+                   proj_matrix);
+  SetInfluenceFrameUniforms(render_queue, false, view_matrix, proj_matrix);
+  RenderScene(render_queue,
+              MakeDrawItem(shader_, uniform_handles_,
+                           is_skinning_ ? &skinning_palette_buffer_ : nullptr,
+                           model_matrix, 1));
+}
+
+void Model::RenderInstances(RenderQueue &render_queue,
+                            const glm::mat4 &view_matrix,
+                            const glm::mat4 &proj_matrix,
+                            const std::vector<InstanceState> &instances) {
+  if (instances.empty()) {
+    return;
+  }
+  BeginCulling(view_matrix, proj_matrix);
+  if (!is_skinning_) {
+    // No palette to carry the instance transform, pose once and draw the
+    // instances one by one. The shared pose is needed if any instance may
+    // be seen.
+    bool is_culled = true;
+    int lod_tier = kAnimationLodNum - 1;
+    for (const auto &instance : instances) {
+      is_culled =
+          is_culled && IsPoseCulled(pose_bounds_, instance.model_matrix);
+      lod_tier = std::min(
+          lod_tier, SelectAnimationLod(pose_bounds_, instance.model_matrix));
+    }
+    UpdatePose(is_culled, lod_tier);
+    SetFrameUniforms(render_queue, shader_, uniform_handles_, view_matrix,
+                     proj_matrix);
+    for (const auto &instance : instances) {
+      RenderScene(render_queue, MakeDrawItem(shader_, uniform_handles_, nullptr,
+                                             instance.model_matrix, 1));
     }
+    return;
+  }
 
-    if (render_params.texture_id) {
-      // Enable texture sampler.
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, render_params.texture_id);
-      shader_.Set("diffuse_texture", 0);
+  const int instance_num = instances.size();
+  const int joint_num = skinning_joints_.size();
+  if (instance_palette_buffer_.GetInstanceCapacity() == 0) {
+    // Crowds don't fit in a uniform block.
+    instance_palette_buffer_.Init(joint_num, instance_num, true);
+    instanced_shader_.SetDefines(instance_palette_buffer_.GetShaderDefines());
+    instanced_shader_.InitFromFile(vs_path_, fs_path_);
+    ResolveUniformHandles(instanced_shader_, instanced_uniform_handles_);
+    InitInfluenceShaders(true, instance_palette_buffer_.GetShaderDefines());
+  }
+  instance_palette_buffer_.Reserve(instance_num);
+  while (instance_trees_.size() < instances.size()) {
+    instance_trees_.push_back(scene_tree_.Copy());
+  }
+  instance_bounds_.resize(instance_trees_.size());
+  instance_lods_.resize(instance_trees_.size());
 
-    } else {
-      shader_.Set("vertex_color", render_params.color);
+  const double time_stamp = GetTimeStampSecond();
+  if (instance_start_time_ < 0) {
+    instance_start_time_ = time_stamp;
+  }
+  instance_palettes_.resize(instance_num * joint_num);
+  pose_updated_node_num_ = 0;
+  // The palettes of the visible instances are packed, gl_InstanceID indexes
+  // them.
+  int visible_num = 0;
+  AABB crowd_bounds;
+  // The instanced draws use the influences of the finest visible tier.
+  int finest_tier = kAnimationLodNum - 1;
+  for (int i_idx = 0; i_idx < instance_num; ++i_idx) {
+    const auto &instance = instances[i_idx];
+    auto &scene_tree = instance_trees_[i_idx];
+    // The clip time comes from the time stamp, nothing to advance.
+    if (IsPoseCulled(instance_bounds_[i_idx], instance.model_matrix)) {
+      ++culled_instance_num_;
+      ++skipped_pose_num_;
+      continue;
+    }
+    const int lod_tier =
+        SelectAnimationLod(instance_bounds_[i_idx], instance.model_matrix);
+    const SkeletonLod::Level *skeleton_level = GetSkeletonLevel(lod_tier);
+    scene_tree.SetNodeMask(skeleton_level ? &skeleton_level->node_mask
+                                          : nullptr);
+    if (instance.animation_index >= 0 &&
+        instance.animation_index < animation_size_) {
+      const float phase = std::fmod(i_idx * kPhaseStep, 1.f);
+      SampleAnimation(instance.animation_index,
+                      time_stamp - instance_start_time_ + instance.time_offset,
+                      lod_tier, phase, scene_tree, instance_lods_[i_idx]);
+    }
+    scene_tree.UpdateGlobalPose();
+    pose_updated_node_num_ += scene_tree.TakeUpdatedNodeNum();
+    BuildSkinningPalette(scene_tree, skeleton_level);
+    instance_bounds_[i_idx] =
+        Bounds::GetSkinnedBounds(joint_bounds_, skinning_palette_.data());
+    const AABB world_bounds =
+        instance_bounds_[i_idx].Transform(instance.model_matrix);
+    if (frustum_culling_ && !frustum_.Intersects(world_bounds)) {
+      ++culled_instance_num_;
+      continue;
     }
 
-    if (render_params.draw_type == DRAW_ARRAY) {
-      glDrawArrays(mode, 0, render_params.count);
-    } else if (render_params.draw_type == DRAW_ELEMENT) {
-      const auto &index_accessor = model_.accessors[primitive.indices];
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,
-                   gpu_buffer_views_[index_accessor.bufferView]);
-      glDrawElements(mode, render_params.count, index_accessor.componentType,
-                     (GLvoid *)(index_accessor.byteOffset));
+    // Bake the world transform into the palette, the shader uses an
+    // identity model matrix.
+    const AffineMatrix world =
+        AffineKernel::FromMatrix4(Eigen::Matrix4f(&instance.model_matrix[0][0]));
+    AffineMatrix *instance_palette =
+        &instance_palettes_[visible_num * joint_num];
+    for (int j_idx = 0; j_idx < joint_num; ++j_idx) {
+      AffineKernel::Multiply(world, skinning_palette_[j_idx],
+                             instance_palette[j_idx]);
     }
+    crowd_bounds.Extend(world_bounds);
+    finest_tier = std::min(finest_tier, lod_tier);
+    ++visible_num;
+  }
+  if (visible_num == 0) {
+    return;
+  }
+  instance_palettes_.resize(visible_num * joint_num);
+  instance_palette_buffer_.Upload(instance_palettes_);
+  // The instanced draws are tested against the visible instances.
+  skinned_bounds_ = crowd_bounds;
+
+  influence_lod_variant_ = skin_influence_lod_ ? finest_tier : 0;
+  SetFrameUniforms(render_queue, instanced_shader_, instanced_uniform_handles_,
+                   view_matrix, proj_matrix);
+  SetInfluenceFrameUniforms(render_queue, true, view_matrix, proj_matrix);
+  RenderScene(render_queue,
+              MakeDrawItem(instanced_shader_, instanced_uniform_handles_,
+                           &instance_palette_buffer_, glm::mat4(1.f),
+                           visible_num));
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glDisableVertexAttribArray(0);
-    glDisableVertexAttribArray(1);
-    glDisableVertexAttribArray(2);
+void Model::BeginCulling(const glm::mat4 &view_matrix,
+                         const glm::mat4 &proj_matrix) {
+  frustum_.Init(proj_matrix * view_matrix);
+  submitted_draw_num_ = 0;
+  culled_draw_num_ = 0;
+  culled_instance_num_ = 0;
+  skipped_pose_num_ = 0;
+  lod_view_matrix_ = view_matrix;
+  lod_proj_scale_ = proj_matrix[1][1];
+  std::fill(animation_lod_pose_nums_,
+            animation_lod_pose_nums_ + kAnimationLodNum, 0);
+  sampled_pose_num_ = 0;
+  evaluated_joint_num_ = 0;
+  std::fill(influence_draw_nums_, influence_draw_nums_ + kInfluenceVariantNum,
+            0);
+}
+
+bool Model::IsPoseCulled(const AABB &pose_bounds,
+                         const glm::mat4 &model_matrix) const {
+  // Empty until the first evaluated pose.
+  return animation_culling_ && frustum_culling_ && !pose_bounds.IsEmpty() &&
+         !frustum_.Intersects(
+             pose_bounds.Grow(animation_culling_margin_).Transform(
+                 model_matrix));
+}
+
+void Model::UpdatePose(bool is_culled, int lod_tier) {
+  // Set the animation index manually.
+  const bool has_clip = animation_size_ > 0 && animation_index_ >= 0 &&
+                        animation_index_ < animation_size_;
+  if (is_culled) {
+    // Only the clock advances, the draws are culled by the same bounds.
+    if (has_clip) {
+      scene_tree_.AdvanceAnimationFrame(animation_index_,
+                                        GetTimeStampSecond());
+    }
+    pose_updated_node_num_ = 0;
+    ++skipped_pose_num_;
     if (is_skinning_) {
-      glDisableVertexAttribArray(3);
-      glDisableVertexAttribArray(4);
+      skinned_bounds_ = pose_bounds_;
     }
-    glBindVertexArray(0);
+    return;
+  }
+  const SkeletonLod::Level *skeleton_level = GetSkeletonLevel(lod_tier);
+  scene_tree_.SetNodeMask(skeleton_level ? &skeleton_level->node_mask
+                                         : nullptr);
+  if (has_clip) {
+    scene_tree_.AdvanceAnimationFrame(animation_index_, GetTimeStampSecond());
+    SampleAnimation(animation_index_, scene_tree_.GetAnimationTime(),
+                    lod_tier, 0.f, scene_tree_, animation_lod_state_);
+  }
+
+  scene_tree_.UpdateGlobalPose();
+  pose_updated_node_num_ = scene_tree_.TakeUpdatedNodeNum();
+  if (is_skinning_) {
+    BuildSkinningPalette(scene_tree_, skeleton_level);
+    skinning_palette_buffer_.Upload(skinning_palette_);
+    skinned_bounds_ =
+        Bounds::GetSkinnedBounds(joint_bounds_, skinning_palette_.data());
+    pose_bounds_ = skinned_bounds_;
+  } else {
+    pose_bounds_ =
+        animation_culling_ || animation_lod_ ? GetSceneBounds() : AABB();
   }
 }
 
-void Model::ProcessBufferView(const tinygltf::Accessor &accessor) {
-  if (cpu_buffer_views_.find(accessor.bufferView) != cpu_buffer_views_.end()) {
+void Model::InitInfluenceShaders(bool is_instanced,
+                                 const std::vector<std::string> &defines) {
+  influence_shaders_inited_[is_instanced] = false;
+  for (int v_idx = 1; v_idx < kInfluenceVariantNum; ++v_idx) {
+    std::vector<std::string> variant_defines = defines;
+    variant_defines.push_back("SKINNING_INFLUENCE_NUM " +
+                              std::to_string(kInfluenceNums[v_idx]));
+    const int s_idx = GetInfluenceShaderIndex(is_instanced, v_idx);
+    influence_shaders_[s_idx].SetDefines(variant_defines);
+    if (!influence_shaders_[s_idx].InitFromFile(vs_path_, fs_path_)) {
+      LOG(WARNING) << asset_path_
+                   << " skin influence shader failed, draw 4 influences.";
+      return;
+    }
+    ResolveUniformHandles(influence_shaders_[s_idx],
+                          influence_uniform_handles_[s_idx]);
+  }
+  influence_shaders_inited_[is_instanced] = true;
+}
+
+void Model::SetInfluenceFrameUniforms(RenderQueue &render_queue,
+                                      bool is_instanced,
+                                      const glm::mat4 &view_matrix,
+                                      const glm::mat4 &proj_matrix) {
+  if (!is_skinning_ || !influence_shaders_inited_[is_instanced]) {
     return;
   }
-  const auto &buffer_view = model_.bufferViews[accessor.bufferView];
-  const auto &buffer = model_.buffers[buffer_view.buffer];
-  std::vector<uint8_t> &data = cpu_buffer_views_[accessor.bufferView];
-  data.resize(buffer_view.byteLength, 0);
-  std::copy(buffer.data.data() + buffer_view.byteOffset,
-            buffer.data.data() + buffer_view.byteOffset +
-                buffer_view.byteLength,
-            data.data());
-  if (accessor.sparse.isSparse) {
-    const size_t size_of_object_in_buffer =
-        GLTFComponentByteSize(accessor.componentType);
-    const size_t size_of_sparse_indices =
-        GLTFComponentByteSize(accessor.sparse.indices.componentType);
-    const auto &indices_buffer_view =
-        model_.bufferViews[accessor.sparse.indices.bufferView];
-    const auto &indices_buffer = model_.buffers[indices_buffer_view.buffer];
-    const auto &values_buffer_view =
-        model_.bufferViews[accessor.sparse.values.bufferView];
-    const auto &values_buffer = model_.buffers[values_buffer_view.buffer];
-
-    for (size_t sparse_idx = 0; sparse_idx < accessor.sparse.count;
-         ++sparse_idx) {
-      int index = 0;
-      switch (accessor.sparse.indices.componentType) {
-      case TINYGLTF_COMPONENT_TYPE_BYTE:
-      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-        index = (int)*(unsigned char *)(indices_buffer.data.data() +
-                                        indices_buffer_view.byteOffset +
-                                        accessor.sparse.indices.byteOffset +
-                                        (sparse_idx * size_of_sparse_indices));
-        break;
-      case TINYGLTF_COMPONENT_TYPE_SHORT:
-      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-        index = (int)*(unsigned short *)(indices_buffer.data.data() +
-                                         indices_buffer_view.byteOffset +
-                                         accessor.sparse.indices.byteOffset +
-                                         (sparse_idx * size_of_sparse_indices));
-        break;
-      case TINYGLTF_COMPONENT_TYPE_INT:
-      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-        index = (int)*(unsigned int *)(indices_buffer.data.data() +
-                                       indices_buffer_view.byteOffset +
-                                       accessor.sparse.indices.byteOffset +
-                                       (sparse_idx * size_of_sparse_indices));
-        break;
-      }
-      const uint8_t *read_from =
-          values_buffer.data.data() +
-          (values_buffer_view.byteOffset + accessor.sparse.values.byteOffset) +
-          (sparse_idx * (size_of_object_in_buffer * accessor.type));
+  for (int v_idx = 1; v_idx < kInfluenceVariantNum; ++v_idx) {
+    const int s_idx = GetInfluenceShaderIndex(is_instanced, v_idx);
+    SetFrameUniforms(render_queue, influence_shaders_[s_idx],
+                     influence_uniform_handles_[s_idx], view_matrix,
+                     proj_matrix);
+  }
+}
 
-      uint8_t *write_to =
-          data.data() + index * (size_of_object_in_buffer * accessor.type);
-      memcpy(write_to, read_from, size_of_object_in_buffer * accessor.type);
-    }
+int Model::GetInfluenceVariant(const RenderParams &render_params,
+                               bool is_instanced) const {
+  if (!influence_shaders_inited_[is_instanced]) {
+    return 0;
+  }
+  int variant = 0;
+  while (variant + 1 < kInfluenceVariantNum &&
+         kInfluenceNums[variant + 1] >= render_params.influence_num) {
+    ++variant;
   }
+  // Fewer influences than needed pick the largest ones.
+  if (render_params.influence_sorted) {
+    variant = std::max(variant, influence_lod_variant_);
+  }
+  return variant;
 }
 
-GLuint Model::ProcessBufferView(const tinygltf::Accessor &accessor,
-                                GLenum buffer_type) {
-  if (gpu_buffer_views_.find(accessor.bufferView) != gpu_buffer_views_.end()) {
-    return gpu_buffer_views_[accessor.bufferView];
+const SkeletonLod::Level *Model::GetSkeletonLevel(int lod_tier) const {
+  if (!skeleton_lod_ || lod_tier == 0 || lod_tier >= skeleton_lods_.size()) {
+    return nullptr;
   }
+  return &skeleton_lods_[lod_tier];
+}
 
-  const auto &buffer_view = model_.bufferViews[accessor.bufferView];
-  const auto &buffer = model_.buffers[buffer_view.buffer];
-  GLuint vbo = 0;
-  glGenBuffers(1, &vbo);
-  glBindBuffer(buffer_type, vbo);
-  gpu_buffer_views_[accessor.bufferView] = vbo;
+void Model::BuildSkinningPalette(SceneTree &scene_tree,
+                                 const SkeletonLod::Level *level) {
+  if (level == nullptr) {
+    scene_tree.GetSkinningPoseData(skinning_joints_, skinning_invbindmat_,
+                                   skinning_palette_);
+    evaluated_joint_num_ += skinning_joints_.size();
+    return;
+  }
+  // A dropped joint takes the entry of its kept ancestor, as if its
+  // vertices were skinned to it.
+  scene_tree.GetSkinningPoseData(level->joints, level->invbindmat,
+                                 level_palette_);
+  skinning_palette_.resize(skinning_joints_.size());
+  for (size_t j_idx = 0; j_idx < skinning_joints_.size(); ++j_idx) {
+    skinning_palette_[j_idx] = level_palette_[level->palette_indices[j_idx]];
+  }
+  evaluated_joint_num_ += level->joints.size();
+}
 
-  if (!accessor.sparse.isSparse) {
-    // parse raw data.
-    glBufferData(buffer_type, buffer_view.byteLength,
-                 &buffer.data.at(0) + buffer_view.byteOffset, GL_STATIC_DRAW);
-  } else {
-    // parse sparse data.
-    std::vector<uint8_t> sparse_data(buffer_view.byteLength, 0);
-    std::copy(buffer.data.data() + buffer_view.byteOffset,
-              buffer.data.data() + buffer_view.byteOffset +
-                  buffer_view.byteLength,
-              sparse_data.data());
-
-    const size_t size_of_object_in_buffer =
-        GLTFComponentByteSize(accessor.componentType);
-    const size_t size_of_sparse_indices =
-        GLTFComponentByteSize(accessor.sparse.indices.componentType);
-    const auto &indices_buffer_view =
-        model_.bufferViews[accessor.sparse.indices.bufferView];
-    const auto &indices_buffer = model_.buffers[indices_buffer_view.buffer];
-    const auto &values_buffer_view =
-        model_.bufferViews[accessor.sparse.values.bufferView];
-    const auto &values_buffer = model_.buffers[values_buffer_view.buffer];
-
-    for (size_t sparse_idx = 0; sparse_idx < accessor.sparse.count;
-         ++sparse_idx) {
-      int index = 0;
-      switch (accessor.sparse.indices.componentType) {
-      case TINYGLTF_COMPONENT_TYPE_BYTE:
-      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-        index = (int)*(unsigned char *)(indices_buffer.data.data() +
-                                        indices_buffer_view.byteOffset +
-                                        accessor.sparse.indices.byteOffset +
-                                        (sparse_idx * size_of_sparse_indices));
-        break;
-      case TINYGLTF_COMPONENT_TYPE_SHORT:
-      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-        index = (int)*(unsigned short *)(indices_buffer.data.data() +
-                                         indices_buffer_view.byteOffset +
-                                         accessor.sparse.indices.byteOffset +
-                                         (sparse_idx * size_of_sparse_indices));
-        break;
-      case TINYGLTF_COMPONENT_TYPE_INT:
-      case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-        index = (int)*(unsigned int *)(indices_buffer.data.data() +
-                                       indices_buffer_view.byteOffset +
-                                       accessor.sparse.indices.byteOffset +
-                                       (sparse_idx * size_of_sparse_indices));
-        break;
-      }
-      const uint8_t *read_from =
-          values_buffer.data.data() +
-          (values_buffer_view.byteOffset + accessor.sparse.values.byteOffset) +
-          (sparse_idx * (size_of_object_in_buffer * accessor.type));
+int Model::SelectAnimationLod(const AABB &pose_bounds,
+                              const glm::mat4 &model_matrix) const {
+  if ((!animation_lod_ && !skeleton_lod_ && !skin_influence_lod_) ||
+      pose_bounds.IsEmpty()) {
+    return 0;
+  }
+  const AABB view_bounds =
+      pose_bounds.Transform(lod_view_matrix_ * model_matrix);
+  const glm::vec3 center = (view_bounds.min + view_bounds.max) * 0.5f;
+  const glm::vec3 extent = (view_bounds.max - view_bounds.min) * 0.5f;
+  const float radius = std::sqrt(glm::dot(extent, extent));
+  // The view looks down -z, closer than radius the camera may be inside.
+  const float distance = -center.z;
+  if (distance <= radius) {
+    return 0;
+  }
+  const float screen_size = radius * lod_proj_scale_ / distance;
+  int tier = 0;
+  while (tier < kAnimationLodNum - 1 &&
+         screen_size < kAnimationLodScreenSizes[tier]) {
+    ++tier;
+  }
+  return tier;
+}
 
-      uint8_t *write_to = sparse_data.data() +
-                          index * (size_of_object_in_buffer * accessor.type);
-      memcpy(write_to, read_from, size_of_object_in_buffer * accessor.type);
+void Model::SampleAnimation(int clip_idx, double anim_time, int lod_tier,
+                            float phase, SceneTree &scene_tree,
+                            AnimationLod &lod) {
+  const AnimationClip &clip = animation_clips_[clip_idx];
+  if (!animation_lod_) {
+    scene_tree.SetAnimationTime(clip, anim_time);
+    ++sampled_pose_num_;
+    return;
+  }
+  ++animation_lod_pose_nums_[lod_tier];
+  if (lod.tier != lod_tier) {
+    lod.tier = lod_tier;
+    lod.clip_idx = -1;
+  }
+  // Sample k is at (k - phase) / rate, period k blends samples k and k + 1.
+  const double rate = kAnimationLodRates[lod_tier];
+  const double sample_pos = anim_time * rate + phase;
+  const int64_t period = static_cast<int64_t>(std::floor(sample_pos));
+  if (lod.clip_idx != clip_idx || lod.period != period) {
+    if (lod.clip_idx == clip_idx && lod.period + 1 == period) {
+      // The end of the last period starts this one.
+      std::swap(lod.from_pose, lod.to_pose);
+    } else {
+      scene_tree.SetAnimationTime(clip, std::max((period - phase) / rate, 0.0));
+      scene_tree.SaveLocalPose(lod.from_pose);
+      ++sampled_pose_num_;
     }
-    glBufferData(buffer_view.target, buffer_view.byteLength, sparse_data.data(),
-                 GL_STATIC_DRAW);
+    scene_tree.SetAnimationTime(clip, (period + 1 - phase) / rate);
+    scene_tree.SaveLocalPose(lod.to_pose);
+    ++sampled_pose_num_;
+    lod.clip_idx = clip_idx;
+    lod.period = period;
   }
-  glBindBuffer(buffer_type, 0);
-  return vbo;
+  scene_tree.BlendLocalPose(lod.from_pose, lod.to_pose,
+                            static_cast<float>(sample_pos - period));
 }
 
-void SceneTree::Init(const tinygltf::Model &model) {
-  node_array_.clear();
-  node_name2index_map_.clear();
-  for (size_t n_idx = 0; n_idx < model.nodes.size(); ++n_idx) {
-    const auto &node = model.nodes[n_idx];
-    glm::mat4 node_transform = GetNodeTransform(node);
-    node_array_.push_back(STLMakeSharedOfEigenTypes<SceneTreeNode>(
-        n_idx, -1, node.name, Eigen::Matrix4f(&node_transform[0][0]),
-        Eigen::Matrix4f::Identity()));
-    node_name2index_map_[node.name] = n_idx;
+AABB Model::GetSceneBounds() const {
+  AABB result;
+  if (mesh_bounds_.empty()) {
+    return result;
+  }
+  for (const auto &static_batch : static_batches_) {
+    result.Extend(static_batch.bounds);
   }
-  for (size_t n_idx = 0; n_idx < model.nodes.size(); ++n_idx) {
-    const auto &node = model.nodes[n_idx];
-    for (const auto &child_idx : node.children) {
-      node_array_[child_idx]->parent_idx_ = n_idx;
+  std::vector<int> node_stack = scene_roots_;
+  while (!node_stack.empty()) {
+    const int node_idx = node_stack.back();
+    node_stack.pop_back();
+    const int mesh_idx = node_meshes_[node_idx];
+    if (mesh_idx >= 0 && (node_batched_.empty() || !node_batched_[node_idx])) {
+      const Eigen::Matrix4f node_global = scene_tree_.GetGlobalMatrix(node_idx);
+      glm::mat4 node_matrix;
+      std::copy(node_global.data(), node_global.data() + node_global.size(),
+                &node_matrix[0][0]);
+      result.Extend(mesh_bounds_[mesh_idx].Transform(node_matrix));
     }
+    node_stack.insert(node_stack.end(), node_children_[node_idx].begin(),
+                      node_children_[node_idx].end());
   }
-  BuildGraph();
-  // only update inv_bind_mat_ when initing.
-  UpdateGlobalPose(true);
+  return result;
 }
 
-SceneTree::SceneTree(const std::vector<SceneTreeNode::Ptr> &input_bone_array)
-    : node_array_(input_bone_array) {
-  for (auto bone_ptr : node_array_) {
-    node_name2index_map_[bone_ptr->name_] = bone_ptr->idx_;
+AABB Model::GetDrawBounds(int mesh_idx) const {
+  if (is_skinning_) {
+    return skinned_bounds_;
   }
-  BuildGraph();
-  UpdateGlobalPose();
+  return mesh_bounds_.empty() ? AABB() : mesh_bounds_[mesh_idx];
 }
 
-SceneTree SceneTree::Copy() const {
-  std::vector<SceneTreeNode::Ptr> new_bone_array;
-  for (const auto &cur_bone_ptr : node_array_) {
-    new_bone_array.push_back(STLMakeSharedOfEigenTypes<SceneTreeNode>(
-        cur_bone_ptr->idx_, cur_bone_ptr->parent_idx_, cur_bone_ptr->name_,
-        cur_bone_ptr->local_mat_, cur_bone_ptr->global_mat_));
+bool Model::CullDraws(const AABB &bounds, const glm::mat4 &model_matrix,
+                      int draw_num) {
+  if (!frustum_culling_ ||
+      frustum_.Intersects(bounds.Transform(model_matrix))) {
+    return false;
   }
-  return SceneTree(new_bone_array);
+  culled_draw_num_ += draw_num;
+  return true;
 }
 
-glm::vec3 SceneTree::GetRootTrans() const {
-  return glm::vec3(root_->left_node_->global_mat_(0, 3),
-                   root_->left_node_->global_mat_(1, 3),
-                   root_->left_node_->global_mat_(2, 3));
+void Model::RenderScene(RenderQueue &render_queue,
+                        const RenderQueue::DrawItem &base_item) {
+  // The static node transforms are in the batch vertices.
+  for (const auto &static_batch : static_batches_) {
+    if (!CullDraws(is_skinning_ ? skinned_bounds_ : static_batch.bounds,
+                   base_item.model_matrix, 1)) {
+      SubmitDraw(render_queue, static_batch.render_params, base_item);
+    }
+  }
+  for (int root_idx : scene_roots_) {
+    RenderNode(render_queue, root_idx, glm::mat4(1.f), base_item);
+  }
 }
 
-void SceneTree::BuildGraph() {
-  CHECK(!this->graph_inited_) << "graph is already initialized.";
-  root_ = STLMakeSharedOfEigenTypes<SceneTreeNode>(
-      -1, -1, "", Eigen::Matrix4f::Identity(), Eigen::Matrix4f::Identity());
-  for (auto i = 0; i < this->node_array_.size(); i++) {
-    auto &cur_bone_ptr = this->node_array_[i];
-    SceneTreeNode::Ptr parent_ptr;
-    if (cur_bone_ptr->parent_idx_ == -1) {
-      parent_ptr = root_;
-    } else {
-      parent_ptr = this->node_array_[cur_bone_ptr->parent_idx_];
+void Model::RenderMultiDraw(RenderQueue &render_queue,
+                            const glm::mat4 &model_matrix) {
+  // The skinned nodes are posed by the palette, like RenderNode.
+  std::vector<bool> &draw_visible = multi_draw_visible_;
+  draw_visible.resize(multi_draw_nodes_.size());
+  multi_draw_data_.resize(multi_draw_nodes_.size() * kDrawDataFloatNum);
+  for (size_t d_idx = 0; d_idx < multi_draw_nodes_.size(); ++d_idx) {
+    const int node_idx = multi_draw_nodes_[d_idx];
+    glm::mat4 draw_matrix = model_matrix;
+    if (!is_skinning_) {
+      const Eigen::Matrix4f node_global = scene_tree_.GetGlobalMatrix(node_idx);
+      glm::mat4 node_matrix;
+      std::copy(node_global.data(), node_global.data() + node_global.size(),
+                &node_matrix[0][0]);
+      draw_matrix = model_matrix * node_matrix;
     }
-    if (parent_ptr->left_node_ == nullptr) {
-      parent_ptr->left_node_ = cur_bone_ptr;
-    } else {
-      cur_bone_ptr->right_node_ = parent_ptr->left_node_;
-      parent_ptr->left_node_ = cur_bone_ptr;
+    draw_visible[d_idx] =
+        !CullDraws(GetDrawBounds(node_meshes_[node_idx]), draw_matrix, 1);
+    float *draw_data = &multi_draw_data_[d_idx * kDrawDataFloatNum];
+    std::copy(&draw_matrix[0][0], &draw_matrix[0][0] + 16, draw_data);
+    std::copy(&multi_draw_colors_[d_idx][0], &multi_draw_colors_[d_idx][0] + 4,
+              draw_data + 16);
+  }
+
+  RenderQueue::DrawItem item = MakeDrawItem(
+      multi_draw_shader_, multi_draw_uniform_handles_,
+      is_skinning_ ? &skinning_palette_buffer_ : nullptr, model_matrix, 1);
+  item.vao = multi_draw_vao_;
+  item.mode = GL_TRIANGLES;
+  item.index_type = multi_draw_index_type_;
+  item.indirect_buffer = multi_draw_commands_;
+  item.storage_buffer = multi_draw_storage_;
+  // The visible commands of a group stay contiguous, their base instance
+  // still indexes the draw data of every draw.
+  multi_draw_frame_commands_.clear();
+  for (const auto &group : multi_draw_groups_) {
+    const size_t first_command = multi_draw_frame_commands_.size();
+    for (int c_idx = group.first_command;
+         c_idx < group.first_command + group.command_num; ++c_idx) {
+      if (draw_visible[c_idx]) {
+        multi_draw_frame_commands_.push_back(multi_draw_commands_data_[c_idx]);
+      }
     }
-  }
-  this->graph_inited_ = true;
-}
-
-void SceneTree::UpdateGlobalPose(bool with_inverse) {
-  // Use depth first search to update global matrix.
-  STLVectorOfEigenTypes<std::pair<SceneTreeNode::Ptr, Eigen::Matrix4f>> s;
-  s.push_back(std::make_pair(root_->left_node_, Eigen::Matrix4f::Identity()));
-
-  while (!s.empty()) {
-    SceneTreeNode::Ptr cur_node = s.back().first;
-    Eigen::Matrix4f global_transfrom = s.back().second;
-    s.pop_back();
-
-    // push brother node.
-    if (cur_node->right_node_ != nullptr) {
-      s.push_back(std::make_pair(cur_node->right_node_, global_transfrom));
-    }
-    Eigen::Matrix4f local_mat = cur_node->local_mat_;
-    global_transfrom = global_transfrom * local_mat;
-    cur_node->global_mat_ = global_transfrom;
-    if (cur_node->left_node_ != nullptr) {
-      s.push_back(std::make_pair(cur_node->left_node_, global_transfrom));
-    }
-  }
-}
-
-void SceneTree::GetSkinningPoseData(
-    const std::vector<int> &skinning_joints,
-    const STLVectorOfEigenTypes<Eigen::Matrix4f> &skinning_invbindmat,
-    std::vector<float> &skinning_pose_data) {
-  skinning_pose_data.resize(skinning_joints.size() * 16, 0);
-  for (int i = 0; i < skinning_joints.size(); ++i) {
-    int b_idx = skinning_joints[i];
-    Eigen::Matrix4f pose_mat =
-        node_array_[b_idx]->global_mat_ * skinning_invbindmat[i];
-    std::copy(pose_mat.data(), pose_mat.data() + 16,
-              &skinning_pose_data[16 * i]);
-  }
-}
-
-void SceneTree::SetAnimationFrame(const tinygltf::Model &model, int anim_idx,
-                                  double time_stamp) {
-  CHECK(anim_idx >= 0 && anim_idx < model.animations.size())
-      << "anim_idx is beyond model.animations array.";
-  if (last_anim_index_ != anim_idx) {
-    last_anim_index_ = anim_idx;
-    anim_timestamp_ = time_stamp;
-  }
-  anim_time_ = time_stamp - anim_timestamp_;
-
-  // no animation information.
-  const auto &animation_samplers = model.animations[anim_idx].samplers;
-  const auto &animation_channels = model.animations[anim_idx].channels;
-
-  for (int chan_idx = 0; chan_idx < animation_channels.size(); ++chan_idx) {
-    const auto &cur_anim_channel = animation_channels[chan_idx];
-    const auto &cur_anim_sampler = animation_samplers[cur_anim_channel.sampler];
-
-    // Currently only support rotation animation.
-    // Cause I only used this program for rigid body.
-    int node_idx = cur_anim_channel.target_node;
-    Eigen::Matrix4f cur_local = node_array_[node_idx]->local_mat_;
-    std::vector<float> qts_array;
-    MatrixToQTS(cur_local, qts_array);
-
-    const auto &time_accessor = model.accessors[cur_anim_sampler.input];
-    const auto &value_accessor = model.accessors[cur_anim_sampler.output];
-
-    const auto &time_buffer_view = model.bufferViews[time_accessor.bufferView];
-    const auto &time_buffer = model.buffers[time_buffer_view.buffer];
-
-    const float *time_ptr = reinterpret_cast<const float *>(
-        time_buffer.data.data() + time_buffer_view.byteOffset +
-        time_accessor.byteOffset);
-    int time_elm_size = GLTFTypeElmSize(time_accessor.type);
-    std::vector<float> time_arr(time_ptr,
-                                time_accessor.count * time_elm_size + time_ptr);
-
-    double max_time = *time_arr.rbegin();
-
-    const auto &value_buffer_view =
-        model.bufferViews[value_accessor.bufferView];
-    const auto &value_buffer = model.buffers[value_buffer_view.buffer];
-    const float *value_ptr = reinterpret_cast<const float *>(
-        value_buffer.data.data() + value_buffer_view.byteOffset +
-        value_accessor.byteOffset);
-    int value_elm_size = GLTFTypeElmSize(value_accessor.type);
-    std::vector<float> value_arr(value_ptr, value_ptr + value_accessor.count *
-                                                            value_elm_size);
-    double cur_mod_time = GetMod(anim_time_, max_time);
-    auto time_iter =
-        std::lower_bound(time_arr.begin(), time_arr.end(), cur_mod_time);
-    int index = time_iter - time_arr.begin() - 1;
-    if (index < 0)
-      index = 0;
-
-    float weight = (cur_mod_time - time_arr[index]) /
-                   (time_arr[index + 1] - time_arr[index]);
-
-    // Interpolate the animation.
-    if (cur_anim_channel.target_path == "rotation") {
-      // find the left
-      glm::quat quat_left(value_arr[4 * index + 3], value_arr[4 * index + 0],
-                          value_arr[4 * index + 1], value_arr[4 * index + 2]);
-      glm::quat quat_right(
-          value_arr[4 * (index + 1) + 3], value_arr[4 * (index + 1) + 0],
-          value_arr[4 * (index + 1) + 1], value_arr[4 * (index + 1) + 2]);
-      glm::quat quat_slerp = glm::shortMix(quat_left, quat_right, weight);
-      qts_array[0] = quat_slerp.x;
-      qts_array[1] = quat_slerp.y;
-      qts_array[2] = quat_slerp.z;
-      qts_array[3] = quat_slerp.w;
-    } else if (cur_anim_channel.target_path == "translation") {
-      qts_array[4] = (1 - weight) * value_arr[3 * index + 0] +
-                     weight * value_arr[3 * (index + 1) + 0];
-      qts_array[5] = (1 - weight) * value_arr[3 * index + 1] +
-                     weight * value_arr[3 * (index + 1) + 1];
-      qts_array[6] = (1 - weight) * value_arr[3 * index + 2] +
-                     weight * value_arr[3 * (index + 1) + 2];
-    } else if (cur_anim_channel.target_path == "scale") {
-      qts_array[7] = (1 - weight) * value_arr[3 * index + 0] +
-                     weight * value_arr[3 * (index + 1) + 0];
-      qts_array[8] = (1 - weight) * value_arr[3 * index + 1] +
-                     weight * value_arr[3 * (index + 1) + 1];
-      qts_array[9] = (1 - weight) * value_arr[3 * index + 2] +
-                     weight * value_arr[3 * (index + 1) + 2];
-    }
-    QTSToMatrix(qts_array, node_array_[node_idx]->local_mat_);
-  }
-}
-
-void SceneTree::SetLocalPose(const std::vector<float> &transform_array) {
-  CHECK(!node_array_.empty()) << "Bonemap is not inited!";
-  int mat_size = node_array_[0]->local_mat_.size();
-  CHECK(transform_array.size() == node_array_.size() * mat_size)
-      << "transform_array size is invalid: " << transform_array.size()
-      << "(wish " << node_array_.size() * mat_size << ").";
-
-  for (int b_idx = 0; b_idx < node_array_.size(); ++b_idx) {
-    node_array_[b_idx]->local_mat_ =
-        Eigen::Map<const Eigen::Matrix4f>(&transform_array[b_idx * mat_size]);
-  }
-}
-
-void SceneTree::GetGlobalKeypoints(
-    const std::vector<std::string> &keypoint_names,
-    std::vector<glm::vec3> &keypoints) {
-  keypoints.clear();
-  UpdateGlobalPose();
-  for (auto cur_name : keypoint_names) {
-    auto cur_bone = node_array_[node_name2index_map_[cur_name]];
-    keypoints.push_back(glm::vec3(cur_bone->global_mat_(0, 3),
-                                  cur_bone->global_mat_(1, 3),
-                                  cur_bone->global_mat_(2, 3)));
-  }
-}
-
-SceneTree SceneTree::Split(
-    const std::vector<std::string> &scene_tree_ordered_name) const {
-  std::vector<bool> scene_tree_valid(this->node_array_.size(), false);
-  std::map<int, int> oldIdx2newIdx_map;
-  std::vector<SceneTreeNode::Ptr> new_bone_array(
-      scene_tree_ordered_name.size());
-
-  for (auto i = 0; i < scene_tree_ordered_name.size(); i++) {
-    auto bone_name = scene_tree_ordered_name[i];
-    CHECK(this->node_name2index_map_.find(bone_name) !=
-          this->node_name2index_map_.end())
-        << "can't find bone " << bone_name;
-    auto cur_idx = this->node_name2index_map_.at(bone_name);
-    scene_tree_valid[cur_idx] = true;
-    oldIdx2newIdx_map[cur_idx] = i;
-  }
-  for (auto i = 0; i < this->node_array_.size(); i++) {
-    auto bone_ptr = this->node_array_[i];
-    if (!scene_tree_valid[i])
+    if (multi_draw_frame_commands_.size() == first_command) {
       continue;
+    }
+    item.texture = group.texture_id;
+    item.sampler = group.sampler_id;
+    item.indirect_offset = first_command * sizeof(DrawCommand);
+    item.draw_num = multi_draw_frame_commands_.size() - first_command;
+    submitted_draw_num_ += item.draw_num;
+    render_queue.Submit(item);
+  }
+  if (multi_draw_frame_commands_.empty()) {
+    return;
+  }
 
-    auto new_idx = oldIdx2newIdx_map[i];
-    auto old_parent_idx = bone_ptr->parent_idx_;
-    Eigen::Matrix4f local_mat = bone_ptr->local_mat_;
-    int new_parent_idx = -1;
-    while (old_parent_idx != -1) {
-      auto parent_ptr = this->node_array_[old_parent_idx];
-      if (scene_tree_valid[old_parent_idx]) {
-        new_parent_idx = oldIdx2newIdx_map[old_parent_idx];
-        break;
-      } else {
-        local_mat = parent_ptr->local_mat_ * local_mat;
-        old_parent_idx = parent_ptr->parent_idx_;
-      }
+  // Orphan the storage, the draws of the previous frames keep theirs.
+  const size_t data_byte_size = multi_draw_data_.size() * sizeof(float);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, multi_draw_storage_);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, data_byte_size, nullptr,
+               GL_STREAM_DRAW);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, data_byte_size,
+                  multi_draw_data_.data());
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  const size_t command_byte_size =
+      multi_draw_frame_commands_.size() * sizeof(DrawCommand);
+  // The indirect buffer binding is shadowed by the state cache.
+  render_queue.GetStateCache().BindDrawIndirectBuffer(multi_draw_commands_);
+  glBufferData(GL_DRAW_INDIRECT_BUFFER, command_byte_size, nullptr,
+               GL_STREAM_DRAW);
+  glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, command_byte_size,
+                  multi_draw_frame_commands_.data());
+}
+
+glm::mat4 GetNodeTransform(const tinygltf::Node &node) {
+  glm::mat4 node_transform(1.f);
+  if (node.matrix.size() == 16) {
+    std::copy(node.matrix.begin(), node.matrix.end(), &node_transform[0][0]);
+  } else {
+    glm::vec3 scale_vec(1.0, 1.0, 1.0);
+    glm::quat rot_vec(1.0, 0.0, 0.0, 0.0);
+    glm::vec3 trans_vec(0.0, 0.0, 0.0);
+    if (!node.scale.empty()) {
+      scale_vec = glm::vec3(node.scale[0], node.scale[1], node.scale[2]);
+    }
+    if (!node.rotation.empty()) {
+      rot_vec = glm::quat(node.rotation[3], node.rotation[0], node.rotation[1],
+                          node.rotation[2]);
+    }
+    if (!node.translation.empty()) {
+      trans_vec = glm::vec3(node.translation[0], node.translation[1],
+                            node.translation[2]);
     }
-    new_parent_idx =
-        (old_parent_idx == -1) ? -1 : oldIdx2newIdx_map[old_parent_idx];
 
-    new_bone_array[new_idx] = STLMakeSharedOfEigenTypes<SceneTreeNode>(
-        new_idx, new_parent_idx, this->node_array_[i]->name_, local_mat,
-        this->node_array_[i]->global_mat_);
+    glm::mat4 cur_scale = glm::scale(glm::mat4(1.f), scale_vec);
+    glm::mat4 cur_rot = glm::toMat4(rot_vec);
+    glm::mat4 cur_trans = glm::translate(glm::mat4(1.f), trans_vec);
+    node_transform = cur_trans * cur_rot * cur_scale;
   }
-  SceneTree result(new_bone_array);
-  result.UpdateGlobalPose();
-  return result;
+
+  return node_transform;
 }
 
-SceneTree SceneTree::UpdateTransform(
-    const std::vector<std::string> &ordered_names,
-    const STLVectorOfEigenTypes<Eigen::Matrix4f> &transforms) const {
-  CHECK(ordered_names.size() == transforms.size())
-      << ordered_names.size() << ", " << transforms.size();
-  std::vector<SceneTreeNode::Ptr> new_bone_array(this->node_array_.size(),
-                                                 nullptr);
-
-  for (auto i = 0; i < new_bone_array.size(); i++) {
-    new_bone_array[i] = STLMakeSharedOfEigenTypes<SceneTreeNode>(
-        this->node_array_[i]->idx_, this->node_array_[i]->parent_idx_,
-        this->node_array_[i]->name_, this->node_array_[i]->local_mat_,
-        this->node_array_[i]->global_mat_);
-  }
-  for (auto i = 0; i < ordered_names.size(); i++) {
-    auto bone_name = ordered_names[i];
-    auto transform = transforms[i];
-    auto iter = this->node_name2index_map_.find(bone_name);
-    CHECK(iter != this->node_name2index_map_.end())
-        << "can't find bone " << bone_name;
-    auto cur_idx = iter->second;
-    new_bone_array[cur_idx]->local_mat_ =
-        new_bone_array[cur_idx]->local_mat_ * transform;
-  }
-  SceneTree result(new_bone_array);
-  result.UpdateGlobalPose();
-  return result;
+void Model::RenderNode(RenderQueue &render_queue, int node_idx,
+                       const glm::mat4 &parent_transform,
+                       const RenderQueue::DrawItem &base_item) {
+  Eigen::Matrix4f node_local = scene_tree_.GetLocalMatrix(node_idx);
+  glm::mat4 cur_transform(1.f);
+  std::copy(node_local.data(), node_local.data() + node_local.size(),
+            &cur_transform[0][0]);
+  cur_transform = parent_transform * cur_transform;
+  const int mesh_idx = node_meshes_[node_idx];
+  const bool is_batched = !node_batched_.empty() && node_batched_[node_idx];
+  if (mesh_idx > -1 && !is_batched) {
+    // If use skinning, the node transforms are in the skinning palette. So I
+    // only need model_matrix.
+    RenderQueue::DrawItem item = base_item;
+    if (!is_skinning_) {
+      item.model_matrix = base_item.model_matrix * cur_transform;
+    }
+    if (!CullDraws(GetDrawBounds(mesh_idx), item.model_matrix,
+                   mesh_render_params_[mesh_idx].size())) {
+      RenderMesh(render_queue, mesh_idx, item);
+    }
+  }
+  for (int child_idx : node_children_[node_idx]) {
+    RenderNode(render_queue, child_idx, cur_transform, base_item);
+  }
 }
 
-void SceneTree::SetNodeTranslation(const glm::vec3 &translation,
-                                   const std::string &node_name) {
-  node_array_[this->node_name2index_map_.at(node_name)]->local_mat_.block(0, 3,
-                                                                          3, 1)
-      << translation.x,
-      translation.y, translation.z;
-}
-
-void SceneTree::AddFakedBoneNode(
-    const std::vector<std::string> &bone_names,
-    const std::vector<std::string> &parent_names,
-    const STLVectorOfEigenTypes<Eigen::Matrix4f> &rest_mats) {
-  int cur_offset = this->node_array_.size();
-  for (auto i = 0; i < bone_names.size(); i++) {
-    auto iter = this->node_name2index_map_.find(parent_names[i]);
-    CHECK(iter != this->node_name2index_map_.end())
-        << "can't find bone " << parent_names[i];
-    this->node_name2index_map_[bone_names[i]] = cur_offset;
-    SceneTreeNode::Ptr parent_ptr = this->node_array_[iter->second];
-
-    Eigen::Matrix4f global_mat = parent_ptr->global_mat_ * rest_mats[i];
-    SceneTreeNode::Ptr new_bone_ptr = STLMakeSharedOfEigenTypes<SceneTreeNode>(
-        cur_offset++, iter->second, bone_names[i], rest_mats[i], global_mat);
-
-    if (parent_ptr->left_node_ == nullptr) {
-      parent_ptr->left_node_ = new_bone_ptr;
-    } else {
-      new_bone_ptr->right_node_ = parent_ptr->left_node_;
-      parent_ptr->left_node_ = new_bone_ptr;
-    }
-    this->node_array_.emplace_back(new_bone_ptr);
-  }
-}
-
-void SceneTree::GetLocalTransform(std::vector<float> &transform_array) {
-  CHECK(!node_array_.empty()) << "Bonemap hasn't been inited!";
-  int mat_size = node_array_[0]->local_mat_.size();
-  std::vector<float> cur_transform_array(mat_size * node_array_.size());
-
-  for (int b_idx = 0; b_idx < node_array_.size(); ++b_idx) {
-    std::copy(node_array_[b_idx]->local_mat_.data(),
-              node_array_[b_idx]->local_mat_.data() +
-                  node_array_[b_idx]->local_mat_.size(),
-              &cur_transform_array[mat_size * b_idx]);
-  }
-  transform_array = cur_transform_array;
-}
-
-void SceneTree::SetBoneTranslation(const std::string &bone_name,
-                                   const glm::vec3 &translation,
-                                   std::vector<float> &transform_array) {
-  auto bone_iter = node_name2index_map_.find(bone_name);
-  CHECK(bone_iter != node_name2index_map_.end())
-      << "Bonename : " << bone_name << " doesn't exist in bone_array!";
-  Eigen::Matrix4f cur_transform_matrix(
-      &transform_array[16 * bone_iter->second]);
-  cur_transform_matrix.block(0, 3, 3, 1) << translation.x, translation.y,
-      translation.z;
-  std::copy(cur_transform_matrix.data(),
-            cur_transform_matrix.data() + cur_transform_matrix.size(),
-            &transform_array[16 * bone_iter->second]);
-}
-
-void SceneTree::ConvertLocalRotationToGlobalRotation(
-    const STLVectorOfEigenTypes<Eigen::Matrix4f> &local_rotation_mats,
-    STLVectorOfEigenTypes<Eigen::Matrix4f> &global_rotation_mats) {
-  CHECK(local_rotation_mats.size() == node_array_.size())
-      << "local_rotation_mats size(" << local_rotation_mats.size()
-      << ") doesn't match bone_array size(" << node_array_.size() << ")";
-  global_rotation_mats.resize(local_rotation_mats.size(),
-                              Eigen::Matrix4f::Identity());
-  for (int b_idx = 0; b_idx < node_array_.size(); ++b_idx) {
-    // Remove the offset, and convert local rotation to global rotaiton.
-    Eigen::Matrix4f global_mat = Eigen::Matrix4f::Identity();
-    global_mat.block(0, 0, 3, 3) =
-        node_array_[b_idx]->global_mat_.block(0, 0, 3, 3);
-    // local_rotation_mats is use on local_vec, to make it global,
-    // I need use local_vec = global_mat.inverse() * global_vec
-    // So global rotation (use on global vec and under global coordinate) is
-    // global_mat * local_rotation_mats[b_idx] * global_mat.inverse().
-    global_rotation_mats[b_idx] =
-        global_mat * local_rotation_mats[b_idx] * global_mat.inverse();
+void Model::RenderMesh(RenderQueue &render_queue, int mesh_idx,
+                       const RenderQueue::DrawItem &base_item) {
+  for (const auto &render_params : mesh_render_params_[mesh_idx]) {
+    SubmitDraw(render_queue, render_params, base_item);
+  }
+}
+
+void Model::SubmitDraw(RenderQueue &render_queue,
+                       const RenderParams &render_params,
+                       const RenderQueue::DrawItem &base_item) {
+  // The attrib arrays and the index buffer are recorded in the vao.
+  RenderQueue::DrawItem item = base_item;
+  ++submitted_draw_num_;
+  Shader::UniformHandle color_handle = base_item.color_handle;
+  if (is_skinning_) {
+    const bool is_instanced = base_item.shader == &instanced_shader_;
+    const int variant = GetInfluenceVariant(render_params, is_instanced);
+    if (variant > 0) {
+      const int s_idx = GetInfluenceShaderIndex(is_instanced, variant);
+      item.shader = &influence_shaders_[s_idx];
+      item.model_matrix_handle = influence_uniform_handles_[s_idx].model_matrix;
+      color_handle = influence_uniform_handles_[s_idx].vertex_color;
+    }
+    ++influence_draw_nums_[variant];
+  }
+  item.vao = render_params.vao;
+  item.mode = render_params.mode;
+  item.count = render_params.count;
+  item.texture = render_params.texture_id;
+  item.sampler = render_params.sampler_id;
+  item.color_handle =
+      render_params.texture_id ? Shader::UniformHandle() : color_handle;
+  item.color = render_params.color;
+  if (render_params.draw_type == DRAW_ELEMENT) {
+    item.index_type = render_params.index_type;
+    item.index_offset = render_params.index_offset;
+  } else {
+    item.index_type = 0;
+    item.index_offset = 0;
   }
+  render_queue.Submit(item);
+}
+
+GLuint Model::ProcessBufferView(int accessor_idx, GLenum buffer_type,
+                                int &byte_stride, size_t &byte_offset) {
+  const auto &accessor = model_.accessors[accessor_idx];
+  if (accessor.sparse.isSparse || accessor.bufferView < 0) {
+    // The sparse values differ per accessor, patch a packed copy of the
+    // elements instead of the shared bufferView.
+    const AccessorView view(model_, loader_.GetBufferSpans(), accessor);
+    byte_stride = view.GetElementByteSize();
+    byte_offset = 0;
+    auto iter = gpu_packed_accessors_.find(accessor_idx);
+    if (iter != gpu_packed_accessors_.end()) {
+      return iter->second;
+    }
+    std::vector<uint8_t> packed;
+    view.ReadPacked(packed);
+    const GLuint vbo =
+        AcquireBuffer(GPUResourceCache::RESOURCE_PACKED_BUFFER, accessor_idx,
+                      buffer_type, packed);
+    glBindBuffer(buffer_type, 0);
+    gpu_packed_accessors_[accessor_idx] = vbo;
+    source_geometry_byte_size_ += packed.size();
+    geometry_byte_size_ += packed.size();
+    return vbo;
+  }
+
+  const auto &buffer_view = model_.bufferViews[accessor.bufferView];
+  byte_stride = accessor.ByteStride(buffer_view);
+  CHECK(byte_stride != -1) << "byte_strid equal -1";
+  byte_offset = accessor.byteOffset;
+  if (gpu_buffer_views_.find(accessor.bufferView) != gpu_buffer_views_.end()) {
+    return gpu_buffer_views_[accessor.bufferView];
+  }
+
+  GPUResourceCache::Key key;
+  key.type = GPUResourceCache::RESOURCE_BUFFER;
+  key.asset = asset_path_;
+  key.index = accessor.bufferView;
+  cached_resources_.push_back(key);
+  const GLuint vbo = GPUResourceCache::GetShared().Acquire(
+      key, [&](size_t &byte_size) {
+        byte_size = buffer_view.byteLength;
+        return UploadBufferView(buffer_view, buffer_type);
+      });
+  gpu_buffer_views_[accessor.bufferView] = vbo;
+  source_geometry_byte_size_ += buffer_view.byteLength;
+  geometry_byte_size_ += buffer_view.byteLength;
+  return vbo;
+}
+
+GLuint Model::UploadBufferView(const tinygltf::BufferView &buffer_view,
+                               GLenum buffer_type) {
+  const uint8_t *buffer_data = GetBufferData(buffer_view.buffer);
+  GLuint vbo = 0;
+  glGenBuffers(1, &vbo);
+  glBindBuffer(buffer_type, vbo);
+  glBufferData(buffer_type, buffer_view.byteLength,
+               buffer_data + buffer_view.byteOffset, GL_STATIC_DRAW);
+  glBindBuffer(buffer_type, 0);
+  return vbo;
 }
 
 int GLTFTypeElmSize(int type) {
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <GL/gl3w.h>
+#include <atomic>
+#include <functional>
 #include <glm/glm.hpp>
 #include <memory>
 #include <set>
@@ -9,188 +11,131 @@
 #include <vector>
 
 
+#include "common/thread_pool.h"
 #include "common/utility.h"
+#include "graphic/animation.h"
+#include "graphic/bounds.h"
+#include "graphic/gltf_loader.h"
+#include "graphic/gpu_resource_cache.h"
+#include "graphic/render_queue.h"
+#include "graphic/scene_tree.h"
 #include "graphic/shader.h"
+#include "graphic/skeleton_lod.h"
+#include "graphic/skinning_palette.h"
+#include "graphic/static_batcher.h"
+#include "graphic/vertex_compaction.h"
 
 // Helper function.
 size_t GLTFComponentByteSize(int type);
 int GLTFTypeElmSize(int type);
 GLenum GLTFRenderMode(int mode);
 glm::mat4 GetNodeTransform(const tinygltf::Node &node);
-void QTSToMatrix(const std::vector<float> &qts, Eigen::Matrix4f &matrix);
-void MatrixToQTS(const Eigen::Matrix4f &_matrix, std::vector<float> &qts);
 
-// Define the skeleton
-class SceneTreeNode {
-public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-  using Ptr = std::shared_ptr<SceneTreeNode>;
-
-  SceneTreeNode() = delete;
-  SceneTreeNode(int index, int parent_idx, const std::string &name,
-                const Eigen::Matrix4f &local_mat,
-                const Eigen::Matrix4f &global_mat)
-      : idx_(index), parent_idx_(parent_idx), name_(name),
-        local_mat_(local_mat), global_mat_(global_mat) {}
-  ~SceneTreeNode() = default;
-
-  int idx_;
-  int parent_idx_;
-  std::string name_;
-  Eigen::Matrix4f local_mat_;
-  Eigen::Matrix4f global_mat_;
-
-  // left node for first child.
-  Ptr left_node_ = nullptr;
-  // right node for brother.
-  Ptr right_node_ = nullptr;
-};
-
-class SceneTree {
+class Model {
 public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
-  SceneTree() = default;
-  ~SceneTree() = default;
-
-  void Init(const tinygltf::Model &model);
-
-  SceneTree Copy() const;
-
-  void UpdateGlobalPose(bool with_inverse = false);
-  // Before get, you may need UpdateGlobalPose first if the local pose has been
-  // changed.
-  void GetSkinningPoseData(
-      const std::vector<int> &skinning_joints,
-      const STLVectorOfEigenTypes<Eigen::Matrix4f> &skinning_invbindmat,
-      std::vector<float> &skinning_pose_data);
-  void SetAnimationFrame(const tinygltf::Model &model, int anim_idx, double time_stamp);
-  void ResetAnimationTimer() {
-    anim_time_ = 0;
-    anim_timestamp_ = -1;
-  }
-
-  void SetLocalPose(const std::vector<float> &transform_array);
-
-  void GetGlobalKeypoints(const std::vector<std::string> &keypoint_names,
-                          std::vector<glm::vec3> &keypoints);
-
-  // split current skeleton into smaller one
-  SceneTree Split(const std::vector<std::string> &skeleton_ordered_name) const;
-
-  SceneTree UpdateTransform(
-      const std::vector<std::string> &ordered_names,
-      const STLVectorOfEigenTypes<Eigen::Matrix4f> &transforms) const;
-
-  void SetNodeTranslation(const glm::vec3 &translation,
-                          const std::string &node_names);
-
-  int GetNodeNum() const { return node_array_.size(); }
-
-  SceneTreeNode::Ptr GetNode(const std::string &node_name) {
-    if (node_name2index_map_.find(node_name) != node_name2index_map_.end()) {
-      return GetNode(node_name2index_map_[node_name]);
-    } else {
-      LOG(WARNING) << "Node: " << node_name
-                   << " doesn't exist in the node array";
-      return nullptr;
-    }
-  }
-  SceneTreeNode::Ptr GetNode(int node_idx) { return node_array_[node_idx]; }
-
-  glm::vec3 GetRootTrans() const;
-
-  // recover pose by eular angle.
-  template <typename T>
-  void RecoverPose(Eigen::Matrix<T, Eigen::Dynamic, 3> &result_pose,
-                   const std::vector<T> &params = {},
-                   const std::vector<Eigen::Vector3d> &bone_transforms = {},
-                   bool use_xyz = true) const {
-    STLVectorOfEigenTypes<std::pair<SceneTreeNode::Ptr, Eigen::Matrix<T, 4, 4>>>
-        queue;
-    queue.push_back(
-        std::make_pair(root_->left_node_, Eigen::Matrix<T, 4, 4>::Identity()));
-    while (!queue.empty()) {
-      SceneTreeNode::Ptr cur_node = queue.back().first;
-      Eigen::Matrix<T, 4, 4> global_transform = queue.back().second;
-      queue.pop_back();
-
-      if (cur_node->right_node_ != nullptr) {
-        queue.push_back(
-            std::make_pair(cur_node->right_node_, global_transform));
-      }
-      Eigen::Matrix<T, 4, 4> rest_mat = cur_node->local_mat_.template cast<T>();
-      if (!bone_transforms.empty() && cur_node->name_ != "Root_M") {
-        rest_mat.block(0, 3, 3, 1) << bone_transforms[cur_node->idx_].cast<T>();
-      }
-      global_transform = global_transform * rest_mat;
-      if (cur_node->left_node_ != nullptr && !params.empty()) {
-        Eigen::Matrix<T, 4, 4> local_transform =
-            Eigen::Matrix<T, 4, 4>::Identity();
-        Eigen::Matrix<T, 3, 3> cur_rotation =
-            Eigen::Matrix<T, 3, 3>::Identity();
-        if (use_xyz) {
-          cur_rotation = Eigen::AngleAxis<T>(params[3 * cur_node->idx_ + 2],
-                                             Eigen::Matrix<T, 3, 1>::UnitZ()) *
-                         Eigen::AngleAxis<T>(params[3 * cur_node->idx_ + 1],
-                                             Eigen::Matrix<T, 3, 1>::UnitY()) *
-                         Eigen::AngleAxis<T>(params[3 * cur_node->idx_ + 0],
-                                             Eigen::Matrix<T, 3, 1>::UnitX());
-        } else {
-          cur_rotation = Eigen::AngleAxis<T>(params[3 * cur_node->idx_ + 0],
-                                             Eigen::Matrix<T, 3, 1>::UnitX()) *
-                         Eigen::AngleAxis<T>(params[3 * cur_node->idx_ + 1],
-                                             Eigen::Matrix<T, 3, 1>::UnitY()) *
-                         Eigen::AngleAxis<T>(params[3 * cur_node->idx_ + 2],
-                                             Eigen::Matrix<T, 3, 1>::UnitZ());
-        }
-        local_transform.block(0, 0, 3, 3) = cur_rotation;
-        global_transform = global_transform * local_transform;
-      }
-      result_pose.row(cur_node->idx_) << global_transform(0, 3),
-          global_transform(1, 3), global_transform(2, 3);
-      if (cur_node->left_node_ != nullptr) {
-        queue.push_back(std::make_pair(cur_node->left_node_, global_transform));
-      }
-    }
-  }
-
-  void
-  AddFakedBoneNode(const std::vector<std::string> &bone_names,
-                   const std::vector<std::string> &parent_names,
-                   const STLVectorOfEigenTypes<Eigen::Matrix4f> &rest_mats);
-
-  // only support entire skeleton
-  void GetLocalTransform(std::vector<float> &transfrom_array);
+  enum DrawType { DRAW_ARRAY = 0, DRAW_ELEMENT = 1 };
+  struct LoadOptions {
+    // Map the .glb binary chunk and the external .bin files instead of
+    // copying them, the mappings are released at the end of Init.
+    bool map_buffers = true;
+    // Decode the images and compile the clips on ThreadPool::GetShared(),
+    // only the GL calls stay on the calling thread.
+    bool parallel = true;
+    // Keep the tinygltf model(decoded images, buffers) after the upload,
+    // only the runtime tables are needed to render.
+    bool keep_gltf = false;
+    // Convert the gltf primitives to the compact vertex formats of
+    // VertexCompaction on the pool, the cooked models are uploaded as is.
+    bool compact_vertices = false;
+    // Merge the static meshes sharing a material into one draw, see
+    // StaticBatcher. gltf only, like compact_vertices.
+    bool batch_static = false;
+    // Draw the whole model from one vertex and index arena with one
+    // glMultiDrawElementsIndirect per texture, the node matrices and colors
+    // in a shader storage buffer. Needs a GL 4.3 context, the per primitive
+    // draws are kept for older ones and for RenderInstances. gltf only.
+    bool multi_draw = false;
+    // How the joint sets of SetSkeletonLod are chosen. gltf only.
+    SkeletonLod::Mode skeleton_lod_mode = SkeletonLod::MODE_WEIGHT;
+  };
 
-  // calculate the rotation under global(Identity) coordinate.
-  void SetBoneTranslation(const std::string &bone_name,
-                          const glm::vec3 &translation,
-                          std::vector<float> &transform_array);
-  void ConvertLocalRotationToGlobalRotation(
-      const STLVectorOfEigenTypes<Eigen::Matrix4f> &local_rotation_mats,
-      STLVectorOfEigenTypes<Eigen::Matrix4f> &global_rotation_mats);
+  // Resident CPU bytes by category. Containers are counted by capacity, the
+  // tinygltf metadata by element size, so it is approximate.
+  struct MemoryReport {
+    size_t gltf_images = 0;
+    size_t gltf_buffers = 0;
+    size_t gltf_metadata = 0;
+    size_t animation = 0;
+    size_t scene_tree = 0;
+    size_t skinning = 0;
+    size_t render_tables = 0;
+
+    size_t GetTotal() const;
+    std::string ToString() const;
+  };
 
 private:
-  explicit SceneTree(const std::vector<SceneTreeNode::Ptr> &bone_array);
-
-  std::vector<SceneTreeNode::Ptr> node_array_;
-  std::map<std::string, int> node_name2index_map_;
-  SceneTreeNode::Ptr root_;
-  bool graph_inited_ = false;
-  void BuildGraph();
-
-  double anim_time_ = -1;
-  double anim_timestamp_ = 0;
-  int last_anim_index_ = -1;
-};
+  struct LoadState;
 
-class Model {
 public:
-  enum DrawType { DRAW_ARRAY = 0, DRAW_ELEMENT = 1 };
+
   Model() = default;
+  // model_path is a .gltf, a .glb or a cooked .sac(see sa_cook).
   void Init(const std::string &model_path);
-  void Render(const glm::mat4 &view_matrix, const glm::mat4 &proj_matrix,
-              const glm::mat4 &model_matrix);
+  void Init(const std::string &model_path, const LoadOptions &options);
+
+  // Handle of a LoadAsync. The CPU stages run on the pool, the GL calls run
+  // in Update on the GL thread.
+  class AsyncLoad {
+  public:
+    // Waits for the running CPU stages, the queued GL calls are dropped.
+    ~AsyncLoad();
+    AsyncLoad(const AsyncLoad &rhs) = delete;
+    AsyncLoad &operator=(const AsyncLoad &rhs) = delete;
+
+    // Run the queued GL calls until budget_ms is spent, call it once per
+    // frame. Return true once the load ended, ready or failed.
+    bool Update(double budget_ms);
+    bool IsReady() const;
+    // The file is missing or unreadable, GetError tells why.
+    bool IsFailed() const;
+    const std::string &GetError() const;
+    // nullptr until ready, and after a failed load.
+    std::shared_ptr<Model> GetModel() const;
+
+  private:
+    friend class Model;
+    AsyncLoad() = default;
+
+    std::shared_ptr<Model> model_;
+    std::shared_ptr<LoadState> state_;
+  };
+  // Start loading a new model, call it from the GL thread and keep rendering
+  // the current model until the handle is ready. With options.parallel off
+  // the CPU stages run inside LoadAsync.
+  static std::unique_ptr<AsyncLoad> LoadAsync(const std::string &model_path);
+  static std::unique_ptr<AsyncLoad> LoadAsync(const std::string &model_path,
+                                              const LoadOptions &options);
+  // Update the pose and submit the draws into render_queue, they are drawn
+  // when the queue is flushed.
+  void Render(RenderQueue &render_queue, const glm::mat4 &view_matrix,
+              const glm::mat4 &proj_matrix, const glm::mat4 &model_matrix);
+
+  // One instance of a crowd, the instances share the meshes and the clips
+  // but have their own pose.
+  struct InstanceState {
+    glm::mat4 model_matrix = glm::mat4(1.f);
+    // -1 for the bind pose.
+    int animation_index = 0;
+    // Seconds added to the clip time, so the instances don't move in sync.
+    double time_offset = 0;
+  };
+  // Pose every instance and submit one instanced draw per primitive. The
+  // world transform of each instance is baked into its skinning palette.
+  // Models without skin are drawn instance by instance with the shared pose.
+  void RenderInstances(RenderQueue &render_queue, const glm::mat4 &view_matrix,
+                       const glm::mat4 &proj_matrix,
+                       const std::vector<InstanceState> &instances);
 
   int* GetAnimationIndexPtr() {
     return &animation_index_;
@@ -204,41 +149,391 @@ public:
   const std::string& GetAnimationNames() const {
     return animation_names_;
   }
+  // Scene tree nodes recomputed in the last Render.
+  int GetPoseUpdatedNodeNum() const {
+    return pose_updated_node_num_;
+  }
+  int GetNodeNum() const {
+    return scene_tree_.GetNodeNum();
+  }
+  MemoryReport GetMemoryReport() const;
+  // Vertex and index bytes of the source accessors and of the uploaded
+  // buffers, they only differ with LoadOptions::compact_vertices.
+  size_t GetSourceGeometryByteSize() const {
+    return source_geometry_byte_size_;
+  }
+  size_t GetGeometryByteSize() const { return geometry_byte_size_; }
+  // Draws of one Render, without and with the static batches.
+  int GetSourceDrawNum() const { return source_draw_num_; }
+  int GetDrawNum() const { return draw_num_; }
+  // Skip the draws and the crowd instances outside the view frustum, on by
+  // default. The bounds come from the gltf accessors, the cooked models
+  // store them.
+  void SetFrustumCulling(bool enabled) { frustum_culling_ = enabled; }
+  // Draws(multi draw commands included) and crowd instances of the last
+  // Render or RenderInstances.
+  int GetSubmittedDrawNum() const { return submitted_draw_num_; }
+  int GetCulledDrawNum() const { return culled_draw_num_; }
+  int GetCulledInstanceNum() const { return culled_instance_num_; }
+  // Skip the pose of the model or of a crowd instance while the bounds of
+  // its last evaluated pose, grown by the margin, are outside the frustum.
+  // Only the clip clock advances, the pose is evaluated again on the frame
+  // the grown bounds come back into view. Needs the frustum culling, off by
+  // default. margin is the ratio of the bounds size added on every side,
+  // raise it for clips moving far from the last pose.
+  void SetAnimationCulling(bool enabled) { animation_culling_ = enabled; }
+  void SetAnimationCullingMargin(float margin) {
+    animation_culling_margin_ = margin;
+  }
+  // Poses skipped in the last Render or RenderInstances.
+  int GetSkippedPoseNum() const { return skipped_pose_num_; }
+  // Sample the clip of the model or of a crowd instance at the rate of its
+  // LOD tier, chosen by the screen size of its last pose bounds. The
+  // samples of the instances are staggered over the frames and the frames
+  // in between blend the last two sampled local poses, so the pose doesn't
+  // lag the clip. Off by default.
+  static constexpr int kAnimationLodNum = 3;
+  void SetAnimationLod(bool enabled) { animation_lod_ = enabled; }
+  // Poses of tier in the last Render or RenderInstances, 0 is the finest.
+  int GetAnimationLodPoseNum(int tier) const {
+    return animation_lod_pose_nums_[tier];
+  }
+  // Clip samples of the last Render or RenderInstances.
+  int GetSampledPoseNum() const { return sampled_pose_num_; }
+  // Evaluate a reduced joint set for the skinned model or crowd instance
+  // at the same tier as the animation LOD, see SkeletonLod. The dropped
+  // joints follow their nearest kept ancestor. Off by default.
+  void SetSkeletonLod(bool enabled) { skeleton_lod_ = enabled; }
+  // Palette joints evaluated in the last Render or RenderInstances.
+  int GetEvaluatedJointNum() const { return evaluated_joint_num_; }
+  // Draw the skinned primitives of the model or of the crowd with 4, 2 or 1
+  // influences per vertex at the animation LOD tiers 0, 1 and 2. The
+  // primitives always use the fewest influences they need, see
+  // SkinInfluence. Off by default, the crowd uses its finest visible tier.
+  static constexpr int kInfluenceVariantNum = 3;
+  void SetSkinInfluenceLod(bool enabled) { skin_influence_lod_ = enabled; }
+  // Skinned draws of the last Render or RenderInstances with 4, 2 and 1
+  // influences for variant 0, 1 and 2.
+  int GetInfluenceDrawNum(int variant) const {
+    return influence_draw_nums_[variant];
+  }
 
-  ~Model(){};
+  ~Model() { ReleaseResources(); }
 
 private:
   struct RenderParams {
     DrawType draw_type = DRAW_ARRAY;
     int count = 0;
     GLuint vao = 0;
+    GLenum mode = GL_TRIANGLES;
     GLuint indices_vbo = 0;
+    GLenum index_type = 0;
+    size_t index_offset = 0;
     GLuint texture_id = 0;
+    GLuint sampler_id = 0;
+    // gltf texture index, -1 for none.
+    int texture_idx = -1;
     glm::vec4 color = glm::vec4(0.5, 0.5, 0.5, 1.0);
+    // Skin influences of the vertices, see SkinInfluence. Fewer influences
+    // than that are only drawn if sorted.
+    int influence_num = 4;
+    bool influence_sorted = false;
+  };
+
+  struct UniformHandles {
+    Shader::UniformHandle view_matrix;
+    Shader::UniformHandle proj_matrix;
+    Shader::UniformHandle model_matrix;
+    Shader::UniformHandle diffuse_texture;
+    Shader::UniformHandle vertex_color;
   };
 
-  void RenderNode(int node_idx, const glm::mat4 &parent_transform, const glm::mat4& model_matrix);
-  void RenderMesh(int mesh_idx);
-  GLuint ProcessBufferView(const tinygltf::Accessor &accessor,
-                           GLenum buffer_type);
-  void ProcessBufferView(const tinygltf::Accessor& accessor);
-  
-  //void SetPrimitiveNormals(const tinygltf::Primitive& primitive, RenderParams& render_params);
+  // The staged load of Init and LoadAsync. The CPU stages run on the pool
+  // (inline without pool) and push their GL calls into gl_tasks, the last
+  // stage queues FinishLoad behind them.
+  struct LoadState {
+    ThreadPool *thread_pool = nullptr;
+    bool keep_gltf = false;
+    // LoadOptions::multi_draw on a GL 4.3 context.
+    bool multi_draw = false;
+    TaskQueue gl_tasks;
+    std::atomic<int> cpu_task_num{0};
+    // Only touched by the GL thread.
+    bool finished = false;
+    // Set by the failed stages before FinishLoad is queued, see FailLoad.
+    // Several pool stages can fail, error is the first one.
+    std::atomic<bool> failed{false};
+    std::string error;
+    // gltf texture index -> GL texture.
+    std::vector<GLuint> textures;
+    // image index -> gltf textures using it.
+    std::vector<std::vector<int>> image_textures;
+  };
+  std::shared_ptr<LoadState> StartLoad(const std::string &model_path,
+                                       const LoadOptions &options);
+  // The tasks keep state alive, they only reference the model while running.
+  void RunCPUTask(const std::shared_ptr<LoadState> &state,
+                  std::function<void()> task);
+  void FinishLoad(LoadState &state);
+  // End the load without a model, FinishLoad releases what the other stages
+  // made.
+  void FailLoad(LoadState &state, const std::string &error);
+  // Drop the tinygltf model.
+  void ReleaseCPUData();
+  void InitFromGLTF(const std::string &model_path, const LoadOptions &options,
+                    const std::shared_ptr<LoadState> &state);
+  void InitMesh(int m_idx);
+  // GL side of a compacted mesh, see LoadOptions::compact_vertices.
+  void InitCompactMesh(
+      int m_idx, const std::vector<VertexCompaction::Primitive> &primitives);
+  void InitStaticBatches(const std::vector<StaticBatcher::Batch> &batches);
+  // Mesh bounds and joint bounds, on the pool.
+  void InitBounds();
+  // The levels of SetSkeletonLod, on the pool.
+  void InitSkeletonLod(SkeletonLod::Mode mode);
+  // The vao, the commands and the draw data of LoadOptions::multi_draw.
+  void InitMultiDraw(const StaticBatcher::Batch &arena);
+  // The texture or the color of a gltf material, -1 for the default.
+  void SetMaterial(int material_idx, RenderParams &render_params);
+  // Upload data into a new buffer of the shared cache, or reuse the cached
+  // one.
+  GLuint AcquireBuffer(GPUResourceCache::ResourceType type, int index,
+                       GLenum buffer_type, const std::vector<uint8_t> &data);
+  // Every array is uploaded straight from the mapped file.
+  void InitFromCooked(const std::string &cooked_path,
+                      const LoadOptions &options, LoadState &state);
+  // The GL texture of model_.images[image_idx] from the shared cache, the
+  // image must be decoded on a miss.
+  GLuint UploadTexture(int image_idx);
+  GLuint GetTextureSampler(int texture_idx);
+  // Delete the vaos and drop the references to the cached resources.
+  void ReleaseResources();
+  void ResolveUniformHandles(Shader &shader, UniformHandles &handles);
+  void SetFrameUniforms(RenderQueue &render_queue, Shader &shader,
+                        const UniformHandles &handles,
+                        const glm::mat4 &view_matrix,
+                        const glm::mat4 &proj_matrix);
+  // The per draw state shared by all the primitives of a Render call.
+  RenderQueue::DrawItem MakeDrawItem(Shader &shader,
+                                     const UniformHandles &handles,
+                                     const SkinningPalette *palette,
+                                     const glm::mat4 &model_matrix,
+                                     int instance_num);
+  // Reset the culling stats and set the frustum of the frame.
+  void BeginCulling(const glm::mat4 &view_matrix,
+                    const glm::mat4 &proj_matrix);
+  // See SetAnimationCulling, pose_bounds are in model space.
+  bool IsPoseCulled(const AABB &pose_bounds,
+                    const glm::mat4 &model_matrix) const;
+  // Sample the clip into scene_tree_ and update the palette and the pose
+  // bounds, or only advance the clip clock if is_culled.
+  void UpdatePose(bool is_culled, int lod_tier);
+  // About animation LOD, the sample period of the pose. from_pose and
+  // to_pose are the samples at the start and the end of the period.
+  struct AnimationLod {
+    int tier = 0;
+    // -1 until the first sample.
+    int clip_idx = -1;
+    int64_t period = 0;
+    SceneTree::LocalPose from_pose;
+    SceneTree::LocalPose to_pose;
+  };
+  // The skeleton level of lod_tier, nullptr for the full skeleton.
+  const SkeletonLod::Level *GetSkeletonLevel(int lod_tier) const;
+  // skinning_palette_ of the scene_tree pose, only the joints of level are
+  // evaluated.
+  void BuildSkinningPalette(SceneTree &scene_tree,
+                            const SkeletonLod::Level *level);
+  // The variant shaders of shader_ or instanced_shader_, defines are the
+  // ones of the base shader.
+  void InitInfluenceShaders(bool is_instanced,
+                            const std::vector<std::string> &defines);
+  // Set the per frame uniforms of the variant shaders, if built.
+  void SetInfluenceFrameUniforms(RenderQueue &render_queue, bool is_instanced,
+                                 const glm::mat4 &view_matrix,
+                                 const glm::mat4 &proj_matrix);
+  // The influence variant of render_params in the current Render or
+  // RenderInstances, 0 for the base shader.
+  int GetInfluenceVariant(const RenderParams &render_params,
+                          bool is_instanced) const;
+  // Tier of the pose bounds(model space), 0 without bounds or without any
+  // of the animation, skeleton and skin influence LOD.
+  int SelectAnimationLod(const AABB &pose_bounds,
+                         const glm::mat4 &model_matrix) const;
+  // Pose scene_tree at anim_time of clip_idx, sampled at the rate of
+  // lod_tier and blended, or sampled as is without LOD. phase in [0, 1)
+  // shifts the sample times by a part of the period.
+  void SampleAnimation(int clip_idx, double anim_time, int lod_tier,
+                       float phase, SceneTree &scene_tree, AnimationLod &lod);
+  // Model space bounds of the scene nodes in the current pose, without skin.
+  AABB GetSceneBounds() const;
+  // Mesh space bounds of the draws of mesh_idx, the posed skin for the
+  // skinned models. Empty(never culled) without bounds.
+  AABB GetDrawBounds(int mesh_idx) const;
+  // True if bounds transformed by model_matrix is outside the frustum, the
+  // draw_num draws are counted as culled.
+  bool CullDraws(const AABB &bounds, const glm::mat4 &model_matrix,
+                 int draw_num);
+  void RenderScene(RenderQueue &render_queue,
+                   const RenderQueue::DrawItem &base_item);
+  // Upload the draw data of the current pose and submit the texture groups.
+  void RenderMultiDraw(RenderQueue &render_queue,
+                       const glm::mat4 &model_matrix);
+  void RenderNode(RenderQueue &render_queue, int node_idx,
+                  const glm::mat4 &parent_transform,
+                  const RenderQueue::DrawItem &base_item);
+  void RenderMesh(RenderQueue &render_queue, int mesh_idx,
+                  const RenderQueue::DrawItem &base_item);
+  void SubmitDraw(RenderQueue &render_queue, const RenderParams &render_params,
+                  const RenderQueue::DrawItem &base_item);
+  // Only valid during Init.
+  const uint8_t *GetBufferData(int buffer_idx) const {
+    return loader_.GetBufferSpans()[buffer_idx].data;
+  }
+  // The GL buffer of an accessor from the shared cache, and the layout of
+  // the accessor in it. The plain accessors share the buffer of their
+  // bufferView, the sparse ones and the ones without bufferView have their
+  // patched elements packed in a buffer of their own.
+  GLuint ProcessBufferView(int accessor_idx, GLenum buffer_type,
+                           int &byte_stride, size_t &byte_offset);
+  GLuint UploadBufferView(const tinygltf::BufferView &buffer_view,
+                          GLenum buffer_type);
   tinygltf::Model model_;
+  GLTFLoader loader_;
 
   // About Animation.
+  std::vector<AnimationClip> animation_clips_;
   int animation_index_ = -1;
   int animation_size_ = 0;
   std::string animation_names_;
 
+  // Node tables of the render traversal, indexed by node index.
+  std::vector<int> node_meshes_;
+  std::vector<std::vector<int>> node_children_;
+  std::vector<int> scene_roots_;
+
+  bool has_texture_ = false;
   bool is_skinning_ = false;
   std::vector<int> skinning_joints_;
-  STLVectorOfEigenTypes<Eigen::Matrix4f> skinning_invbindmat_;
+  STLVectorOfEigenTypes<AffineMatrix> skinning_invbindmat_;
+  // Reused every frame to avoid allocation.
+  STLVectorOfEigenTypes<AffineMatrix> skinning_palette_;
+  SkinningPalette skinning_palette_buffer_;
   SceneTree scene_tree_;
+  int pose_updated_node_num_ = 0;
 
+  std::string vs_path_;
+  std::string fs_path_;
   Shader shader_;
+  UniformHandles uniform_handles_;
+
+  // About instancing, built by the first RenderInstances.
+  STLVectorOfEigenTypes<SceneTree> instance_trees_;
+  double instance_start_time_ = -1;
+  STLVectorOfEigenTypes<AffineMatrix> instance_palettes_;
+  SkinningPalette instance_palette_buffer_;
+  Shader instanced_shader_;
+  UniformHandles instanced_uniform_handles_;
 
   std::map<int, std::vector<RenderParams>> mesh_render_params_;
+  // About static batching, the batches are drawn before the scene nodes.
+  struct StaticBatch {
+    RenderParams render_params;
+    std::vector<StaticBatcher::Range> ranges;
+    // Model space, the static node transforms are in the vertices.
+    AABB bounds;
+  };
+  std::vector<StaticBatch> static_batches_;
+  // Per node, true if a static batch draws its mesh. Empty without batches.
+  std::vector<bool> node_batched_;
+  int source_draw_num_ = 0;
+  int draw_num_ = 0;
+  // About frustum culling, the bounds are in mesh space. joint_bounds_ is
+  // per skin joint, see Bounds::ExtendJointBounds.
+  std::vector<AABB> mesh_bounds_;
+  std::vector<AABB> joint_bounds_;
+  // joint_bounds_ posed by the palette of the last Render.
+  AABB skinned_bounds_;
+  bool frustum_culling_ = true;
+  Frustum frustum_;
+  int submitted_draw_num_ = 0;
+  int culled_draw_num_ = 0;
+  int culled_instance_num_ = 0;
+  // About animation culling, the bounds of the last evaluated pose.
+  bool animation_culling_ = false;
+  float animation_culling_margin_ = 0.25f;
+  AABB pose_bounds_;
+  std::vector<AABB> instance_bounds_;
+  int skipped_pose_num_ = 0;
+  // About animation LOD, the view of the frame and the sample periods of
+  // the model and of the crowd instances.
+  bool animation_lod_ = false;
+  glm::mat4 lod_view_matrix_ = glm::mat4(1.f);
+  // proj_matrix[1][1], the half view height at distance 1 is its inverse.
+  float lod_proj_scale_ = 1.f;
+  AnimationLod animation_lod_state_;
+  std::vector<AnimationLod> instance_lods_;
+  int animation_lod_pose_nums_[kAnimationLodNum] = {};
+  int sampled_pose_num_ = 0;
+  // About skeleton LOD, one level per animation LOD tier.
+  bool skeleton_lod_ = false;
+  std::vector<SkeletonLod::Level> skeleton_lods_;
+  // The palette of the kept joints, reused every frame.
+  STLVectorOfEigenTypes<AffineMatrix> level_palette_;
+  int evaluated_joint_num_ = 0;
+  // About skin influence LOD, the shaders of the variants 1 and 2, for the
+  // single model then for the crowd. Empty handles until built.
+  bool skin_influence_lod_ = false;
+  Shader influence_shaders_[2 * (kInfluenceVariantNum - 1)];
+  UniformHandles influence_uniform_handles_[2 * (kInfluenceVariantNum - 1)];
+  bool influence_shaders_inited_[2] = {false, false};
+  // The variant of the LOD tier of the current draws, the sorted
+  // primitives use it or a coarser one.
+  int influence_lod_variant_ = 0;
+  int influence_draw_nums_[kInfluenceVariantNum] = {};
+  // About multi draw indirect, one command per (scene node, primitive),
+  // grouped by texture. The base instance of a command is its draw index,
+  // fetched by the shader through an instanced attribute.
+  struct MultiDrawGroup {
+    GLuint texture_id = 0;
+    GLuint sampler_id = 0;
+    // gltf texture index, -1 for none.
+    int texture_idx = -1;
+    int first_command = 0;
+    int command_num = 0;
+  };
+  // Layout of glMultiDrawElementsIndirect.
+  struct DrawCommand {
+    GLuint count = 0;
+    GLuint instance_count = 1;
+    GLuint first_index = 0;
+    GLint base_vertex = 0;
+    GLuint base_instance = 0;
+  };
+  std::vector<MultiDrawGroup> multi_draw_groups_;
+  GLuint multi_draw_vao_ = 0;
+  GLenum multi_draw_index_type_ = 0;
+  // Every command, and the ones not culled in the last frame.
+  std::vector<DrawCommand> multi_draw_commands_data_;
+  std::vector<DrawCommand> multi_draw_frame_commands_;
+  std::vector<bool> multi_draw_visible_;
+  GLuint multi_draw_commands_ = 0;
+  // Per draw, the node and the material color.
+  std::vector<int> multi_draw_nodes_;
+  std::vector<glm::vec4> multi_draw_colors_;
+  // The shader storage of the per draw data, rewritten every frame.
+  GLuint multi_draw_storage_ = 0;
+  std::vector<float> multi_draw_data_;
+  Shader multi_draw_shader_;
+  UniformHandles multi_draw_uniform_handles_;
+  // The cache key of the textures and buffers are (asset_path_, image,
+  // bufferView or packed accessor), the cooked models use their own
+  // indices.
+  std::string asset_path_;
+  std::vector<GPUResourceCache::Key> cached_resources_;
   std::map<int, GLuint> gpu_buffer_views_;
-  std::map<int, std::vector<uint8_t>> cpu_buffer_views_;
+  // accessor index -> GL buffer, see ProcessBufferView.
+  std::map<int, GLuint> gpu_packed_accessors_;
+  size_t source_geometry_byte_size_ = 0;
+  size_t geometry_byte_size_ = 0;
 };
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include <algorithm>
+
+#include "graphic/render_queue.h"
+
+void RenderQueue::BeginFrame() {
+  state_cache_.Invalidate();
+  state_cache_.ResetStats();
+  stats_ = Stats();
+}
+
+void RenderQueue::Flush() {
+  sorted_indices_.resize(items_.size());
+  for (size_t i_idx = 0; i_idx < items_.size(); ++i_idx) {
+    sorted_indices_[i_idx] = i_idx;
+  }
+  // Program switches are the most expensive, then textures, then vaos. Keep
+  // the submission order for the same state.
+  std::stable_sort(sorted_indices_.begin(), sorted_indices_.end(),
+                   [this](int lhs_idx, int rhs_idx) {
+                     const auto &lhs = items_[lhs_idx];
+                     const auto &rhs = items_[rhs_idx];
+                     const GLuint lhs_program = lhs.shader->GetProgramId();
+                     const GLuint rhs_program = rhs.shader->GetProgramId();
+                     if (lhs_program != rhs_program) {
+                       return lhs_program < rhs_program;
+                     }
+                     if (lhs.texture != rhs.texture) {
+                       return lhs.texture < rhs.texture;
+                     }
+                     return lhs.vao < rhs.vao;
+                   });
+
+  Shader *cur_shader = nullptr;
+  const SkinningPalette *cur_palette = nullptr;
+  bool has_model_matrix = false;
+  glm::mat4 cur_model_matrix;
+  bool has_color = false;
+  glm::vec4 cur_color;
+  for (int i_idx : sorted_indices_) {
+    const auto &item = items_[i_idx];
+    if (item.shader != cur_shader) {
+      cur_shader = item.shader;
+      state_cache_.UseProgram(cur_shader->GetProgramId());
+      cur_palette = nullptr;
+      has_model_matrix = false;
+      has_color = false;
+    }
+    if (item.skinning_palette && item.skinning_palette != cur_palette) {
+      cur_palette = item.skinning_palette;
+      cur_palette->Bind(*cur_shader, state_cache_);
+    }
+
+    // Uniforms, only set when the value changes.
+    if (item.model_matrix_handle.IsValid()) {
+      if (!has_model_matrix || item.model_matrix != cur_model_matrix) {
+        cur_shader->Set(item.model_matrix_handle, item.model_matrix);
+        cur_model_matrix = item.model_matrix;
+        has_model_matrix = true;
+        state_cache_.CountIssued();
+      } else {
+        state_cache_.CountElided();
+      }
+    }
+    if (item.color_handle.IsValid()) {
+      if (!has_color || item.color != cur_color) {
+        cur_shader->Set(item.color_handle, item.color);
+        cur_color = item.color;
+        has_color = true;
+        state_cache_.CountIssued();
+      } else {
+        state_cache_.CountElided();
+      }
+    }
+
+    if (item.texture) {
+      state_cache_.BindTexture(0, GL_TEXTURE_2D, item.texture);
+      state_cache_.BindSampler(0, item.sampler);
+    }
+    if (item.storage_buffer) {
+      state_cache_.BindStorageBuffer(0, item.storage_buffer);
+    }
+    state_cache_.BindVertexArray(item.vao);
+    const GLvoid *index_ptr =
+        reinterpret_cast<const GLvoid *>(item.index_offset);
+    if (item.indirect_buffer) {
+      state_cache_.BindDrawIndirectBuffer(item.indirect_buffer);
+      glMultiDrawElementsIndirect(
+          item.mode, item.index_type,
+          reinterpret_cast<const GLvoid *>(item.indirect_offset),
+          item.draw_num, 0);
+      stats_.indirect_draws += item.draw_num;
+    } else if (item.instance_num > 1) {
+      if (item.index_type) {
+        glDrawElementsInstanced(item.mode, item.count, item.index_type,
+                                index_ptr, item.instance_num);
+      } else {
+        glDrawArraysInstanced(item.mode, 0, item.count, item.instance_num);
+      }
+    } else if (item.index_type) {
+      glDrawElements(item.mode, item.count, item.index_type, index_ptr);
+    } else {
+      glDrawArrays(item.mode, 0, item.count);
+    }
+    state_cache_.CountIssued();
+    ++stats_.draw_calls;
+  }
+  stats_.item_num += items_.size();
+  items_.clear();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <GL/gl3w.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "graphic/gl_state.h"
+#include "graphic/shader.h"
+#include "graphic/skinning_palette.h"
+
+// Collect the draws of a pass, sort them by program, texture and vao, then
+// submit them through the GLStateCache so the redundant binds are skipped.
+// The per frame uniforms of a shader(e.g. view/proj) are program state, set
+// them when submitting, only the per draw uniforms live in DrawItem.
+class RenderQueue {
+public:
+  struct DrawItem {
+    Shader *shader = nullptr;
+    GLuint vao = 0;
+    // Bound to GL_TEXTURE_2D of unit 0, 0 for none.
+    GLuint texture = 0;
+    // Sampler object of unit 0, 0 for the texture parameters.
+    GLuint sampler = 0;
+    // nullptr if not skinned.
+    const SkinningPalette *skinning_palette = nullptr;
+    GLenum mode = GL_TRIANGLES;
+    GLsizei count = 0;
+    // glDrawElements if index_type isn't 0, the index buffer is in the vao.
+    GLenum index_type = 0;
+    size_t index_offset = 0;
+    // Instanced draw if more than 1.
+    GLsizei instance_num = 1;
+    // glMultiDrawElementsIndirect of draw_num commands at indirect_offset if
+    // not 0, with index_type. GL 4.3+ only.
+    GLuint indirect_buffer = 0;
+    size_t indirect_offset = 0;
+    GLsizei draw_num = 0;
+    // Shader storage buffer bound to binding 0, 0 for none.
+    GLuint storage_buffer = 0;
+    Shader::UniformHandle model_matrix_handle;
+    glm::mat4 model_matrix = glm::mat4(1.f);
+    Shader::UniformHandle color_handle;
+    glm::vec4 color = glm::vec4(1.f);
+  };
+
+  struct Stats {
+    int item_num = 0;
+    int draw_calls = 0;
+    // Commands of the multi draw indirect calls, each call counts once in
+    // draw_calls.
+    int indirect_draws = 0;
+    // GL calls issued and skipped as redundant.
+    GLStateCache::Stats state;
+  };
+
+  RenderQueue() = default;
+
+  // The state is unknown at the beginning of a frame.
+  void BeginFrame();
+  void Submit(const DrawItem &item) { items_.push_back(item); }
+  // Sort and draw all the submitted items, then clear the queue.
+  void Flush();
+
+  GLStateCache &GetStateCache() { return state_cache_; }
+  // Stats since BeginFrame.
+  Stats GetStats() const {
+    Stats stats = stats_;
+    stats.state = state_cache_.GetStats();
+    return stats;
+  }
+
+private:
+  std::vector<DrawItem> items_;
+  // Reused by Flush.
+  std::vector<int> sorted_indices_;
+  GLStateCache state_cache_;
+  Stats stats_;
+};
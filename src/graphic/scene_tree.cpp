@@ -0,0 +1,647 @@
+#include <algorithm>
+
+#include "common/logging.h"
+#include "graphic/model.h"
+#include "graphic/scene_tree.h"
+
+void QTSToMatrix(const std::vector<float> &qts, Eigen::Matrix4f &matrix) {
+  ComposeTRS(Eigen::Quaternionf(&qts[0]),
+             Eigen::Vector3f(qts[4], qts[5], qts[6]),
+             Eigen::Vector3f(qts[7], qts[8], qts[9]), matrix);
+}
+
+void MatrixToQTS(const Eigen::Matrix4f &matrix, std::vector<float> &qts) {
+  Eigen::Quaternionf rotation;
+  Eigen::Vector3f translation, scale;
+  DecomposeTRS(matrix, rotation, translation, scale);
+  qts.assign(10, 0);
+  qts[0] = rotation.x();
+  qts[1] = rotation.y();
+  qts[2] = rotation.z();
+  qts[3] = rotation.w();
+  qts[4] = translation.x();
+  qts[5] = translation.y();
+  qts[6] = translation.z();
+  qts[7] = scale.x();
+  qts[8] = scale.y();
+  qts[9] = scale.z();
+}
+
+void ComposeTRS(const Eigen::Quaternionf &rotation,
+                const Eigen::Vector3f &translation,
+                const Eigen::Vector3f &scale, Eigen::Matrix4f &matrix) {
+  matrix.setIdentity();
+  matrix.block<3, 3>(0, 0) = rotation.toRotationMatrix() * scale.asDiagonal();
+  matrix.block<3, 1>(0, 3) = translation;
+}
+
+void DecomposeTRS(const Eigen::Matrix4f &matrix, Eigen::Quaternionf &rotation,
+                  Eigen::Vector3f &translation, Eigen::Vector3f &scale) {
+  Eigen::Matrix3f rot_mat = matrix.block<3, 3>(0, 0);
+  translation = matrix.block<3, 1>(0, 3);
+  scale << rot_mat.col(0).norm(), rot_mat.col(1).norm(), rot_mat.col(2).norm();
+  // Mirrored transform, put the reflection into the scale.
+  if (rot_mat.determinant() < 0) {
+    scale.x() = -scale.x();
+  }
+  for (int c_idx = 0; c_idx < 3; ++c_idx) {
+    if (scale[c_idx] != 0) {
+      rot_mat.col(c_idx) /= scale[c_idx];
+    }
+  }
+  rotation = Eigen::Quaternionf(rot_mat);
+  rotation.normalize();
+}
+
+void SceneTree::Clear() {
+  node_indices_.clear();
+  node_names_.clear();
+  parent_slots_.clear();
+  local_rotations_.clear();
+  local_translations_.clear();
+  local_scales_.clear();
+  local_dirty_.clear();
+  node_name2index_map_.clear();
+}
+
+size_t SceneTree::GetByteSize() const {
+  size_t byte_size = GetVectorBytes(node_indices_) +
+                     GetVectorBytes(node_names_) +
+                     GetVectorBytes(parent_slots_) +
+                     GetVectorBytes(subtree_sizes_) +
+                     GetVectorBytes(local_rotations_) +
+                     GetVectorBytes(local_translations_) +
+                     GetVectorBytes(local_scales_) +
+                     GetVectorBytes(local_mats_) +
+                     GetVectorBytes(global_mats_) +
+                     GetVectorBytes(local_dirty_) +
+                     GetVectorBytes(global_updated_) +
+                     GetVectorBytes(update_slots_) +
+                     GetVectorBytes(skinning_slots_) +
+                     GetVectorBytes(node_slots_) +
+                     GetVectorBytes(anim_cursors_);
+  for (const auto &node_name : node_names_) {
+    byte_size += node_name.capacity();
+  }
+  for (const auto &name_index : node_name2index_map_) {
+    byte_size += sizeof(name_index) + name_index.first.capacity();
+  }
+  return byte_size;
+}
+
+void SceneTree::Init(const tinygltf::Model &model) {
+  Clear();
+
+  std::vector<int> parent_indices(model.nodes.size(), -1);
+  for (size_t n_idx = 0; n_idx < model.nodes.size(); ++n_idx) {
+    for (const auto &child_idx : model.nodes[n_idx].children) {
+      parent_indices[child_idx] = n_idx;
+    }
+  }
+  for (size_t n_idx = 0; n_idx < model.nodes.size(); ++n_idx) {
+    const auto &node = model.nodes[n_idx];
+    glm::mat4 node_transform = GetNodeTransform(node);
+    AppendNode(n_idx, parent_indices[n_idx], node.name,
+               Eigen::Matrix4f(&node_transform[0][0]));
+
+    if (node.matrix.size() != 16) {
+      // Take the TRS directly, avoid the decomposition error.
+      if (!node.rotation.empty()) {
+        local_rotations_.back() =
+            Eigen::Quaternionf(node.rotation[3], node.rotation[0],
+                               node.rotation[1], node.rotation[2]);
+      }
+      if (!node.translation.empty()) {
+        local_translations_.back() << node.translation[0],
+            node.translation[1], node.translation[2];
+      }
+      if (!node.scale.empty()) {
+        local_scales_.back() << node.scale[0], node.scale[1], node.scale[2];
+      }
+    }
+  }
+  SortNodes();
+  // only update inv_bind_mat_ when initing.
+  UpdateGlobalPose(true);
+}
+
+void SceneTree::Init(const std::vector<std::string> &node_names,
+                     const std::vector<int> &parent_indices,
+                     const std::vector<float> &rotations,
+                     const std::vector<float> &translations,
+                     const std::vector<float> &scales) {
+  Clear();
+  const size_t node_num = node_names.size();
+  CHECK(parent_indices.size() == node_num &&
+        rotations.size() == 4 * node_num &&
+        translations.size() == 3 * node_num && scales.size() == 3 * node_num)
+      << "SceneTree: node tables don't match.";
+  for (size_t n_idx = 0; n_idx < node_num; ++n_idx) {
+    const Eigen::Quaternionf rotation(
+        rotations[4 * n_idx + 3], rotations[4 * n_idx],
+        rotations[4 * n_idx + 1], rotations[4 * n_idx + 2]);
+    const Eigen::Vector3f translation(&translations[3 * n_idx]);
+    const Eigen::Vector3f scale(&scales[3 * n_idx]);
+    Eigen::Matrix4f local_mat;
+    ComposeTRS(rotation, translation, scale, local_mat);
+    AppendNode(n_idx, parent_indices[n_idx], node_names[n_idx], local_mat);
+    local_rotations_.back() = rotation;
+    local_translations_.back() = translation;
+    local_scales_.back() = scale;
+  }
+  SortNodes();
+  UpdateGlobalPose(true);
+}
+
+void SceneTree::GetLocalPose(int node_idx, float *rotation,
+                             float *translation, float *scale) const {
+  const int slot = node_slots_[node_idx];
+  const Eigen::Quaternionf &local_rotation = local_rotations_[slot];
+  rotation[0] = local_rotation.x();
+  rotation[1] = local_rotation.y();
+  rotation[2] = local_rotation.z();
+  rotation[3] = local_rotation.w();
+  for (int c_idx = 0; c_idx < 3; ++c_idx) {
+    translation[c_idx] = local_translations_[slot][c_idx];
+    scale[c_idx] = local_scales_[slot][c_idx];
+  }
+}
+
+SceneTree::SceneTree(const std::vector<std::string> &node_names,
+                     const std::vector<int> &parent_indices,
+                     const STLVectorOfEigenTypes<Eigen::Matrix4f> &local_mats) {
+  for (size_t n_idx = 0; n_idx < node_names.size(); ++n_idx) {
+    AppendNode(n_idx, parent_indices[n_idx], node_names[n_idx],
+               local_mats[n_idx]);
+  }
+  SortNodes();
+  UpdateGlobalPose();
+}
+
+SceneTree SceneTree::Copy() const {
+  SceneTree result(*this);
+  result.anim_time_ = -1;
+  result.anim_timestamp_ = 0;
+  result.last_anim_index_ = -1;
+  result.node_mask_ = nullptr;
+  return result;
+}
+
+void SceneTree::AppendNode(int node_idx, int parent_idx,
+                           const std::string &name,
+                           const Eigen::Matrix4f &local_mat) {
+  node_indices_.push_back(node_idx);
+  node_names_.push_back(name);
+  parent_slots_.push_back(parent_idx);
+  local_rotations_.emplace_back();
+  local_translations_.emplace_back();
+  local_scales_.emplace_back();
+  SetLocalMatrix(node_indices_.size() - 1, local_mat);
+  node_name2index_map_[name] = node_idx;
+}
+
+void SceneTree::SortNodes() {
+  const int node_num = node_indices_.size();
+  // Node index -> position before sorting.
+  std::vector<int> node_positions(node_num, -1);
+  for (int pos = 0; pos < node_num; ++pos) {
+    CHECK(node_indices_[pos] >= 0 && node_indices_[pos] < node_num)
+        << "node index " << node_indices_[pos] << " is out of range.";
+    node_positions[node_indices_[pos]] = pos;
+  }
+
+  std::vector<std::vector<int>> children(node_num);
+  std::vector<int> roots;
+  for (int n_idx = 0; n_idx < node_num; ++n_idx) {
+    int parent_idx = parent_slots_[node_positions[n_idx]];
+    if (parent_idx == -1) {
+      roots.push_back(n_idx);
+    } else {
+      children[parent_idx].push_back(n_idx);
+    }
+  }
+
+  // Depth first, children in node index order.
+  std::vector<int> sorted_nodes;
+  sorted_nodes.reserve(node_num);
+  std::vector<int> stack(roots.rbegin(), roots.rend());
+  while (!stack.empty()) {
+    int n_idx = stack.back();
+    stack.pop_back();
+    sorted_nodes.push_back(n_idx);
+    stack.insert(stack.end(), children[n_idx].rbegin(),
+                 children[n_idx].rend());
+  }
+  CHECK(sorted_nodes.size() == node_num) << "scene tree has cycle.";
+
+  node_slots_.assign(node_num, -1);
+  for (int slot = 0; slot < node_num; ++slot) {
+    node_slots_[sorted_nodes[slot]] = slot;
+  }
+
+  std::vector<int> old_parents(parent_slots_);
+  std::vector<std::string> old_names(node_names_);
+  STLVectorOfEigenTypes<Eigen::Quaternionf> old_rotations(local_rotations_);
+  STLVectorOfEigenTypes<Eigen::Vector3f> old_translations(local_translations_);
+  STLVectorOfEigenTypes<Eigen::Vector3f> old_scales(local_scales_);
+  for (int slot = 0; slot < node_num; ++slot) {
+    int pos = node_positions[sorted_nodes[slot]];
+    node_indices_[slot] = sorted_nodes[slot];
+    node_names_[slot] = old_names[pos];
+    parent_slots_[slot] =
+        old_parents[pos] == -1 ? -1 : node_slots_[old_parents[pos]];
+    local_rotations_[slot] = old_rotations[pos];
+    local_translations_[slot] = old_translations[pos];
+    local_scales_[slot] = old_scales[pos];
+  }
+
+  subtree_sizes_.assign(node_num, 1);
+  for (int slot = node_num - 1; slot >= 0; --slot) {
+    if (parent_slots_[slot] != -1) {
+      subtree_sizes_[parent_slots_[slot]] += subtree_sizes_[slot];
+    }
+  }
+  root_slot_ = roots.empty() ? -1 : node_slots_[roots.back()];
+
+  local_mats_.resize(node_num, AffineMatrix::Identity());
+  global_mats_.resize(node_num, AffineMatrix::Identity());
+  local_dirty_.assign(node_num, 1);
+  global_updated_.assign(node_num, 0);
+  dirty_begin_ = 0;
+  dirty_end_ = node_num;
+}
+
+glm::vec3 SceneTree::GetRootTrans() const {
+  const float *root_mat = global_mats_[root_slot_].m;
+  return glm::vec3(root_mat[3], root_mat[7], root_mat[11]);
+}
+
+Eigen::Matrix4f SceneTree::ComposeLocalMatrix(int slot) const {
+  Eigen::Matrix4f local_mat;
+  ComposeTRS(local_rotations_[slot], local_translations_[slot],
+             local_scales_[slot], local_mat);
+  return local_mat;
+}
+
+void SceneTree::SetLocalMatrix(int slot, const Eigen::Matrix4f &local_mat) {
+  DecomposeTRS(local_mat, local_rotations_[slot], local_translations_[slot],
+               local_scales_[slot]);
+  // Nodes are appended before sorting, flags are set in SortNodes then.
+  if (slot < local_dirty_.size()) {
+    MarkDirty(slot);
+  }
+}
+
+void SceneTree::UpdateGlobalPose(bool with_inverse) {
+  static_assert(sizeof(Eigen::Quaternionf) == 4 * sizeof(float) &&
+                    sizeof(Eigen::Vector3f) == 3 * sizeof(float),
+                "TRS arrays must be packed floats.");
+  // Compose the local matrices of each run of dirty nodes in one batch.
+  for (int slot = dirty_begin_; slot < dirty_end_;) {
+    if (IsMaskedOut(slot)) {
+      // The whole subtree is masked out.
+      slot += subtree_sizes_[slot];
+      continue;
+    }
+    if (!local_dirty_[slot]) {
+      ++slot;
+      continue;
+    }
+    int run_end = slot + 1;
+    while (run_end < dirty_end_ && local_dirty_[run_end] &&
+           !IsMaskedOut(run_end)) {
+      ++run_end;
+    }
+    AffineKernel::ComposeTRS(local_rotations_[slot].coeffs().data(),
+                             local_translations_[slot].data(),
+                             local_scales_[slot].data(), run_end - slot,
+                             &local_mats_[slot]);
+    slot = run_end;
+  }
+
+  // Parents are always before their children, and all the dirty subtrees are
+  // inside [dirty_begin_, dirty_end_).
+  update_slots_.clear();
+  // The masked out subtrees stay dirty until they are kept again.
+  int pending_begin = node_indices_.size();
+  int pending_end = 0;
+  for (int slot = dirty_begin_; slot < dirty_end_; ++slot) {
+    if (IsMaskedOut(slot)) {
+      local_dirty_[slot] = 1;
+      global_updated_[slot] = 0;
+      pending_begin = std::min(pending_begin, slot);
+      pending_end = std::max(pending_end, slot + subtree_sizes_[slot]);
+      slot += subtree_sizes_[slot] - 1;
+      continue;
+    }
+    const int parent_slot = parent_slots_[slot];
+    const bool parent_updated =
+        parent_slot >= dirty_begin_ && global_updated_[parent_slot];
+    if (local_dirty_[slot]) {
+      local_dirty_[slot] = 0;
+    } else if (!parent_updated) {
+      global_updated_[slot] = 0;
+      continue;
+    }
+    global_updated_[slot] = 1;
+    update_slots_.push_back(slot);
+  }
+  AffineKernel::ConcatenateHierarchy(local_mats_.data(), parent_slots_.data(),
+                                     update_slots_.data(), update_slots_.size(),
+                                     global_mats_.data());
+  updated_node_num_ += update_slots_.size();
+  dirty_begin_ = pending_begin;
+  dirty_end_ = pending_end;
+}
+
+void SceneTree::GetSkinningPoseData(
+    const std::vector<int> &skinning_joints,
+    const STLVectorOfEigenTypes<AffineMatrix> &skinning_invbindmat,
+    STLVectorOfEigenTypes<AffineMatrix> &skinning_palette) {
+  CHECK(skinning_joints.size() == skinning_invbindmat.size())
+      << "skinning joints doesn't match inverse bind matrix count.";
+  skinning_slots_.resize(skinning_joints.size());
+  for (size_t j_idx = 0; j_idx < skinning_joints.size(); ++j_idx) {
+    skinning_slots_[j_idx] = node_slots_[skinning_joints[j_idx]];
+  }
+  skinning_palette.resize(skinning_joints.size());
+  AffineKernel::BuildPalette(global_mats_.data(), skinning_slots_.data(),
+                             skinning_invbindmat.data(),
+                             skinning_joints.size(), skinning_palette.data());
+}
+
+void SceneTree::SetAnimationFrame(const AnimationClip &clip, int anim_idx,
+                                  double time_stamp) {
+  AdvanceAnimationFrame(anim_idx, time_stamp);
+  SetAnimationTime(clip, anim_time_);
+}
+
+void SceneTree::AdvanceAnimationFrame(int anim_idx, double time_stamp) {
+  if (last_anim_index_ != anim_idx) {
+    last_anim_index_ = anim_idx;
+    anim_timestamp_ = time_stamp;
+  }
+  anim_time_ = time_stamp - anim_timestamp_;
+}
+
+void SceneTree::SetAnimationTime(const AnimationClip &clip, double anim_time) {
+  anim_time_ = anim_time;
+  clip.EvaluateTimelines(anim_time_, anim_cursors_);
+  float value[4];
+  for (int chan_idx = 0; chan_idx < clip.GetChannelNum(); ++chan_idx) {
+    const auto &channel = clip.GetChannel(chan_idx);
+    const int slot = node_slots_[channel.node_idx];
+    if (IsMaskedOut(slot)) {
+      continue;
+    }
+    clip.SampleChannel(chan_idx, anim_cursors_[channel.timeline_idx], value);
+
+    // Only mark the node when the value really changes, e.g. holding keys.
+    switch (channel.path) {
+    case AnimationClip::PATH_ROTATION: {
+      Eigen::Quaternionf rotation(value[3], value[0], value[1], value[2]);
+      if (rotation.coeffs() != local_rotations_[slot].coeffs()) {
+        local_rotations_[slot] = rotation;
+        MarkDirty(slot);
+      }
+      break;
+    }
+    case AnimationClip::PATH_TRANSLATION: {
+      Eigen::Vector3f translation(value[0], value[1], value[2]);
+      if (translation != local_translations_[slot]) {
+        local_translations_[slot] = translation;
+        MarkDirty(slot);
+      }
+      break;
+    }
+    case AnimationClip::PATH_SCALE: {
+      Eigen::Vector3f scale(value[0], value[1], value[2]);
+      if (scale != local_scales_[slot]) {
+        local_scales_[slot] = scale;
+        MarkDirty(slot);
+      }
+      break;
+    }
+    }
+  }
+}
+
+void SceneTree::SaveLocalPose(LocalPose &pose) const {
+  pose.rotations = local_rotations_;
+  pose.translations = local_translations_;
+  pose.scales = local_scales_;
+}
+
+void SceneTree::BlendLocalPose(const LocalPose &from, const LocalPose &to,
+                               float alpha) {
+  CHECK(from.rotations.size() == local_rotations_.size() &&
+        to.rotations.size() == local_rotations_.size())
+      << "The poses don't match the tree.";
+  for (int slot = 0; slot < local_rotations_.size(); ++slot) {
+    if (IsMaskedOut(slot)) {
+      slot += subtree_sizes_[slot] - 1;
+      continue;
+    }
+    // Equal samples are copied, the lerp could round them and mark the
+    // still nodes dirty.
+    Eigen::Quaternionf rotation = from.rotations[slot];
+    if (rotation.coeffs() != to.rotations[slot].coeffs()) {
+      // Shortest path, the normalized lerp is close to slerp for the small
+      // angles between two samples.
+      const Eigen::Vector4f &to_coeffs = to.rotations[slot].coeffs();
+      const float sign = rotation.coeffs().dot(to_coeffs) < 0 ? -1.f : 1.f;
+      rotation.coeffs() =
+          (1 - alpha) * rotation.coeffs() + (sign * alpha) * to_coeffs;
+      rotation.normalize();
+    }
+    Eigen::Vector3f translation = from.translations[slot];
+    if (translation != to.translations[slot]) {
+      translation = (1 - alpha) * translation + alpha * to.translations[slot];
+    }
+    Eigen::Vector3f scale = from.scales[slot];
+    if (scale != to.scales[slot]) {
+      scale = (1 - alpha) * scale + alpha * to.scales[slot];
+    }
+    if (rotation.coeffs() != local_rotations_[slot].coeffs() ||
+        translation != local_translations_[slot] ||
+        scale != local_scales_[slot]) {
+      local_rotations_[slot] = rotation;
+      local_translations_[slot] = translation;
+      local_scales_[slot] = scale;
+      MarkDirty(slot);
+    }
+  }
+}
+
+void SceneTree::SetLocalPose(const std::vector<float> &transform_array) {
+  CHECK(!node_indices_.empty()) << "Bonemap is not inited!";
+  int mat_size = 16;
+  CHECK(transform_array.size() == node_indices_.size() * mat_size)
+      << "transform_array size is invalid: " << transform_array.size()
+      << "(wish " << node_indices_.size() * mat_size << ").";
+
+  for (int b_idx = 0; b_idx < node_indices_.size(); ++b_idx) {
+    SetLocalMatrix(node_slots_[b_idx],
+                   Eigen::Map<const Eigen::Matrix4f>(
+                       &transform_array[b_idx * mat_size]));
+  }
+}
+
+void SceneTree::GetGlobalKeypoints(
+    const std::vector<std::string> &keypoint_names,
+    std::vector<glm::vec3> &keypoints) {
+  keypoints.clear();
+  UpdateGlobalPose();
+  for (auto cur_name : keypoint_names) {
+    const float *global_mat =
+        global_mats_[node_slots_[node_name2index_map_[cur_name]]].m;
+    keypoints.push_back(
+        glm::vec3(global_mat[3], global_mat[7], global_mat[11]));
+  }
+}
+
+SceneTree SceneTree::Split(
+    const std::vector<std::string> &scene_tree_ordered_name) const {
+  std::vector<bool> scene_tree_valid(this->node_indices_.size(), false);
+  std::map<int, int> oldSlot2newIdx_map;
+
+  for (auto i = 0; i < scene_tree_ordered_name.size(); i++) {
+    auto bone_name = scene_tree_ordered_name[i];
+    CHECK(this->node_name2index_map_.find(bone_name) !=
+          this->node_name2index_map_.end())
+        << "can't find bone " << bone_name;
+    auto cur_slot = node_slots_[this->node_name2index_map_.at(bone_name)];
+    scene_tree_valid[cur_slot] = true;
+    oldSlot2newIdx_map[cur_slot] = i;
+  }
+
+  std::vector<int> new_parent_indices(scene_tree_ordered_name.size(), -1);
+  STLVectorOfEigenTypes<Eigen::Matrix4f> new_local_mats(
+      scene_tree_ordered_name.size(), Eigen::Matrix4f::Identity());
+  for (auto slot = 0; slot < this->node_indices_.size(); slot++) {
+    if (!scene_tree_valid[slot])
+      continue;
+
+    auto new_idx = oldSlot2newIdx_map[slot];
+    auto old_parent_slot = parent_slots_[slot];
+    Eigen::Matrix4f local_mat = ComposeLocalMatrix(slot);
+    // Merge the skipped parents into the local matrix.
+    while (old_parent_slot != -1 && !scene_tree_valid[old_parent_slot]) {
+      local_mat = ComposeLocalMatrix(old_parent_slot) * local_mat;
+      old_parent_slot = parent_slots_[old_parent_slot];
+    }
+    new_parent_indices[new_idx] =
+        (old_parent_slot == -1) ? -1 : oldSlot2newIdx_map[old_parent_slot];
+    new_local_mats[new_idx] = local_mat;
+  }
+  return SceneTree(scene_tree_ordered_name, new_parent_indices,
+                   new_local_mats);
+}
+
+SceneTree SceneTree::UpdateTransform(
+    const std::vector<std::string> &ordered_names,
+    const STLVectorOfEigenTypes<Eigen::Matrix4f> &transforms) const {
+  CHECK(ordered_names.size() == transforms.size())
+      << ordered_names.size() << ", " << transforms.size();
+  SceneTree result = Copy();
+  for (auto i = 0; i < ordered_names.size(); i++) {
+    auto iter = this->node_name2index_map_.find(ordered_names[i]);
+    CHECK(iter != this->node_name2index_map_.end())
+        << "can't find bone " << ordered_names[i];
+    auto cur_slot = node_slots_[iter->second];
+    result.SetLocalMatrix(cur_slot,
+                          ComposeLocalMatrix(cur_slot) * transforms[i]);
+  }
+  result.UpdateGlobalPose();
+  return result;
+}
+
+void SceneTree::SetNodeTranslation(const glm::vec3 &translation,
+                                   const std::string &node_name) {
+  int slot = node_slots_[this->node_name2index_map_.at(node_name)];
+  local_translations_[slot] << translation.x, translation.y, translation.z;
+  MarkDirty(slot);
+}
+
+void SceneTree::AddFakedBoneNode(
+    const std::vector<std::string> &bone_names,
+    const std::vector<std::string> &parent_names,
+    const STLVectorOfEigenTypes<Eigen::Matrix4f> &rest_mats) {
+  if (bone_names.empty()) {
+    return;
+  }
+  // Restore the node index of parents, SortNodes works on node indices.
+  for (auto &parent_slot : parent_slots_) {
+    parent_slot = parent_slot == -1 ? -1 : node_indices_[parent_slot];
+  }
+  STLVectorOfEigenTypes<Eigen::Matrix4f> global_mats(node_indices_.size());
+  for (size_t slot = 0; slot < node_indices_.size(); ++slot) {
+    global_mats[node_indices_[slot]] =
+        AffineKernel::ToMatrix4(global_mats_[slot]);
+  }
+
+  int cur_offset = this->node_indices_.size();
+  for (auto i = 0; i < bone_names.size(); i++) {
+    auto iter = this->node_name2index_map_.find(parent_names[i]);
+    CHECK(iter != this->node_name2index_map_.end())
+        << "can't find bone " << parent_names[i];
+    global_mats.push_back(global_mats[iter->second] * rest_mats[i]);
+    AppendNode(cur_offset++, iter->second, bone_names[i], rest_mats[i]);
+  }
+  SortNodes();
+  for (size_t n_idx = 0; n_idx < global_mats.size(); ++n_idx) {
+    global_mats_[node_slots_[n_idx]] =
+        AffineKernel::FromMatrix4(global_mats[n_idx]);
+  }
+}
+
+void SceneTree::GetLocalTransform(std::vector<float> &transform_array) {
+  CHECK(!node_indices_.empty()) << "Bonemap hasn't been inited!";
+  int mat_size = 16;
+  std::vector<float> cur_transform_array(mat_size * node_indices_.size());
+
+  for (int b_idx = 0; b_idx < node_indices_.size(); ++b_idx) {
+    Eigen::Matrix4f local_mat = ComposeLocalMatrix(node_slots_[b_idx]);
+    std::copy(local_mat.data(), local_mat.data() + mat_size,
+              &cur_transform_array[mat_size * b_idx]);
+  }
+  transform_array = cur_transform_array;
+}
+
+void SceneTree::SetBoneTranslation(const std::string &bone_name,
+                                   const glm::vec3 &translation,
+                                   std::vector<float> &transform_array) {
+  auto bone_iter = node_name2index_map_.find(bone_name);
+  CHECK(bone_iter != node_name2index_map_.end())
+      << "Bonename : " << bone_name << " doesn't exist in bone_array!";
+  Eigen::Matrix4f cur_transform_matrix(
+      &transform_array[16 * bone_iter->second]);
+  cur_transform_matrix.block(0, 3, 3, 1) << translation.x, translation.y,
+      translation.z;
+  std::copy(cur_transform_matrix.data(),
+            cur_transform_matrix.data() + cur_transform_matrix.size(),
+            &transform_array[16 * bone_iter->second]);
+}
+
+void SceneTree::ConvertLocalRotationToGlobalRotation(
+    const STLVectorOfEigenTypes<Eigen::Matrix4f> &local_rotation_mats,
+    STLVectorOfEigenTypes<Eigen::Matrix4f> &global_rotation_mats) {
+  CHECK(local_rotation_mats.size() == node_indices_.size())
+      << "local_rotation_mats size(" << local_rotation_mats.size()
+      << ") doesn't match bone_array size(" << node_indices_.size() << ")";
+  global_rotation_mats.resize(local_rotation_mats.size(),
+                              Eigen::Matrix4f::Identity());
+  for (int b_idx = 0; b_idx < node_indices_.size(); ++b_idx) {
+    // Remove the offset, and convert local rotation to global rotaiton.
+    Eigen::Matrix4f global_mat = Eigen::Matrix4f::Identity();
+    global_mat.block(0, 0, 3, 3) =
+        AffineKernel::ToMatrix4(global_mats_[node_slots_[b_idx]])
+            .block(0, 0, 3, 3);
+    // local_rotation_mats is use on local_vec, to make it global,
+    // I need use local_vec = global_mat.inverse() * global_vec
+    // So global rotation (use on global vec and under global coordinate) is
+    // global_mat * local_rotation_mats[b_idx] * global_mat.inverse().
+    global_rotation_mats[b_idx] =
+        global_mat * local_rotation_mats[b_idx] * global_mat.inverse();
+  }
+}
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <map>
+#include <string>
+#include <tiny_gltf.h>
+#include <vector>
+
+#include "common/affine_kernels.h"
+#include "common/utility.h"
+#include "graphic/animation.h"
+
+// Helper function.
+void QTSToMatrix(const std::vector<float> &qts, Eigen::Matrix4f &matrix);
+void MatrixToQTS(const Eigen::Matrix4f &_matrix, std::vector<float> &qts);
+// matrix = T * R * S, the same order as gltf.
+void ComposeTRS(const Eigen::Quaternionf &rotation,
+                const Eigen::Vector3f &translation,
+                const Eigen::Vector3f &scale, Eigen::Matrix4f &matrix);
+void DecomposeTRS(const Eigen::Matrix4f &matrix, Eigen::Quaternionf &rotation,
+                  Eigen::Vector3f &translation, Eigen::Vector3f &scale);
+
+// Define the skeleton
+// Nodes are stored in flat arrays sorted by depth first order(parents before
+// children, every subtree is a contiguous range), so the global pose is a
+// single forward loop. The public interface still uses the node index of the
+// source(gltf node index), node_slots_ maps it to the sorted slot.
+// Every write of a local pose marks the node dirty, UpdateGlobalPose only
+// recomputes the dirty subtrees.
+class SceneTree {
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  SceneTree() = default;
+  ~SceneTree() = default;
+
+  void Init(const tinygltf::Model &model);
+  // Build from flat node tables, e.g. of a cooked model. parent_indices are
+  // node indices, rotations are (x, y, z, w).
+  void Init(const std::vector<std::string> &node_names,
+            const std::vector<int> &parent_indices,
+            const std::vector<float> &rotations,
+            const std::vector<float> &translations,
+            const std::vector<float> &scales);
+
+  SceneTree Copy() const;
+
+  // Only the dirty subtrees are recomputed.
+  void UpdateGlobalPose(bool with_inverse = false);
+  // Nodes recomputed by UpdateGlobalPose since the last call, for stats.
+  int TakeUpdatedNodeNum() {
+    int updated_node_num = updated_node_num_;
+    updated_node_num_ = 0;
+    return updated_node_num;
+  }
+  // Before get, you may need UpdateGlobalPose first if the local pose has been
+  // changed. skinning_palette[i] = global(skinning_joints[i]) * invbindmat[i].
+  void GetSkinningPoseData(
+      const std::vector<int> &skinning_joints,
+      const STLVectorOfEigenTypes<AffineMatrix> &skinning_invbindmat,
+      STLVectorOfEigenTypes<AffineMatrix> &skinning_palette);
+  void SetAnimationFrame(const AnimationClip &clip, int anim_idx,
+                         double time_stamp);
+  // Only advance the clip clock of SetAnimationFrame, the pose isn't
+  // sampled, e.g. for a character nobody sees.
+  void AdvanceAnimationFrame(int anim_idx, double time_stamp);
+  // Sample the clip at anim_time(seconds since the clip start).
+  void SetAnimationTime(const AnimationClip &clip, double anim_time);
+  void ResetAnimationTimer() {
+    anim_time_ = 0;
+    anim_timestamp_ = -1;
+  }
+  // Clip time of the last SetAnimationFrame or AdvanceAnimationFrame.
+  double GetAnimationTime() const { return anim_time_; }
+
+  // Local TRS of every node by slot, a snapshot for pose blending.
+  struct LocalPose {
+    STLVectorOfEigenTypes<Eigen::Quaternionf> rotations;
+    STLVectorOfEigenTypes<Eigen::Vector3f> translations;
+    STLVectorOfEigenTypes<Eigen::Vector3f> scales;
+  };
+  void SaveLocalPose(LocalPose &pose) const;
+  // local = nlerp(from, to, alpha) for the rotations, lerp for the rest.
+  // Only the nodes whose value changes are marked dirty.
+  void BlendLocalPose(const LocalPose &from, const LocalPose &to, float alpha);
+  // Only evaluate the nodes of node_mask(by node index, 0 to skip) in
+  // SetAnimationTime, BlendLocalPose and UpdateGlobalPose, nullptr for all.
+  // The parents of a kept node must be kept. The skipped nodes keep their
+  // last global matrix and are recomputed once kept again. node_mask must
+  // outlive its use, Copy doesn't keep it.
+  void SetNodeMask(const std::vector<uint8_t> *node_mask) {
+    node_mask_ = node_mask;
+  }
+
+  void SetLocalPose(const std::vector<float> &transform_array);
+
+  void GetGlobalKeypoints(const std::vector<std::string> &keypoint_names,
+                          std::vector<glm::vec3> &keypoints);
+
+  // split current skeleton into smaller one
+  SceneTree Split(const std::vector<std::string> &skeleton_ordered_name) const;
+
+  SceneTree UpdateTransform(
+      const std::vector<std::string> &ordered_names,
+      const STLVectorOfEigenTypes<Eigen::Matrix4f> &transforms) const;
+
+  void SetNodeTranslation(const glm::vec3 &translation,
+                          const std::string &node_names);
+
+  int GetNodeNum() const { return node_indices_.size(); }
+  // Resident CPU bytes, the names are counted by their characters.
+  size_t GetByteSize() const;
+
+  int GetNodeIndex(const std::string &node_name) const {
+    auto iter = node_name2index_map_.find(node_name);
+    if (iter != node_name2index_map_.end()) {
+      return iter->second;
+    } else {
+      LOG(WARNING) << "Node: " << node_name
+                   << " doesn't exist in the node array";
+      return -1;
+    }
+  }
+  const std::string &GetNodeName(int node_idx) const {
+    return node_names_[node_slots_[node_idx]];
+  }
+  int GetParentIndex(int node_idx) const {
+    int parent_slot = parent_slots_[node_slots_[node_idx]];
+    return parent_slot == -1 ? -1 : node_indices_[parent_slot];
+  }
+  // Valid after UpdateGlobalPose.
+  Eigen::Matrix4f GetLocalMatrix(int node_idx) const {
+    return AffineKernel::ToMatrix4(local_mats_[node_slots_[node_idx]]);
+  }
+  Eigen::Matrix4f GetGlobalMatrix(int node_idx) const {
+    return AffineKernel::ToMatrix4(global_mats_[node_slots_[node_idx]]);
+  }
+  // Local TRS of node_idx, rotation is (x, y, z, w).
+  void GetLocalPose(int node_idx, float *rotation, float *translation,
+                    float *scale) const;
+
+  glm::vec3 GetRootTrans() const;
+
+  // recover pose by eular angle.
+  template <typename T>
+  void RecoverPose(Eigen::Matrix<T, Eigen::Dynamic, 3> &result_pose,
+                   const std::vector<T> &params = {},
+                   const std::vector<Eigen::Vector3d> &bone_transforms = {},
+                   bool use_xyz = true) const {
+    STLVectorOfEigenTypes<Eigen::Matrix<T, 4, 4>> global_transforms(
+        node_indices_.size());
+    for (size_t slot = 0; slot < node_indices_.size(); ++slot) {
+      const int node_idx = node_indices_[slot];
+      Eigen::Matrix<T, 4, 4> rest_mat =
+          ComposeLocalMatrix(slot).template cast<T>();
+      if (!bone_transforms.empty() && node_names_[slot] != "Root_M") {
+        rest_mat.block(0, 3, 3, 1) << bone_transforms[node_idx].cast<T>();
+      }
+      Eigen::Matrix<T, 4, 4> global_transform =
+          parent_slots_[slot] == -1
+              ? rest_mat
+              : Eigen::Matrix<T, 4, 4>(
+                    global_transforms[parent_slots_[slot]] * rest_mat);
+      if (subtree_sizes_[slot] > 1 && !params.empty()) {
+        Eigen::Matrix<T, 4, 4> local_transform =
+            Eigen::Matrix<T, 4, 4>::Identity();
+        Eigen::Matrix<T, 3, 3> cur_rotation =
+            Eigen::Matrix<T, 3, 3>::Identity();
+        if (use_xyz) {
+          cur_rotation = Eigen::AngleAxis<T>(params[3 * node_idx + 2],
+                                             Eigen::Matrix<T, 3, 1>::UnitZ()) *
+                         Eigen::AngleAxis<T>(params[3 * node_idx + 1],
+                                             Eigen::Matrix<T, 3, 1>::UnitY()) *
+                         Eigen::AngleAxis<T>(params[3 * node_idx + 0],
+                                             Eigen::Matrix<T, 3, 1>::UnitX());
+        } else {
+          cur_rotation = Eigen::AngleAxis<T>(params[3 * node_idx + 0],
+                                             Eigen::Matrix<T, 3, 1>::UnitX()) *
+                         Eigen::AngleAxis<T>(params[3 * node_idx + 1],
+                                             Eigen::Matrix<T, 3, 1>::UnitY()) *
+                         Eigen::AngleAxis<T>(params[3 * node_idx + 2],
+                                             Eigen::Matrix<T, 3, 1>::UnitZ());
+        }
+        local_transform.block(0, 0, 3, 3) = cur_rotation;
+        global_transform = global_transform * local_transform;
+      }
+      result_pose.row(node_idx) << global_transform(0, 3),
+          global_transform(1, 3), global_transform(2, 3);
+      global_transforms[slot] = global_transform;
+    }
+  }
+
+  void
+  AddFakedBoneNode(const std::vector<std::string> &bone_names,
+                   const std::vector<std::string> &parent_names,
+                   const STLVectorOfEigenTypes<Eigen::Matrix4f> &rest_mats);
+
+  // only support entire skeleton
+  void GetLocalTransform(std::vector<float> &transfrom_array);
+
+  // calculate the rotation under global(Identity) coordinate.
+  void SetBoneTranslation(const std::string &bone_name,
+                          const glm::vec3 &translation,
+                          std::vector<float> &transform_array);
+  void ConvertLocalRotationToGlobalRotation(
+      const STLVectorOfEigenTypes<Eigen::Matrix4f> &local_rotation_mats,
+      STLVectorOfEigenTypes<Eigen::Matrix4f> &global_rotation_mats);
+
+private:
+  // parent_indices are node indices, local_mats are indexed by node index.
+  SceneTree(const std::vector<std::string> &node_names,
+            const std::vector<int> &parent_indices,
+            const STLVectorOfEigenTypes<Eigen::Matrix4f> &local_mats);
+
+  // Drop all the nodes.
+  void Clear();
+  Eigen::Matrix4f ComposeLocalMatrix(int slot) const;
+  void SetLocalMatrix(int slot, const Eigen::Matrix4f &local_mat);
+  bool IsMaskedOut(int slot) const {
+    return node_mask_ != nullptr && !(*node_mask_)[node_indices_[slot]];
+  }
+  // The local pose of slot has changed, its subtree must be recomputed.
+  void MarkDirty(int slot) {
+    local_dirty_[slot] = 1;
+    dirty_begin_ = std::min(dirty_begin_, slot);
+    dirty_end_ = std::max(dirty_end_, slot + subtree_sizes_[slot]);
+  }
+  // Append one node at the end of the arrays, call SortNodes after that.
+  void AppendNode(int node_idx, int parent_idx, const std::string &name,
+                  const Eigen::Matrix4f &local_mat);
+  // Sort all the arrays into depth first order. Before sorting,
+  // parent_slots_ holds node indices.
+  void SortNodes();
+
+  // Sorted by slot.
+  std::vector<int> node_indices_;
+  std::vector<std::string> node_names_;
+  std::vector<int> parent_slots_;
+  // Node number of the subtree rooted at the slot, itself included.
+  std::vector<int> subtree_sizes_;
+  // Local pose, the local matrices are only built from them in
+  // UpdateGlobalPose.
+  STLVectorOfEigenTypes<Eigen::Quaternionf> local_rotations_;
+  STLVectorOfEigenTypes<Eigen::Vector3f> local_translations_;
+  STLVectorOfEigenTypes<Eigen::Vector3f> local_scales_;
+  // Affine 3x4, computed by AffineKernel.
+  STLVectorOfEigenTypes<AffineMatrix> local_mats_;
+  STLVectorOfEigenTypes<AffineMatrix> global_mats_;
+
+  // Dirty flags of the local pose, and the slot range covering all the dirty
+  // subtrees.
+  std::vector<uint8_t> local_dirty_;
+  // Whether the global matrix is recomputed in current UpdateGlobalPose.
+  std::vector<uint8_t> global_updated_;
+  int dirty_begin_ = 0;
+  int dirty_end_ = 0;
+  int updated_node_num_ = 0;
+  // See SetNodeMask.
+  const std::vector<uint8_t> *node_mask_ = nullptr;
+  // Reused by UpdateGlobalPose and GetSkinningPoseData.
+  std::vector<int> update_slots_;
+  std::vector<int> skinning_slots_;
+
+  // Node index -> slot.
+  std::vector<int> node_slots_;
+  std::map<std::string, int> node_name2index_map_;
+  // The last top level node, used by GetRootTrans.
+  int root_slot_ = -1;
+
+  double anim_time_ = -1;
+  double anim_timestamp_ = 0;
+  int last_anim_index_ = -1;
+  // Reused every frame to avoid allocation.
+  std::vector<AnimationClip::KeyCursor> anim_cursors_;
+};
@@ -9,8 +9,36 @@ Shader::~Shader() {}
 
 bool Shader::CompileShader(const std::string &shader_str, GLenum shader_type,
                    GLuint &shader_id) {
-  const char *shader_str_arr[] = {shader_str.c_str()};
-  int shader_len_arr[] = {shader_str.size()};
+  std::string full_shader_str = shader_str;
+  if (!version_.empty()) {
+    const size_t version_pos = full_shader_str.find("#version");
+    if (version_pos != std::string::npos) {
+      const size_t line_end = full_shader_str.find_first_of("\r\n",
+                                                            version_pos);
+      full_shader_str.replace(version_pos,
+                              line_end == std::string::npos
+                                  ? std::string::npos
+                                  : line_end - version_pos,
+                              "#version " + version_);
+    }
+  }
+  if (!defines_.empty()) {
+    std::string define_str;
+    for (const auto &define : defines_) {
+      define_str += "#define " + define + "\n";
+    }
+    // #version must stay the first line.
+    size_t insert_pos = 0;
+    size_t version_pos = full_shader_str.find("#version");
+    if (version_pos != std::string::npos) {
+      insert_pos = full_shader_str.find('\n', version_pos);
+      insert_pos = insert_pos == std::string::npos ? full_shader_str.size()
+                                                   : insert_pos + 1;
+    }
+    full_shader_str.insert(insert_pos, define_str);
+  }
+  const char *shader_str_arr[] = {full_shader_str.c_str()};
+  int shader_len_arr[] = {static_cast<int>(full_shader_str.size())};
   shader_id = glCreateShader(shader_type);
   glShaderSource(shader_id, 1, shader_str_arr, shader_len_arr);
   glCompileShader(shader_id);
@@ -46,6 +74,7 @@ bool Shader::LinkShader(const std::vector<GLuint> &shader_id_arr) {
     LOG(WARNING) << "ShaderProgram Link Error: " << link_log;
     return false;
   }
+  ReflectUniforms();
   return true;
 }
 
@@ -163,11 +192,129 @@ void Shader::Use() {
     LOG(WARNING) << "Shader Error: Shader hasn't been inited!";
 }
 
+void Shader::ReflectUniforms() {
+  uniforms_.clear();
+  uniform_indices_.clear();
+  uniform_blocks_.clear();
+  reported_names_.clear();
+
+  GLint uniform_num = 0;
+  glGetProgramiv(program_id_, GL_ACTIVE_UNIFORMS, &uniform_num);
+  char name_buffer[256];
+  for (GLint u_idx = 0; u_idx < uniform_num; ++u_idx) {
+    UniformInfo info;
+    GLsizei name_len = 0;
+    glGetActiveUniform(program_id_, u_idx, sizeof(name_buffer), &name_len,
+                       &info.size, &info.type, name_buffer);
+    info.name.assign(name_buffer, name_len);
+    info.location = glGetUniformLocation(program_id_, info.name.c_str());
+    // Members of uniform blocks have no location.
+    if (info.location == -1) {
+      continue;
+    }
+    // Arrays are reported as "name[0]", register them by "name".
+    const size_t bracket_pos = info.name.find('[');
+    if (bracket_pos != std::string::npos) {
+      info.name.resize(bracket_pos);
+    }
+    uniform_indices_[info.name] = uniforms_.size();
+    uniforms_.push_back(info);
+  }
+
+  GLint block_num = 0;
+  glGetProgramiv(program_id_, GL_ACTIVE_UNIFORM_BLOCKS, &block_num);
+  for (GLint b_idx = 0; b_idx < block_num; ++b_idx) {
+    GLsizei name_len = 0;
+    glGetActiveUniformBlockName(program_id_, b_idx, sizeof(name_buffer),
+                                &name_len, name_buffer);
+    uniform_blocks_[std::string(name_buffer, name_len)] =
+        std::make_pair(static_cast<GLuint>(b_idx), -1);
+  }
+}
+
+Shader::UniformHandle Shader::GetUniformHandle(const std::string &val_name,
+                                               bool optional) {
+  UniformHandle handle;
+  auto iter = uniform_indices_.find(val_name);
+  if (iter != uniform_indices_.end()) {
+    handle.index = iter->second;
+  } else if (!optional && reported_names_.insert(val_name).second) {
+    LOG(WARNING) << "Shader Error: uniform " << val_name
+                 << " doesn't exist or isn't active!";
+  }
+  return handle;
+}
+
+void Shader::BindUniformBlock(const std::string &block_name, GLuint binding) {
+  if (!inited_) {
+    LOG(WARNING) << "Shader Error: Shader hasn't been inited!";
+    return;
+  }
+  auto iter = uniform_blocks_.find(block_name);
+  if (iter == uniform_blocks_.end()) {
+    if (reported_names_.insert(block_name).second) {
+      LOG(WARNING) << "Shader Error: uniform block " << block_name
+                   << " doesn't exist!";
+    }
+    return;
+  }
+  // The binding is program state, only set it when it changes.
+  if (iter->second.second != static_cast<GLint>(binding)) {
+    glUniformBlockBinding(program_id_, iter->second.first, binding);
+    iter->second.second = binding;
+  }
+}
+
+void Shader::SetMat4Array(UniformHandle handle, const std::vector<float> &val,
+                          int n) {
+  CHECK(val.size() == n * 16) << "val size doesn't match 16 * n";
+  if (handle.IsValid()) {
+    glUniformMatrix4fv(uniforms_[handle.index].location, n, GL_FALSE,
+                       val.data());
+  }
+}
+
+void Shader::Set(UniformHandle handle, const glm::mat3 &val) {
+  if (handle.IsValid()) {
+    glUniformMatrix3fv(uniforms_[handle.index].location, 1, GL_FALSE,
+                       &val[0][0]);
+  }
+}
+
+void Shader::Set(UniformHandle handle, const glm::vec3 &val) {
+  if (handle.IsValid()) {
+    glUniform3f(uniforms_[handle.index].location, val.x, val.y, val.z);
+  }
+}
+
+void Shader::Set(UniformHandle handle, const glm::mat4 &val) {
+  if (handle.IsValid()) {
+    glUniformMatrix4fv(uniforms_[handle.index].location, 1, GL_FALSE,
+                       &val[0][0]);
+  }
+}
+
+void Shader::Set(UniformHandle handle, const glm::vec4 &val) {
+  if (handle.IsValid()) {
+    glUniform4f(uniforms_[handle.index].location, val.x, val.y, val.z, val.w);
+  }
+}
+
+void Shader::Set(UniformHandle handle, float val) {
+  if (handle.IsValid()) {
+    glUniform1f(uniforms_[handle.index].location, val);
+  }
+}
+
+void Shader::Set(UniformHandle handle, int val) {
+  if (handle.IsValid()) {
+    glUniform1i(uniforms_[handle.index].location, val);
+  }
+}
+
 void Shader::SetMat4Array(const std::string &val_name, const std::vector<float> &val, int n) {
   if (inited_) {
-    CHECK(val.size() == n * 16) << "val size doesn't match 16 * n";
-    GLint location = glGetUniformLocation(program_id_, val_name.c_str());
-    glUniformMatrix4fv(location, n, GL_FALSE, val.data());
+    SetMat4Array(GetUniformHandle(val_name), val, n);
   }
   else {
     LOG(WARNING) << "Shader Error: Shader hasn't been inited!";
@@ -176,8 +323,7 @@ void Shader::SetMat4Array(const std::string &val_name, const std::vector<float>
 
 void Shader::Set(const std::string &val_name, const glm::mat3 &val) {
   if (inited_) {
-    GLint location = glGetUniformLocation(program_id_, val_name.c_str());
-    glUniformMatrix3fv(location, 1, GL_FALSE, &val[0][0]);
+    Set(GetUniformHandle(val_name), val);
   } else {
     LOG(WARNING) << "Shader Error: Shader hasn't been inited!";
   }
@@ -185,8 +331,7 @@ void Shader::Set(const std::string &val_name, const glm::mat3 &val) {
 
 void Shader::Set(const std::string &val_name, const glm::vec3 &val) {
   if (inited_) {
-    GLint location = glGetUniformLocation(program_id_, val_name.c_str());
-    glUniform3f(location, val.x, val.y, val.z);
+    Set(GetUniformHandle(val_name), val);
   } else {
     LOG(WARNING) << "Shader Error: Shader hasn't been inited!";
   }
@@ -194,8 +339,7 @@ void Shader::Set(const std::string &val_name, const glm::vec3 &val) {
 
 void Shader::Set(const std::string &val_name, const glm::mat4 &val) {
   if (inited_) {
-    GLint location = glGetUniformLocation(program_id_, val_name.c_str());
-    glUniformMatrix4fv(location, 1, GL_FALSE, &val[0][0]);
+    Set(GetUniformHandle(val_name), val);
   } else {
     LOG(WARNING) << "Shader Error: Shader hasn't been inited!";
   }
@@ -203,8 +347,7 @@ void Shader::Set(const std::string &val_name, const glm::mat4 &val) {
 
 void Shader::Set(const std::string &val_name, const glm::vec4 &val) {
   if (inited_) {
-    GLint location = glGetUniformLocation(program_id_, val_name.c_str());
-    glUniform4f(location, val.x, val.y, val.z, val.w);
+    Set(GetUniformHandle(val_name), val);
   } else {
     LOG(WARNING) << "Shader Error: Shader hasn't been inited!";
   }
@@ -212,8 +355,7 @@ void Shader::Set(const std::string &val_name, const glm::vec4 &val) {
 
 void Shader::Set(const std::string &val_name, float val) {
   if (inited_) {
-    GLint location = glGetUniformLocation(program_id_, val_name.c_str());
-    glUniform1f(location, val);
+    Set(GetUniformHandle(val_name), val);
   } else {
     LOG(WARNING) << "Shader Error: Shader hasn't been inited!";
   }
@@ -221,8 +363,7 @@ void Shader::Set(const std::string &val_name, float val) {
 
 void Shader::Set(const std::string &val_name, int val) {
   if (inited_) {
-    GLint location = glGetUniformLocation(program_id_, val_name.c_str());
-    glUniform1i(location, val);
+    Set(GetUniformHandle(val_name), val);
   } else {
     LOG(WARNING) << "Shader Error: Shader hasn't been inited!";
   }
@@ -3,10 +3,20 @@
 #include <GL/gl3w.h>
 #include <glm/glm.hpp>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+// All the active uniforms are reflected after link. Resolve the uniforms used
+// in hot paths into UniformHandle once, setting by handle is an array lookup.
 class Shader {
 public:
+  // Index into the reflected uniforms, valid until the shader is inited again.
+  struct UniformHandle {
+    int index = -1;
+    bool IsValid() const { return index >= 0; }
+  };
+
   Shader() = default;
   ~Shader();
   bool InitFromFile(const std::string &vs_path, const std::string &fs_path);
@@ -20,8 +30,36 @@ public:
   Shader(const Shader &rhs) = delete;
   Shader &operator=(const Shader &rhs) = delete;
 
+  // "NAME" or "NAME VALUE", inserted as #define after the #version line of
+  // every stage. Must be set before Init.
+  void SetDefines(const std::vector<std::string> &defines) {
+    defines_ = defines;
+  }
+  // Replace the #version of every stage, e.g. "430 core" for the GL 4.3
+  // features behind a define. Must be set before Init.
+  void SetVersion(const std::string &version) { version_ = version; }
+
   void Use();
+  GLuint GetProgramId() const { return program_id_; }
+
+  // Bind the uniform block to the binding point(no layout binding in 330).
+  void BindUniformBlock(const std::string &block_name, GLuint binding);
+
+  // Unknown names are reported once. Optional uniforms, e.g. ones the
+  // driver may optimize out, are not reported.
+  UniformHandle GetUniformHandle(const std::string &val_name,
+                                 bool optional = false);
 
+  // Invalid handles are ignored, they have been reported when resolved.
+  void SetMat4Array(UniformHandle handle, const std::vector<float> &val, int n);
+  void Set(UniformHandle handle, const glm::mat3 &val);
+  void Set(UniformHandle handle, const glm::vec3 &val);
+  void Set(UniformHandle handle, const glm::mat4 &val);
+  void Set(UniformHandle handle, const glm::vec4 &val);
+  void Set(UniformHandle handle, float val);
+  void Set(UniformHandle handle, int val);
+
+  // Set by name, the name is resolved by the reflected uniforms.
   void SetMat4Array(const std::string &val_name, const std::vector<float> &val, int n);
   void Set(const std::string &val_name, const glm::mat3 &val);
   void Set(const std::string &val_name, const glm::vec3 &val);
@@ -34,7 +72,24 @@ private:
   bool CompileShader(const std::string &shader_str, GLenum shader_type,
                      GLuint &shader_id);
   bool LinkShader(const std::vector<GLuint> &shader_id_arr);
+  void ReflectUniforms();
+
+  struct UniformInfo {
+    std::string name;
+    GLint location = -1;
+    GLenum type = 0;
+    GLint size = 0;
+  };
 
   GLuint program_id_;
   bool inited_ = false;
+  std::vector<std::string> defines_;
+  std::string version_;
+
+  std::vector<UniformInfo> uniforms_;
+  std::unordered_map<std::string, int> uniform_indices_;
+  // Block name -> (block index, binding point, -1 if not bound yet).
+  std::unordered_map<std::string, std::pair<GLuint, GLint>> uniform_blocks_;
+  // Unknown names already reported.
+  std::unordered_set<std::string> reported_names_;
 };
\ No newline at end of file
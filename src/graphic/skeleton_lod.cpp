@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cmath>
+
+#include "common/logging.h"
+#include "graphic/accessor_view.h"
+#include "graphic/skeleton_lod.h"
+
+namespace SkeletonLod {
+
+namespace {
+
+// MODE_DEPTH, every level drops this many more hierarchy levels.
+const int kDepthStep = 2;
+// MODE_WEIGHT, level 1 drops the subtrees below this share of the total
+// weight, every next level multiplies it by kWeightShareGrowth.
+const double kWeightShare = 0.005;
+const double kWeightShareGrowth = 4;
+
+} // namespace
+
+void AccumulateJointWeights(const tinygltf::Model &model,
+                            const std::vector<BufferSpan> &buffers,
+                            const tinygltf::Mesh &mesh,
+                            std::vector<double> &joint_weights) {
+  std::vector<float> joints;
+  std::vector<float> weights;
+  for (const auto &primitive : mesh.primitives) {
+    auto joints_iter = primitive.attributes.find("JOINTS_0");
+    auto weights_iter = primitive.attributes.find("WEIGHTS_0");
+    if (joints_iter == primitive.attributes.end() ||
+        weights_iter == primitive.attributes.end()) {
+      continue;
+    }
+    AccessorView(model, buffers, model.accessors[joints_iter->second])
+        .ReadFloats(joints);
+    AccessorView(model, buffers, model.accessors[weights_iter->second])
+        .ReadFloats(weights);
+    CHECK(joints.size() == weights.size())
+        << "JOINTS_0 and WEIGHTS_0 must have the same count.";
+    for (size_t i_idx = 0; i_idx < joints.size(); ++i_idx) {
+      const size_t joint = static_cast<size_t>(joints[i_idx]);
+      if (weights[i_idx] > 0 && joint < joint_weights.size()) {
+        joint_weights[joint] += weights[i_idx];
+      }
+    }
+  }
+}
+
+void Build(const tinygltf::Model &model, const tinygltf::Skin &skin,
+           const STLVectorOfEigenTypes<AffineMatrix> &skin_invbindmat,
+           const std::vector<double> &joint_weights, Mode mode, int level_num,
+           std::vector<Level> &levels) {
+  std::vector<std::vector<int>> node_children(model.nodes.size());
+  std::vector<int> node_meshes(model.nodes.size());
+  for (size_t n_idx = 0; n_idx < model.nodes.size(); ++n_idx) {
+    node_children[n_idx] = model.nodes[n_idx].children;
+    node_meshes[n_idx] = model.nodes[n_idx].mesh;
+  }
+  Build(node_children, node_meshes, skin.joints, skin_invbindmat,
+        joint_weights, mode, level_num, levels);
+}
+
+void Build(const std::vector<std::vector<int>> &node_children,
+           const std::vector<int> &node_meshes, const std::vector<int> &joints,
+           const STLVectorOfEigenTypes<AffineMatrix> &skin_invbindmat,
+           const std::vector<double> &joint_weights, Mode mode, int level_num,
+           std::vector<Level> &levels) {
+  const int node_num = node_children.size();
+  const int joint_num = joints.size();
+  CHECK(skin_invbindmat.size() == joint_num)
+      << "skin joints doesn't match matrix count.";
+  std::vector<int> parents(node_num, -1);
+  for (int n_idx = 0; n_idx < node_num; ++n_idx) {
+    for (int child_idx : node_children[n_idx]) {
+      parents[child_idx] = n_idx;
+    }
+  }
+  std::vector<int> node_joints(node_num, -1);
+  for (int j_idx = 0; j_idx < joint_num; ++j_idx) {
+    node_joints[joints[j_idx]] = j_idx;
+  }
+
+  // Parents before children, depth counts the joint ancestors.
+  std::vector<int> order;
+  std::vector<int> node_stack;
+  for (int n_idx = 0; n_idx < node_num; ++n_idx) {
+    if (parents[n_idx] == -1) {
+      node_stack.push_back(n_idx);
+    }
+  }
+  std::vector<int> depths(node_num, 0);
+  while (!node_stack.empty()) {
+    const int node_idx = node_stack.back();
+    node_stack.pop_back();
+    order.push_back(node_idx);
+    for (int child_idx : node_children[node_idx]) {
+      depths[child_idx] =
+          depths[node_idx] + (node_joints[node_idx] >= 0 ? 1 : 0);
+      node_stack.push_back(child_idx);
+    }
+  }
+  int max_depth = 0;
+  for (int j_idx = 0; j_idx < joint_num; ++j_idx) {
+    max_depth = std::max(max_depth, depths[joints[j_idx]]);
+  }
+  // Children before parents, a subtree weight bounds the ones below it.
+  std::vector<double> subtree_weights(node_num, 0);
+  double total_weight = 0;
+  for (auto iter = order.rbegin(); iter != order.rend(); ++iter) {
+    const int joint_idx = node_joints[*iter];
+    if (joint_idx >= 0 && joint_idx < joint_weights.size()) {
+      subtree_weights[*iter] += joint_weights[joint_idx];
+      total_weight += joint_weights[joint_idx];
+    }
+    if (parents[*iter] >= 0) {
+      subtree_weights[parents[*iter]] += subtree_weights[*iter];
+    }
+  }
+
+  levels.assign(level_num, Level());
+  std::vector<uint8_t> is_dropped(node_num);
+  for (int l_idx = 0; l_idx < level_num; ++l_idx) {
+    const double weight_share =
+        l_idx == 0 ? 0 : kWeightShare * std::pow(kWeightShareGrowth, l_idx - 1);
+    // The root joints are never dropped, they end every redirection.
+    for (int node_idx : order) {
+      const int joint_idx = node_joints[node_idx];
+      const bool parent_dropped =
+          parents[node_idx] >= 0 && is_dropped[parents[node_idx]];
+      if (joint_idx < 0 || depths[node_idx] == 0 || l_idx == 0) {
+        is_dropped[node_idx] = parent_dropped;
+      } else if (mode == MODE_DEPTH) {
+        is_dropped[node_idx] =
+            parent_dropped || depths[node_idx] > max_depth - kDepthStep * l_idx;
+      } else {
+        is_dropped[node_idx] =
+            parent_dropped ||
+            (total_weight > 0 &&
+             subtree_weights[node_idx] < weight_share * total_weight);
+      }
+    }
+    Level &level = levels[l_idx];
+    level.node_mask.assign(node_num, 0);
+    for (auto iter = order.rbegin(); iter != order.rend(); ++iter) {
+      if (!is_dropped[*iter] || node_meshes[*iter] >= 0) {
+        level.node_mask[*iter] = 1;
+      }
+      if (level.node_mask[*iter] && parents[*iter] >= 0) {
+        level.node_mask[parents[*iter]] = 1;
+      }
+    }
+
+    std::vector<int> kept_indices(joint_num, -1);
+    for (int j_idx = 0; j_idx < joint_num; ++j_idx) {
+      if (level.node_mask[joints[j_idx]]) {
+        kept_indices[j_idx] = level.joints.size();
+        level.joints.push_back(joints[j_idx]);
+        level.invbindmat.push_back(skin_invbindmat[j_idx]);
+      }
+    }
+    level.palette_indices.resize(joint_num);
+    for (int j_idx = 0; j_idx < joint_num; ++j_idx) {
+      int node_idx = joints[j_idx];
+      while (node_joints[node_idx] < 0 ||
+             kept_indices[node_joints[node_idx]] < 0) {
+        node_idx = parents[node_idx];
+        CHECK(node_idx >= 0) << "Joint " << j_idx << " has no kept ancestor.";
+      }
+      level.palette_indices[j_idx] = kept_indices[node_joints[node_idx]];
+    }
+  }
+}
+
+} // namespace SkeletonLod
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <tiny_gltf.h>
+#include <vector>
+
+#include "common/affine_kernels.h"
+#include "common/utility.h"
+#include "graphic/gltf_loader.h"
+
+// Load time joint sets of a skin for the distant characters, see
+// Model::SetSkeletonLod. A lower level drops the joints nobody can see at
+// distance, e.g. the fingers and the face. A dropped joint isn't evaluated,
+// its palette entry is the one of its nearest kept ancestor joint, so its
+// vertices move rigidly with that joint as if they were skinned to it.
+//
+// The dropped joints are closed downward, the children of a dropped joint
+// are dropped. The nodes carrying a mesh and their ancestors are always
+// kept.
+namespace SkeletonLod {
+
+enum Mode {
+  // Drop the deepest levels of the joint hierarchy.
+  MODE_DEPTH = 0,
+  // Drop the subtrees holding the smallest share of the vertex weights.
+  MODE_WEIGHT = 1,
+};
+
+struct Level {
+  // By node index, 0 for the nodes skipped at this level, see
+  // SceneTree::SetNodeMask.
+  std::vector<uint8_t> node_mask;
+  // The kept skin joints, node indices and inverse bind matrices.
+  std::vector<int> joints;
+  STLVectorOfEigenTypes<AffineMatrix> invbindmat;
+  // Per skin joint, the index in joints of its palette entry.
+  std::vector<int> palette_indices;
+};
+
+// Summed vertex weight of every skin joint over the primitives of mesh.
+void AccumulateJointWeights(const tinygltf::Model &model,
+                            const std::vector<BufferSpan> &buffers,
+                            const tinygltf::Mesh &mesh,
+                            std::vector<double> &joint_weights);
+// level_num levels of the skin, level 0 keeps every joint. joint_weights
+// is only read by MODE_WEIGHT.
+void Build(const tinygltf::Model &model, const tinygltf::Skin &skin,
+           const STLVectorOfEigenTypes<AffineMatrix> &skin_invbindmat,
+           const std::vector<double> &joint_weights, Mode mode, int level_num,
+           std::vector<Level> &levels);
+// The same from the node tables, e.g. of a cooked model. node_meshes is -1
+// for the nodes without mesh, joints are the skin joint nodes.
+void Build(const std::vector<std::vector<int>> &node_children,
+           const std::vector<int> &node_meshes, const std::vector<int> &joints,
+           const STLVectorOfEigenTypes<AffineMatrix> &skin_invbindmat,
+           const std::vector<double> &joint_weights, Mode mode, int level_num,
+           std::vector<Level> &levels);
+
+} // namespace SkeletonLod
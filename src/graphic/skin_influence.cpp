@@ -0,0 +1,77 @@
+#include <algorithm>
+
+#include "common/logging.h"
+#include "graphic/skin_influence.h"
+
+namespace SkinInfluence {
+
+namespace {
+
+// Below half a unorm8 step, lost by the compact weights anyway.
+const float kMinWeight = 0.5f / 255.f;
+
+// 3 influences use the 4 influence shader.
+int ToInfluenceNum(int used_num) {
+  return used_num <= 2 ? std::max(used_num, 1) : 4;
+}
+
+} // namespace
+
+int Normalize(std::vector<float> &joints, std::vector<float> &weights) {
+  CHECK(joints.size() == weights.size() && weights.size() % 4 == 0)
+      << "JOINTS_0 and WEIGHTS_0 must be vec4 of the same count.";
+  int max_used_num = 1;
+  for (size_t v_idx = 0; v_idx < weights.size() / 4; ++v_idx) {
+    float *vertex_joints = &joints[4 * v_idx];
+    float *vertex_weights = &weights[4 * v_idx];
+    int order[4] = {0, 1, 2, 3};
+    std::stable_sort(order, order + 4, [vertex_weights](int lhs, int rhs) {
+      return vertex_weights[lhs] > vertex_weights[rhs];
+    });
+    float sorted_joints[4];
+    float sorted_weights[4];
+    float sum = 0;
+    int used_num = 0;
+    for (int i_idx = 0; i_idx < 4; ++i_idx) {
+      const float weight = vertex_weights[order[i_idx]];
+      if (weight >= kMinWeight) {
+        sorted_joints[used_num] = vertex_joints[order[i_idx]];
+        sorted_weights[used_num] = weight;
+        sum += weight;
+        ++used_num;
+      }
+    }
+    if (sum <= 0) {
+      // No influence, left as is.
+      continue;
+    }
+    for (int i_idx = 0; i_idx < 4; ++i_idx) {
+      // The unused joints point at the first one, a valid palette entry.
+      vertex_joints[i_idx] =
+          i_idx < used_num ? sorted_joints[i_idx] : sorted_joints[0];
+      vertex_weights[i_idx] =
+          i_idx < used_num ? sorted_weights[i_idx] / sum : 0.f;
+    }
+    max_used_num = std::max(max_used_num, used_num);
+  }
+  return ToInfluenceNum(max_used_num);
+}
+
+int Analyze(const std::vector<float> &weights, bool &is_sorted) {
+  is_sorted = true;
+  int max_used_num = 1;
+  for (size_t v_idx = 0; v_idx < weights.size() / 4; ++v_idx) {
+    const float *vertex_weights = &weights[4 * v_idx];
+    for (int i_idx = 0; i_idx < 4; ++i_idx) {
+      if (vertex_weights[i_idx] > 0) {
+        max_used_num = std::max(max_used_num, i_idx + 1);
+      }
+      if (i_idx > 0 && vertex_weights[i_idx] > vertex_weights[i_idx - 1]) {
+        is_sorted = false;
+      }
+    }
+  }
+  return ToInfluenceNum(max_used_num);
+}
+
+} // namespace SkinInfluence
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <vector>
+
+// Load time analysis of the skin influences(JOINTS_0, WEIGHTS_0), for the
+// skinned shaders specialized by influence number, see
+// Model::SetSkinInfluenceLod. A primitive is drawn with 1, 2 or 4
+// influences per vertex. With the influences sorted by decreasing weight,
+// the first 1 or 2 renormalized are also a cheaper approximation for the
+// distant characters.
+namespace SkinInfluence {
+
+// Sort the influences of every vertex by decreasing weight, drop the ones
+// below a unorm8 step and renormalize the rest to sum one. joints and
+// weights are vec4 per vertex. Return the influence number of the
+// primitive, 1, 2 or 4.
+int Normalize(std::vector<float> &joints, std::vector<float> &weights);
+// Influence number of weights as they are, the last non zero weight of the
+// vertices, 1, 2 or 4. is_sorted is set if every vertex has decreasing
+// weights, only then the first influences are the largest ones.
+int Analyze(const std::vector<float> &weights, bool &is_sorted);
+
+} // namespace SkinInfluence
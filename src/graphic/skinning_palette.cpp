@@ -0,0 +1,115 @@
+#include <algorithm>
+
+#include "graphic/skinning_palette.h"
+#include "common/logging.h"
+
+constexpr int SkinningPalette::kRingSize;
+constexpr GLuint SkinningPalette::kUniformBinding;
+constexpr GLuint SkinningPalette::kTextureUnit;
+
+SkinningPalette::~SkinningPalette() { Release(); }
+
+void SkinningPalette::Release() {
+  if (buffers_[0]) {
+    glDeleteBuffers(kRingSize, buffers_);
+  }
+  if (textures_[0]) {
+    glDeleteTextures(kRingSize, textures_);
+  }
+  for (int r_idx = 0; r_idx < kRingSize; ++r_idx) {
+    buffers_[r_idx] = 0;
+    textures_[r_idx] = 0;
+  }
+  joint_num_ = 0;
+  instance_capacity_ = 0;
+}
+
+void SkinningPalette::Init(int joint_num, int instance_num, bool force_tbo) {
+  CHECK(joint_num > 0 && instance_num > 0)
+      << "SkinningPalette: joint_num and instance_num must be positive.";
+  Release();
+  joint_num_ = joint_num;
+  instance_capacity_ = 0;
+  ring_index_ = 0;
+
+  const GLsizeiptr byte_size =
+      static_cast<GLsizeiptr>(joint_num) * instance_num * sizeof(AffineMatrix);
+  GLint max_block_size = 0;
+  glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &max_block_size);
+  storage_ = !force_tbo && byte_size <= max_block_size ? STORAGE_UBO
+                                                       : STORAGE_TBO;
+
+  glGenBuffers(kRingSize, buffers_);
+  Reserve(instance_num);
+
+  if (storage_ == STORAGE_TBO) {
+    // Three RGBA32F texels per joint.
+    glGenTextures(kRingSize, textures_);
+    for (int r_idx = 0; r_idx < kRingSize; ++r_idx) {
+      glBindTexture(GL_TEXTURE_BUFFER, textures_[r_idx]);
+      glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffers_[r_idx]);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+  }
+  LOG(INFO) << "SkinningPalette: " << joint_num << " joints x "
+            << instance_num << " instances in "
+            << (storage_ == STORAGE_UBO ? "uniform buffer" : "texture buffer")
+            << " (max uniform block size " << max_block_size << ").";
+}
+
+void SkinningPalette::Reserve(int instance_num) {
+  if (instance_num <= instance_capacity_) {
+    return;
+  }
+  CHECK(storage_ == STORAGE_TBO || instance_capacity_ == 0)
+      << "SkinningPalette: only the texture buffer can grow.";
+  instance_capacity_ = std::max(instance_num, 2 * instance_capacity_);
+  const GLenum target =
+      storage_ == STORAGE_UBO ? GL_UNIFORM_BUFFER : GL_TEXTURE_BUFFER;
+  // The texture buffers refer to the buffer objects, so they follow the new
+  // data store.
+  for (int r_idx = 0; r_idx < kRingSize; ++r_idx) {
+    glBindBuffer(target, buffers_[r_idx]);
+    glBufferData(target,
+                 static_cast<GLsizeiptr>(joint_num_) * instance_capacity_ *
+                     sizeof(AffineMatrix),
+                 nullptr, GL_DYNAMIC_DRAW);
+  }
+  glBindBuffer(target, 0);
+}
+
+std::vector<std::string> SkinningPalette::GetShaderDefines() const {
+  std::vector<std::string> defines = {"SKINNING_JOINT_NUM " +
+                                      std::to_string(joint_num_)};
+  if (storage_ == STORAGE_TBO) {
+    defines.push_back("SKINNING_PALETTE_TBO");
+  }
+  return defines;
+}
+
+void SkinningPalette::Upload(
+    const STLVectorOfEigenTypes<AffineMatrix> &palette) {
+  CHECK(palette.size() % joint_num_ == 0 &&
+        palette.size() / joint_num_ <= instance_capacity_)
+      << "SkinningPalette: palette size " << palette.size()
+      << " doesn't match joint num " << joint_num_ << " x instance capacity "
+      << instance_capacity_;
+  ring_index_ = (ring_index_ + 1) % kRingSize;
+  const GLenum target =
+      storage_ == STORAGE_UBO ? GL_UNIFORM_BUFFER : GL_TEXTURE_BUFFER;
+  glBindBuffer(target, buffers_[ring_index_]);
+  glBufferSubData(target, 0, palette.size() * sizeof(AffineMatrix),
+                  palette.data());
+  glBindBuffer(target, 0);
+}
+
+void SkinningPalette::Bind(Shader &shader, GLStateCache &state_cache) const {
+  if (storage_ == STORAGE_UBO) {
+    shader.BindUniformBlock("SkinningPalette", kUniformBinding);
+    state_cache.BindUniformBuffer(kUniformBinding, buffers_[ring_index_]);
+  } else {
+    state_cache.BindTexture(kTextureUnit, GL_TEXTURE_BUFFER,
+                            textures_[ring_index_]);
+    shader.Set("skinning_palette", static_cast<int>(kTextureUnit));
+  }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <GL/gl3w.h>
+#include <string>
+#include <vector>
+
+#include "common/affine_kernels.h"
+#include "common/utility.h"
+#include "graphic/gl_state.h"
+#include "graphic/shader.h"
+
+// GPU storage of the skinning palette(one 3x4 affine matrix, i.e. three vec4
+// rows, per joint). Small rigs use a uniform buffer, rigs exceeding
+// GL_MAX_UNIFORM_BLOCK_SIZE use a texture buffer. Upload writes into a ring
+// of buffers, so the buffer still read by the previous frames is never
+// overwritten. Upload once per frame, then Bind for every pass that skins the
+// same character. Instanced draws pack the palettes of all the instances in
+// one buffer, the shader offsets the joints by gl_InstanceID.
+class SkinningPalette {
+public:
+  enum Storage { STORAGE_UBO = 0, STORAGE_TBO = 1 };
+  // Ring size, the frames the driver may keep in flight.
+  static constexpr int kRingSize = 3;
+  // Binding point of the uniform block, texture unit of the texture buffer.
+  static constexpr GLuint kUniformBinding = 0;
+  static constexpr GLuint kTextureUnit = 8;
+
+  SkinningPalette() = default;
+  ~SkinningPalette();
+  SkinningPalette(const SkinningPalette &rhs) = delete;
+  SkinningPalette &operator=(const SkinningPalette &rhs) = delete;
+
+  // force_tbo: use the texture buffer even if the palettes fit in a uniform
+  // block, e.g. for crowds that grow later.
+  void Init(int joint_num, int instance_num = 1, bool force_tbo = false);
+  // Grow the buffers to hold instance_num palettes, only for STORAGE_TBO
+  // since the shader defines of the storage don't change.
+  void Reserve(int instance_num);
+  // Shader defines matching the storage, call Shader::SetDefines with them
+  // before compiling the skinning shader.
+  std::vector<std::string> GetShaderDefines() const;
+  // Write the palettes(instance after instance) into the next buffer of the
+  // ring.
+  void Upload(const STLVectorOfEigenTypes<AffineMatrix> &palette);
+  // Bind the last uploaded buffer to the shader, the shader must be in use.
+  void Bind(Shader &shader, GLStateCache &state_cache) const;
+  // Delete the buffers, Init again before use.
+  void Release();
+
+  Storage GetStorage() const { return storage_; }
+  int GetJointNum() const { return joint_num_; }
+  int GetInstanceCapacity() const { return instance_capacity_; }
+
+private:
+  Storage storage_ = STORAGE_UBO;
+  int joint_num_ = 0;
+  int instance_capacity_ = 0;
+  int ring_index_ = 0;
+  GLuint buffers_[kRingSize] = {0, 0, 0};
+  // Only for STORAGE_TBO.
+  GLuint textures_[kRingSize] = {0, 0, 0};
+};
@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <utility>
+
+#include <glm/glm.hpp>
+
+#include "common/logging.h"
+#include "graphic/accessor_view.h"
+#include "graphic/model.h"
+#include "graphic/skin_influence.h"
+#include "graphic/static_batcher.h"
+
+namespace StaticBatcher {
+
+namespace {
+
+// Indexed by the attribute location of the avatar shaders.
+const char *const kAttribNames[] = {"POSITION", "TEXCOORD_0", "NORMAL",
+                                    "JOINTS_0", "WEIGHTS_0"};
+const GLint kAttribSizes[] = {3, 2, 3, 4, 4};
+const int kAttribNum = 5;
+
+bool IsBatchable(const tinygltf::Mesh &mesh) {
+  for (const auto &primitive : mesh.primitives) {
+    if (primitive.mode != TINYGLTF_MODE_TRIANGLES ||
+        primitive.attributes.find("POSITION") == primitive.attributes.end()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Bit i for kAttribNames[i].
+int GetAttribMask(const tinygltf::Primitive &primitive) {
+  int mask = 0;
+  for (int a_idx = 0; a_idx < kAttribNum; ++a_idx) {
+    if (primitive.attributes.find(kAttribNames[a_idx]) !=
+        primitive.attributes.end()) {
+      mask |= 1 << a_idx;
+    }
+  }
+  return mask;
+}
+
+void InitLayout(int attrib_mask, Batch &batch) {
+  for (int a_idx = 0; a_idx < kAttribNum; ++a_idx) {
+    if (!(attrib_mask & (1 << a_idx))) {
+      continue;
+    }
+    Attrib attrib;
+    attrib.location = a_idx;
+    attrib.size = kAttribSizes[a_idx];
+    attrib.type = a_idx == 3 ? GL_UNSIGNED_SHORT : GL_FLOAT;
+    attrib.offset = batch.stride;
+    batch.stride += attrib.size * (a_idx == 3 ? sizeof(uint16_t)
+                                              : sizeof(float));
+    batch.attribs.push_back(attrib);
+  }
+}
+
+// World transforms of the scene, in render traversal order.
+void CollectNodes(const tinygltf::Model &model, int node_idx,
+                  const glm::mat4 &parent_transform,
+                  std::vector<std::pair<int, glm::mat4>> &nodes) {
+  const glm::mat4 transform =
+      parent_transform * GetNodeTransform(model.nodes[node_idx]);
+  nodes.push_back(std::make_pair(node_idx, transform));
+  for (int child_idx : model.nodes[node_idx].children) {
+    CollectNodes(model, child_idx, transform, nodes);
+  }
+}
+
+void AppendPrimitive(const tinygltf::Model &model,
+                     const std::vector<BufferSpan> &buffers,
+                     const tinygltf::Primitive &primitive,
+                     const glm::mat4 &transform, bool apply_transform,
+                     Batch &batch, std::vector<uint32_t> &indices) {
+  const size_t base_vertex = batch.vertex_num;
+  const size_t vertex_num =
+      model.accessors[primitive.attributes.at("POSITION")].count;
+  batch.vertex_num += vertex_num;
+  batch.vertices.resize(batch.vertex_num * batch.stride, 0);
+  const glm::mat3 normal_matrix =
+      glm::transpose(glm::inverse(glm::mat3(transform)));
+  // The influences are sorted and renormalized as pairs.
+  std::vector<float> joints;
+  std::vector<float> weights;
+  auto joints_iter = primitive.attributes.find("JOINTS_0");
+  auto weights_iter = primitive.attributes.find("WEIGHTS_0");
+  if (joints_iter != primitive.attributes.end() &&
+      weights_iter != primitive.attributes.end()) {
+    AccessorView(model, buffers, model.accessors[joints_iter->second])
+        .ReadFloats(joints);
+    AccessorView(model, buffers, model.accessors[weights_iter->second])
+        .ReadFloats(weights);
+    batch.influence_num = std::max(batch.influence_num,
+                                   SkinInfluence::Normalize(joints, weights));
+  }
+  std::vector<float> values;
+  for (const auto &attrib : batch.attribs) {
+    const char *attrib_name = kAttribNames[attrib.location];
+    auto a_iter = primitive.attributes.find(attrib_name);
+    if (a_iter == primitive.attributes.end()) {
+      // Only in an arena, the GL default of a disabled array.
+      values.assign(vertex_num * attrib.size, 0.f);
+      if (attrib.size == 4) {
+        for (size_t v_idx = 0; v_idx < vertex_num; ++v_idx) {
+          values[v_idx * 4 + 3] = 1.f;
+        }
+      }
+    } else {
+      const AccessorView view(model, buffers, model.accessors[a_iter->second]);
+      CHECK(view.GetComponentNum() == attrib.size)
+          << attrib_name << " has " << view.GetComponentNum()
+          << " components.";
+      CHECK(view.GetCount() == vertex_num)
+          << attrib_name << " doesn't match POSITION count.";
+      if (attrib.location == 3 && !joints.empty()) {
+        values.swap(joints);
+      } else if (attrib.location == 4 && !weights.empty()) {
+        values.swap(weights);
+      } else {
+        view.ReadFloats(values);
+      }
+    }
+    for (size_t v_idx = 0; v_idx < vertex_num; ++v_idx) {
+      uint8_t *dst =
+          &batch.vertices[(base_vertex + v_idx) * batch.stride + attrib.offset];
+      const float *value = &values[v_idx * attrib.size];
+      if (attrib.location == 3) {
+        for (int c_idx = 0; c_idx < 4; ++c_idx) {
+          const uint16_t joint = static_cast<uint16_t>(value[c_idx]);
+          std::memcpy(dst + c_idx * sizeof(joint), &joint, sizeof(joint));
+        }
+      } else if (apply_transform && attrib.location == 0) {
+        const glm::vec4 position =
+            transform * glm::vec4(value[0], value[1], value[2], 1.f);
+        std::memcpy(dst, &position[0], 3 * sizeof(float));
+      } else if (apply_transform && attrib.location == 2) {
+        const glm::vec3 normal = glm::normalize(
+            normal_matrix * glm::vec3(value[0], value[1], value[2]));
+        std::memcpy(dst, &normal[0], 3 * sizeof(float));
+      } else {
+        std::memcpy(dst, value, attrib.size * sizeof(float));
+      }
+    }
+  }
+
+  if (primitive.indices >= 0) {
+    std::vector<uint32_t> source_indices;
+    AccessorView(model, buffers, model.accessors[primitive.indices])
+        .ReadIndices(source_indices);
+    for (uint32_t index : source_indices) {
+      indices.push_back(base_vertex + index);
+    }
+  } else {
+    for (size_t v_idx = 0; v_idx < vertex_num; ++v_idx) {
+      indices.push_back(base_vertex + v_idx);
+    }
+  }
+}
+
+// u16 if the vertices fit.
+void PackIndices(const std::vector<uint32_t> &indices, Batch &batch) {
+  batch.index_num = indices.size();
+  if (batch.vertex_num <= 65536) {
+    batch.index_type = GL_UNSIGNED_SHORT;
+    batch.indices.resize(indices.size() * sizeof(uint16_t));
+    for (size_t i_idx = 0; i_idx < indices.size(); ++i_idx) {
+      const uint16_t index = indices[i_idx];
+      std::memcpy(&batch.indices[i_idx * sizeof(index)], &index,
+                  sizeof(index));
+    }
+  } else {
+    batch.index_type = GL_UNSIGNED_INT;
+    batch.indices.resize(indices.size() * sizeof(uint32_t));
+    std::memcpy(batch.indices.data(), indices.data(), batch.indices.size());
+  }
+}
+
+} // namespace
+
+std::vector<bool> SelectNodes(const tinygltf::Model &model,
+                              const std::vector<int> &scene_roots,
+                              bool is_skinning) {
+  // The animated nodes and their subtrees move, the palette moves the
+  // skinned meshes whatever their node.
+  std::vector<bool> is_dynamic(model.nodes.size(), false);
+  std::vector<int> node_stack;
+  if (!is_skinning) {
+    for (const auto &animation : model.animations) {
+      for (const auto &channel : animation.channels) {
+        if (channel.target_node >= 0) {
+          node_stack.push_back(channel.target_node);
+        }
+      }
+    }
+    while (!node_stack.empty()) {
+      const int node_idx = node_stack.back();
+      node_stack.pop_back();
+      if (!is_dynamic[node_idx]) {
+        is_dynamic[node_idx] = true;
+        node_stack.insert(node_stack.end(),
+                          model.nodes[node_idx].children.begin(),
+                          model.nodes[node_idx].children.end());
+      }
+    }
+  }
+
+  std::vector<bool> result(model.nodes.size(), false);
+  node_stack = scene_roots;
+  while (!node_stack.empty()) {
+    const int node_idx = node_stack.back();
+    node_stack.pop_back();
+    const auto &node = model.nodes[node_idx];
+    result[node_idx] = node.mesh >= 0 && !is_dynamic[node_idx] &&
+                       IsBatchable(model.meshes[node.mesh]);
+    node_stack.insert(node_stack.end(), node.children.begin(),
+                      node.children.end());
+  }
+  return result;
+}
+
+void Build(const tinygltf::Model &model, const std::vector<BufferSpan> &buffers,
+           const std::vector<int> &scene_roots,
+           const std::vector<bool> &node_batched, bool is_skinning,
+           std::vector<Batch> &batches) {
+  batches.clear();
+  std::vector<std::pair<int, glm::mat4>> nodes;
+  for (int root_idx : scene_roots) {
+    CollectNodes(model, root_idx, glm::mat4(1.f), nodes);
+  }
+  // (material, attribute mask) -> batch index.
+  std::map<std::pair<int, int>, size_t> batch_map;
+  std::vector<std::vector<uint32_t>> batch_indices;
+  for (const auto &node : nodes) {
+    if (!node_batched[node.first]) {
+      continue;
+    }
+    const int mesh_idx = model.nodes[node.first].mesh;
+    const auto &primitives = model.meshes[mesh_idx].primitives;
+    for (size_t p_idx = 0; p_idx < primitives.size(); ++p_idx) {
+      const auto &primitive = primitives[p_idx];
+      const std::pair<int, int> key(primitive.material,
+                                    GetAttribMask(primitive));
+      auto iter = batch_map.find(key);
+      if (iter == batch_map.end()) {
+        iter = batch_map.insert(std::make_pair(key, batches.size())).first;
+        batches.push_back(Batch());
+        batches.back().material = key.first;
+        InitLayout(key.second, batches.back());
+        batch_indices.push_back(std::vector<uint32_t>());
+      }
+      Batch &batch = batches[iter->second];
+      std::vector<uint32_t> &indices = batch_indices[iter->second];
+      Range range;
+      range.node_idx = node.first;
+      range.mesh_idx = mesh_idx;
+      range.primitive_idx = p_idx;
+      range.first_index = indices.size();
+      AppendPrimitive(model, buffers, primitive, node.second, !is_skinning,
+                      batch, indices);
+      range.index_num = indices.size() - range.first_index;
+      batch.ranges.push_back(range);
+    }
+  }
+
+  for (size_t b_idx = 0; b_idx < batches.size(); ++b_idx) {
+    PackIndices(batch_indices[b_idx], batches[b_idx]);
+  }
+}
+
+bool BuildArena(const tinygltf::Model &model,
+                const std::vector<BufferSpan> &buffers, Batch &arena) {
+  arena = Batch();
+  int attrib_mask = 0;
+  for (const auto &mesh : model.meshes) {
+    if (!IsBatchable(mesh)) {
+      return false;
+    }
+    for (const auto &primitive : mesh.primitives) {
+      attrib_mask |= GetAttribMask(primitive);
+    }
+  }
+  InitLayout(attrib_mask, arena);
+  std::vector<uint32_t> indices;
+  for (size_t m_idx = 0; m_idx < model.meshes.size(); ++m_idx) {
+    const auto &primitives = model.meshes[m_idx].primitives;
+    for (size_t p_idx = 0; p_idx < primitives.size(); ++p_idx) {
+      Range range;
+      range.mesh_idx = m_idx;
+      range.primitive_idx = p_idx;
+      range.first_index = indices.size();
+      AppendPrimitive(model, buffers, primitives[p_idx], glm::mat4(1.f), false,
+                      arena, indices);
+      range.index_num = indices.size() - range.first_index;
+      arena.ranges.push_back(range);
+    }
+  }
+  PackIndices(indices, arena);
+  return true;
+}
+
+} // namespace StaticBatcher
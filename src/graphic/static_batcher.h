@@ -0,0 +1,73 @@
+#pragma once
+
+#include <GL/gl3w.h>
+#include <cstdint>
+#include <tiny_gltf.h>
+#include <vector>
+
+#include "graphic/gltf_loader.h"
+
+// Load time merge of the meshes sharing a material into one vertex and one
+// index buffer, see Model::LoadOptions::batch_static. A node is batched when
+// its mesh only has triangle lists and its transform never changes, i.e. no
+// animation targets it or its ancestors. Skinned models are posed by the
+// palette alone, every mesh node of them is batched as is. The static node
+// transforms are applied to the positions and the normals.
+//
+// Batch vertices are interleaved, float positions, texcoords, normals and
+// weights, u16 integer joints, only the attributes of the batch.
+namespace StaticBatcher {
+
+// Same meaning as the glVertexAttribPointer arguments.
+struct Attrib {
+  GLuint location = 0;
+  GLint size = 0;
+  GLenum type = GL_FLOAT;
+  size_t offset = 0;
+};
+
+// The indices of one source primitive inside the batch. node_idx is -1 in an
+// arena.
+struct Range {
+  int node_idx = -1;
+  int mesh_idx = -1;
+  int primitive_idx = -1;
+  size_t first_index = 0;
+  size_t index_num = 0;
+};
+
+struct Batch {
+  // gltf material, -1 for the default one.
+  int material = -1;
+  std::vector<Attrib> attribs;
+  GLsizei stride = 0;
+  std::vector<uint8_t> vertices;
+  size_t vertex_num = 0;
+  // GL_UNSIGNED_SHORT if the vertices fit, GL_UNSIGNED_INT otherwise.
+  GLenum index_type = GL_UNSIGNED_INT;
+  std::vector<uint8_t> indices;
+  size_t index_num = 0;
+  std::vector<Range> ranges;
+  // Max SkinInfluence number of the skinned primitives, the influences are
+  // sorted. 0 without skin.
+  int influence_num = 0;
+};
+
+// Per node, true if the node is drawn by a batch. Only the nodes of the
+// scene roots are batched.
+std::vector<bool> SelectNodes(const tinygltf::Model &model,
+                              const std::vector<int> &scene_roots,
+                              bool is_skinning);
+// One batch per material and attribute set of the selected nodes.
+void Build(const tinygltf::Model &model, const std::vector<BufferSpan> &buffers,
+           const std::vector<int> &scene_roots,
+           const std::vector<bool> &node_batched, bool is_skinning,
+           std::vector<Batch> &batches);
+// Every primitive of every mesh once, untransformed, in one batch with the
+// union of the attributes, for Model::LoadOptions::multi_draw. The missing
+// attributes get the GL default (0, 0, 0, 1). material is -1, see the range
+// primitives. Return false if a mesh isn't batchable.
+bool BuildArena(const tinygltf::Model &model,
+                const std::vector<BufferSpan> &buffers, Batch &arena);
+
+} // namespace StaticBatcher
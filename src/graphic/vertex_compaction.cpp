@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "common/logging.h"
+#include "graphic/accessor_view.h"
+#include "graphic/model.h"
+#include "graphic/skin_influence.h"
+#include "graphic/vertex_compaction.h"
+
+namespace VertexCompaction {
+
+namespace {
+
+const float kMaxHalf = 65504.f;
+
+// value rounded by the dropped bits, ties to even.
+uint16_t RoundToEven(uint32_t value, uint32_t dropped, uint32_t half_way) {
+  if (dropped > half_way || (dropped == half_way && (value & 1))) {
+    ++value;
+  }
+  return value;
+}
+
+template <typename T> void Store(uint8_t *dst, T value) {
+  std::memcpy(dst, &value, sizeof(T));
+}
+
+Stream MakeStream(int accessor_idx, GLuint location, GLint size, GLenum type,
+                  bool normalized, GLsizei stride, size_t vertex_num) {
+  Stream stream;
+  stream.accessor_idx = accessor_idx;
+  stream.location = location;
+  stream.size = size;
+  stream.type = type;
+  stream.normalized = normalized;
+  stream.stride = stride;
+  stream.data.assign(vertex_num * stride, 0);
+  return stream;
+}
+
+// half x3, float x3 if a coordinate is beyond the half range.
+Stream CompactPositions(int accessor_idx, const AccessorView &view) {
+  std::vector<float> values;
+  view.ReadFloats(values);
+  const int comp_num = view.GetComponentNum();
+  float max_abs = 0;
+  for (float value : values) {
+    max_abs = std::max(max_abs, std::abs(value));
+  }
+  if (max_abs >= kMaxHalf) {
+    Stream stream = MakeStream(accessor_idx, 0, comp_num, GL_FLOAT, false,
+                               comp_num * sizeof(float), view.GetCount());
+    std::memcpy(stream.data.data(), values.data(), stream.data.size());
+    return stream;
+  }
+  Stream stream = MakeStream(accessor_idx, 0, comp_num, GL_HALF_FLOAT, false,
+                             (comp_num * sizeof(uint16_t) + 3) & ~3u,
+                             view.GetCount());
+  for (size_t v_idx = 0; v_idx < view.GetCount(); ++v_idx) {
+    for (int c_idx = 0; c_idx < comp_num; ++c_idx) {
+      Store(&stream.data[v_idx * stream.stride + c_idx * sizeof(uint16_t)],
+            FloatToHalf(values[v_idx * comp_num + c_idx]));
+    }
+  }
+  return stream;
+}
+
+Stream CompactNormals(int accessor_idx, const AccessorView &view) {
+  CHECK(view.GetComponentNum() == 3) << "NORMAL must be a vec3.";
+  std::vector<float> values;
+  view.ReadFloats(values);
+  Stream stream = MakeStream(accessor_idx, 2, 3, GL_SHORT, true,
+                             4 * sizeof(int16_t), view.GetCount());
+  for (size_t v_idx = 0; v_idx < view.GetCount(); ++v_idx) {
+    for (int c_idx = 0; c_idx < 3; ++c_idx) {
+      const float value =
+          std::min(std::max(values[v_idx * 3 + c_idx], -1.f), 1.f);
+      Store(&stream.data[v_idx * stream.stride + c_idx * sizeof(int16_t)],
+            static_cast<int16_t>(std::lround(value * 32767.f)));
+    }
+  }
+  return stream;
+}
+
+// unorm16 x2 inside [0, 1], half x2 for the wrapped coordinates.
+Stream CompactTexcoords(int accessor_idx, const AccessorView &view) {
+  CHECK(view.GetComponentNum() == 2) << "TEXCOORD_0 must be a vec2.";
+  std::vector<float> values;
+  view.ReadFloats(values);
+  bool is_unit = true;
+  for (float value : values) {
+    is_unit = is_unit && value >= 0.f && value <= 1.f;
+  }
+  const GLenum type = is_unit ? GL_UNSIGNED_SHORT : GL_HALF_FLOAT;
+  Stream stream = MakeStream(accessor_idx, 1, 2, type, is_unit,
+                             2 * sizeof(uint16_t), view.GetCount());
+  for (size_t c_idx = 0; c_idx < values.size(); ++c_idx) {
+    const uint16_t value =
+        is_unit ? static_cast<uint16_t>(std::lround(values[c_idx] * 65535.f))
+                : FloatToHalf(values[c_idx]);
+    Store(&stream.data[c_idx * sizeof(uint16_t)], value);
+  }
+  return stream;
+}
+
+Stream CompactJoints(int accessor_idx, const AccessorView &view,
+                     const std::vector<float> &values) {
+  CHECK(view.GetComponentNum() == 4) << "JOINTS_0 must be a vec4.";
+  float max_joint = 0;
+  for (float value : values) {
+    max_joint = std::max(max_joint, value);
+  }
+  const bool is_byte = max_joint < 256.f;
+  Stream stream = MakeStream(
+      accessor_idx, 3, 4, is_byte ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT,
+      false, is_byte ? 4 : 4 * sizeof(uint16_t), view.GetCount());
+  for (size_t c_idx = 0; c_idx < values.size(); ++c_idx) {
+    if (is_byte) {
+      stream.data[c_idx] = static_cast<uint8_t>(values[c_idx]);
+    } else {
+      Store(&stream.data[c_idx * sizeof(uint16_t)],
+            static_cast<uint16_t>(values[c_idx]));
+    }
+  }
+  return stream;
+}
+
+// The rounding error goes to the largest weight, so the bytes sum to 255.
+Stream CompactWeights(int accessor_idx, const AccessorView &view,
+                      const std::vector<float> &values) {
+  CHECK(view.GetComponentNum() == 4) << "WEIGHTS_0 must be a vec4.";
+  Stream stream = MakeStream(accessor_idx, 4, 4, GL_UNSIGNED_BYTE, true, 4,
+                             view.GetCount());
+  for (size_t v_idx = 0; v_idx < view.GetCount(); ++v_idx) {
+    const float *weights = &values[v_idx * 4];
+    uint8_t *result = &stream.data[v_idx * 4];
+    int sum = 0;
+    int max_idx = 0;
+    for (int c_idx = 0; c_idx < 4; ++c_idx) {
+      const float weight = std::min(std::max(weights[c_idx], 0.f), 1.f);
+      result[c_idx] = static_cast<uint8_t>(std::lround(weight * 255.f));
+      sum += result[c_idx];
+      if (weights[c_idx] > weights[max_idx]) {
+        max_idx = c_idx;
+      }
+    }
+    if (sum > 0) {
+      result[max_idx] = static_cast<uint8_t>(
+          std::min(std::max(result[max_idx] + 255 - sum, 0), 255));
+    }
+  }
+  return stream;
+}
+
+// u16 if every index fits, u32 otherwise. The u8 indices are widened too,
+// most hardware doesn't fetch them natively.
+Stream CompactIndices(int accessor_idx, const AccessorView &view) {
+  std::vector<uint32_t> indices;
+  view.ReadIndices(indices);
+  const uint32_t max_index =
+      indices.empty() ? 0 : *std::max_element(indices.begin(), indices.end());
+  const bool is_short = max_index < 65536;
+  Stream stream = MakeStream(
+      accessor_idx, 0, 1, is_short ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+      false, is_short ? sizeof(uint16_t) : sizeof(uint32_t), indices.size());
+  for (size_t i_idx = 0; i_idx < indices.size(); ++i_idx) {
+    if (is_short) {
+      Store(&stream.data[i_idx * sizeof(uint16_t)],
+            static_cast<uint16_t>(indices[i_idx]));
+    } else {
+      Store(&stream.data[i_idx * sizeof(uint32_t)], indices[i_idx]);
+    }
+  }
+  return stream;
+}
+
+} // namespace
+
+int GetAttribLocation(const std::string &attrib_name) {
+  if (attrib_name == "POSITION") {
+    return 0;
+  } else if (attrib_name == "TEXCOORD_0") {
+    return 1;
+  } else if (attrib_name == "NORMAL") {
+    return 2;
+  } else if (attrib_name == "JOINTS_0") {
+    return 3;
+  } else if (attrib_name == "WEIGHTS_0") {
+    return 4;
+  }
+  return -1;
+}
+
+void Compact(const tinygltf::Model &model,
+             const std::vector<BufferSpan> &buffers,
+             const tinygltf::Primitive &primitive, Primitive &result) {
+  result = Primitive();
+  // The influences are sorted and renormalized as pairs.
+  std::vector<float> joints;
+  std::vector<float> weights;
+  auto joints_iter = primitive.attributes.find("JOINTS_0");
+  auto weights_iter = primitive.attributes.find("WEIGHTS_0");
+  if (joints_iter != primitive.attributes.end() &&
+      weights_iter != primitive.attributes.end()) {
+    AccessorView(model, buffers, model.accessors[joints_iter->second])
+        .ReadFloats(joints);
+    AccessorView(model, buffers, model.accessors[weights_iter->second])
+        .ReadFloats(weights);
+    result.influence_num = SkinInfluence::Normalize(joints, weights);
+  }
+  for (const auto &attrib : primitive.attributes) {
+    const int location = GetAttribLocation(attrib.first);
+    if (location < 0) {
+      continue;
+    }
+    const AccessorView view(model, buffers, model.accessors[attrib.second]);
+    result.source_byte_size += view.GetCount() * view.GetElementByteSize();
+    if (location == 0) {
+      result.vertex_num = view.GetCount();
+      result.streams.push_back(CompactPositions(attrib.second, view));
+    } else if (location == 1) {
+      result.streams.push_back(CompactTexcoords(attrib.second, view));
+    } else if (location == 2) {
+      result.streams.push_back(CompactNormals(attrib.second, view));
+    } else if (location == 3) {
+      if (weights.empty()) {
+        view.ReadFloats(joints);
+      }
+      result.streams.push_back(CompactJoints(attrib.second, view, joints));
+    } else {
+      if (joints.empty()) {
+        view.ReadFloats(weights);
+      }
+      result.streams.push_back(CompactWeights(attrib.second, view, weights));
+    }
+    result.compact_byte_size += result.streams.back().data.size();
+  }
+  if (primitive.indices >= 0) {
+    const AccessorView view(model, buffers,
+                            model.accessors[primitive.indices]);
+    result.source_byte_size += view.GetCount() * view.GetElementByteSize();
+    result.indices = CompactIndices(primitive.indices, view);
+    result.index_num = view.GetCount();
+    result.compact_byte_size += result.indices.data.size();
+  } else {
+    result.indices.type = 0;
+  }
+}
+
+uint16_t FloatToHalf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  const uint32_t float_exponent = (bits >> 23) & 0xff;
+  uint32_t mantissa = bits & 0x7fffff;
+  if (float_exponent == 0xff) {
+    // Infinity, or a quiet NaN.
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  const int exponent = int(float_exponent) - 127 + 15;
+  if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+  if (exponent <= 0) {
+    // Subnormal half, or zero.
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    const uint32_t half_mantissa = mantissa >> shift;
+    return sign | RoundToEven(half_mantissa, mantissa & ((1u << shift) - 1),
+                              1u << (shift - 1));
+  }
+  // A carry out of the mantissa rounds up the exponent, up to infinity.
+  return sign | RoundToEven((exponent << 10) | (mantissa >> 13),
+                            mantissa & 0x1fff, 0x1000);
+}
+
+} // namespace VertexCompaction
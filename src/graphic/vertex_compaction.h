@@ -0,0 +1,55 @@
+#pragma once
+
+#include <GL/gl3w.h>
+#include <cstdint>
+#include <tiny_gltf.h>
+#include <vector>
+
+#include "graphic/gltf_loader.h"
+
+// Load time conversion of the primitives into compact vertex formats, see
+// Model::LoadOptions::compact_vertices.
+//   POSITION    half float x3, float if beyond the half range
+//   NORMAL      snorm16 x3
+//   TEXCOORD_0  unorm16 x2, half float x2 outside [0, 1]
+//   JOINTS_0    u8 x4 integer attribute, u16 from 256 joints
+//   WEIGHTS_0   unorm8 x4, rounded so they still sum to one
+// The influences are sorted and renormalized by SkinInfluence::Normalize.
+//   indices     u16 if the indices fit, u32 otherwise
+// Every element is padded to 4 bytes. The attributes Model doesn't bind are
+// dropped.
+namespace VertexCompaction {
+
+struct Stream {
+  // The source accessor, the compact buffers are cached by it.
+  int accessor_idx = -1;
+  GLuint location = 0;
+  GLint size = 0;
+  GLenum type = GL_FLOAT;
+  bool normalized = false;
+  GLsizei stride = 0;
+  std::vector<uint8_t> data;
+};
+
+struct Primitive {
+  std::vector<Stream> streams;
+  size_t vertex_num = 0;
+  // Index type 0 for the non indexed primitives.
+  Stream indices;
+  size_t index_num = 0;
+  // Bytes of the source accessors and of the compact streams.
+  size_t source_byte_size = 0;
+  size_t compact_byte_size = 0;
+  // See SkinInfluence, 0 without skin.
+  int influence_num = 0;
+};
+
+// Vertex attribute location of a gltf attribute, -1 if Model doesn't bind it.
+int GetAttribLocation(const std::string &attrib_name);
+void Compact(const tinygltf::Model &model,
+             const std::vector<BufferSpan> &buffers,
+             const tinygltf::Primitive &primitive, Primitive &result);
+// Round to nearest, overflow to infinity.
+uint16_t FloatToHalf(float value);
+
+} // namespace VertexCompaction
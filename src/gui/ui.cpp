@@ -1,9 +1,13 @@
+#include <cmath>
+#include <filesystem/path.h>
 #include <glm/common.hpp>
 #include <glm/gtx/string_cast.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <memory>
 
 #include "common/logging.h"
+#include "graphic/cooked_model.h"
+#include "graphic/gpu_resource_cache.h"
 #include "gui/ui.h"
 
 static void glfw_error_callback(int error, const char *desc) {
@@ -14,8 +18,8 @@ bool App::Init(int wnd_width, int wnd_height, const std::string &title) {
   glfwSetErrorCallback(glfw_error_callback);
   CHECK(glfwInit()) << "GLFW Error: Failed to initiali  ze GLFW!";
 
-  // Use OpenGL 3.3
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  // Prefer OpenGL 4.3 for the multi draw indirect path, fall back to 3.3.
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_SAMPLES, 4);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // 3.2+ only
@@ -25,6 +29,12 @@ bool App::Init(int wnd_width, int wnd_height, const std::string &title) {
 
   window_ = glfwCreateWindow(wnd_width, wnd_height, "Skinning Animation",
                              nullptr, nullptr);
+  if (!window_) {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    window_ = glfwCreateWindow(wnd_width, wnd_height, "Skinning Animation",
+                               nullptr, nullptr);
+  }
 
   if (!window_)
     return inited_;
@@ -75,13 +85,49 @@ bool App::Init(int wnd_width, int wnd_height, const std::string &title) {
   }
 
   InitPlane();
-  avatar_model_.Init("../resource/BrainStem/BrainStem.gltf");
+  // The frame loop starts while the avatar loads.
+  LoadAvatar(avatar_path_);
   avatar_model_matrix_ = glm::mat4(1.0f);
 
   inited_ = true;
   return inited_;
 }
 
+void App::LoadAvatar(const std::string &model_path) {
+  // The cooked model is built already, the load options don't apply to it.
+  // Only take it on request, and only when sa_cook ran on this gltf.
+  avatar_loading_path_ = model_path;
+  const std::string cooked_path = CookedModel::GetCookedPath(model_path);
+  if (prefer_cooked_ && !CookedModel::IsCookedPath(model_path)) {
+    if (CookedModel::IsUpToDate(cooked_path, model_path)) {
+      avatar_loading_path_ = cooked_path;
+    } else if (filesystem::path(cooked_path).is_file()) {
+      LOG(WARNING) << cooked_path << " is stale, load " << model_path;
+    }
+  }
+  Model::LoadOptions options;
+  options.compact_vertices = compact_vertices_;
+  options.batch_static = batch_static_;
+  options.multi_draw = multi_draw_;
+  avatar_load_ = Model::LoadAsync(avatar_loading_path_, options);
+}
+
+void App::UpdateAvatarLoad() {
+  if (!avatar_load_ || !avatar_load_->Update(load_budget_ms_)) {
+    return;
+  }
+  // Swap between two frames, the old model is released here. A failed load
+  // keeps the current model.
+  if (avatar_load_->IsFailed()) {
+    avatar_load_error_ = avatar_load_->GetError();
+  } else {
+    avatar_model_ = avatar_load_->GetModel();
+    avatar_model_path_ = avatar_loading_path_;
+    avatar_load_error_.clear();
+  }
+  avatar_load_.reset();
+}
+
 void App::InitPlane() {
   plane_render_params_.shader.InitFromFile("../shader/ground_vs.glsl",
                                            "../shader/ground_fs.glsl");
@@ -153,6 +199,8 @@ int App::MainLoop() {
     glClearColor(clear_color_.x, clear_color_.y, clear_color_.z,
                  clear_color_.w);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // imgui changes the GL state behind the cache.
+    render_queue_.BeginFrame();
 
     // Render Some thing include GUI.
     // Video visualizer.
@@ -187,7 +235,10 @@ int App::MainLoop() {
     glfwSwapBuffers(window_);
   }
 
-  // Cleanup
+  // Cleanup, the GL objects go before the context.
+  avatar_load_.reset();
+  avatar_model_.reset();
+  GPUResourceCache::GetShared().Clear();
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
@@ -231,29 +282,16 @@ void App::RenderPlane(const glm::mat4 &view_matrix,
                       const glm::mat4 &proj_matrix,
                       const glm::mat4 &model_matrix) {
 
-  plane_render_params_.shader.Use();
+  GLStateCache &state_cache = render_queue_.GetStateCache();
+  state_cache.UseProgram(plane_render_params_.shader.GetProgramId());
   plane_render_params_.shader.Set("model_matrix", model_matrix);
   plane_render_params_.shader.Set("view_matrix", view_matrix);
   plane_render_params_.shader.Set("proj_matrix", proj_matrix);
-  glBindVertexArray(plane_render_params_.vao);
-  GLboolean last_enable_depth_test = glIsEnabled(GL_DEPTH_TEST);
-  GLboolean last_enable_multisample = glIsEnabled(GL_MULTISAMPLE);
-
-  glEnable(GL_DEPTH_TEST);
-  glEnable(GL_MULTISAMPLE);
-
-  glEnableVertexAttribArray(0);
-  glEnableVertexAttribArray(1);
-  glEnableVertexAttribArray(2);
+  state_cache.CountIssued(3);
+  state_cache.BindVertexArray(plane_render_params_.vao);
 
   glDrawArrays(GL_TRIANGLES, 0, plane_render_params_.vertex_num);
-
-  glBindVertexArray(0);
-
-  if (!last_enable_depth_test)
-    glDisable(GL_DEPTH_TEST);
-  if (!last_enable_multisample)
-    glDisable(GL_MULTISAMPLE);
+  state_cache.CountIssued();
 }
 
 void App::RenderScene() {
@@ -308,14 +346,126 @@ void App::RenderScene() {
     view_matrix_ = glm::lookAt(camera_pos, camera_target, glm::vec3(0, 1, 0));
   }
 
+  ImGui::Separator();
+  ImGui::Text("Model");
+  ImGui::InputText("Path", avatar_path_, sizeof(avatar_path_));
+  if (ImGui::Button("Load")) {
+    LoadAvatar(avatar_path_);
+  }
+  ImGui::SameLine();
+  ImGui::SliderFloat("Budget ms", &load_budget_ms_, 0.5f, 16.f);
+  ImGui::Checkbox("Compact vertices", &compact_vertices_);
+  ImGui::SameLine();
+  ImGui::Checkbox("Batch static", &batch_static_);
+  ImGui::SameLine();
+  ImGui::Checkbox("Multi draw", &multi_draw_);
+  ImGui::SameLine();
+  ImGui::Checkbox("Prefer cooked", &prefer_cooked_);
+  UpdateAvatarLoad();
+  if (avatar_model_) {
+    ImGui::Text("Loaded: %s%s", avatar_model_path_.c_str(),
+                CookedModel::IsCookedPath(avatar_model_path_)
+                    ? " (cooked, the load options don't apply)"
+                    : "");
+  }
+  if (avatar_load_) {
+    ImGui::Text("Loading %s...", avatar_loading_path_.c_str());
+  } else if (!avatar_load_error_.empty()) {
+    ImGui::Text("%s", avatar_load_error_.c_str());
+  }
+  const GPUResourceCache::Stats &cache_stats =
+      GPUResourceCache::GetShared().GetStats();
+  ImGui::Text("GPU cache: %d textures, %d buffers, %.1f MB",
+              cache_stats.texture_num, cache_stats.buffer_num,
+              cache_stats.resident_bytes / (1024.0 * 1024.0));
+  ImGui::Text("GPU cache: %d hits / %d misses", cache_stats.hits,
+              cache_stats.misses);
+
   ImGui::Separator();
   ImGui::Text("Animation");
-  ImGui::Combo("Animation: ", avatar_model_.GetAnimationIndexPtr(),
-               avatar_model_.GetAnimationNames().c_str());
+  if (avatar_model_) {
+    ImGui::Combo("Animation: ", avatar_model_->GetAnimationIndexPtr(),
+                 avatar_model_->GetAnimationNames().c_str());
+  }
+  ImGui::SliderInt("Crowd size", &crowd_size_, 0, 2048);
+  ImGui::SliderFloat("Crowd spacing", &crowd_spacing_, 0.5f, 5.f);
+  if (crowd_size_ > 0) {
+    ImGui::Text("Crowd update: %.2f ms", crowd_update_time_ * 1000.0);
+  }
+  ImGui::Checkbox("Frustum culling", &frustum_culling_);
+  ImGui::SameLine();
+  ImGui::Checkbox("Animation culling", &animation_culling_);
+  ImGui::SliderFloat("Culling margin", &animation_culling_margin_, 0.f, 1.f);
+  ImGui::Checkbox("Animation LOD", &animation_lod_);
+  ImGui::SameLine();
+  ImGui::Checkbox("Skeleton LOD", &skeleton_lod_);
+  ImGui::SameLine();
+  ImGui::Checkbox("Influence LOD", &skin_influence_lod_);
 
+  // The scene pass state, imgui restores its own state.
+  GLStateCache &state_cache = render_queue_.GetStateCache();
+  state_cache.SetEnabled(GL_DEPTH_TEST, true);
+  state_cache.SetEnabled(GL_MULTISAMPLE, true);
   RenderPlane(view_matrix_, proj_matrix_, model_matrix_);
-  avatar_model_.Render(view_matrix_, proj_matrix_,
-                       model_matrix_ * avatar_model_matrix_);
+  if (avatar_model_) {
+    avatar_model_->SetFrustumCulling(frustum_culling_);
+    avatar_model_->SetAnimationCulling(animation_culling_);
+    avatar_model_->SetAnimationCullingMargin(animation_culling_margin_);
+    avatar_model_->SetAnimationLod(animation_lod_);
+    avatar_model_->SetSkeletonLod(skeleton_lod_);
+    avatar_model_->SetSkinInfluenceLod(skin_influence_lod_);
+  }
+  if (avatar_model_ && crowd_size_ > 0) {
+    UpdateCrowd();
+    double start_time = GetTimeStampSecond();
+    avatar_model_->RenderInstances(render_queue_, view_matrix_, proj_matrix_,
+                                   crowd_instances_);
+    crowd_update_time_ = GetTimeStampSecond() - start_time;
+  } else if (avatar_model_) {
+    avatar_model_->Render(render_queue_, view_matrix_, proj_matrix_,
+                          model_matrix_ * avatar_model_matrix_);
+  }
+  render_queue_.Flush();
+  if (avatar_model_) {
+    ImGui::Text("Pose update: %d / %d nodes",
+                avatar_model_->GetPoseUpdatedNodeNum(),
+                avatar_model_->GetNodeNum());
+    ImGui::Text("Model CPU memory: %.1f KB",
+                avatar_model_->GetMemoryReport().GetTotal() / 1024.0);
+    ImGui::Text("Geometry: %.1f KB, source %.1f KB",
+                avatar_model_->GetGeometryByteSize() / 1024.0,
+                avatar_model_->GetSourceGeometryByteSize() / 1024.0);
+    ImGui::Text("Model draws: %d, %d unbatched",
+                avatar_model_->GetDrawNum(),
+                avatar_model_->GetSourceDrawNum());
+    ImGui::Text("Culled: %d draws, %d instances, %d draws submitted",
+                avatar_model_->GetCulledDrawNum(),
+                avatar_model_->GetCulledInstanceNum(),
+                avatar_model_->GetSubmittedDrawNum());
+    ImGui::Text("Poses skipped: %d", avatar_model_->GetSkippedPoseNum());
+    if (animation_lod_) {
+      ImGui::Text("Animation LOD: %d / %d / %d poses",
+                  avatar_model_->GetAnimationLodPoseNum(0),
+                  avatar_model_->GetAnimationLodPoseNum(1),
+                  avatar_model_->GetAnimationLodPoseNum(2));
+    }
+    ImGui::Text("Clip samples: %d, palette joints: %d",
+                avatar_model_->GetSampledPoseNum(),
+                avatar_model_->GetEvaluatedJointNum());
+    ImGui::Text("Skinned draws: %d x4, %d x2, %d x1 influences",
+                avatar_model_->GetInfluenceDrawNum(0),
+                avatar_model_->GetInfluenceDrawNum(1),
+                avatar_model_->GetInfluenceDrawNum(2));
+  }
+  RenderQueue::Stats render_stats = render_queue_.GetStats();
+  ImGui::Text("Draw calls: %d, GL calls: %d issued / %d elided",
+              render_stats.draw_calls, render_stats.state.issued,
+              render_stats.state.elided);
+  if (render_stats.indirect_draws > 0) {
+    ImGui::Text("Indirect draws: %d", render_stats.indirect_draws);
+  }
+  // Averaged by imgui over the last frames.
+  ImGui::Text("Frame: %.2f ms", 1000.f / io.Framerate);
 
   ImGui::Separator();
   ImGuizmo::SetID(0);
@@ -329,6 +479,32 @@ void App::RenderScene() {
                            0x10101010);
 }
 
+void App::UpdateCrowd() {
+  // Keep the time offsets of the existing instances when the size changes.
+  const int old_size = crowd_instances_.size();
+  crowd_instances_.resize(crowd_size_);
+  for (int i_idx = old_size; i_idx < crowd_size_; ++i_idx) {
+    // A cheap hash, so the offsets don't depend on the resize history.
+    const unsigned int hash = (i_idx + 1) * 2654435761u;
+    crowd_instances_[i_idx].time_offset = (hash >> 8) / double(1 << 24) * 4.0;
+  }
+
+  // A square grid centered at the origin.
+  const int grid_width = std::ceil(std::sqrt(float(crowd_size_)));
+  const float grid_offset = 0.5f * (grid_width - 1) * crowd_spacing_;
+  const int animation_index = avatar_model_->GetAnimationIndex();
+  for (int i_idx = 0; i_idx < crowd_size_; ++i_idx) {
+    auto &instance = crowd_instances_[i_idx];
+    const glm::vec3 grid_pos(
+        (i_idx % grid_width) * crowd_spacing_ - grid_offset, 0.f,
+        (i_idx / grid_width) * crowd_spacing_ - grid_offset);
+    instance.model_matrix = model_matrix_ *
+                            glm::translate(glm::mat4(1.f), grid_pos) *
+                            avatar_model_matrix_;
+    instance.animation_index = animation_index;
+  }
+}
+
 void App::EditTransform(const float *cameraView, float *cameraProjection,
                         float *matrix, bool editTransformDecomposition) {
   static ImGuizmo::OPERATION mCurrentGizmoOperation(ImGuizmo::TRANSLATE);
@@ -3,6 +3,8 @@
 #include <cstdio>
 #include <imgui.h>
 #include <iostream>
+#include <memory>
+#include <string>
 
 #include <GL/gl3w.h>
 #include <GLFW/glfw3.h>
@@ -17,6 +19,7 @@
 #include "graphic/geometry.h"
 #include "graphic/shader.h"
 #include "graphic/model.h"
+#include "graphic/render_queue.h"
 #include "graphic/texture.h"
 #include "gui/imgui_impl_glfw.h"
 #include "gui/imgui_impl_opengl3.h"
@@ -51,9 +54,51 @@ private:
   void RenderPlane(const glm::mat4 &view_matrix, const glm::mat4 &proj_matrix,
                    const glm::mat4 &model_matrix);
   
-  // for avatar
-  Model avatar_model_;
+  // Draws of the scene pass, and the GL state cache.
+  RenderQueue render_queue_;
+
+  // for avatar, nullptr until the first load is ready.
+  std::shared_ptr<Model> avatar_model_;
   glm::mat4 avatar_model_matrix_;
+  // The model being loaded, swapped in once ready.
+  void LoadAvatar(const std::string &model_path);
+  void UpdateAvatarLoad();
+  std::unique_ptr<Model::AsyncLoad> avatar_load_;
+  // Why the last load failed, empty once a load succeeds.
+  std::string avatar_load_error_;
+  // The file of avatar_load_ and the one of avatar_model_, the gltf or its
+  // cooked model.
+  std::string avatar_loading_path_;
+  std::string avatar_model_path_;
+  char avatar_path_[256] = "../resource/BrainStem/BrainStem.gltf";
+  // Milliseconds of GL uploads per frame for the loading model.
+  float load_budget_ms_ = 4.f;
+  // Model::LoadOptions::compact_vertices of the next load.
+  bool compact_vertices_ = false;
+  // Model::LoadOptions::batch_static of the next load.
+  bool batch_static_ = false;
+  // Model::LoadOptions::multi_draw of the next load.
+  bool multi_draw_ = false;
+  // Load the cooked model next to the gltf when it is up to date, see
+  // CookedModel::IsUpToDate.
+  bool prefer_cooked_ = false;
+
+  // for crowd, 0 draws the single avatar.
+  void UpdateCrowd();
+  int crowd_size_ = 0;
+  float crowd_spacing_ = 1.5f;
+  std::vector<Model::InstanceState> crowd_instances_;
+  // Seconds of the last RenderInstances(posing and palette upload).
+  double crowd_update_time_ = 0;
+  // Model::SetFrustumCulling.
+  bool frustum_culling_ = true;
+  // Model::SetAnimationCulling and its margin.
+  bool animation_culling_ = false;
+  float animation_culling_margin_ = 0.25f;
+  // Model::SetAnimationLod, SetSkeletonLod and SetSkinInfluenceLod.
+  bool animation_lod_ = false;
+  bool skeleton_lod_ = false;
+  bool skin_influence_lod_ = false;
   
   struct CameraAngle {
     float x = 165.f / 180.f * MY_PI;